@@ -0,0 +1,122 @@
+/* ==================================================================== 
+ * The Kannel Software License, Version 1.0 
+ * 
+ * Copyright (c) 2001-2016 Kannel Group  
+ * Copyright (c) 1998-2001 WapIT Ltd.   
+ * All rights reserved. 
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions 
+ * are met: 
+ * 
+ * 1. Redistributions of source code must retain the above copyright 
+ *    notice, this list of conditions and the following disclaimer. 
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright 
+ *    notice, this list of conditions and the following disclaimer in 
+ *    the documentation and/or other materials provided with the 
+ *    distribution. 
+ * 
+ * 3. The end-user documentation included with the redistribution, 
+ *    if any, must include the following acknowledgment: 
+ *       "This product includes software developed by the 
+ *        Kannel Group (http://www.kannel.org/)." 
+ *    Alternately, this acknowledgment may appear in the software itself, 
+ *    if and wherever such third-party acknowledgments normally appear. 
+ * 
+ * 4. The names "Kannel" and "Kannel Group" must not be used to 
+ *    endorse or promote products derived from this software without 
+ *    prior written permission. For written permission, please  
+ *    contact org@kannel.org. 
+ * 
+ * 5. Products derived from this software may not be called "Kannel", 
+ *    nor may "Kannel" appear in their name, without prior written 
+ *    permission of the Kannel Group. 
+ * 
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESSED OR IMPLIED 
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES 
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+ * DISCLAIMED.  IN NO EVENT SHALL THE KANNEL GROUP OR ITS CONTRIBUTORS 
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,  
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT  
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR  
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,  
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE  
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,  
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. 
+ * ==================================================================== 
+ * 
+ * This software consists of voluntary contributions made by many 
+ * individuals on behalf of the Kannel Group.  For more information on  
+ * the Kannel Group, please see <http://www.kannel.org/>. 
+ * 
+ * Portions of this software are based upon software originally written at  
+ * WapIT Ltd., Helsinki, Finland for the Kannel project.  
+ */ 
+
+/*
+ * check_histogram.c - Check that histograms work
+ *
+ * This is a test program for checking gw_histogram_t. Some threads
+ * record the values 1 to PER_THREAD concurrently, then the count and
+ * the percentiles are checked against the known distribution.
+ */
+
+#ifndef THREADS
+#define THREADS 16
+#endif
+
+#ifndef PER_THREAD
+#define PER_THREAD (100000)
+#endif
+
+#include "gwlib/gwlib.h"
+
+static void record(void *arg) {
+	gw_histogram_t *h;
+	long long i;
+	
+	h = arg;
+	for (i = 1; i <= PER_THREAD; ++i)
+		gw_histogram_record(h, i);
+}
+
+
+static void check_percentile(gw_histogram_t *h, double p) {
+	long long want, got;
+
+	want = (long long) (p / 100.0 * PER_THREAD);
+	got = gw_histogram_percentile(h, p);
+	/* buckets are 1/16 wide */
+	if (got < want || got > want + want / 16 + 1)
+		panic(0, "percentile %.1f is %lld, expected %lld", p, got, want);
+}
+
+
+int main(void) {
+	gw_histogram_t *h;
+	long threads[THREADS];
+	long i;
+	
+	gwlib_init();
+	log_set_output_level(GW_INFO);
+	h = gw_histogram_create();
+	if (gw_histogram_percentile(h, 50) != -1)
+		panic(0, "empty histogram has a percentile");
+	for (i = 0; i < THREADS; ++i)
+		threads[i] = gwthread_create(record, h);
+	for (i = 0; i < THREADS; ++i)
+		gwthread_join(threads[i]);
+
+	if (gw_histogram_count(h) != (long long) THREADS * PER_THREAD)
+		panic(0, "histogram lost values");
+	check_percentile(h, 50);
+	check_percentile(h, 99);
+	check_percentile(h, 99.9);
+	if (gw_histogram_percentile(h, 100) != PER_THREAD)
+		panic(0, "maximum is %lld", gw_histogram_percentile(h, 100));
+	gw_histogram_destroy(h);
+	gwlib_shutdown();
+	
+	return 0;
+}
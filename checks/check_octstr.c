@@ -111,11 +111,97 @@ static void check_comparisons(void)
 }
 
 
+static void check_growth(void)
+{
+    Octstr *os;
+    long i;
+
+    /* start short, so the data is inline, and grow past that */
+    os = octstr_create("12345");
+    for (i = 0; i < 500; ++i) {
+        octstr_append_char(os, '0' + i % 10);
+        if (octstr_len(os) != 6 + i ||
+            octstr_get_char(os, 5 + i) != '0' + i % 10 ||
+            memcmp(octstr_get_cstr(os), "12345", 5) != 0)
+            panic(0, "octstr_append_char broke the data at length %ld",
+                  octstr_len(os));
+    }
+    octstr_destroy(os);
+
+    os = octstr_create("a b");
+    octstr_url_encode(os);
+    if (octstr_str_compare(os, "a+b") != 0)
+        panic(0, "octstr_url_encode failed on a short string");
+    octstr_insert(os, octstr_imm("0123456789012345678901234567890123456789"
+                                 "0123456789012345678901234567890123456789"), 1);
+    if (octstr_len(os) != 83 || octstr_get_char(os, 82) != 'b')
+        panic(0, "octstr_insert failed to grow a short string");
+    octstr_destroy(os);
+}
+
+
+static void check_interning(void)
+{
+    static const char *foo = "foo";
+    Octstr *a, *b, *c;
+    char buf[16];
+    long i;
+
+    a = octstr_create("smsc-one");
+    b = octstr_intern(a);
+    c = octstr_intern_data("smsc-one", 8);
+    if (b != c || octstr_compare(a, b) != 0)
+        panic(0, "octstr_intern returned different strings for `smsc-one'");
+    if (octstr_intern_data("smsc-two", 8) == b)
+        panic(0, "octstr_intern returned the same string for different data");
+    octstr_destroy(b);
+    octstr_destroy(a);
+
+    /* force the table to grow, earlier strings must still be found */
+    for (i = 0; i < 5000; ++i) {
+        sprintf(buf, "%ld", i);
+        octstr_destroy(octstr_intern_data(buf, strlen(buf)));
+    }
+    if (octstr_intern_data("smsc-one", 8) != c)
+        panic(0, "octstr_intern lost a string when growing");
+
+    if (octstr_imm(foo) != octstr_imm(foo) ||
+        octstr_str_compare(octstr_imm(foo), "foo") != 0)
+        panic(0, "octstr_imm broken");
+}
+
+
+static void check_sharing(void)
+{
+    static const char *imm = "imm";
+    Octstr *a, *b, *c;
+
+    a = octstr_create("a string shared by several holders, longer than inline");
+    b = octstr_share(a);
+    c = octstr_share(a);
+    if (a != b || b != c)
+        panic(0, "octstr_share did not return the same string");
+    octstr_destroy(a);
+    octstr_destroy(b);
+    if (octstr_str_compare(c, "a string shared by several holders, longer than inline") != 0)
+        panic(0, "shared string freed before its last holder");
+    octstr_destroy(c);
+
+    if (octstr_share(octstr_imm(imm)) != octstr_imm(imm))
+        panic(0, "octstr_share of octstr_imm broken");
+    if (octstr_share(NULL) != NULL)
+        panic(0, "octstr_share of NULL broken");
+}
+
+
 int main(void)
 {
     gwlib_init();
     log_set_output_level(GW_INFO);
     check_comparisons();
+    check_growth();
+    check_interning();
+    check_sharing();
     gwlib_shutdown();
     return 0;
 }
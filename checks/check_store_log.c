@@ -0,0 +1,237 @@
+/* ==================================================================== 
+ * The Kannel Software License, Version 1.0 
+ * 
+ * Copyright (c) 2001-2016 Kannel Group  
+ * Copyright (c) 1998-2001 WapIT Ltd.   
+ * All rights reserved. 
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions 
+ * are met: 
+ * 
+ * 1. Redistributions of source code must retain the above copyright 
+ *    notice, this list of conditions and the following disclaimer. 
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright 
+ *    notice, this list of conditions and the following disclaimer in 
+ *    the documentation and/or other materials provided with the 
+ *    distribution. 
+ * 
+ * 3. The end-user documentation included with the redistribution, 
+ *    if any, must include the following acknowledgment: 
+ *       "This product includes software developed by the 
+ *        Kannel Group (http://www.kannel.org/)." 
+ *    Alternately, this acknowledgment may appear in the software itself, 
+ *    if and wherever such third-party acknowledgments normally appear. 
+ * 
+ * 4. The names "Kannel" and "Kannel Group" must not be used to 
+ *    endorse or promote products derived from this software without 
+ *    prior written permission. For written permission, please  
+ *    contact org@kannel.org. 
+ * 
+ * 5. Products derived from this software may not be called "Kannel", 
+ *    nor may "Kannel" appear in their name, without prior written 
+ *    permission of the Kannel Group. 
+ * 
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESSED OR IMPLIED 
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES 
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+ * DISCLAIMED.  IN NO EVENT SHALL THE KANNEL GROUP OR ITS CONTRIBUTORS 
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,  
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT  
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR  
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,  
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE  
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,  
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. 
+ * ==================================================================== 
+ * 
+ * This software consists of voluntary contributions made by many 
+ * individuals on behalf of the Kannel Group.  For more information on  
+ * the Kannel Group, please see <http://www.kannel.org/>. 
+ * 
+ * Portions of this software are based upon software originally written at  
+ * WapIT Ltd., Helsinki, Finland for the Kannel project.  
+ */ 
+
+/*
+ * check_store_log.c - Check that the "log" store type works
+ *
+ * This is a test program for checking the append-only segmented store.
+ * Messages are saved into small segments and most of them acknowledged,
+ * then the compactor must remove the old segments. Reloading the store
+ * must return exactly the messages left unacknowledged, and once those
+ * are acknowledged too, a further reload must return nothing.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <dirent.h>
+
+#ifndef MESSAGES
+#define MESSAGES 200
+#endif
+
+/* every KEEP'th message is left unacknowledged */
+#ifndef KEEP
+#define KEEP 10
+#endif
+
+#include "gwlib/gwlib.h"
+#include "gw/msg.h"
+#include "gw/bb_store.h"
+
+static List *received;
+
+static void receive(Msg *msg) {
+	gwlist_append(received, msg);
+}
+
+
+static Msg *create_sms(long i) {
+	Msg *msg;
+
+	msg = msg_create(sms);
+	msg->sms.sender = octstr_create("123");
+	msg->sms.receiver = octstr_create("456");
+	msg->sms.smsc_id = octstr_create("check");
+	msg->sms.msgdata = octstr_format("message %ld of the store log check", i);
+	return msg;
+}
+
+
+/* return the number of segment files, removing them if unlink_all is set */
+static long segments(Octstr *dir, int unlink_all) {
+	DIR *d;
+	struct dirent *ent;
+	Octstr *name;
+	long id, n;
+	char c;
+
+	if ((d = opendir(octstr_get_cstr(dir))) == NULL)
+		panic(0, "cannot open `%s'", octstr_get_cstr(dir));
+	n = 0;
+	while ((ent = readdir(d)) != NULL) {
+		if (sscanf(ent->d_name, "store-%ld.lo%c", &id, &c) != 2 || c != 'g')
+			continue;
+		n++;
+		if (unlink_all) {
+			name = octstr_format("%S/%s", dir, ent->d_name);
+			unlink(octstr_get_cstr(name));
+			octstr_destroy(name);
+		}
+	}
+	closedir(d);
+	return n;
+}
+
+
+static void open_store(Cfg *cfg, Octstr *dir) {
+	received = gwlist_create();
+	if (store_init(cfg, octstr_imm("log"), dir, 1, msg_pack,
+	               msg_unpack_wrapper) == -1 || store_load(receive) == -1)
+		panic(0, "cannot open the store in `%s'", octstr_get_cstr(dir));
+}
+
+
+static void close_store(void) {
+	store_shutdown();
+	gwlist_destroy(received, msg_destroy_item);
+}
+
+
+int main(void) {
+	Msg *msgs[MESSAGES], *msg;
+	int seen[MESSAGES];
+	char dirname[] = "check_store_log.XXXXXX";
+	Octstr *dir, *cfgname;
+	FILE *f;
+	Cfg *cfg;
+	long i, before;
+
+	gwlib_init();
+	log_set_output_level(GW_WARNING);
+
+	if (mkdtemp(dirname) == NULL)
+		panic(0, "cannot create a store directory");
+	dir = octstr_create(dirname);
+
+	/* small segments, so there is something to compact */
+	cfgname = octstr_format("%S/kannel.conf", dir);
+	if ((f = fopen(octstr_get_cstr(cfgname), "w")) == NULL)
+		panic(0, "cannot write `%s'", octstr_get_cstr(cfgname));
+	fprintf(f, "group = core\nstore-segment-size = 2048\n");
+	fclose(f);
+	cfg = cfg_create(cfgname);
+	if (cfg_read(cfg) == -1)
+		panic(0, "cannot read `%s'", octstr_get_cstr(cfgname));
+
+	/* write and acknowledge */
+	open_store(cfg, dir);
+	if (gwlist_len(received) != 0)
+		panic(0, "new store is not empty");
+	for (i = 0; i < MESSAGES; ++i) {
+		msgs[i] = create_sms(i);
+		if (store_save(msgs[i]) == -1)
+			panic(0, "cannot save message %ld", i);
+	}
+	for (i = 0; i < MESSAGES; ++i) {
+		if (i % KEEP != 0 && store_save_ack(msgs[i], ack_success) == -1)
+			panic(0, "cannot save ack of message %ld", i);
+	}
+	if (store_messages() != MESSAGES / KEEP)
+		panic(0, "store has %ld messages, expected %d", store_messages(),
+		      MESSAGES / KEEP);
+
+	/* the compactor runs each second */
+	before = segments(dir, 0);
+	if (before < 3)
+		panic(0, "only %ld segments written", before);
+	for (i = 0; i < 50 && segments(dir, 0) >= before; ++i)
+		gwthread_sleep(0.1);
+	if (segments(dir, 0) >= before)
+		panic(0, "%ld segments not compacted", before);
+	close_store();
+
+	/* reload, check and acknowledge the rest */
+	open_store(cfg, dir);
+	if (gwlist_len(received) != MESSAGES / KEEP)
+		panic(0, "reloaded %ld messages, expected %d", gwlist_len(received),
+		      MESSAGES / KEEP);
+	for (i = 0; i < MESSAGES; ++i)
+		seen[i] = 0;
+	while ((msg = gwlist_extract_first(received)) != NULL) {
+		if (sscanf(octstr_get_cstr(msg->sms.msgdata), "message %ld", &i) != 1 ||
+		    i < 0 || i >= MESSAGES || i % KEEP != 0 || seen[i] ||
+		    uuid_compare(msg->sms.id, msgs[i]->sms.id) != 0 ||
+		    octstr_compare(msg->sms.msgdata, msgs[i]->sms.msgdata) != 0)
+			panic(0, "wrong message reloaded: %s",
+			      octstr_get_cstr(msg->sms.msgdata));
+		seen[i] = 1;
+		if (store_save_ack(msg, ack_success) == -1)
+			panic(0, "cannot save ack of message %ld", i);
+		msg_destroy(msg);
+	}
+	if (store_messages() != 0)
+		panic(0, "%ld messages left after acks", store_messages());
+	close_store();
+
+	/* everything acknowledged, nothing must come back */
+	open_store(cfg, dir);
+	if (gwlist_len(received) != 0)
+		panic(0, "reloaded %ld acknowledged messages", gwlist_len(received));
+	close_store();
+
+	for (i = 0; i < MESSAGES; ++i)
+		msg_destroy(msgs[i]);
+	segments(dir, 1);
+	unlink(octstr_get_cstr(cfgname));
+	rmdir(dirname);
+	octstr_destroy(cfgname);
+	octstr_destroy(dir);
+	cfg_destroy(cfg);
+	gwlib_shutdown();
+
+	return 0;
+}
@@ -77,19 +77,27 @@
 
 #include "gwlib/gwlib.h"
 #include "msg.h"
+#include "shared.h"
 #include "bearerbox.h"
 #include "bb_smscconn_cb.h"
 
 #define SMSBOX_MAX_PENDING 100
 
+/*
+ * boxc_sender writes up to this many already queued messages, or this
+ * many bytes, to the box before flushing the connection.
+ */
+#define BOXC_BATCH_MSGS 64
+#define BOXC_BATCH_BYTES 65536
+
 /* passed from bearerbox core */
 
 extern volatile sig_atomic_t bb_status;
 extern volatile sig_atomic_t restart;
-extern List *incoming_sms;
-extern List *outgoing_sms;
-extern List *incoming_wdp;
-extern List *outgoing_wdp;
+extern gw_queue_t *incoming_sms;
+extern gw_queue_t *outgoing_sms;
+extern gw_queue_t *incoming_wdp;
+extern gw_queue_t *outgoing_wdp;
 
 extern List *flow_threads;
 extern List *suspended;
@@ -139,14 +147,16 @@ typedef struct _boxc {
     time_t        connect_time;
     Octstr        *client_ip;
     List            *incoming;
-    List            *retry;   	/* If sending fails */
-    List            *outgoing;
+    gw_queue_t      *retry;   	/* If sending fails */
+    gw_queue_t      *outgoing;
     Dict           *sent;
     Semaphore *pending;
     volatile sig_atomic_t alive;
     Octstr        *boxc_id; /* identifies the connected smsbox instance */
     /* used to mark connection usable or still waiting for ident. msg */
     volatile int routable;
+    /* box accepted the packed Msg format */
+    volatile int packed;
 } Boxc;
 
 
@@ -165,15 +175,18 @@ static void boxc_gwlist_destroy(List *list);
 static Msg *read_from_box(Boxc *boxconn)
 {
     int ret;
-    Octstr *pack;
     Msg *msg;
 
-    pack = NULL;
+    msg = NULL;
     while (bb_status != BB_DEAD && boxconn->alive) {
             /* XXX: if box doesn't send (just keep conn open) we block here while shutdown */
-	    pack = conn_read_withlen(boxconn->conn);
-	    gw_claim_area(pack);
-	    if (pack != NULL)
+	    ret = box_read_msg(boxconn->conn, &msg);
+	    if (ret == -1) {
+	        error(0, "Failed to unpack data!");
+	        return NULL;
+	    }
+	    gw_claim_area(msg);
+	    if (msg != NULL)
 	        break;
 	    if (conn_error(boxconn->conn)) {
 	        info(0, "Read error when reading from box <%s>, disconnecting",
@@ -194,14 +207,6 @@ static Msg *read_from_box(Boxc *boxconn)
 	    }
     }
 
-    if (pack == NULL)
-    	return NULL;
-
-    msg = msg_unpack(pack);
-    octstr_destroy(pack);
-
-    if (msg == NULL)
-	    error(0, "Failed to unpack data!");
     return msg;
 }
 
@@ -215,6 +220,8 @@ static void deliver_sms_to_queue(Msg *msg, Boxc *conn)
     Msg *mack;
     int rc;
 
+    msg_stamp(msg, MSG_STAGE_ACCEPT);
+
     /*
      * save modifies ID and time, so if the smsbox uses it, save
      * it FIRST for the reply message!!!
@@ -343,7 +350,7 @@ static void boxc_receiver(void *arg)
 
             /* XXX we should block these in SHUTDOWN phase too, but
                we need ack/nack msgs implemented first. */
-            gwlist_produce(conn->outgoing, msg);
+            gw_queue_produce(conn->outgoing, msg);
 
         } else if (msg_type(msg) == sms && conn->is_wap) {
             debug("bb.boxc", 0, "boxc_receiver: got sms from wapbox");
@@ -368,7 +375,7 @@ static void boxc_receiver(void *arg)
                     Msg *orig;
                     boxc_sent_pop(conn, msg, &orig);
                     if (orig != NULL) /* retry this message */
-                        gwlist_append(conn->retry, orig);
+                        gw_queue_produce(conn->retry, orig);
                 } else {
                     boxc_sent_pop(conn, msg, NULL);
                     store_save(msg);
@@ -439,6 +446,15 @@ static void boxc_receiver(void *arg)
                 /* wakeup the dequeue thread */
                 gwthread_wakeup(sms_dequeue_thread);
             }
+            /* box accepted our offer of the packed format */
+            else if (msg_type(msg) == admin && msg->admin.command == cmd_feature) {
+                if (msg->admin.boxc_id != NULL &&
+                    octstr_str_compare(msg->admin.boxc_id, MSG_FEATURE_PACKED) == 0) {
+                    debug("bb.boxc", 0, "boxc_receiver: box <%s> uses packed messages",
+                          octstr_get_cstr(conn->client_ip));
+                    conn->packed = 1;
+                }
+            }
             else
                 warning(0, "boxc_receiver: unknown msg received from <%s>, "
                            "ignored", octstr_get_cstr(conn->client_ip));
@@ -454,13 +470,6 @@ static void boxc_receiver(void *arg)
 
 static int send_msg(Boxc *boxconn, Msg *pmsg)
 {
-    Octstr *pack;
-
-    pack = msg_pack(pmsg);
-
-    if (pack == NULL)
-        return -1;
-
     if (boxconn->boxc_id != NULL)
         debug("bb.boxc", 0, "send_msg: sending msg to boxc: <%s>",
           octstr_get_cstr(boxconn->boxc_id));
@@ -468,18 +477,29 @@ static int send_msg(Boxc *boxconn, Msg *pmsg)
         debug("bb.boxc", 0, "send_msg: sending msg to box: <%s>",
           octstr_get_cstr(boxconn->client_ip));
 
-    if (conn_write_withlen(boxconn->conn, pack) == -1) {
+    if (box_write_msg(boxconn->conn, pmsg, boxconn->packed) == -1) {
     	error(0, "Couldn't write Msg to box <%s>, disconnecting",
 	      octstr_get_cstr(boxconn->client_ip));
-        octstr_destroy(pack);
         return -1;
     }
 
-    octstr_destroy(pack);
     return 0;
 }
 
 
+/* Offer the packed Msg format, the box answers if it supports it. */
+static void send_feature_offer(Boxc *boxconn)
+{
+    Msg *msg;
+
+    msg = msg_create(admin);
+    msg->admin.command = cmd_feature;
+    msg->admin.boxc_id = octstr_create(MSG_FEATURE_PACKED);
+    send_msg(boxconn, msg);
+    msg_destroy(msg);
+}
+
+
 static void boxc_sent_push(Boxc *conn, Msg *m)
 {
     Octstr *os;
@@ -490,7 +510,7 @@ static void boxc_sent_push(Boxc *conn, Msg *m)
 
     uuid_unparse(m->sms.id, id);
     os = octstr_create(id);
-    dict_put(conn->sent, os, msg_duplicate(m));
+    dict_put(conn->sent, os, msg_ref(m));
     semaphore_down(conn->pending);
     octstr_destroy(os);
 }
@@ -533,6 +553,7 @@ static void boxc_sender(void *arg)
 {
     Msg *msg;
     Boxc *conn = arg;
+    int batch, failed;
 
     gwlist_add_producer(flow_threads);
 
@@ -554,21 +575,38 @@ static void boxc_sender(void *arg)
             msg_destroy(msg);
             break;
         }
-        if (msg_type(msg) == heartbeat) {
-            debug("bb.boxc", 0, "boxc_sender: catch an heartbeat - we are alive");
+
+        /*
+         * Write what is already queued in one go. Only take more messages
+         * while the pending window is open, so boxc_sent_push() does not
+         * block with unflushed data.
+         */
+        conn_set_output_buffering(conn->conn, BOXC_BATCH_BYTES);
+        failed = 0;
+        batch = 0;
+        do {
+            if (msg_type(msg) == heartbeat) {
+                debug("bb.boxc", 0, "boxc_sender: catch an heartbeat - we are alive");
+                msg_destroy(msg);
+                continue;
+            }
+            boxc_sent_push(conn, msg);
+            if (!conn->alive || send_msg(conn, msg) == -1) {
+                /* we got message here */
+                boxc_sent_pop(conn, msg, NULL);
+                gw_queue_produce(conn->retry, msg);
+                failed = 1;
+                break;
+            }
             msg_destroy(msg);
-            continue;
-        }
-        boxc_sent_push(conn, msg);
-        if (!conn->alive || send_msg(conn, msg) == -1) {
-            /* we got message here */
-            boxc_sent_pop(conn, msg, NULL);
-            gwlist_produce(conn->retry, msg);
+            debug("bb.boxc", 0, "boxc_sender: sent message to <%s>",
+                   octstr_get_cstr(conn->client_ip));
+        } while (++batch < BOXC_BATCH_MSGS &&
+                 (conn->is_wap || semaphore_getvalue(conn->pending) > 0) &&
+                 (msg = gwlist_extract_first(conn->incoming)) != NULL);
+        conn_set_output_buffering(conn->conn, 0);
+        if (failed)
             break;
-        }
-        msg_destroy(msg);
-        debug("bb.boxc", 0, "boxc_sender: sent message to <%s>",
-               octstr_get_cstr(conn->client_ip));
     }
     /* the client closes the connection, after that die in receiver */
     /* conn->alive = 0; */
@@ -598,6 +636,7 @@ static Boxc *boxc_create(int fd, Octstr *ip, int ssl)
     boxc->connect_time = time(NULL);
     boxc->boxc_id = NULL;
     boxc->routable = 0;
+    boxc->packed = 0;
     return boxc;
 }
 
@@ -678,6 +717,7 @@ static void run_smsbox(void *arg)
     newconn->sent = dict_create(smsbox_max_pending, NULL);
     newconn->pending = semaphore_create(smsbox_max_pending);
 
+    send_feature_offer(newconn);
     sender = gwthread_create(boxc_sender, newconn);
     if (sender == -1) {
         error(0, "Failed to start a new thread, disconnecting client <%s>",
@@ -694,9 +734,9 @@ static void run_smsbox(void *arg)
     gwlist_append(smsbox_list, newconn);
     gw_rwlock_unlock(smsbox_list_rwlock);
 
-    gwlist_add_producer(newconn->outgoing);
+    gw_queue_add_producer(newconn->outgoing);
     boxc_receiver(newconn);
-    gwlist_remove_producer(newconn->outgoing);
+    gw_queue_remove_producer(newconn->outgoing);
 
     /* remove us from smsbox routing list */
     gw_rwlock_wrlock(smsbox_list_rwlock);
@@ -730,7 +770,7 @@ static void run_smsbox(void *arg)
     keys = dict_keys(newconn->sent);
     while((key = gwlist_extract_first(keys)) != NULL) {
         msg = dict_remove(newconn->sent, key);
-        gwlist_produce(incoming_sms, msg);
+        gw_queue_produce(incoming_sms, msg);
         octstr_destroy(key);
     }
     gw_assert(gwlist_len(keys) == 0);
@@ -738,7 +778,7 @@ static void run_smsbox(void *arg)
 
     /* clear our send queue */
     while((msg = gwlist_extract_first(newconn->incoming)) != NULL) {
-        gwlist_produce(incoming_sms, msg);
+        gw_queue_produce(incoming_sms, msg);
     }
 
 cleanup:
@@ -783,6 +823,7 @@ static void run_wapbox(void *arg)
     newconn->retry = incoming_wdp;
     newconn->outgoing = outgoing_wdp;
 
+    send_feature_offer(newconn);
     sender = gwthread_create(boxc_sender, newconn);
     if (sender == -1) {
 	    error(0, "Failed to start a new thread, disconnecting client <%s>",
@@ -790,12 +831,12 @@ static void run_wapbox(void *arg)
 	    goto cleanup;
     }
     gwlist_append(wapbox_list, newconn);
-    gwlist_add_producer(newconn->outgoing);
+    gw_queue_add_producer(newconn->outgoing);
     boxc_receiver(newconn);
 
     /* cleanup after receiver has exited */
 
-    gwlist_remove_producer(newconn->outgoing);
+    gw_queue_remove_producer(newconn->outgoing);
     gwlist_lock(wapbox_list);
     gwlist_delete_equal(wapbox_list, newconn);
     gwlist_unlock(wapbox_list);
@@ -938,7 +979,7 @@ static void wdp_to_wapboxes(void *arg)
 
 	    gwlist_consume(suspended);	/* block here if suspended */
 
-	    if ((msg = gwlist_consume(incoming_wdp)) == NULL)
+	    if ((msg = gw_queue_consume(incoming_wdp)) == NULL)
 	         break;
 
 	    gw_assert(msg_type(msg) == wdp_datagram);
@@ -972,7 +1013,7 @@ static void wdp_to_wapboxes(void *arg)
 
 
 static void wait_for_connections(int fd, void (*function) (void *arg),
-    	    	    	    	 List *waited, int ssl)
+    	    	    	    	 gw_queue_t *waited, int ssl)
 {
     int ret;
     int timeout = 10; /* 10 sec. */
@@ -988,7 +1029,7 @@ static void wait_for_connections(int fd, void (*function) (void *arg),
          *           Otherwise we wait here for ever!
          */
         if (bb_status == BB_SHUTDOWN) {
-            ret = gwlist_wait_until_nonempty(waited);
+            ret = gw_queue_wait_until_nonempty(waited);
             if (ret == -1 || !timeout)
                 break;
             else
@@ -1038,7 +1079,7 @@ static void smsboxc_run(void *arg)
     gwlist_remove_producer(smsbox_list);
 
     /* continue avalanche */
-    gwlist_remove_producer(outgoing_sms);
+    gw_queue_remove_producer(outgoing_sms);
 
     /* all connections do the same, so that all must remove() before it
      * is completely over
@@ -1090,7 +1131,7 @@ static void wapboxc_run(void *arg)
 
     /* continue avalanche */
 
-    gwlist_remove_producer(outgoing_wdp);
+    gw_queue_remove_producer(outgoing_wdp);
 
 
     /* wait for all connections to die and then remove list
@@ -1274,7 +1315,7 @@ int smsbox_start(Cfg *cfg)
     /* load the defined smsbox routing rules */
     init_smsbox_routes(cfg);
 
-    gwlist_add_producer(outgoing_sms);
+    gw_queue_add_producer(outgoing_sms);
     gwlist_add_producer(smsbox_list);
 
     smsbox_running = 1;
@@ -1330,7 +1371,7 @@ int wapbox_start(Cfg *cfg)
 	    info(0, "Box connection allowed IPs defined without any denied...");
 
     wapbox_list = gwlist_create();	/* have a list of connections */
-    gwlist_add_producer(outgoing_wdp);
+    gw_queue_add_producer(outgoing_wdp);
     if (!boxid)
         boxid = counter_create();
 
@@ -1524,8 +1565,8 @@ int route_incoming_to_boxc(Msg *msg)
     if (gwlist_len(smsbox_list) == 0) {
         gw_rwlock_unlock(smsbox_list_rwlock);
     	warning(0, "smsbox_list empty!");
-        if (max_incoming_sms_qlength < 0 || max_incoming_sms_qlength > gwlist_len(incoming_sms)) {
-            gwlist_produce(incoming_sms, msg);
+        if (max_incoming_sms_qlength < 0 || max_incoming_sms_qlength > gw_queue_len(incoming_sms)) {
+            gw_queue_produce(incoming_sms, msg);
             return 0;
         } else {
             return -1;
@@ -1571,8 +1612,8 @@ int route_incoming_to_boxc(Msg *msg)
             warning(0, "Could not route message to smsbox id <%s>, smsbox is gone!",
                     octstr_get_cstr(boxc_id));
             gw_rwlock_unlock(smsbox_list_rwlock);
-            if (max_incoming_sms_qlength < 0 || max_incoming_sms_qlength > gwlist_len(incoming_sms)) {
-                gwlist_produce(incoming_sms, msg);
+            if (max_incoming_sms_qlength < 0 || max_incoming_sms_qlength > gw_queue_len(incoming_sms)) {
+                gw_queue_produce(incoming_sms, msg);
                 return 0;
             } else {
                 return -1;
@@ -1612,8 +1653,8 @@ int route_incoming_to_boxc(Msg *msg)
              * such boxc_id connected.
              */
             gw_rwlock_unlock(smsbox_list_rwlock);
-            if (max_incoming_sms_qlength < 0 || max_incoming_sms_qlength > gwlist_len(incoming_sms)) {
-                gwlist_produce(incoming_sms, msg);
+            if (max_incoming_sms_qlength < 0 || max_incoming_sms_qlength > gw_queue_len(incoming_sms)) {
+                gw_queue_produce(incoming_sms, msg);
                 return 0;
             } else {
                 return -1;
@@ -1656,8 +1697,8 @@ int route_incoming_to_boxc(Msg *msg)
 
     if (bc == NULL && full_found == 0) {
         warning(0, "smsbox_list empty!");
-        if (max_incoming_sms_qlength < 0 || max_incoming_sms_qlength > gwlist_len(incoming_sms)) {
-            gwlist_produce(incoming_sms, msg);
+        if (max_incoming_sms_qlength < 0 || max_incoming_sms_qlength > gw_queue_len(incoming_sms)) {
+            gw_queue_produce(incoming_sms, msg);
                return 0;
          } else {
              return -1;
@@ -1691,21 +1732,21 @@ static void sms_to_smsboxes(void *arg)
             if (ret == 0 || ret == -1) {
                 /* debug("", 0, "time to sleep"); */
                 gwthread_sleep(60.0);
-                /* debug("", 0, "wake up list len %ld", gwlist_len(incoming_sms)); */
+                /* debug("", 0, "wake up list len %ld", gw_queue_len(incoming_sms)); */
                 /* shutdown ? */
                 if (gwlist_producer_count(smsbox_list) == 0 && gwlist_len(smsbox_list) == 0)
                     break;
             }
-            startmsg = msg = gwlist_consume(incoming_sms);
+            startmsg = msg = gw_queue_consume(incoming_sms);
             /* debug("", 0, "gwlist_consume done 1"); */
             newmsg = NULL;
         }
         else {
-            newmsg = msg = gwlist_consume(incoming_sms);
+            newmsg = msg = gw_queue_consume(incoming_sms);
 
             /* Back at the first message? */
             if (newmsg == startmsg) {
-                gwlist_insert(incoming_sms, 0, msg);
+                gw_queue_insert_head(incoming_sms, msg);
                 continue;
             }
         }
@@ -1722,7 +1763,7 @@ static void sms_to_smsboxes(void *arg)
         if (ret == 1)
             startmsg = newmsg = NULL;
         else if (ret == -1) {
-            gwlist_produce(incoming_sms, msg);
+            gw_queue_produce(incoming_sms, msg);
         }
     }
 
@@ -144,6 +144,13 @@ static Octstr *httpd_status(List *cgivars, int status_type)
     return bb_print_status(status_type);
 }
 
+static Octstr *httpd_latency(List *cgivars, int status_type)
+{
+    Octstr *reply;
+    if ((reply = httpd_check_authorization(cgivars, 1))!= NULL) return reply;
+    return smsc2_latency_status(status_type);
+}
+
 static Octstr *httpd_store_status(List *cgivars, int status_type)
 {
     Octstr *reply;
@@ -374,6 +381,7 @@ static struct httpd_command {
 } httpd_commands[] = {
     { "status", httpd_status },
     { "store-status", httpd_store_status },
+    { "latency", httpd_latency },
     { "log-level", httpd_loglevel },
     { "shutdown", httpd_shutdown },
     { "suspend", httpd_suspend },
@@ -443,6 +451,8 @@ static void httpd_serve(HTTPClient *client, Octstr *ourl, List *headers,
             status_type = BBSTATUS_XML;
         else if (octstr_str_compare(tmp, "wml") == 0)
             status_type = BBSTATUS_WML;
+        else if (octstr_str_compare(tmp, "json") == 0)
+            status_type = BBSTATUS_JSON;
 
         octstr_destroy(tmp);
     }
@@ -457,6 +467,8 @@ static void httpd_serve(HTTPClient *client, Octstr *ourl, List *headers,
     /* check if command found */
     if (httpd_commands[i].command == NULL) {
         char *lb = bb_status_linebreak(status_type);
+        if (lb == NULL)
+            lb = "\n";
 	reply = octstr_format("Unknown command `%S'.%sPossible commands are:%s",
             ourl, lb, lb);
         for (i=0; httpd_commands[i].command != NULL; i++)
@@ -481,6 +493,10 @@ static void httpd_serve(HTTPClient *client, Octstr *ourl, List *headers,
 	header = "<?xml version=\"1.0\"?>\n"
             "<gateway>\n";
         footer = "</gateway>\n";
+    } else if (status_type == BBSTATUS_JSON) {
+	header = "";
+	footer = "";
+	content_type = "application/json";
     } else {
 	header = "";
 	footer = "";
@@ -97,8 +97,8 @@
 /* passed from bearerbox core */
 
 extern volatile sig_atomic_t bb_status;
-extern List *incoming_sms;
-extern List *outgoing_sms;
+extern gw_queue_t *incoming_sms;
+extern gw_queue_t *outgoing_sms;
 
 extern Counter *incoming_sms_counter;
 extern Counter *outgoing_sms_counter;
@@ -127,10 +127,22 @@ extern Octstr *cfg_filename;
 static volatile sig_atomic_t smsc_running;
 static List *smsc_list;
 static RWLock smsc_list_lock;
+static SMSCConnRoutes *smsc_routes;
 static Cfg *cfg_reloaded;
 static List *smsc_groups;
 static Octstr *unified_prefix;
 
+/*
+ * Latency of sent messages in microseconds. Index i holds the time from
+ * the previous stamped stage to stage i, index MSG_STAGE_ACCEPT the
+ * whole time from the box to the acknowledgement of the SMSC. Each
+ * SMSCConn keeps the same set for its own messages.
+ */
+static gw_histogram_t *latency[msg_stage_count];
+static const char *latency_names[msg_stage_count] = {
+    "total", "store", "route", "queue", "submit"
+};
+
 static RWLock white_black_list_lock;
 static Octstr *black_list_sender_url;
 static Octstr *white_list_sender_url;
@@ -185,7 +197,7 @@ static void concat_handling_clear_old_parts(int force);
 void bb_smscconn_ready(SMSCConn *conn)
 {
     gwlist_add_producer(flow_threads);
-    gwlist_add_producer(incoming_sms);
+    gw_queue_add_producer(incoming_sms);
 }
 
 
@@ -201,7 +213,7 @@ void bb_smscconn_killed(void)
     /* NOTE: after status has been set to SMSCCONN_DEAD, bearerbox
      *   is free to release/delete 'conn'
      */
-    gwlist_remove_producer(incoming_sms);
+    gw_queue_remove_producer(incoming_sms);
     gwlist_remove_producer(flow_threads);
 }
 
@@ -236,7 +248,7 @@ static void handle_split(SMSCConn *conn, Msg *msg, long reason)
             msg->sms.resend_try = (msg->sms.resend_try > 0 ? msg->sms.resend_try + 1 : 1);
             time(&msg->sms.resend_time);
         }
-        gwlist_produce(outgoing_sms, msg);
+        gw_queue_produce(outgoing_sms, msg);
         return;
     case SMSCCONN_FAILED_DISCARDED:
     case SMSCCONN_FAILED_REJECTED:
@@ -276,8 +288,34 @@ static void handle_split(SMSCConn *conn, Msg *msg, long reason)
 }
 
 
+static void latency_record(gw_histogram_t **hist, Msg *sms)
+{
+    long long prev = 0;
+    int i;
+
+    for (i = MSG_STAGE_ACCEPT; i < msg_stage_count; i++) {
+        if (sms->stamps[i] == 0)
+            continue;
+        if (prev > 0)
+            gw_histogram_record(hist[i], sms->stamps[i] - prev);
+        prev = sms->stamps[i];
+    }
+    if (sms->stamps[MSG_STAGE_ACCEPT] > 0)
+        gw_histogram_record(hist[MSG_STAGE_ACCEPT],
+                            sms->stamps[MSG_STAGE_SENT] - sms->stamps[MSG_STAGE_ACCEPT]);
+}
+
+
 void bb_smscconn_sent(SMSCConn *conn, Msg *sms, Octstr *reply)
 {
+    msg_stamp(sms, MSG_STAGE_SENT);
+    if (sms->sms.split_parts == NULL) {
+        /* split messages count once, when the last part is through */
+        latency_record(latency, sms);
+        if (conn != NULL)
+            latency_record(conn->latency, sms);
+    }
+
     if (sms->sms.split_parts != NULL) {
         handle_split(conn, sms, SMSCCONN_SUCCESS);
         octstr_destroy(reply);
@@ -289,18 +327,18 @@ void bb_smscconn_sent(SMSCConn *conn, Msg *sms, Octstr *reply)
 
     if (sms->sms.sms_type != report_mt) {
         bb_alog_sms(conn, sms, "Sent SMS");
-        counter_increase(outgoing_sms_counter);
+        counter_stat_increase(outgoing_sms_counter);
         load_increase(outgoing_sms_load);
         if (conn != NULL) {
-            counter_increase(conn->sent);
+            counter_stat_increase(conn->sent);
             load_increase(conn->outgoing_sms_load);
         }
     } else {
         bb_alog_sms(conn, sms, "Sent DLR");
-        counter_increase(outgoing_dlr_counter);
+        counter_stat_increase(outgoing_dlr_counter);
         load_increase(outgoing_dlr_load);
         if (conn != NULL) {
-            counter_increase(conn->sent_dlr);
+            counter_stat_increase(conn->sent_dlr);
             load_increase(conn->outgoing_dlr_load);
         }
     }
@@ -354,18 +392,18 @@ void bb_smscconn_send_failed(SMSCConn *conn, Msg *sms, int reason, Octstr *reply
            sms->sms.resend_try = (sms->sms.resend_try > 0 ? sms->sms.resend_try + 1 : 1);
            time(&sms->sms.resend_time);
        }
-       gwlist_produce(outgoing_sms, sms);
+       gw_queue_produce(outgoing_sms, sms);
        break;
        
     case SMSCCONN_FAILED_SHUTDOWN:
-        gwlist_produce(outgoing_sms, sms);
+        gw_queue_produce(outgoing_sms, sms);
         break;
 
     default:
         /* write NACK to store file */
         store_save_ack(sms, ack_failed);
 
-        if (conn) counter_increase(conn->failed);
+        if (conn) counter_stat_increase(conn->failed);
         if (reason == SMSCCONN_FAILED_DISCARDED) {
             if (sms->sms.sms_type != report_mt)
                 bb_alog_sms(conn, sms, "DISCARDED SMS");
@@ -419,7 +457,7 @@ static long bb_smscconn_receive_internal(SMSCConn *conn, Msg *sms)
     int rc;
     Msg *copy;
 
-    copy = msg_duplicate(sms);
+    copy = msg_share(sms);
 
     /*
      * Try to reroute internally to an smsc-id without leaving
@@ -454,18 +492,18 @@ static long bb_smscconn_receive_internal(SMSCConn *conn, Msg *sms)
 
     if (sms->sms.sms_type != report_mo) {
         bb_alog_sms(conn, sms, "Receive SMS");
-        counter_increase(incoming_sms_counter);
+        counter_stat_increase(incoming_sms_counter);
         load_increase(incoming_sms_load);
         if (conn != NULL) {
-            counter_increase(conn->received);
+            counter_stat_increase(conn->received);
             load_increase(conn->incoming_sms_load);
         }
     } else {
         bb_alog_sms(conn, sms, "Receive DLR");
-        counter_increase(incoming_dlr_counter);
+        counter_stat_increase(incoming_dlr_counter);
         load_increase(incoming_dlr_load);
         if (conn != NULL) {
-            counter_increase(conn->received_dlr);
+            counter_stat_increase(conn->received_dlr);
             load_increase(conn->incoming_dlr_load);
         }
     }
@@ -600,10 +638,10 @@ long bb_smscconn_receive(SMSCConn *conn, Msg *sms)
         ret = concat_handling_check_and_handle(&sms, (conn ? conn->id : NULL));
         switch(ret) {
         case concat_pending:
-            counter_increase(incoming_sms_counter); /* ?? */
+            counter_stat_increase(incoming_sms_counter); /* ?? */
             load_increase(incoming_sms_load);
             if (conn != NULL) {
-                counter_increase(conn->received);
+                counter_stat_increase(conn->received);
                 load_increase(conn->incoming_sms_load);
             }
             return SMSCCONN_SUCCESS;
@@ -653,6 +691,7 @@ static void sms_router(void *arg)
     Msg *msg, *startmsg, *newmsg;
     long ret;
     time_t concat_mo_check;
+    long concat_wait;
 
     gwlist_add_producer(flow_threads);
     gwthread_wakeup(MAIN_THREAD_ID);
@@ -660,6 +699,7 @@ static void sms_router(void *arg)
     startmsg = newmsg = NULL;
     ret = SMSCCONN_SUCCESS;
     concat_mo_check = time(NULL);
+    concat_wait = (handle_concatenated_mo ? 1 : concatenated_mo_timeout);
 
     while(bb_status != BB_SHUTDOWN && bb_status != BB_DEAD) {
 
@@ -669,15 +709,16 @@ static void sms_router(void *arg)
                 double sleep_time = (sms_resend_frequency / 2 > 1 ? sms_resend_frequency / 2 : sms_resend_frequency);
                 debug("bb.sms", 0, "sms_router: time to sleep %.2f secs.", sleep_time);
                 gwthread_sleep(sleep_time);
-                debug("bb.sms", 0, "sms_router: gwlist_len = %ld", gwlist_len(outgoing_sms));
+                debug("bb.sms", 0, "sms_router: gwlist_len = %ld", gw_queue_len(outgoing_sms));
             }
-            startmsg = msg = gwlist_timed_consume(outgoing_sms, concatenated_mo_timeout);
+            startmsg = msg = gw_queue_timed_consume(outgoing_sms, concat_wait);
             newmsg = NULL;
         } else {
-            newmsg = msg = gwlist_timed_consume(outgoing_sms, concatenated_mo_timeout);
+            newmsg = msg = gw_queue_timed_consume(outgoing_sms, concat_wait);
         }
 
-        if (difftime(time(NULL), concat_mo_check) > concatenated_mo_timeout) {
+        /* expiring is cheap with the timer wheel, so check every second */
+        if (difftime(time(NULL), concat_mo_check) >= 1) {
             concat_mo_check = time(NULL);
             concat_handling_clear_old_parts(0);
         }
@@ -695,7 +736,7 @@ static void sms_router(void *arg)
         if (msg->sms.resend_try > 0 && difftime(time(NULL), msg->sms.resend_time) < sms_resend_frequency &&
             bb_status != BB_SHUTDOWN && bb_status != BB_DEAD) {
             debug("bb.sms", 0, "re-queing SMS not-yet-to-be resent");
-            gwlist_produce(outgoing_sms, msg);
+            gw_queue_produce(outgoing_sms, msg);
             ret = SMSCCONN_QUEUED;
             continue;
         }
@@ -715,7 +756,7 @@ static void sms_router(void *arg)
             break;
         case SMSCCONN_FAILED_QFULL:
             debug("bb.sms", 0, "Routing failed, re-queuing.");
-            gwlist_produce(outgoing_sms, msg);
+            gw_queue_produce(outgoing_sms, msg);
             break;
         case SMSCCONN_FAILED_EXPIRED:
             debug("bb.sms", 0, "Routing failed, expired.");
@@ -798,6 +839,18 @@ static int cmp_conn_grp_id(void *a, void *b)
 }
 
 
+/*
+ * Re-compile the routing table after smsc_list or the routing
+ * configuration of its connections changed.
+ * NOTE: Caller must hold the write lock of smsc_list!
+ */
+static void smsc2_rebuild_routes(void)
+{
+    smscconn_routes_destroy(smsc_routes);
+    smsc_routes = smscconn_routes_create(smsc_list);
+}
+
+
 /*-------------------------------------------------------------
  * public functions
  *
@@ -817,6 +870,9 @@ int smsc2_start(Cfg *cfg)
 
     /* create split sms counter */
     split_msg_counter = counter_create();
+
+    for (i = 0; i < msg_stage_count; i++)
+        latency[i] = gw_histogram_create();
     
     /* create smsc list and rwlock for it */
     smsc_list = gwlist_create();
@@ -932,11 +988,13 @@ int smsc2_start(Cfg *cfg)
         }
     }
     gwlist_remove_producer(smsc_list);
+    smsc_routes = NULL;
+    smsc2_rebuild_routes();
     
     if ((router_thread = gwthread_create(sms_router, NULL)) == -1)
 	panic(0, "Failed to start a new thread for SMS routing");
     
-    gwlist_add_producer(incoming_sms);
+    gw_queue_add_producer(incoming_sms);
     smsc_running = 1;
     return 0;
 }
@@ -1067,6 +1125,7 @@ int smsc2_restart_smsc(Octstr *id)
         success = 1;
         num++;
     }
+    smsc2_rebuild_routes();
 
     gw_rwlock_unlock(&smsc_list_lock);
     
@@ -1100,6 +1159,7 @@ int smsc2_remove_smsc(Octstr *id)
         success = 1;
     }
     gwlist_remove_producer(smsc_list);
+    smsc2_rebuild_routes();
 
     gw_rwlock_unlock(&smsc_list_lock);
     if (success == 0) {
@@ -1155,6 +1215,7 @@ int smsc2_add_smsc(Octstr *id)
         }
     }
     gwlist_remove_producer(smsc_list);
+    smsc2_rebuild_routes();
     gw_rwlock_unlock(&smsc_list_lock);
     if (success == 0) {
         error(0, "SMSC %s not found", octstr_get_cstr(id));
@@ -1163,62 +1224,46 @@ int smsc2_add_smsc(Octstr *id)
     return 0;
 }
 
-int smsc2_reload_lists(void)
+/*
+ * Load a new list from url and replace *list with it. The list is built
+ * before taking the lock, so routing only waits for the pointer swap,
+ * and the old list is freed after the lock has been released again.
+ */
+static int reload_list(Numhash **list, Octstr *url, const char *name)
 {
-    Numhash *tmp;
-    int rc = 1;
+    Numhash *tmp, *old;
 
-    if (white_list_sender_url != NULL) {
-        tmp = numhash_create(octstr_get_cstr(white_list_sender_url));
-        if (white_list_sender == NULL) {
-            error(0, "Unable to reload white_list."),
-            rc = -1;
-        } else {
-        	gw_rwlock_wrlock(&white_black_list_lock);
-        	numhash_destroy(white_list_sender);
-        	white_list_sender = tmp;
-        	gw_rwlock_unlock(&white_black_list_lock);
-        }
-    }
+    if (url == NULL)
+        return 1;
 
-    if (black_list_sender_url != NULL) {
-        tmp = numhash_create(octstr_get_cstr(black_list_sender_url));
-        if (black_list_sender == NULL) {
-            error(0, "Unable to reload black_list");
-            rc = -1;
-        } else {
-        	gw_rwlock_wrlock(&white_black_list_lock);
-        	numhash_destroy(black_list_sender);
-        	black_list_sender = tmp;
-        	gw_rwlock_unlock(&white_black_list_lock);
-        }
+    tmp = numhash_create(octstr_get_cstr(url));
+    if (tmp == NULL) {
+        error(0, "Unable to reload %s.", name);
+        return -1;
     }
 
-    if (white_list_receiver_url != NULL) {
-        tmp = numhash_create(octstr_get_cstr(white_list_receiver_url));
-        if (white_list_receiver == NULL) {
-            error(0, "Unable to reload white_list."),
-            rc = -1;
-        } else {
-            gw_rwlock_wrlock(&white_black_list_lock);
-            numhash_destroy(white_list_receiver);
-            white_list_receiver = tmp;
-            gw_rwlock_unlock(&white_black_list_lock);
-        }
-    }
+    gw_rwlock_wrlock(&white_black_list_lock);
+    old = *list;
+    *list = tmp;
+    gw_rwlock_unlock(&white_black_list_lock);
 
-    if (black_list_receiver_url != NULL) {
-        tmp = numhash_create(octstr_get_cstr(black_list_receiver_url));
-        if (black_list_receiver == NULL) {
-            error(0, "Unable to reload black_list");
-            rc = -1;
-        } else {
-            gw_rwlock_wrlock(&white_black_list_lock);
-            numhash_destroy(black_list_receiver);
-            black_list_sender = tmp;
-            gw_rwlock_unlock(&white_black_list_lock);
-        }
-    }
+    numhash_destroy(old);
+
+    return 1;
+}
+
+int smsc2_reload_lists(void)
+{
+    int rc = 1;
+
+    if (reload_list(&white_list_sender, white_list_sender_url, "white-list") == -1)
+        rc = -1;
+    if (reload_list(&black_list_sender, black_list_sender_url, "black-list") == -1)
+        rc = -1;
+    if (reload_list(&white_list_receiver, white_list_receiver_url, "white-list-receiver") == -1)
+        rc = -1;
+    if (reload_list(&black_list_receiver, black_list_receiver_url, "black-list-receiver") == -1)
+        rc = -1;
 
     return rc;
 }
@@ -1294,7 +1339,7 @@ int smsc2_shutdown(void)
      * receive thingies? Is this guaranteed by setting bb_status
      * to shutdown before calling these?
      */
-    gwlist_remove_producer(incoming_sms);
+    gw_queue_remove_producer(incoming_sms);
 
     /* shutdown low levele PDU things */
     smpp_pdu_shutdown();
@@ -1320,8 +1365,14 @@ void smsc2_cleanup(void)
     }
     gwlist_destroy(smsc_list, NULL);
     smsc_list = NULL;
+    smscconn_routes_destroy(smsc_routes);
+    smsc_routes = NULL;
     gw_rwlock_unlock(&smsc_list_lock);
     gwlist_destroy(smsc_groups, NULL);
+    for (i = 0; i < msg_stage_count; i++) {
+        gw_histogram_destroy(latency[i]);
+        latency[i] = NULL;
+    }
     octstr_destroy(unified_prefix);    
     numhash_destroy(white_list_sender);
     numhash_destroy(black_list_sender);
@@ -1360,6 +1411,7 @@ Octstr *smsc2_status(int status_type)
     int para = 0;
     SMSCConn *conn;
     StatusInfo info;
+    Octstr *flow;
     const Octstr *conn_id = NULL;
     const Octstr *conn_admin_id = NULL;
     const Octstr *conn_name = NULL;
@@ -1467,6 +1519,18 @@ Octstr *smsc2_status(int status_type)
                 break;
         }
 
+        /* flow control state, for drivers that report it */
+        if (info.window < 0)
+            flow = octstr_create("");
+        else if (status_type == BBSTATUS_XML)
+            flow = octstr_format("\t\t<window>%ld</window>\n"
+                "\t\t<rate>%.2f</rate>\n"
+                "\t\t<rtt>%.1f,%.1f,%.1f</rtt>\n",
+                info.window, info.rate, info.rtt_p50, info.rtt_p95, info.rtt_p99);
+        else
+            flow = octstr_format(", window %ld, rate %.2f, rtt %.1f/%.1f/%.1f ms",
+                info.window, info.rate, info.rtt_p50, info.rtt_p95, info.rtt_p99);
+
         if (status_type == BBSTATUS_XML)
             octstr_format_append(tmp, "<status>%s</status>\n"
                 "\t\t<failed>%ld</failed>\n"
@@ -1482,17 +1546,19 @@ Octstr *smsc2_status(int status_type)
                 "\t\t\t<inbound>%.2f,%.2f,%.2f</inbound>\n"
                 "\t\t\t<outbound>%.2f,%.2f,%.2f</outbound>\n"
                 "\t\t</dlr>\n"
+                "%S"
                 "\t</smsc>\n", tmp3,
                 info.failed, info.queued, info.received, info.sent,
                 incoming_sms_load_0, incoming_sms_load_1, incoming_sms_load_2,
                 outgoing_sms_load_0, outgoing_sms_load_1, outgoing_sms_load_2,
                 info.received_dlr, info.sent_dlr,
                 incoming_dlr_load_0, incoming_dlr_load_1, incoming_dlr_load_2,
-                outgoing_dlr_load_0, outgoing_dlr_load_1, outgoing_dlr_load_2);
+                outgoing_dlr_load_0, outgoing_dlr_load_1, outgoing_dlr_load_2,
+                flow);
         else
             octstr_format_append(tmp, " (%s, rcvd: sms %ld (%.2f,%.2f,%.2f) / dlr %ld (%.2f,%.2f,%.2f), "
                 "sent: sms %ld (%.2f,%.2f,%.2f) / dlr %ld (%.2f,%.2f,%.2f), failed %ld, "
-                "queued %ld msgs)%s",
+                "queued %ld msgs%S)%s",
                 tmp3,
                 info.received,
                 incoming_sms_load_0, incoming_sms_load_1, incoming_sms_load_2,
@@ -1504,7 +1570,9 @@ Octstr *smsc2_status(int status_type)
                 outgoing_dlr_load_0, outgoing_dlr_load_1, outgoing_dlr_load_2,
                 info.failed,
                 info.queued,
+                flow,
                 lb);
+        octstr_destroy(flow);
     }
 
     gw_rwlock_unlock(&smsc_list_lock);
@@ -1519,6 +1587,125 @@ Octstr *smsc2_status(int status_type)
 }
 
 
+static void json_append_string(Octstr *os, const Octstr *str)
+{
+    long i;
+    int c;
+
+    octstr_append_char(os, '"');
+    for (i = 0; i < octstr_len(str); i++) {
+        c = octstr_get_char(str, i);
+        if (c == '"' || c == '\\')
+            octstr_format_append(os, "\\%c", c);
+        else if (c < 0x20)
+            octstr_format_append(os, "\\u%04x", c);
+        else
+            octstr_append_char(os, c);
+    }
+    octstr_append_char(os, '"');
+}
+
+
+/*
+ * Append p50, p99 and p999 of each latency histogram in milliseconds.
+ */
+static void latency_append(Octstr *os, gw_histogram_t **hist, int status_type)
+{
+    static const double percentiles[] = { 50, 99, 99.9 };
+    long long values[3], count;
+    int i, first = 1;
+
+    for (i = 0; i < msg_stage_count; i++) {
+        count = gw_histogram_percentiles(hist[i], percentiles, values, 3);
+        if (status_type == BBSTATUS_XML)
+            octstr_format_append(os, "<%s><count>%lld</count><p50>%.3f</p50>"
+                "<p99>%.3f</p99><p999>%.3f</p999></%s>", latency_names[i], count,
+                values[0] / 1000.0, values[1] / 1000.0, values[2] / 1000.0,
+                latency_names[i]);
+        else if (status_type == BBSTATUS_JSON)
+            octstr_format_append(os, "%s\"%s\": {\"count\": %lld, \"p50\": %.3f, "
+                "\"p99\": %.3f, \"p999\": %.3f}", first ? "" : ", ", latency_names[i],
+                count, values[0] / 1000.0, values[1] / 1000.0, values[2] / 1000.0);
+        else if (count > 0)
+            octstr_format_append(os, "%s%s %.3f/%.3f/%.3f (%lld)", first ? "" : ", ",
+                latency_names[i], values[0] / 1000.0, values[1] / 1000.0,
+                values[2] / 1000.0, count);
+        else
+            continue;
+        first = 0;
+    }
+}
+
+
+Octstr *smsc2_latency_status(int status_type)
+{
+    Octstr *tmp;
+    SMSCConn *conn;
+    const Octstr *id;
+    char *lb, *para, *end;
+    long i;
+
+    if (status_type == BBSTATUS_JSON)
+        lb = "";
+    else if ((lb = bb_status_linebreak(status_type)) == NULL)
+        return octstr_create("Un-supported format");
+
+    if (!smsc_running)
+        return octstr_create("");
+
+    if (status_type == BBSTATUS_XML) {
+        tmp = octstr_create("\t<latency>\n\t\t");
+    } else if (status_type == BBSTATUS_JSON) {
+        tmp = octstr_create("{\"latency\": {");
+    } else {
+        para = (status_type == BBSTATUS_HTML ? " <p>" :
+                status_type == BBSTATUS_WML ? "   <p>" : "");
+        tmp = octstr_format("%sLatency (ms, p50/p99/p999): ", para);
+    }
+    latency_append(tmp, latency, status_type);
+    if (status_type == BBSTATUS_XML)
+        octstr_append_cstr(tmp, "\n");
+    else if (status_type == BBSTATUS_JSON)
+        octstr_append_cstr(tmp, ", \"smscs\": [");
+    else
+        octstr_append_cstr(tmp, lb);
+
+    gw_rwlock_rdlock(&smsc_list_lock);
+    for (i = 0; i < gwlist_len(smsc_list); i++) {
+        conn = gwlist_get(smsc_list, i);
+        id = smscconn_id(conn) ? smscconn_id(conn) : octstr_imm("unknown");
+        if (status_type == BBSTATUS_XML) {
+            octstr_format_append(tmp, "\t\t<smsc><id>%S</id>", id);
+            latency_append(tmp, conn->latency, status_type);
+            octstr_append_cstr(tmp, "</smsc>\n");
+        } else if (status_type == BBSTATUS_JSON) {
+            octstr_append_cstr(tmp, i ? ", {\"id\": " : "{\"id\": ");
+            json_append_string(tmp, id);
+            octstr_append_cstr(tmp, ", ");
+            latency_append(tmp, conn->latency, status_type);
+            octstr_append_cstr(tmp, "}");
+        } else {
+            octstr_format_append(tmp, "    %S: ", id);
+            latency_append(tmp, conn->latency, status_type);
+            octstr_append_cstr(tmp, lb);
+        }
+    }
+    gw_rwlock_unlock(&smsc_list_lock);
+
+    if (status_type == BBSTATUS_XML)
+        end = "\t</latency>\n";
+    else if (status_type == BBSTATUS_JSON)
+        end = "]}}\n";
+    else if (status_type == BBSTATUS_HTML || status_type == BBSTATUS_WML)
+        end = "</p>\n\n";
+    else
+        end = "\n";
+    octstr_append_cstr(tmp, end);
+
+    return tmp;
+}
+
+
 int smsc2_graceful_restart(void)
 {
     CfgGroup *grp;
@@ -1674,6 +1861,7 @@ int smsc2_graceful_restart(void)
     }
     gwlist_remove_producer(smsc_list);
     gwlist_destroy(add, NULL);
+    smsc2_rebuild_routes();
 
     gw_rwlock_unlock(&smsc_list_lock);
 
@@ -1707,6 +1895,8 @@ int smsc2_graceful_restart(void)
  * If cannot find nothing at all, returns SMSCCONN_FAILED_DISCARDED and
  * message is NOT destroyed (otherwise it is)
  */
+#define ROUT_STACK_WORDS 4
+
 long smsc2_rout(Msg *msg, int resend)
 {
     StatusInfo stat;
@@ -1714,6 +1904,10 @@ long smsc2_rout(Msg *msg, int resend)
     long bp_load, bo_load;
     int i, s, ret, bad_found, full_found;
     long max_queue, queue_length;
+    unsigned long usable_buf[ROUT_STACK_WORDS * 2];
+    unsigned long *usable = usable_buf, *preferred = usable_buf + ROUT_STACK_WORDS;
+    long words;
+    int count_queues;
     char *uf;
 
     /* XXX handle ack here? */
@@ -1721,10 +1915,11 @@ long smsc2_rout(Msg *msg, int resend)
         error(0, "Attempt to route non SMS message through smsc2_rout!");
         return SMSCCONN_FAILED_DISCARDED;
     }
+    msg_stamp(msg, MSG_STAGE_ROUTE);
 
     /* check if validity period has expired */
     if (msg->sms.validity != SMS_PARAM_UNDEFINED && time(NULL) > msg->sms.validity) {
-        bb_smscconn_send_failed(NULL, msg_duplicate(msg), SMSCCONN_FAILED_EXPIRED, octstr_create("validity expired"));
+        bb_smscconn_send_failed(NULL, msg_ref(msg), SMSCCONN_FAILED_EXPIRED, octstr_create("validity expired"));
         return SMSCCONN_FAILED_EXPIRED;
     }
 
@@ -1739,7 +1934,7 @@ long smsc2_rout(Msg *msg, int resend)
         gw_rwlock_unlock(&white_black_list_lock);
         info(0, "Number <%s> is not in white-list, message rejected",
              octstr_get_cstr(msg->sms.sender));
-        bb_smscconn_send_failed(NULL, msg_duplicate(msg), SMSCCONN_FAILED_REJECTED, octstr_create("sender not in white-list"));
+        bb_smscconn_send_failed(NULL, msg_ref(msg), SMSCCONN_FAILED_REJECTED, octstr_create("sender not in white-list"));
         return SMSCCONN_FAILED_REJECTED;
     }
 
@@ -1747,7 +1942,7 @@ long smsc2_rout(Msg *msg, int resend)
         gw_rwlock_unlock(&white_black_list_lock);
         info(0, "Number <%s> is not in white-list, message rejected",
              octstr_get_cstr(msg->sms.sender));
-        bb_smscconn_send_failed(NULL, msg_duplicate(msg), SMSCCONN_FAILED_REJECTED, octstr_create("sender not in white-list"));
+        bb_smscconn_send_failed(NULL, msg_ref(msg), SMSCCONN_FAILED_REJECTED, octstr_create("sender not in white-list"));
         return SMSCCONN_FAILED_REJECTED;
     }
 
@@ -1755,7 +1950,7 @@ long smsc2_rout(Msg *msg, int resend)
         gw_rwlock_unlock(&white_black_list_lock);
         info(0, "Number <%s> is in black-list, message rejected",
              octstr_get_cstr(msg->sms.sender));
-        bb_smscconn_send_failed(NULL, msg_duplicate(msg), SMSCCONN_FAILED_REJECTED, octstr_create("sender in black-list"));
+        bb_smscconn_send_failed(NULL, msg_ref(msg), SMSCCONN_FAILED_REJECTED, octstr_create("sender in black-list"));
         return SMSCCONN_FAILED_REJECTED;
     }
 
@@ -1763,7 +1958,7 @@ long smsc2_rout(Msg *msg, int resend)
         gw_rwlock_unlock(&white_black_list_lock);
         info(0, "Number <%s> is not in black-list, message rejected",
              octstr_get_cstr(msg->sms.sender));
-        bb_smscconn_send_failed(NULL, msg_duplicate(msg), SMSCCONN_FAILED_REJECTED, octstr_create("sender in black-list"));
+        bb_smscconn_send_failed(NULL, msg_ref(msg), SMSCCONN_FAILED_REJECTED, octstr_create("sender in black-list"));
         return SMSCCONN_FAILED_REJECTED;
     }
 
@@ -1771,7 +1966,7 @@ long smsc2_rout(Msg *msg, int resend)
         gw_rwlock_unlock(&white_black_list_lock);
         info(0, "Number <%s> is not in white-list-receiver, message rejected",
              octstr_get_cstr(msg->sms.receiver));
-        bb_smscconn_send_failed(NULL, msg_duplicate(msg), SMSCCONN_FAILED_REJECTED, octstr_create("receiver not in white-list"));
+        bb_smscconn_send_failed(NULL, msg_ref(msg), SMSCCONN_FAILED_REJECTED, octstr_create("receiver not in white-list"));
         return SMSCCONN_FAILED_REJECTED;
     }
 
@@ -1779,7 +1974,7 @@ long smsc2_rout(Msg *msg, int resend)
         gw_rwlock_unlock(&white_black_list_lock);
         info(0, "Number <%s> is not in white-list-receiver, message rejected",
              octstr_get_cstr(msg->sms.receiver));
-        bb_smscconn_send_failed(NULL, msg_duplicate(msg), SMSCCONN_FAILED_REJECTED, octstr_create("receiver not in white-list"));
+        bb_smscconn_send_failed(NULL, msg_ref(msg), SMSCCONN_FAILED_REJECTED, octstr_create("receiver not in white-list"));
         return SMSCCONN_FAILED_REJECTED;
     }
 
@@ -1787,7 +1982,7 @@ long smsc2_rout(Msg *msg, int resend)
         gw_rwlock_unlock(&white_black_list_lock);
         info(0, "Number <%s> is in black-list-receiver, message rejected",
              octstr_get_cstr(msg->sms.receiver));
-        bb_smscconn_send_failed(NULL, msg_duplicate(msg), SMSCCONN_FAILED_REJECTED, octstr_create("receiver in black-list"));
+        bb_smscconn_send_failed(NULL, msg_ref(msg), SMSCCONN_FAILED_REJECTED, octstr_create("receiver in black-list"));
         return SMSCCONN_FAILED_REJECTED;
     }
 
@@ -1795,7 +1990,7 @@ long smsc2_rout(Msg *msg, int resend)
         gw_rwlock_unlock(&white_black_list_lock);
         info(0, "Number <%s> is not in black-list-receiver, message rejected",
              octstr_get_cstr(msg->sms.receiver));
-        bb_smscconn_send_failed(NULL, msg_duplicate(msg), SMSCCONN_FAILED_REJECTED, octstr_create("receiver in black-list"));
+        bb_smscconn_send_failed(NULL, msg_ref(msg), SMSCCONN_FAILED_REJECTED, octstr_create("receiver in black-list"));
         return SMSCCONN_FAILED_REJECTED;
     }
     gw_rwlock_unlock(&white_black_list_lock);
@@ -1820,23 +2015,48 @@ long smsc2_rout(Msg *msg, int resend)
     	 * and 80% for new msgs. So we can guarantee that old msgs find
     	 * place in the SMSC's queue.
     	 */
-    	if (gwlist_len(outgoing_sms) > 0) {
+    	if (gw_queue_len(outgoing_sms) > 0) {
     		max_queue = (resend ? max_outgoing_sms_qlength :
     		max_outgoing_sms_qlength * 0.8);
     	} else
     		max_queue = max_outgoing_sms_qlength;
 
+    	words = smscconn_routes_words(smsc_routes);
+    	if (words > ROUT_STACK_WORDS) {
+    	    usable = gw_malloc(sizeof(usable[0]) * words * 2);
+    	    preferred = usable + words;
+    	}
+    	smscconn_routes_lookup(smsc_routes, msg, usable, preferred);
+
+    	/* the sum of all queues is only needed for the global limit */
+    	count_queues = (max_outgoing_sms_qlength > 0 && !resend);
+
     	s = gw_rand() % gwlist_len(smsc_list);
 
     	conn = NULL;
     	for (i = 0; i < gwlist_len(smsc_list); i++) {
-    		conn = gwlist_get(smsc_list,  (i+s) % gwlist_len(smsc_list));
+    		long idx = (i+s) % gwlist_len(smsc_list);
 
+    		if (!smscconn_route_isset(usable, idx)) {
+    			if (count_queues) {
+    				smscconn_info(gwlist_get(smsc_list, idx), &stat);
+    				queue_length += (stat.queued > 0 ? stat.queued : 0);
+    			}
+    			continue;
+    		}
+    		ret = smscconn_route_isset(preferred, idx);
+
+    		/* nothing to learn from it unless summing up the queues */
+    		if (ret != 1 && best_preferred && !count_queues)
+    			continue;
+
+    		conn = gwlist_get(smsc_list, idx);
     		smscconn_info(conn, &stat);
     		queue_length += (stat.queued > 0 ? stat.queued : 0);
 
-    		ret = smscconn_usable(conn,msg);
-    		if (ret == -1)
+    		/* dead transmitter or active receiver connections are not feasible */
+    		if (stat.status == SMSCCONN_DEAD || stat.status == SMSCCONN_ACTIVE_RECV ||
+    		    stat.killed != SMSCCONN_ALIVE)
     			continue;
 
     		/* if we already have a preferred one, skip non-preferred */
@@ -1865,7 +2085,9 @@ long smsc2_rout(Msg *msg, int resend)
     			bo_load = stat.load;
     		}
     	}
-    	queue_length += gwlist_len(outgoing_sms);
+    	if (usable != usable_buf)
+    	    gw_free(usable);
+    	queue_length += gw_queue_len(outgoing_sms);
     	if (max_outgoing_sms_qlength > 0 && !resend &&
     	    queue_length > gwlist_len(smsc_list) * max_outgoing_sms_qlength) {
     		gw_rwlock_unlock(&smsc_list_lock);
@@ -1885,8 +2107,8 @@ long smsc2_rout(Msg *msg, int resend)
         ret = smscconn_send(best_ok, msg);
     else if (bad_found) {
         gw_rwlock_unlock(&smsc_list_lock);
-        if (max_outgoing_sms_qlength < 0 || gwlist_len(outgoing_sms) < max_outgoing_sms_qlength) {
-            gwlist_produce(outgoing_sms, msg);
+        if (max_outgoing_sms_qlength < 0 || gw_queue_len(outgoing_sms) < max_outgoing_sms_qlength) {
+            gw_queue_produce(outgoing_sms, msg);
             return SMSCCONN_QUEUED;
         }
         debug("bb.sms", 0, "bad_found queue full");
@@ -1903,7 +2125,7 @@ long smsc2_rout(Msg *msg, int resend)
         }
         warning(0, "Cannot find SMSCConn for message to <%s>, rejected.",
                     octstr_get_cstr(msg->sms.receiver));
-        bb_smscconn_send_failed(NULL, msg_duplicate(msg), SMSCCONN_FAILED_DISCARDED, octstr_create("no SMSC"));
+        bb_smscconn_send_failed(NULL, msg_ref(msg), SMSCCONN_FAILED_DISCARDED, octstr_create("no SMSC"));
         return SMSCCONN_FAILED_DISCARDED;
     }
 
@@ -1989,10 +2211,36 @@ typedef struct ConcatMsg {
     /* array of parts */
     Msg **parts;
     Octstr *smsc_id; /* name of smsc conn where we received this msgs */
+    /* timer wheel linkage, see concat_wheel_*() below */
+    long expires;
+    struct ConcatMsg *next;
+    struct ConcatMsg **pprev;
 } ConcatMsg;
 
-static Dict *incoming_concat_msgs;
-static Mutex *concat_lock;
+/*
+ * Pending parts are spread over a fixed number of shards, selected by
+ * (smsc, sender, refnum), so that SMSC receive threads only contend when
+ * they happen to hit the same shard.  Each shard keeps its own Dict and a
+ * hierarchical timer wheel of CONCAT_WHEEL_LEVELS levels, CONCAT_WHEEL_SLOTS
+ * slots each, with one second resolution on the lowest level.  Expiring
+ * timed-out messages then only touches the slots that are due instead of
+ * walking every pending message.
+ */
+#define CONCAT_SHARDS 32
+#define CONCAT_WHEEL_BITS 6
+#define CONCAT_WHEEL_SLOTS (1 << CONCAT_WHEEL_BITS)
+#define CONCAT_WHEEL_MASK (CONCAT_WHEEL_SLOTS - 1)
+#define CONCAT_WHEEL_LEVELS 3
+#define CONCAT_WHEEL_SPAN (1L << (CONCAT_WHEEL_BITS * CONCAT_WHEEL_LEVELS))
+
+typedef struct ConcatShard {
+    Mutex *lock;
+    Dict *msgs;
+    long wheel_time; /* next second to be expired */
+    ConcatMsg *wheel[CONCAT_WHEEL_LEVELS][CONCAT_WHEEL_SLOTS];
+} ConcatShard;
+
+static ConcatShard *concat_shards;
 
 static void destroy_concatMsg(void *x)
 {
@@ -2013,13 +2261,118 @@ static void destroy_concatMsg(void *x)
     gw_free(msg);
 }
 
+static ConcatShard *concat_shard(Octstr *smscid, Octstr *sender, int refnum)
+{
+    unsigned long h;
+
+    h = octstr_hash_key(smscid) * 31 + octstr_hash_key(sender);
+    h = h * 31 + refnum;
+    return &concat_shards[h % CONCAT_SHARDS];
+}
+
+/* Following concat_wheel_* functions must be called with shard lock held. */
+
+static void concat_wheel_insert(ConcatShard *shard, ConcatMsg *x)
+{
+    long delta, when = x->expires;
+    ConcatMsg **slot;
+    int level;
+
+    if (when < shard->wheel_time)
+        when = shard->wheel_time;
+    delta = when - shard->wheel_time;
+    if (delta >= CONCAT_WHEEL_SPAN) {
+        /* out of range, park it at the far end and re-check on cascade */
+        when = shard->wheel_time + CONCAT_WHEEL_SPAN - 1;
+        delta = CONCAT_WHEEL_SPAN - 1;
+    }
+    for (level = 0; level < CONCAT_WHEEL_LEVELS - 1; level++)
+        if (delta < (1L << (CONCAT_WHEEL_BITS * (level + 1))))
+            break;
+    slot = &shard->wheel[level][(when >> (CONCAT_WHEEL_BITS * level)) & CONCAT_WHEEL_MASK];
+
+    x->next = *slot;
+    if (x->next != NULL)
+        x->next->pprev = &x->next;
+    x->pprev = slot;
+    *slot = x;
+}
+
+static void concat_wheel_remove(ConcatMsg *x)
+{
+    if (x->pprev == NULL)
+        return;
+    *x->pprev = x->next;
+    if (x->next != NULL)
+        x->next->pprev = x->pprev;
+    x->next = NULL;
+    x->pprev = NULL;
+}
+
+/* Re-insert all entries of a higher level slot, they'll move down. */
+static void concat_wheel_cascade(ConcatShard *shard, int level)
+{
+    ConcatMsg *x, *next;
+    long idx;
+
+    idx = (shard->wheel_time >> (CONCAT_WHEEL_BITS * level)) & CONCAT_WHEEL_MASK;
+    x = shard->wheel[level][idx];
+    shard->wheel[level][idx] = NULL;
+    for (; x != NULL; x = next) {
+        next = x->next;
+        x->pprev = NULL;
+        concat_wheel_insert(shard, x);
+    }
+}
+
+/* Advance wheel to now and move expired entries from dict to given list. */
+static void concat_wheel_expire(ConcatShard *shard, long now, List *expired)
+{
+    ConcatMsg *x, *next;
+    long idx;
+    int level;
+
+    while (shard->wheel_time <= now) {
+        idx = shard->wheel_time & CONCAT_WHEEL_MASK;
+        for (level = 1; idx == 0 && level < CONCAT_WHEEL_LEVELS; level++) {
+            concat_wheel_cascade(shard, level);
+            idx = (shard->wheel_time >> (CONCAT_WHEEL_BITS * level)) & CONCAT_WHEEL_MASK;
+        }
+        idx = shard->wheel_time & CONCAT_WHEEL_MASK;
+        x = shard->wheel[0][idx];
+        shard->wheel[0][idx] = NULL;
+        for (; x != NULL; x = next) {
+            next = x->next;
+            x->next = NULL;
+            x->pprev = NULL;
+            if (x->expires > shard->wheel_time) {
+                concat_wheel_insert(shard, x);
+                continue;
+            }
+            dict_remove(shard->msgs, x->key);
+            gwlist_append(expired, x);
+        }
+        shard->wheel_time++;
+    }
+}
+
 static void concat_handling_init(void)
 {
-    if (incoming_concat_msgs != NULL) /* already initialised? */
+    long i, size;
+
+    if (concat_shards != NULL) /* already initialised? */
         return;
-    incoming_concat_msgs = dict_create(max_incoming_sms_qlength > 0 ? max_incoming_sms_qlength : 1024, 
-                                       destroy_concatMsg);
-    concat_lock = mutex_create();
+    size = (max_incoming_sms_qlength > 0 ? max_incoming_sms_qlength : 1024) / CONCAT_SHARDS;
+    if (size < 64)
+        size = 64;
+    concat_shards = gw_malloc(CONCAT_SHARDS * sizeof(*concat_shards));
+    memset(concat_shards, 0, CONCAT_SHARDS * sizeof(*concat_shards));
+    for (i = 0; i < CONCAT_SHARDS; i++) {
+        concat_shards[i].lock = mutex_create();
+        /* dict does not own the values, they live in the timer wheel too */
+        concat_shards[i].msgs = dict_create(size, NULL);
+        concat_shards[i].wheel_time = time(NULL);
+    }
     debug("bb.sms",0,"MO concatenated message handling enabled");
 }
 
@@ -2038,112 +2391,146 @@ static void concat_handling_shutdown(void)
 
 static void concat_handling_cleanup(void)
 {
-    if (incoming_concat_msgs == NULL)
+    List *keys;
+    Octstr *key;
+    ConcatMsg *x;
+    long i;
+
+    if (concat_shards == NULL)
         return;
-    dict_destroy(incoming_concat_msgs);
-    mutex_destroy(concat_lock);
+    for (i = 0; i < CONCAT_SHARDS; i++) {
+        keys = dict_keys(concat_shards[i].msgs);
+        while ((key = gwlist_extract_first(keys)) != NULL) {
+            x = dict_remove(concat_shards[i].msgs, key);
+            if (x != NULL)
+                destroy_concatMsg(x);
+            octstr_destroy(key);
+        }
+        gwlist_destroy(keys, NULL);
+        dict_destroy(concat_shards[i].msgs);
+        mutex_destroy(concat_shards[i].lock);
+    }
+    gw_free(concat_shards);
 
-    incoming_concat_msgs = NULL;
-    concat_lock = NULL;
+    concat_shards = NULL;
     debug("bb.sms",0,"MO concatenated message handling cleaned up");
 }
 
+/* Put back a timed-out message we could not deliver. Shard lock must be held. */
+static void concat_handling_requeue(ConcatShard *shard, ConcatMsg *x)
+{
+    ConcatMsg *x1;
+    int i;
+
+    /* retry on the same cadence as other temporary failures */
+    x->expires = time(NULL) + (sms_resend_frequency > 0 ? sms_resend_frequency : 1);
+    x1 = dict_get(shard->msgs, x->key);
+    if (x1 != NULL) { /* oops we have new part */
+        if (x->total_parts != x1->total_parts) {
+            /* broken handset, don't know what todo here??
+             * for now just put old concatMsg into dict with
+             * another key and it will be cleaned up on next run.
+             */
+            octstr_format_append(x->key, " %d", x->total_parts);
+            dict_put(shard->msgs, x->key, x);
+            concat_wheel_insert(shard, x);
+        } else {
+            for (i = 0; i < x->total_parts; i++) {
+                if (x->parts[i] == NULL)
+                    continue;
+                if (x1->parts[i] == NULL) {
+                    x1->parts[i] = x->parts[i];
+                    x->parts[i] = NULL;
+                }
+            }
+            destroy_concatMsg(x);
+        }
+    } else {
+        dict_put(shard->msgs, x->key, x);
+        concat_wheel_insert(shard, x);
+    }
+}
+
 static void concat_handling_clear_old_parts(int force)
 {
-    List *keys;
-    Octstr *key;
+    List *expired;
+    ConcatShard *shard;
+    long i, now;
 
     /* not initialized, go away */
-    if (incoming_concat_msgs == NULL)
+    if (concat_shards == NULL)
         return;
 
-    debug("bb.sms.splits", 0, "clear_old_concat_parts called");
-
-    /* Remove any pending messages that are too old. */
-    keys = dict_keys(incoming_concat_msgs);
-    while((key = gwlist_extract_first(keys)) != NULL) {
+    now = time(NULL);
+    for (i = 0; i < CONCAT_SHARDS; i++) {
         ConcatMsg *x;
         Msg *msg;
         SMSCConn *conn;
-        int i, destroy = 1, smsc_index;
-
-        mutex_lock(concat_lock);
-        x = dict_get(incoming_concat_msgs, key);
-        octstr_destroy(key);
-        if (x == NULL || (!force && difftime(time(NULL), x->trecv) < concatenated_mo_timeout)) {
-            mutex_unlock(concat_lock);
-            continue;
-        }
-        dict_remove(incoming_concat_msgs, x->key);
-        mutex_unlock(concat_lock);
-
-        /* try to find SMSCConn */
-        gw_rwlock_rdlock(&smsc_list_lock);
-        /**
-         * TODO handle cases where we goes down and have to clean concat parts for rerouting
-         */
-        smsc_index = smsc2_find(x->smsc_id, 0);
-        if (smsc_index != -1) {
-            conn = gwlist_get(smsc_list, smsc_index);
-            warning(0, "Time-out waiting for concatenated message '%s'. Send message parts as is.",
-                    octstr_get_cstr(x->key));
-            for (i = 0; i < x->total_parts && destroy == 1; i++) {
-                if (x->parts[i] == NULL)
-                    continue;
-                msg = msg_duplicate(x->parts[i]);
-                switch(bb_smscconn_receive_internal(conn, msg)) {
-                case SMSCCONN_FAILED_REJECTED:
-                case SMSCCONN_QUEUED:
-                case SMSCCONN_SUCCESS:
-                    msg_destroy(x->parts[i]);
-                    x->parts[i] = NULL;
-                    x->num_parts--;
-                    break;
-                case SMSCCONN_FAILED_TEMPORARILY:
-                case SMSCCONN_FAILED_QFULL:
-                default:
-                    /* oops put it back into dict and retry on next run */
-                    store_save(x->parts[i]);
-                    destroy = 0;
-                    break;
-                }
+        int j, destroy, smsc_index;
+
+        shard = &concat_shards[i];
+        expired = gwlist_create();
+        mutex_lock(shard->lock);
+        if (force) {
+            List *keys = dict_keys(shard->msgs);
+            Octstr *key;
+            while ((key = gwlist_extract_first(keys)) != NULL) {
+                x = dict_remove(shard->msgs, key);
+                concat_wheel_remove(x);
+                gwlist_append(expired, x);
+                octstr_destroy(key);
             }
-        }
-        gw_rwlock_unlock(&smsc_list_lock);
-
-        if (destroy) {
-            destroy_concatMsg(x);
-        } else {
-            ConcatMsg *x1;
-            mutex_lock(concat_lock);
-            x1 = dict_get(incoming_concat_msgs, x->key);
-            if (x1 != NULL) { /* oops we have new part */
-                int i;
-                if (x->total_parts != x1->total_parts) {
-                    /* broken handset, don't know what todo here??
-                     * for now just put old concatMsg into dict with
-                     * another key and it will be cleaned up on next run.
-                     */
-                    octstr_format_append(x->key, " %d", x->total_parts);
-                    dict_put(incoming_concat_msgs, x->key, x);
-                } else {
-                    for (i = 0; i < x->total_parts; i++) {
-                        if (x->parts[i] == NULL)
-                            continue;
-                        if (x1->parts[i] == NULL) {
-                            x1->parts[i] = x->parts[i];
-                            x->parts[i] = NULL;
-                        }
+            gwlist_destroy(keys, NULL);
+        } else
+            concat_wheel_expire(shard, now, expired);
+        mutex_unlock(shard->lock);
+
+        while ((x = gwlist_extract_first(expired)) != NULL) {
+            destroy = 1;
+            /* try to find SMSCConn */
+            gw_rwlock_rdlock(&smsc_list_lock);
+            /**
+             * TODO handle cases where we goes down and have to clean concat parts for rerouting
+             */
+            smsc_index = smsc2_find(x->smsc_id, 0);
+            if (smsc_index != -1) {
+                conn = gwlist_get(smsc_list, smsc_index);
+                warning(0, "Time-out waiting for concatenated message '%s'. Send message parts as is.",
+                        octstr_get_cstr(x->key));
+                for (j = 0; j < x->total_parts && destroy == 1; j++) {
+                    if (x->parts[j] == NULL)
+                        continue;
+                    msg = msg_duplicate(x->parts[j]);
+                    switch(bb_smscconn_receive_internal(conn, msg)) {
+                    case SMSCCONN_FAILED_REJECTED:
+                    case SMSCCONN_QUEUED:
+                    case SMSCCONN_SUCCESS:
+                        msg_destroy(x->parts[j]);
+                        x->parts[j] = NULL;
+                        x->num_parts--;
+                        break;
+                    case SMSCCONN_FAILED_TEMPORARILY:
+                    case SMSCCONN_FAILED_QFULL:
+                    default:
+                        /* oops put it back into dict and retry later */
+                        store_save(x->parts[j]);
+                        destroy = 0;
+                        break;
                     }
-                    destroy_concatMsg(x);
                 }
+            }
+            gw_rwlock_unlock(&smsc_list_lock);
+
+            if (destroy) {
+                destroy_concatMsg(x);
             } else {
-                dict_put(incoming_concat_msgs, x->key, x);
+                mutex_lock(shard->lock);
+                concat_handling_requeue(shard, x);
+                mutex_unlock(shard->lock);
             }
-            mutex_unlock(concat_lock);
         }
+        gwlist_destroy(expired, NULL);
     }
-    gwlist_destroy(keys, octstr_destroy_item);
 }
 
 /* Checks if message is concatenated. Returns:
@@ -2157,13 +2544,14 @@ static int concat_handling_check_and_handle(Msg **pmsg, Octstr *smscid)
     int l, iel = 0, refnum, pos, c, part, totalparts, i, sixteenbit;
     Octstr *udh = msg->sms.udhdata, *key;
     ConcatMsg *cmsg;
+    ConcatShard *shard;
     int ret = concat_complete;
 
     if (!handle_concatenated_mo)
         return concat_none;
 
     /* ... module not initialised or there is no UDH or smscid is NULL. */
-    if (incoming_concat_msgs == NULL || (l = octstr_len(udh)) == 0 || smscid == NULL)
+    if (concat_shards == NULL || (l = octstr_len(udh)) == 0 || smscid == NULL)
         return concat_none;
 
     for (pos = 1, c = -1; pos < l - 1; pos += iel + 2) {
@@ -2201,8 +2589,9 @@ static int concat_handling_check_and_handle(Msg **pmsg, Octstr *smscid)
     msg_dump(msg, 0);
      
     key = octstr_format("'%S' '%S' '%S' '%d' '%d' '%H'", msg->sms.sender, msg->sms.receiver, smscid, refnum, totalparts, udh);
-    mutex_lock(concat_lock);
-    if ((cmsg = dict_get(incoming_concat_msgs, key)) == NULL) {
+    shard = concat_shard(smscid, msg->sms.sender, refnum);
+    mutex_lock(shard->lock);
+    if ((cmsg = dict_get(shard->msgs, key)) == NULL) {
         cmsg = gw_malloc(sizeof(*cmsg));
         cmsg->refnum = refnum;
         cmsg->total_parts = totalparts;
@@ -2214,8 +2603,10 @@ static int concat_handling_check_and_handle(Msg **pmsg, Octstr *smscid)
         cmsg->smsc_id = octstr_duplicate(smscid);
         cmsg->parts = gw_malloc(totalparts * sizeof(*cmsg->parts));
         memset(cmsg->parts, 0, cmsg->total_parts * sizeof(*cmsg->parts)); /* clear it. */
+        cmsg->next = NULL;
+        cmsg->pprev = NULL;
 
-        dict_put(incoming_concat_msgs, key, cmsg);
+        dict_put(shard->msgs, key, cmsg);
     }
     octstr_destroy(key);
     octstr_destroy(udh);
@@ -2227,18 +2618,21 @@ static int concat_handling_check_and_handle(Msg **pmsg, Octstr *smscid)
         store_save_ack(msg, ack_success);
         msg_destroy(msg); 
         *pmsg = msg = NULL;
-        mutex_unlock(concat_lock);
+        mutex_unlock(shard->lock);
         return concat_pending;
     } else {
         cmsg->parts[part -1] = msg;
         cmsg->num_parts++;
         /* always update receive time so we have it from last part and don't timeout */
         cmsg->trecv = time(NULL);
+        concat_wheel_remove(cmsg);
+        cmsg->expires = cmsg->trecv + concatenated_mo_timeout;
+        concat_wheel_insert(shard, cmsg);
     }
 
     if (cmsg->num_parts < cmsg->total_parts) {  /* wait for more parts. */
         *pmsg = msg = NULL;
-        mutex_unlock(concat_lock);
+        mutex_unlock(shard->lock);
         return concat_pending;
     }
 
@@ -2254,7 +2648,7 @@ static int concat_handling_check_and_handle(Msg **pmsg, Octstr *smscid)
 
     /* Attempt to save the new one, if that fails, then reply with fail. */
     if (store_save(msg) == -1) {	  
-        mutex_unlock(concat_lock);
+        mutex_unlock(shard->lock);
         msg_destroy(msg);
         *pmsg = msg = NULL;
         return concat_error;
@@ -2266,10 +2660,11 @@ static int concat_handling_check_and_handle(Msg **pmsg, Octstr *smscid)
     msg->sms.udhdata = cmsg->udh;
     cmsg->udh = NULL;
 
-    /* Delete it from the queue and from the Dict. */
-    /* Note: dict_put with NULL value delete and destroy value */
-    dict_put(incoming_concat_msgs, cmsg->key, NULL);
-    mutex_unlock(concat_lock);
+    /* Delete it from the timer wheel and from the Dict. */
+    concat_wheel_remove(cmsg);
+    dict_remove(shard->msgs, cmsg->key);
+    mutex_unlock(shard->lock);
+    destroy_concatMsg(cmsg);
 
     debug("bb.sms.splits", 0, "Got full message [ref %d] of message from %s to %s. Dumping: ",
           refnum, octstr_get_cstr(msg->sms.sender), octstr_get_cstr(msg->sms.receiver));
@@ -304,7 +304,7 @@ static int store_to_dict(Msg *msg)
         time(&msg->sms.time);
 
     if (msg_type(msg) == sms) {
-        copy = msg_duplicate(msg);
+        copy = msg_share(msg);
         
         uuid_unparse(copy->sms.id, id);
         uuid_os = octstr_create(id);
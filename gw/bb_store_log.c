@@ -0,0 +1,948 @@
+/* ====================================================================
+ * The Kannel Software License, Version 1.0
+ *
+ * Copyright (c) 2001-2016 Kannel Group
+ * Copyright (c) 1998-2001 WapIT Ltd.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * 3. The end-user documentation included with the redistribution,
+ *    if any, must include the following acknowledgment:
+ *       "This product includes software developed by the
+ *        Kannel Group (http://www.kannel.org/)."
+ *    Alternately, this acknowledgment may appear in the software itself,
+ *    if and wherever such third-party acknowledgments normally appear.
+ *
+ * 4. The names "Kannel" and "Kannel Group" must not be used to
+ *    endorse or promote products derived from this software without
+ *    prior written permission. For written permission, please
+ *    contact org@kannel.org.
+ *
+ * 5. Products derived from this software may not be called "Kannel",
+ *    nor may "Kannel" appear in their name, without prior written
+ *    permission of the Kannel Group.
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESSED OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED.  IN NO EVENT SHALL THE KANNEL GROUP OR ITS CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * ====================================================================
+ *
+ * This software consists of voluntary contributions made by many
+ * individuals on behalf of the Kannel Group.  For more information on
+ * the Kannel Group, please see <http://www.kannel.org/>.
+ *
+ * Portions of this software are based upon software originally written at
+ * WapIT Ltd., Helsinki, Finland for the Kannel project.
+ */
+
+/**
+ * bb_store_log.c - bearerbox box SMS storage/retrieval module using an
+ *                  append-only segmented log
+ *
+ * Messages and acks are appended to numbered segment files inside the
+ * store-location directory. Concurrent saves are group committed: every
+ * caller appends its record to a pending batch and the first caller that
+ * gets the write lock writes out all batches pending at that time with
+ * one write() per segment, so callers waiting behind it find their record
+ * already written. Each record carries a pointer to its caller's status,
+ * which the writer sets to -1 if the write or fsync fails. Once a segment is no longer the head segment, a
+ * background thread rewrites its remaining non-acknowledged messages into
+ * the head segment and unlinks it. Segments are always removed oldest
+ * first, hence an ack record is never dropped before the message it
+ * refers to. On load the segments are read and unpacked in parallel and
+ * replayed in order.
+ */
+
+#include "gw-config.h"
+
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <errno.h>
+
+#include "gwlib/gwlib.h"
+#include "msg.h"
+#include "sms.h"
+#include "bearerbox.h"
+#include "bb_store.h"
+
+
+/* default size after which a new segment is started */
+#define STORE_LOG_DEFAULT_SEGMENT_SIZE (64 * 1024 * 1024)
+/* maximum number of threads unpacking segments on load */
+#define STORE_LOG_LOAD_THREADS 4
+
+enum {
+    STORE_LOG_FSYNC_NEVER,
+    STORE_LOG_FSYNC_BATCH,
+    STORE_LOG_FSYNC_INTERVAL
+};
+
+typedef struct {
+    long id;
+    long records;   /* sms records assigned to this segment */
+    long live;      /* of those, not yet acknowledged */
+    long bytes;
+} Segment;
+
+typedef struct {
+    Msg *msg;
+    Segment *segment;
+} Entry;
+
+typedef struct {
+    long segment;
+    Octstr *data;
+    List *status;   /* int * of each caller waiting for this batch */
+} Batch;
+
+static Octstr *store_dir = NULL;
+static long segment_size;
+static int fsync_policy;
+static long dump_frequency;
+
+/* protects sms_dict, segments, pending and appended_seq */
+static Mutex *store_mutex = NULL;
+static Dict *sms_dict = NULL;
+static List *segments = NULL;
+static List *pending = NULL;
+static unsigned long appended_seq;
+
+/* protects fd, fd_segment and written_seq */
+static Mutex *write_mutex = NULL;
+static int fd = -1;
+static long fd_segment = -1;
+static unsigned long written_seq;
+
+static int active;
+/* set once a rewrite failed, the segments are kept until a restart */
+static int compact_failed;
+static long compactor_thread = -1;
+static List *loaded;
+
+
+static Octstr *segment_name(long id)
+{
+    return octstr_format("%S/store-%010ld.log", store_dir, id);
+}
+
+
+static Segment *segment_create(long id)
+{
+    Segment *seg = gw_malloc(sizeof(*seg));
+
+    seg->id = id;
+    seg->records = seg->live = seg->bytes = 0;
+    return seg;
+}
+
+
+static void entry_destroy(void *p)
+{
+    Entry *entry = p;
+
+    if (entry == NULL)
+        return;
+    msg_destroy(entry->msg);
+    gw_free(entry);
+}
+
+
+/* for segment ids and Segments, both are plain allocations */
+static void free_item(void *p)
+{
+    gw_free(p);
+}
+
+
+static void batch_destroy(void *p)
+{
+    Batch *batch = p;
+
+    octstr_destroy(batch->data);
+    gwlist_destroy(batch->status, NULL);
+    gw_free(batch);
+}
+
+
+/* tell the callers of all records in batches that they were not stored */
+static void batches_failed(List *batches)
+{
+    Batch *batch;
+    int *status;
+    long i, j;
+
+    for (i = 0; i < gwlist_len(batches); i++) {
+        batch = gwlist_get(batches, i);
+        for (j = 0; j < gwlist_len(batch->status); j++) {
+            status = gwlist_get(batch->status, j);
+            *status = -1;
+        }
+    }
+}
+
+
+static Octstr *msg_key(Msg *msg)
+{
+    char id[UUID_STR_LEN + 1];
+
+    uuid_unparse(msg_type(msg) == sms ? msg->sms.id : msg->ack.id, id);
+    return octstr_create(id);
+}
+
+
+/*
+ * Pack msg as length prefixed record and add it to the pending batch of
+ * the head segment, starting a new segment if the head one is full.
+ * *status is set to -1 if the record can't be written, it must stay valid
+ * until commit() of the returned sequence number has returned.
+ * Caller holds store_mutex. Returns the sequence number to commit.
+ */
+static unsigned long append_record(Msg *msg, Segment **seg_out, int *status)
+{
+    Octstr *pack;
+    unsigned char buf[4];
+    Segment *head;
+    Batch *batch;
+
+    pack = store_msg_pack(msg);
+    encode_network_long(buf, octstr_len(pack));
+    octstr_insert_data(pack, 0, (char*) buf, 4);
+
+    head = gwlist_get(segments, gwlist_len(segments) - 1);
+    if (head->bytes > 0 && head->bytes + octstr_len(pack) > segment_size) {
+        head = segment_create(head->id + 1);
+        gwlist_append(segments, head);
+    }
+    head->bytes += octstr_len(pack);
+
+    batch = gwlist_len(pending) > 0 ? gwlist_get(pending, gwlist_len(pending) - 1) : NULL;
+    if (batch == NULL || batch->segment != head->id) {
+        batch = gw_malloc(sizeof(*batch));
+        batch->segment = head->id;
+        batch->data = octstr_create("");
+        batch->status = gwlist_create();
+        gwlist_append(pending, batch);
+    }
+    octstr_append(batch->data, pack);
+    gwlist_append(batch->status, status);
+    octstr_destroy(pack);
+
+    if (seg_out != NULL)
+        *seg_out = head;
+
+    return ++appended_seq;
+}
+
+
+/*
+ * Write batch to its segment. written are the batches written before in
+ * the same commit, they fail as well if the segment they went to can't
+ * be synced when it is closed.
+ */
+static int write_batch(Batch *batch, List *written)
+{
+    long pos, len;
+    Octstr *name;
+
+    if (fd_segment != batch->segment) {
+        if (fd != -1) {
+            if (fsync_policy != STORE_LOG_FSYNC_NEVER && fsync(fd) == -1) {
+                error(errno, "Could not fsync store segment %ld.", fd_segment);
+                /* with batch syncing callers are only told after it */
+                if (fsync_policy == STORE_LOG_FSYNC_BATCH)
+                    batches_failed(written);
+            }
+            close(fd);
+        }
+        name = segment_name(batch->segment);
+        fd = open(octstr_get_cstr(name), O_WRONLY|O_CREAT|O_APPEND, S_IRUSR|S_IWUSR);
+        if (fd == -1) {
+            error(errno, "Could not open store segment `%s'.", octstr_get_cstr(name));
+            octstr_destroy(name);
+            fd_segment = -1;
+            return -1;
+        }
+        octstr_destroy(name);
+        fd_segment = batch->segment;
+    }
+
+    len = octstr_len(batch->data);
+    for (pos = 0; pos < len; ) {
+        ssize_t rc = write(fd, octstr_get_cstr(batch->data) + pos, len - pos);
+        if (rc == -1) {
+            if (errno == EINTR)
+                continue;
+            error(errno, "Could not write to store segment %ld.", batch->segment);
+            return -1;
+        }
+        pos += rc;
+    }
+
+    return 0;
+}
+
+
+/*
+ * Make sure everything up to seq is written. Whoever holds write_mutex
+ * writes all pending batches, so concurrent callers are committed as
+ * one group. Failures are reported through the status of each record,
+ * the return value only tells whether this call wrote everything.
+ */
+static int commit(unsigned long seq)
+{
+    List *batches, *written;
+    Batch *batch;
+    unsigned long upto;
+    int ret = 0;
+
+    mutex_lock(write_mutex);
+    if (written_seq < seq) {
+        mutex_lock(store_mutex);
+        batches = pending;
+        pending = gwlist_create();
+        upto = appended_seq;
+        mutex_unlock(store_mutex);
+
+        written = gwlist_create();
+        while ((batch = gwlist_extract_first(batches)) != NULL) {
+            if (write_batch(batch, written) == -1) {
+                /* the rest would follow a torn record, fail it as well */
+                gwlist_insert(batches, 0, batch);
+                batches_failed(batches);
+                ret = -1;
+                break;
+            }
+            gwlist_append(written, batch);
+        }
+        gwlist_destroy(batches, batch_destroy);
+
+        if (fsync_policy == STORE_LOG_FSYNC_BATCH && fd != -1 && fsync(fd) == -1) {
+            error(errno, "Could not fsync store segment %ld.", fd_segment);
+            batches_failed(written);
+            ret = -1;
+        }
+        gwlist_destroy(written, batch_destroy);
+        /* the callers of failed records know from their status */
+        written_seq = upto;
+    }
+    mutex_unlock(write_mutex);
+
+    return ret;
+}
+
+
+static int commit_all(void)
+{
+    unsigned long seq;
+
+    mutex_lock(store_mutex);
+    seq = appended_seq;
+    mutex_unlock(store_mutex);
+
+    return commit(seq);
+}
+
+
+/*
+ * Apply msg to the index as if it had been recorded in seg.
+ * Caller holds store_mutex (or is the only thread running).
+ */
+static void index_msg(Msg *msg, Segment *seg, int warn)
+{
+    Octstr *key = msg_key(msg);
+    Entry *entry;
+
+    entry = dict_remove(sms_dict, key);
+    if (msg_type(msg) == sms) {
+        if (entry != NULL) {
+            entry->segment->live--;
+            msg_destroy(entry->msg);
+        } else
+            entry = gw_malloc(sizeof(*entry));
+        entry->msg = msg;
+        entry->segment = seg;
+        seg->records++;
+        seg->live++;
+        dict_put(sms_dict, key, entry);
+    } else {
+        if (entry == NULL) {
+            if (warn)
+                warning(0, "bb_store: get ACK of message not found "
+                        "from store, strange?");
+        } else {
+            entry->segment->live--;
+            entry_destroy(entry);
+        }
+        msg_destroy(msg);
+    }
+    octstr_destroy(key);
+}
+
+
+struct collect {
+    Segment *segment;
+    List *keys;
+};
+
+static void collect_cb(Octstr *key, void *value, void *data)
+{
+    struct collect *c = data;
+    Entry *entry = value;
+
+    if (entry->segment == c->segment)
+        gwlist_append(c->keys, octstr_duplicate(key));
+}
+
+
+/*
+ * Rewrite still pending messages of the oldest segments into the head
+ * segment and remove them.
+ */
+static void compact(void)
+{
+    Segment *oldest, *seg;
+    struct collect c;
+    Octstr *key, *name;
+    Entry *entry;
+    long i, records;
+    int status;
+
+    for (;;) {
+        mutex_lock(store_mutex);
+        if (compact_failed || gwlist_len(segments) < 2) {
+            mutex_unlock(store_mutex);
+            break;
+        }
+        oldest = gwlist_get(segments, 0);
+        /*
+         * Wait with mostly pending segments, they are going to get acked,
+         * unless the log as a whole is more than half dead already.
+         */
+        if (oldest->live > 0 && oldest->live * 2 > oldest->records) {
+            for (i = records = 0; i < gwlist_len(segments); i++)
+                records += ((Segment*) gwlist_get(segments, i))->records;
+            if (dict_key_count(sms_dict) * 2 > records) {
+                mutex_unlock(store_mutex);
+                break;
+            }
+        }
+        mutex_unlock(store_mutex);
+
+        status = 0;
+        if (oldest->live > 0) {
+            c.segment = oldest;
+            c.keys = gwlist_create();
+            dict_traverse(sms_dict, collect_cb, &c);
+            while ((key = gwlist_extract_first(c.keys)) != NULL) {
+                mutex_lock(store_mutex);
+                entry = dict_get(sms_dict, key);
+                if (entry != NULL && entry->segment == oldest) {
+                    append_record(entry->msg, &seg, &status);
+                    oldest->live--;
+                    entry->segment = seg;
+                    seg->records++;
+                    seg->live++;
+                }
+                mutex_unlock(store_mutex);
+                octstr_destroy(key);
+            }
+            gwlist_destroy(c.keys, NULL);
+        }
+
+        /*
+         * Rewritten records have to be on disk before the segment goes.
+         * If they are not, the index already points to the new segment,
+         * so keep all segments, they are replayed on the next start.
+         */
+        if (commit_all() == -1 || status == -1) {
+            error(0, "Could not rewrite store segment %ld, compacting stopped.",
+                  oldest->id);
+            compact_failed = 1;
+            break;
+        }
+
+        mutex_lock(store_mutex);
+        gw_assert(oldest->live == 0);
+        gwlist_delete(segments, 0, 1);
+        mutex_unlock(store_mutex);
+
+        name = segment_name(oldest->id);
+        debug("bb.store", 0, "Removing store segment `%s', %ld records.",
+              octstr_get_cstr(name), oldest->records);
+        if (unlink(octstr_get_cstr(name)) == -1 && errno != ENOENT)
+            error(errno, "Could not unlink store segment `%s'.", octstr_get_cstr(name));
+        octstr_destroy(name);
+        gw_free(oldest);
+    }
+}
+
+
+static void store_compactor(void *arg)
+{
+    while (active) {
+        gwthread_sleep(dump_frequency);
+        compact();
+        if (fsync_policy == STORE_LOG_FSYNC_INTERVAL) {
+            mutex_lock(write_mutex);
+            if (fd != -1 && fsync(fd) == -1)
+                error(errno, "Could not fsync store segment %ld.", fd_segment);
+            mutex_unlock(write_mutex);
+        }
+    }
+}
+
+
+/*------------------------------------------------------*/
+
+static long store_log_messages(void)
+{
+    return (sms_dict ? dict_key_count(sms_dict) : -1);
+}
+
+
+static int store_log_save(Msg *msg)
+{
+    Octstr *key;
+    Entry *entry;
+    Segment *seg;
+    unsigned long seq;
+    int status = 0;
+
+    /* always set msg id and timestamp */
+    if (msg_type(msg) == sms && uuid_is_null(msg->sms.id))
+        uuid_generate(msg->sms.id);
+
+    if (msg_type(msg) == sms && msg->sms.time == MSG_PARAM_UNDEFINED)
+        time(&msg->sms.time);
+
+    if (store_dir == NULL)
+        return 0;
+
+    if (msg_type(msg) != sms && msg_type(msg) != ack)
+        return -1;
+
+    /* block here until store not loaded */
+    gwlist_consume(loaded);
+
+    mutex_lock(store_mutex);
+    if (msg_type(msg) == sms) {
+        seq = append_record(msg, &seg, &status);
+        index_msg(msg_share(msg), seg, 0);
+    } else {
+        key = msg_key(msg);
+        entry = dict_get(sms_dict, key);
+        octstr_destroy(key);
+        if (entry == NULL) {
+            mutex_unlock(store_mutex);
+            warning(0, "bb_store: get ACK of message not found "
+                    "from store, strange?");
+            return 0;
+        }
+        seq = append_record(msg, NULL, &status);
+        index_msg(msg_ref(msg), NULL, 0);
+    }
+    mutex_unlock(store_mutex);
+
+    commit(seq);
+    if (status == -1 && msg_type(msg) == sms) {
+        /* not stored, so it must not be written out by a compaction */
+        mutex_lock(store_mutex);
+        key = msg_key(msg);
+        if ((entry = dict_remove(sms_dict, key)) != NULL) {
+            entry->segment->live--;
+            entry_destroy(entry);
+        }
+        octstr_destroy(key);
+        mutex_unlock(store_mutex);
+    }
+
+    return status;
+}
+
+
+static int store_log_save_ack(Msg *msg, ack_status_t status)
+{
+    int ret;
+    Msg *mack;
+
+    /* only sms are handled */
+    if (!msg || msg_type(msg) != sms)
+        return -1;
+
+    mack = msg_create(ack);
+    mack->ack.nack = status;
+    uuid_copy(mack->ack.id, msg->sms.id);
+    mack->ack.time = msg->sms.time;
+    ret = store_log_save(mack);
+    msg_destroy(mack);
+
+    return ret;
+}
+
+
+struct for_each {
+    void(*callback_fn)(Msg* msg, void *data);
+    void *data;
+};
+
+static void for_each_cb(Octstr *key, void *value, void *data)
+{
+    struct for_each *d = data;
+    Entry *entry = value;
+
+    d->callback_fn(entry->msg, d->data);
+}
+
+
+static void store_log_for_each_message(void(*callback_fn)(Msg* msg, void *data), void *data)
+{
+    struct for_each d;
+
+    if (store_dir == NULL)
+        return;
+
+    d.callback_fn = callback_fn;
+    d.data = data;
+    dict_traverse(sms_dict, for_each_cb, &d);
+}
+
+
+struct load_job {
+    long id;
+    long bytes;
+    List *msgs;
+};
+
+struct load_queue {
+    struct load_job *jobs;
+    long count;
+    Counter *next;
+};
+
+
+static void load_segment(struct load_job *job)
+{
+    Octstr *name, *os, *pack;
+    unsigned char buf[4];
+    long pos, len, end;
+    Msg *msg;
+
+    job->msgs = gwlist_create();
+    job->bytes = 0;
+    name = segment_name(job->id);
+    if ((os = octstr_read_file(octstr_get_cstr(name))) == NULL) {
+        error(0, "Could not read store segment `%s'.", octstr_get_cstr(name));
+        octstr_destroy(name);
+        return;
+    }
+    job->bytes = end = octstr_len(os);
+
+    for (pos = 0; pos < end; pos += len) {
+        if (pos + 4 > end) {
+            warning(0, "Truncated record at end of store segment `%s', skipped.",
+                    octstr_get_cstr(name));
+            break;
+        }
+        octstr_get_many_chars((char*) buf, os, pos, 4);
+        len = decode_network_long(buf);
+        pos += 4;
+        if (len < 0 || pos + len > end) {
+            warning(0, "Truncated record at end of store segment `%s', skipped.",
+                    octstr_get_cstr(name));
+            break;
+        }
+        pack = octstr_copy(os, pos, len);
+        msg = store_msg_unpack(pack);
+        octstr_destroy(pack);
+        if (msg == NULL) {
+            error(0, "Garbage at store segment `%s', skipped.", octstr_get_cstr(name));
+            continue;
+        }
+        if (msg_type(msg) != sms && msg_type(msg) != ack) {
+            warning(0, "Strange message in store segment, discarded, "
+                    "dump follows:");
+            msg_dump(msg, 0);
+            msg_destroy(msg);
+            continue;
+        }
+        gwlist_append(job->msgs, msg);
+    }
+    octstr_destroy(os);
+    octstr_destroy(name);
+}
+
+
+static void load_worker(void *arg)
+{
+    struct load_queue *queue = arg;
+    long i;
+
+    while ((i = counter_increase(queue->next)) < queue->count)
+        load_segment(&queue->jobs[i]);
+}
+
+
+static int cmp_segment_id(const void *a, const void *b)
+{
+    long ia = *(const long*) a, ib = *(const long*) b;
+
+    return ia < ib ? -1 : ia > ib;
+}
+
+
+/* collect ids of all segment files in store_dir */
+static int list_segments(List *ids)
+{
+    DIR *dir;
+    struct dirent *ent;
+    long id, *p;
+    char c;
+
+    if ((dir = opendir(octstr_get_cstr(store_dir))) == NULL) {
+        error(errno, "Could not open directory `%s'", octstr_get_cstr(store_dir));
+        return -1;
+    }
+    while ((ent = readdir(dir)) != NULL) {
+        if (sscanf(ent->d_name, "store-%ld.lo%c", &id, &c) != 2 || c != 'g')
+            continue;
+        p = gw_malloc(sizeof(*p));
+        *p = id;
+        gwlist_append(ids, p);
+    }
+    closedir(dir);
+
+    return 0;
+}
+
+
+static int store_log_load(void(*receive_msg)(Msg*))
+{
+    List *ids, *keys;
+    struct load_queue queue;
+    long threads[STORE_LOG_LOAD_THREADS];
+    long i, n, msgs, last_id;
+    long *id;
+    Segment *seg;
+    Msg *msg;
+    Octstr *key;
+    Entry *entry;
+    int ret;
+
+    /* check if we are active */
+    if (store_dir == NULL)
+        return 0;
+
+    /* sanity check */
+    if (receive_msg == NULL)
+        return -1;
+
+    ids = gwlist_create();
+    ret = list_segments(ids);
+    gwlist_sort(ids, cmp_segment_id);
+
+    queue.count = gwlist_len(ids);
+    queue.jobs = gw_malloc(sizeof(*queue.jobs) * (queue.count + 1));
+    queue.next = counter_create();
+    for (i = 0; i < queue.count; i++) {
+        id = gwlist_get(ids, i);
+        queue.jobs[i].id = *id;
+        queue.jobs[i].msgs = NULL;
+    }
+    gwlist_destroy(ids, free_item);
+
+    if (queue.count > 0)
+        info(0, "Loading %ld store segments from `%s'", queue.count,
+             octstr_get_cstr(store_dir));
+
+    /* unpack the segments in parallel ... */
+    n = queue.count < STORE_LOG_LOAD_THREADS ? queue.count : STORE_LOG_LOAD_THREADS;
+    for (i = 0; i < n; i++) {
+        if ((threads[i] = gwthread_create(load_worker, &queue)) == -1)
+            break;
+    }
+    /* ... doing the rest ourselves if no thread could be started */
+    load_worker(&queue);
+    for (n = i, i = 0; i < n; i++)
+        gwthread_join(threads[i]);
+    counter_destroy(queue.next);
+
+    /* ... and replay them in order */
+    msgs = 0;
+    last_id = -1;
+    for (i = 0; i < queue.count; i++) {
+        seg = segment_create(queue.jobs[i].id);
+        seg->bytes = queue.jobs[i].bytes;
+        gwlist_append(segments, seg);
+        while ((msg = gwlist_extract_first(queue.jobs[i].msgs)) != NULL) {
+            if (msg_type(msg) == sms)
+                msgs++;
+            index_msg(msg, seg, 0);
+        }
+        gwlist_destroy(queue.jobs[i].msgs, NULL);
+        last_id = seg->id;
+    }
+    gw_free(queue.jobs);
+
+    info(0, "Retrieved %ld messages, non-acknowledged messages: %ld",
+         msgs, dict_key_count(sms_dict));
+
+    /* never append behind a possibly torn record, start a new segment */
+    gwlist_append(segments, segment_create(last_id + 1));
+
+    keys = dict_keys(sms_dict);
+    while ((key = gwlist_extract_first(keys)) != NULL) {
+        entry = dict_get(sms_dict, key);
+        if (entry != NULL)
+            receive_msg(msg_share(entry->msg));
+        octstr_destroy(key);
+    }
+    gwlist_destroy(keys, NULL);
+
+    /* allow using of storage */
+    gwlist_remove_producer(loaded);
+
+    /* start compactor thread */
+    if ((compactor_thread = gwthread_create(store_compactor, NULL)) == -1)
+        panic(0, "Failed to create a store compactor thread!");
+
+    return ret;
+}
+
+
+static int store_log_dump(void)
+{
+    int ret;
+
+    if (store_dir == NULL)
+        return 0;
+
+    ret = commit_all();
+    mutex_lock(write_mutex);
+    if (fd != -1 && fsync(fd) == -1) {
+        error(errno, "Could not fsync store segment %ld.", fd_segment);
+        ret = -1;
+    }
+    mutex_unlock(write_mutex);
+
+    return ret;
+}
+
+
+static void store_log_shutdown(void)
+{
+    if (store_dir == NULL)
+        return;
+
+    active = 0;
+    if (compactor_thread != -1) {
+        gwthread_wakeup(compactor_thread);
+        gwthread_join(compactor_thread);
+    }
+
+    store_log_dump();
+    if (fd != -1)
+        close(fd);
+    fd = -1;
+
+    dict_destroy(sms_dict);
+    gwlist_destroy(segments, free_item);
+    gwlist_destroy(pending, batch_destroy);
+    mutex_destroy(store_mutex);
+    mutex_destroy(write_mutex);
+    gwlist_destroy(loaded, NULL);
+    octstr_destroy(store_dir);
+
+    sms_dict = NULL;
+    segments = pending = NULL;
+    store_mutex = write_mutex = NULL;
+    store_dir = NULL;
+}
+
+
+int store_log_init(Cfg *cfg, const Octstr *dir_s, long dump_freq)
+{
+    CfgGroup *grp;
+    Octstr *policy;
+    DIR *dir;
+
+    store_messages = store_log_messages;
+    store_save = store_log_save;
+    store_save_ack = store_log_save_ack;
+    store_load = store_log_load;
+    store_dump = store_log_dump;
+    store_shutdown = store_log_shutdown;
+    store_for_each_message = store_log_for_each_message;
+
+    if (dir_s == NULL)
+        return 0;
+
+    /* check if we can open directory */
+    if ((dir = opendir(octstr_get_cstr(dir_s))) == NULL) {
+        error(errno, "Could not open directory `%s'", octstr_get_cstr(dir_s));
+        return -1;
+    }
+    closedir(dir);
+
+    grp = cfg_get_single_group(cfg, octstr_imm("core"));
+    if (grp == NULL || cfg_get_integer(&segment_size, grp, octstr_imm("store-segment-size")) == -1 ||
+        segment_size <= 0)
+        segment_size = STORE_LOG_DEFAULT_SEGMENT_SIZE;
+
+    fsync_policy = STORE_LOG_FSYNC_NEVER;
+    if (grp != NULL && (policy = cfg_get(grp, octstr_imm("store-fsync"))) != NULL) {
+        if (octstr_str_case_compare(policy, "batch") == 0)
+            fsync_policy = STORE_LOG_FSYNC_BATCH;
+        else if (octstr_str_case_compare(policy, "interval") == 0)
+            fsync_policy = STORE_LOG_FSYNC_INTERVAL;
+        else if (octstr_str_case_compare(policy, "never") != 0) {
+            error(0, "Unknown 'store-fsync' value `%s'.", octstr_get_cstr(policy));
+            octstr_destroy(policy);
+            return -1;
+        }
+        octstr_destroy(policy);
+    }
+
+    if (dump_freq > 0)
+        dump_frequency = dump_freq;
+    else
+        dump_frequency = BB_STORE_DEFAULT_DUMP_FREQ;
+
+    store_dir = octstr_duplicate(dir_s);
+    sms_dict = dict_create(32768, entry_destroy);
+    segments = gwlist_create();
+    pending = gwlist_create();
+    store_mutex = mutex_create();
+    write_mutex = mutex_create();
+    appended_seq = written_seq = 0;
+    fd = -1;
+    fd_segment = -1;
+    active = 1;
+    compact_failed = 0;
+
+    loaded = gwlist_create();
+    gwlist_add_producer(loaded);
+
+    return 0;
+}
@@ -82,7 +82,7 @@
 /* passed from bearerbox core */
 
 extern volatile sig_atomic_t bb_status;
-extern List *incoming_wdp;
+extern gw_queue_t *incoming_wdp;
 
 extern Counter *incoming_wdp_counter;
 extern Counter *outgoing_wdp_counter;
@@ -128,7 +128,7 @@ static void udp_receiver(void *arg)
     Udpc *conn = arg;
     Octstr *ip;
 
-    gwlist_add_producer(incoming_wdp);
+    gw_queue_add_producer(incoming_wdp);
     gwlist_add_producer(flow_threads);
     gwthread_wakeup(MAIN_THREAD_ID);
     
@@ -171,14 +171,14 @@ static void udp_receiver(void *arg)
 	    msg->wdp_datagram.destination_port    = udp_get_port(conn->addr);
 	    msg->wdp_datagram.user_data = datagram;
     
-	    gwlist_produce(incoming_wdp, msg);
-	    counter_increase(incoming_wdp_counter);
+	    gw_queue_produce(incoming_wdp, msg);
+	    counter_stat_increase(incoming_wdp_counter);
 	}
 
 	octstr_destroy(cliaddr);
 	octstr_destroy(ip);
     }    
-    gwlist_remove_producer(incoming_wdp);
+    gw_queue_remove_producer(incoming_wdp);
     gwlist_remove_producer(flow_threads);
 }
 
@@ -225,7 +225,7 @@ static void udp_sender(void *arg)
 	    msg_destroy(msg);
 	    continue;
 	}
-	counter_increase(outgoing_wdp_counter);
+	counter_stat_increase(outgoing_wdp_counter);
 	msg_destroy(msg);
     }
     gwthread_join(conn->receiver);
@@ -372,7 +372,7 @@ int udp_start(Cfg *cfg)
     }
     gwlist_destroy(ifs, NULL);
     
-    gwlist_add_producer(incoming_wdp);
+    gw_queue_add_producer(incoming_wdp);
     udp_running = 1;
     return 0;
 }
@@ -426,7 +426,7 @@ int udp_shutdown(void)
     if (!udp_running) return -1;
 
     debug("bb.thread", 0, "udp_shutdown: Starting avalanche");
-    gwlist_remove_producer(incoming_wdp);
+    gw_queue_remove_producer(incoming_wdp);
     return 0;
 }
 
@@ -81,11 +81,11 @@
 
 /* global variables; included to other modules as needed */
 
-List *incoming_sms;
-List *outgoing_sms;
+gw_queue_t *incoming_sms;
+gw_queue_t *outgoing_sms;
 
-List *incoming_wdp;
-List *outgoing_wdp;
+gw_queue_t *incoming_wdp;
+gw_queue_t *outgoing_wdp;
 
 Counter *incoming_sms_counter;
 Counter *outgoing_sms_counter;
@@ -262,7 +262,7 @@ static void wdp_router(void *arg)
     
     while (bb_status != BB_DEAD) {
 
-        if ((msg = gwlist_consume(outgoing_wdp)) == NULL)
+        if ((msg = gw_queue_consume(outgoing_wdp)) == NULL)
             break;
 
         gw_assert(msg_type(msg) == wdp_datagram);
@@ -377,7 +377,9 @@ static Cfg *init_bearerbox(Cfg *cfg)
     CfgGroup *grp;
     Octstr *log, *val;
     long loglevel, store_dump_freq, value;
-    int lf, m;
+    int lf, m, h2, h2c;
+    long async_log_buffer;
+    int async_log;
 #ifdef HAVE_LIBSSL
     Octstr *ssl_server_cert_file;
     Octstr *ssl_server_key_file;
@@ -420,6 +422,13 @@ static Cfg *init_bearerbox(Cfg *cfg)
         log_set_syslog(NULL, 0);
     }
 
+    cfg_get_bool(&async_log, grp, octstr_imm("log-async"));
+    if (async_log) {
+        if (cfg_get_integer(&async_log_buffer, grp, octstr_imm("log-async-buffer")) == -1)
+            async_log_buffer = 65536;
+        log_async_start(async_log_buffer);
+    }
+
     if (check_config(cfg) == -1)
         panic(0, "Cannot start with corrupted configuration");
 
@@ -505,10 +514,10 @@ static Cfg *init_bearerbox(Cfg *cfg)
 
     /* if all seems to be OK by the first glimpse, real start-up */
 
-    outgoing_sms = gwlist_create();
-    incoming_sms = gwlist_create();
-    outgoing_wdp = gwlist_create();
-    incoming_wdp = gwlist_create();
+    outgoing_sms = gw_queue_create(0);
+    incoming_sms = gw_queue_create(0);
+    outgoing_wdp = gw_queue_create(0);
+    incoming_wdp = gw_queue_create(0);
 
     outgoing_sms_counter = counter_create();
     incoming_sms_counter = counter_create();
@@ -567,6 +576,23 @@ static Cfg *init_bearerbox(Cfg *cfg)
 
     if (cfg_get_integer(&value, grp, octstr_imm("http-timeout")) == 0)
         http_set_client_timeout(value);
+    if (cfg_get_integer(&value, grp, octstr_imm("dns-cache-ttl")) == 0)
+        gw_resolver_set_ttl(value, -1);
+    if (cfg_get_integer(&value, grp, octstr_imm("dns-negative-cache-ttl")) == 0)
+        gw_resolver_set_ttl(-1, value);
+    if (cfg_get_integer(&value, grp, octstr_imm("http-max-clients")) == 0)
+        http_set_server_max_clients(value);
+    if (cfg_get_integer(&value, grp, octstr_imm("http-max-host-connections")) == 0)
+        http_set_client_host_limits(value, -1);
+    if (cfg_get_integer(&value, grp, octstr_imm("http-max-host-queue")) == 0)
+        http_set_client_host_limits(-1, value);
+    if (cfg_get_integer(&value, grp, octstr_imm("http-pipeline-depth")) == 0)
+        http_set_client_pipeline_depth(value);
+    h2 = h2c = 0;
+    cfg_get_bool(&h2, grp, octstr_imm("http-h2"));
+    cfg_get_bool(&h2c, grp, octstr_imm("http-h2c"));
+    if (h2 || h2c)
+        http_set_client_h2(h2, h2c);
 #ifndef NO_SMS    
     {
         List *list;
@@ -614,31 +640,31 @@ static void empty_msg_lists(void)
     Msg *msg;
 
 #ifndef NO_WAP
-    if (gwlist_len(incoming_wdp) > 0 || gwlist_len(outgoing_wdp) > 0)
+    if (gw_queue_len(incoming_wdp) > 0 || gw_queue_len(outgoing_wdp) > 0)
         warning(0, "Remaining WDP: %ld incoming, %ld outgoing",
-                gwlist_len(incoming_wdp), gwlist_len(outgoing_wdp));
+                gw_queue_len(incoming_wdp), gw_queue_len(outgoing_wdp));
 
     info(0, "Total WDP messages: received %ld, sent %ld",
          counter_value(incoming_wdp_counter),
          counter_value(outgoing_wdp_counter));
 #endif
     
-    while ((msg = gwlist_extract_first(incoming_wdp)) != NULL)
+    while ((msg = gw_queue_remove(incoming_wdp)) != NULL)
         msg_destroy(msg);
-    while ((msg = gwlist_extract_first(outgoing_wdp)) != NULL)
+    while ((msg = gw_queue_remove(outgoing_wdp)) != NULL)
         msg_destroy(msg);
 
-    gwlist_destroy(incoming_wdp, NULL);
-    gwlist_destroy(outgoing_wdp, NULL);
+    gw_queue_destroy(incoming_wdp, NULL);
+    gw_queue_destroy(outgoing_wdp, NULL);
 
     counter_destroy(incoming_wdp_counter);
     counter_destroy(outgoing_wdp_counter);
     
 #ifndef NO_SMS
     /* XXX we should record these so that they are not forever lost... */
-    if (gwlist_len(incoming_sms) > 0 || gwlist_len(outgoing_sms) > 0)
+    if (gw_queue_len(incoming_sms) > 0 || gw_queue_len(outgoing_sms) > 0)
         debug("bb", 0, "Remaining SMS: %ld incoming, %ld outgoing",
-              gwlist_len(incoming_sms), gwlist_len(outgoing_sms));
+              gw_queue_len(incoming_sms), gw_queue_len(outgoing_sms));
 
     info(0, "Total SMS messages: received %ld, dlr %ld, sent %ld, dlr %ld",
          counter_value(incoming_sms_counter),
@@ -647,8 +673,8 @@ static void empty_msg_lists(void)
          counter_value(outgoing_dlr_counter));
 #endif
 
-    gwlist_destroy(incoming_sms, msg_destroy_item);
-    gwlist_destroy(outgoing_sms, msg_destroy_item);
+    gw_queue_destroy(incoming_sms, msg_destroy_item);
+    gw_queue_destroy(outgoing_sms, msg_destroy_item);
     
     counter_destroy(incoming_sms_counter);
     counter_destroy(incoming_dlr_counter);
@@ -673,11 +699,11 @@ static void dispatch_into_queue(Msg *msg)
         case mt_push:
         case mt_reply:
         case report_mt:
-            gwlist_append(outgoing_sms, msg);
+            gw_queue_produce(outgoing_sms, msg);
             break;
         case mo:
         case report_mo:
-            gwlist_append(incoming_sms, msg);
+            gw_queue_produce(incoming_sms, msg);
             break;
         default:
             uuid_unparse(msg->sms.id, id);
@@ -983,6 +1009,113 @@ int bb_remove_message(Octstr *message_id)
 #define append_status(r, s, f, x) { s = f(x); octstr_append(r, s); \
                                     octstr_destroy(s); }
 
+static void append_log_status(Octstr *ret, int status_type)
+{
+    unsigned long written, dropped, blocked;
+    char *frmt;
+
+    if (log_async_stats(&written, &dropped, &blocked) == -1)
+        return;
+
+    if (status_type == BBSTATUS_HTML)
+        frmt = " <p>Log: async, written %lu, dropped %lu, blocked %lu</p>\n\n";
+    else if (status_type == BBSTATUS_WML)
+        frmt = "   <p>Log: async<br/>\n"
+               "      Log: written %lu, dropped %lu, blocked %lu</p>\n\n";
+    else if (status_type == BBSTATUS_XML)
+        frmt = "\t<log>\n\t\t<mode>async</mode>\n\t\t<written>%lu</written>\n"
+               "\t\t<dropped>%lu</dropped>\n\t\t<blocked>%lu</blocked>\n\t</log>\n";
+    else
+        frmt = "Log: async, written %lu, dropped %lu, blocked %lu\n\n";
+
+    octstr_format_append(ret, frmt, written, dropped, blocked);
+}
+
+
+static void append_dlr_dbpool_status(Octstr *ret, int status_type)
+{
+    unsigned long checkouts, checks;
+    double avg_ms, max_ms;
+    char *frmt;
+
+    if (dlr_dbpool_stats(&checkouts, &checks, &avg_ms, &max_ms) == -1)
+        return;
+
+    if (status_type == BBSTATUS_HTML)
+        frmt = " <p>DLR: database pool, %lu checkouts, %lu checks, "
+               "wait avg %.3f ms, max %.3f ms</p>\n\n";
+    else if (status_type == BBSTATUS_WML)
+        frmt = "   <p>DLR: database pool, %lu checkouts, %lu checks<br/>\n"
+               "      DLR: wait avg %.3f ms, max %.3f ms</p>\n\n";
+    else if (status_type == BBSTATUS_XML)
+        frmt = "\t<dlr-dbpool>\n\t\t<checkouts>%lu</checkouts>\n"
+               "\t\t<checks>%lu</checks>\n\t\t<avg-wait-ms>%.3f</avg-wait-ms>\n"
+               "\t\t<max-wait-ms>%.3f</max-wait-ms>\n\t</dlr-dbpool>\n";
+    else
+        frmt = "DLR: database pool, %lu checkouts, %lu checks, "
+               "wait avg %.3f ms, max %.3f ms\n\n";
+
+    octstr_format_append(ret, frmt, checkouts, checks, avg_ms, max_ms);
+}
+
+
+static void append_dlr_status(Octstr *ret, int status_type)
+{
+    unsigned long flushes, flushed;
+    double avg_ms, max_ms;
+    long pending;
+    char *frmt;
+
+    append_dlr_dbpool_status(ret, status_type);
+
+    if (dlr_batch_stats(&pending, &flushes, &flushed, &avg_ms, &max_ms) == -1)
+        return;
+
+    if (status_type == BBSTATUS_HTML)
+        frmt = " <p>DLR: batched writes, %ld pending, %lu writes of %lu entries, "
+               "write time avg %.2f ms, max %.2f ms</p>\n\n";
+    else if (status_type == BBSTATUS_WML)
+        frmt = "   <p>DLR: batched writes, %ld pending<br/>\n"
+               "      DLR: %lu writes of %lu entries<br/>\n"
+               "      DLR: write time avg %.2f ms, max %.2f ms</p>\n\n";
+    else if (status_type == BBSTATUS_XML)
+        frmt = "\t<dlr-batch>\n\t\t<pending>%ld</pending>\n\t\t<writes>%lu</writes>\n"
+               "\t\t<entries>%lu</entries>\n\t\t<avg-ms>%.2f</avg-ms>\n"
+               "\t\t<max-ms>%.2f</max-ms>\n\t</dlr-batch>\n";
+    else
+        frmt = "DLR: batched writes, %ld pending, %lu writes of %lu entries, "
+               "write time avg %.2f ms, max %.2f ms\n\n";
+
+    octstr_format_append(ret, frmt, pending, flushes, flushed, avg_ms, max_ms);
+}
+
+
+static void append_http_client_status(Octstr *ret, int status_type)
+{
+    unsigned long hits, misses, pipelined, queued, rejected;
+    char *frmt;
+
+    if (http_client_pool_stats(&hits, &misses, &pipelined, &queued, &rejected) == -1)
+        return;
+
+    if (status_type == BBSTATUS_HTML)
+        frmt = " <p>HTTP client: %lu reused, %lu new connections, %lu pipelined, "
+               "%lu queued, %lu rejected</p>\n\n";
+    else if (status_type == BBSTATUS_WML)
+        frmt = "   <p>HTTP client: %lu reused, %lu new connections<br/>\n"
+               "      HTTP client: %lu pipelined, %lu queued, %lu rejected</p>\n\n";
+    else if (status_type == BBSTATUS_XML)
+        frmt = "\t<http-client>\n\t\t<reused>%lu</reused>\n\t\t<new>%lu</new>\n"
+               "\t\t<pipelined>%lu</pipelined>\n\t\t<queued>%lu</queued>\n"
+               "\t\t<rejected>%lu</rejected>\n\t</http-client>\n";
+    else
+        frmt = "HTTP client: %lu reused, %lu new connections, %lu pipelined, "
+               "%lu queued, %lu rejected\n\n";
+
+    octstr_format_append(ret, frmt, hits, misses, pipelined, queued, rejected);
+}
+
+
 Octstr *bb_print_status(int status_type)
 {
     char *s, *lb;
@@ -1072,10 +1205,10 @@ Octstr *bb_print_status(int status_type)
         octstr_get_cstr(version),
         s, t/3600/24, t/3600%24, t/60%60, t%60,
         counter_value(incoming_wdp_counter),
-        gwlist_len(incoming_wdp) + boxc_incoming_wdp_queue(),
-        counter_value(outgoing_wdp_counter), gwlist_len(outgoing_wdp) + udp_outgoing_queue(),
-        counter_value(incoming_sms_counter), gwlist_len(incoming_sms),
-        counter_value(outgoing_sms_counter), gwlist_len(outgoing_sms),
+        gw_queue_len(incoming_wdp) + boxc_incoming_wdp_queue(),
+        counter_value(outgoing_wdp_counter), gw_queue_len(outgoing_wdp) + udp_outgoing_queue(),
+        counter_value(incoming_sms_counter), gw_queue_len(incoming_sms),
+        counter_value(outgoing_sms_counter), gw_queue_len(outgoing_sms),
         store_messages(),
         load_get(incoming_sms_load,0), load_get(incoming_sms_load,1), load_get(incoming_sms_load,2),
         load_get(outgoing_sms_load,0), load_get(outgoing_sms_load,1), load_get(outgoing_sms_load,2),
@@ -1085,8 +1218,12 @@ Octstr *bb_print_status(int status_type)
         dlr_messages(), dlr_type());
 
     octstr_destroy(version);
-    
+
+    append_dlr_status(ret, status_type);
+    append_log_status(ret, status_type);
+    append_http_client_status(ret, status_type);
     append_status(ret, str, boxc_status, status_type);
+    append_status(ret, str, smsc2_latency_status, status_type);
     append_status(ret, str, smsc2_status, status_type);
     octstr_append_cstr(ret, footer);
     
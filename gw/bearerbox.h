@@ -85,7 +85,8 @@ enum {
     BBSTATUS_HTML = 0,
     BBSTATUS_TEXT = 1,
     BBSTATUS_WML = 2,
-    BBSTATUS_XML = 3
+    BBSTATUS_XML = 3,
+    BBSTATUS_JSON = 4	/* only supported by smsc2_latency_status() */
 };
 
 /*---------------------------------------------------------------
@@ -159,6 +160,9 @@ void smsc2_cleanup(void); /* final clean-up */
 
 Octstr *smsc2_status(int status_type);
 
+/* p50/p99/p999 latency of sent messages per stage, overall and per SMSC */
+Octstr *smsc2_latency_status(int status_type);
+
 /* function to route outgoing SMS'es
  *
  * If finds a good one, puts into it and returns SMSCCONN_SUCCESS
@@ -88,6 +88,7 @@
 #include <unistd.h>
 
 #include "gwlib/gwlib.h"
+#include "gwlib/gw-queue.h"
 #include "sms.h"
 #include "dlr.h"
 #include "dlr_p.h"
@@ -96,6 +97,42 @@
 /* Our callback functions */
 static struct dlr_storage *handles = NULL;
 
+/*
+ * Write-behind of DLR entries, used for storages which can add several
+ * entries in one go. dlr_add() puts the entry into the pending table and
+ * the queue, and worker threads hand whatever has piled up to the storage
+ * in one call. dlr_find() looks into the pending table first, so entries
+ * are found before they have reached the storage; entries removed or
+ * updated while pending are removed or updated in the storage after they
+ * have been written. Once the pending table holds batch_limit entries,
+ * dlr_add() writes synchronously again.
+ *
+ * An entry stays in the pending table until its removal or updates have
+ * reached the storage; the storage calls themselves are made without
+ * holding batch_lock.
+ */
+struct dlr_pending {
+    struct dlr_entry *entry;    /* never changed once queued */
+    Octstr *key;
+    int removed;    /* found with a final status */
+    int status;     /* status to update in storage, 0 for none */
+};
+
+static gw_queue_t *batch_queue = NULL;
+static Dict *batch_pending;         /* smsc and timestamp -> List of pending */
+static Mutex *batch_lock;
+static long batch_size;
+static long batch_limit;
+static long batch_count;            /* entries in batch_pending */
+static long batch_nworkers;
+static long *batch_workers;
+
+/* statistics, protected by batch_lock */
+static unsigned long batch_flushes;
+static unsigned long batch_flushed;
+static double batch_flush_time;
+static double batch_flush_max;
+
 /*
  * Function to allocate a new struct dlr_entry entry
  * and initialize it to zero
@@ -132,6 +169,7 @@ struct dlr_entry *dlr_entry_duplicate(const struct dlr_entry *dlr)
     ret->url = octstr_duplicate(dlr->url);
     ret->boxc_id = octstr_duplicate(dlr->boxc_id);
     ret->mask = dlr->mask;
+    ret->use_dst = dlr->use_dst;
 
     return ret;
 }
@@ -226,6 +264,333 @@ void dlr_db_fields_destroy(struct dlr_db_fields *fields)
 }
 
 
+void dlr_db_add_batch(DBPoolConn *pconn, const Octstr *insert, List *entries,
+                      long max_rows)
+{
+    Octstr *sql;
+    struct dlr_entry *entry;
+    List *binds, *masks;
+    long i, n;
+    int res;
+
+    n = max_rows;
+    while (gwlist_len(entries) > 0) {
+        while (n > gwlist_len(entries))
+            n /= 2;
+        sql = octstr_duplicate(insert);
+        binds = gwlist_create();
+        masks = gwlist_create();
+        for (i = 0; i < n; i++) {
+            entry = gwlist_get(entries, i);
+            octstr_append_cstr(sql, i == 0 ? "(?, ?, ?, ?, ?, ?, ?, ?, 0)" :
+                                             ", (?, ?, ?, ?, ?, ?, ?, ?, 0)");
+            gwlist_append(masks, octstr_format("%d", entry->mask));
+            gwlist_append(binds, entry->smsc);
+            gwlist_append(binds, entry->timestamp);
+            gwlist_append(binds, entry->source);
+            gwlist_append(binds, entry->destination);
+            gwlist_append(binds, entry->service);
+            gwlist_append(binds, entry->url);
+            gwlist_append(binds, gwlist_get(masks, i));
+            gwlist_append(binds, entry->boxc_id);
+        }
+
+#if defined(DLR_TRACE)
+        debug("dlr.dlr", 0, "sql: %s", octstr_get_cstr(sql));
+#endif
+        if ((res = dbpool_conn_update(pconn, sql, binds)) == -1)
+            error(0, "DLR[%s]: Error while adding %ld dlr entries", dlr_type(), n);
+        else if (res < n)
+            warning(0, "DLR[%s]: Only %d of %ld dlr entries inserted", dlr_type(), res, n);
+
+        octstr_destroy(sql);
+        gwlist_destroy(binds, NULL);
+        gwlist_destroy(masks, octstr_destroy_item);
+        for (i = 0; i < n; i++)
+            dlr_entry_destroy(gwlist_extract_first(entries));
+    }
+    gwlist_destroy(entries, NULL);
+}
+
+
+static Octstr *pending_key(const Octstr *smsc, const Octstr *ts)
+{
+    Octstr *key;
+
+    key = octstr_duplicate(smsc);
+    octstr_append_char(key, '\0');
+    octstr_append(key, ts);
+    return key;
+}
+
+
+static void pending_destroy(struct dlr_pending *pending)
+{
+    dlr_entry_destroy(pending->entry);
+    octstr_destroy(pending->key);
+    gw_free(pending);
+}
+
+
+/* Remove pending from batch_pending. Caller must hold batch_lock. */
+static void pending_unlink(struct dlr_pending *pending)
+{
+    List *list;
+
+    list = dict_get(batch_pending, pending->key);
+    gwlist_delete_equal(list, pending);
+    if (gwlist_len(list) == 0)
+        gwlist_destroy(dict_remove(batch_pending, pending->key), NULL);
+    batch_count--;
+}
+
+
+/*
+ * Look for an entry in the pending table. If one is found, mark it for
+ * removal or update as dlr_find() does for the storage and return a
+ * copy of it; *found is set in that case, also if the entry had already
+ * been removed and NULL is returned.
+ */
+static struct dlr_entry *pending_find(const Octstr *smsc, const Octstr *ts,
+                                      const Octstr *dst, int typ, int *found)
+{
+    struct dlr_pending *pending;
+    struct dlr_entry *dlr = NULL;
+    Octstr *key;
+    List *list;
+    long i, pos;
+
+    *found = 0;
+    key = pending_key(smsc, ts);
+    mutex_lock(batch_lock);
+    list = dict_get(batch_pending, key);
+    for (i = 0; i < gwlist_len(list); ++i) {
+        pending = gwlist_get(list, i);
+        pos = octstr_len(pending->entry->destination) - octstr_len(dst);
+        if (dst != NULL && (pos < 0 ||
+            octstr_search(pending->entry->destination, dst, pos) != pos))
+            continue;
+        *found = 1;
+        if (pending->removed)
+            continue;
+        dlr = dlr_entry_duplicate(pending->entry);
+        if (DLR_IS_NOT_FINAL(typ) && DLR_IS_SUCCESS_OR_FAIL(dlr->mask))
+            pending->status = typ;
+        else
+            pending->removed = 1;
+        break;
+    }
+    mutex_unlock(batch_lock);
+    octstr_destroy(key);
+
+    return dlr;
+}
+
+
+/*
+ * Bring the storage up to date with what dlr_find() did to a pending
+ * entry while it was being written, then drop it from the pending table.
+ * dlr_find() may still update the entry while we are at it, so loop until
+ * nothing is left to do.
+ */
+static void pending_apply(struct dlr_pending *pending)
+{
+    Octstr *dst = NULL;
+    long dst_len;
+    int removed, status;
+
+    if (pending->entry->use_dst) {
+        dst = octstr_duplicate(pending->entry->destination);
+        dst_len = octstr_len(dst);
+        if (dst_len > MIN_DST_LEN)
+            octstr_delete(dst, 0, dst_len - MIN_DST_LEN);
+    }
+
+    mutex_lock(batch_lock);
+    for (;;) {
+        removed = pending->removed;
+        status = pending->status;
+        pending->status = 0;
+        if (!removed && status == 0)
+            break;
+        mutex_unlock(batch_lock);
+        if (removed && handles->dlr_remove != NULL)
+            handles->dlr_remove(pending->entry->smsc,
+                                pending->entry->timestamp, dst);
+        else if (!removed && handles->dlr_update != NULL)
+            handles->dlr_update(pending->entry->smsc,
+                                pending->entry->timestamp, dst, status);
+        mutex_lock(batch_lock);
+        if (removed)
+            break;
+    }
+    pending_unlink(pending);
+    mutex_unlock(batch_lock);
+
+    octstr_destroy(dst);
+    pending_destroy(pending);
+}
+
+
+static void batch_worker(void *arg)
+{
+    struct dlr_pending *pending;
+    List *items, *entries;
+    long i, n;
+    double start, ms;
+
+    while ((pending = gw_queue_consume(batch_queue)) != NULL) {
+        items = gwlist_create();
+        gwlist_append(items, pending);
+        while (gwlist_len(items) < batch_size &&
+               (pending = gw_queue_remove(batch_queue)) != NULL)
+            gwlist_append(items, pending);
+
+        /* take what is still wanted, drop what was found meanwhile */
+        entries = gwlist_create();
+        mutex_lock(batch_lock);
+        for (i = 0; i < gwlist_len(items); ) {
+            pending = gwlist_get(items, i);
+            if (pending->removed) {
+                pending_unlink(pending);
+                pending_destroy(pending);
+                gwlist_delete(items, i, 1);
+                continue;
+            }
+            gwlist_append(entries, dlr_entry_duplicate(pending->entry));
+            ++i;
+        }
+        mutex_unlock(batch_lock);
+
+        if ((n = gwlist_len(entries)) == 0) {
+            gwlist_destroy(entries, NULL);
+            gwlist_destroy(items, NULL);
+            continue;
+        }
+        start = date_precise_now();
+        handles->dlr_add_batch(entries);
+        ms = (date_precise_now() - start) * 1000.0;
+
+        /*
+         * Entries nobody asked about are done. The others stay visible as
+         * pending until what dlr_find() did to them meanwhile has been
+         * applied to the storage, outside of the lock.
+         */
+        mutex_lock(batch_lock);
+        for (i = 0; i < gwlist_len(items); ) {
+            pending = gwlist_get(items, i);
+            if (pending->removed || pending->status) {
+                ++i;
+                continue;
+            }
+            pending_unlink(pending);
+            pending_destroy(pending);
+            gwlist_delete(items, i, 1);
+        }
+        batch_flushes++;
+        batch_flushed += n;
+        batch_flush_time += ms;
+        if (ms > batch_flush_max)
+            batch_flush_max = ms;
+        mutex_unlock(batch_lock);
+
+        while ((pending = gwlist_extract_first(items)) != NULL)
+            pending_apply(pending);
+        gwlist_destroy(items, NULL);
+    }
+}
+
+
+/*
+ * Start write-behind if configured and supported by the storage.
+ */
+static void batch_init(CfgGroup *grp)
+{
+    long i;
+
+    if (cfg_get_integer(&batch_size, grp, octstr_imm("dlr-batch-size")) == -1)
+        batch_size = 1;
+    if (batch_size <= 1)
+        return;
+    if (handles->dlr_add_batch == NULL) {
+        warning(0, "DLR: storage type '%s' does not support batched writes, "
+                "ignoring 'dlr-batch-size'.", handles->type);
+        return;
+    }
+    if (cfg_get_integer(&batch_nworkers, grp, octstr_imm("dlr-batch-workers")) == -1 ||
+        batch_nworkers < 1)
+        batch_nworkers = 1;
+    if (cfg_get_integer(&batch_limit, grp, octstr_imm("dlr-batch-queue-limit")) == -1 ||
+        batch_limit < batch_size)
+        batch_limit = batch_size > 10000 ? batch_size : 10000;
+
+    batch_pending = dict_create(1024, NULL);
+    batch_lock = mutex_create();
+    batch_count = 0;
+    batch_queue = gw_queue_create(0);
+    gw_queue_add_producer(batch_queue);
+    batch_workers = gw_malloc(batch_nworkers * sizeof(*batch_workers));
+    for (i = 0; i < batch_nworkers; ++i)
+        if ((batch_workers[i] = gwthread_create(batch_worker, NULL)) == -1)
+            panic(0, "DLR: failed to start batch writer thread.");
+
+    info(0, "DLR: writing up to %ld entries at once with %ld thread(s), "
+         "at most %ld pending.", batch_size, batch_nworkers, batch_limit);
+}
+
+
+/*
+ * Write all pending entries and stop the workers.
+ */
+static void batch_shutdown(void)
+{
+    long i;
+
+    if (batch_queue == NULL)
+        return;
+
+    gw_queue_remove_producer(batch_queue);
+    for (i = 0; i < batch_nworkers; ++i)
+        gwthread_join(batch_workers[i]);
+    gw_free(batch_workers);
+    gw_queue_destroy(batch_queue, NULL);
+    batch_queue = NULL;
+    gw_assert(batch_count == 0);
+    dict_destroy(batch_pending);
+    mutex_destroy(batch_lock);
+}
+
+
+int dlr_batch_stats(long *pending, unsigned long *flushes,
+                    unsigned long *flushed, double *avg_ms, double *max_ms)
+{
+    if (batch_queue == NULL)
+        return -1;
+
+    mutex_lock(batch_lock);
+    *pending = batch_count;
+    *flushes = batch_flushes;
+    *flushed = batch_flushed;
+    *avg_ms = batch_flushes > 0 ? batch_flush_time / batch_flushes : 0;
+    *max_ms = batch_flush_max;
+    mutex_unlock(batch_lock);
+
+    return 0;
+}
+
+
+int dlr_dbpool_stats(unsigned long *checkouts, unsigned long *checks,
+                     double *avg_wait_ms, double *max_wait_ms)
+{
+    if (handles == NULL || handles->pool == NULL)
+        return -1;
+
+    dbpool_stats(handles->pool, checkouts, checks, avg_wait_ms, max_wait_ms);
+
+    return 0;
+}
+
+
 /*
  * Initialize specifically dlr storage. If defined storage is unknown
  * then panic.
@@ -289,6 +654,8 @@ void dlr_init(Cfg* cfg)
     /* get info from storage */
     info(0, "DLR using storage type: %s", handles->type);
 
+    batch_init(grp);
+
     /* cleanup */
     octstr_destroy(dlr_type);
 }
@@ -298,6 +665,10 @@ void dlr_init(Cfg* cfg)
  */
 void dlr_shutdown()
 {
+    batch_shutdown();
+
+    if (handles != NULL)
+        handles->pool = NULL;
     if (handles != NULL && handles->dlr_shutdown != NULL)
         handles->dlr_shutdown();
 }
@@ -307,8 +678,17 @@ void dlr_shutdown()
  */
 long dlr_messages(void)
 {
-    if (handles != NULL && handles->dlr_messages != NULL)
-        return handles->dlr_messages();
+    long msgs;
+
+    if (handles != NULL && handles->dlr_messages != NULL) {
+        msgs = handles->dlr_messages();
+        if (msgs >= 0 && batch_queue != NULL) {
+            mutex_lock(batch_lock);
+            msgs += batch_count;
+            mutex_unlock(batch_lock);
+        }
+        return msgs;
+    }
 
     return -1;
 }
@@ -375,6 +755,30 @@ void dlr_add(const Octstr *smsc, const Octstr *ts, Msg *msg, int use_dst)
           dlr_type(), octstr_get_cstr(dlr->smsc), octstr_get_cstr(dlr->timestamp),
           octstr_get_cstr(dlr->source), octstr_get_cstr(dlr->destination), dlr->mask, octstr_get_cstr(dlr->boxc_id));
 	
+    /* queue it for the writers unless too much is pending already */
+    if (batch_queue != NULL) {
+        struct dlr_pending *pending;
+        List *list;
+
+        mutex_lock(batch_lock);
+        if (batch_count < batch_limit) {
+            pending = gw_malloc(sizeof(*pending));
+            pending->entry = dlr;
+            pending->key = pending_key(dlr->smsc, dlr->timestamp);
+            pending->removed = pending->status = 0;
+            if ((list = dict_get(batch_pending, pending->key)) == NULL) {
+                list = gwlist_create();
+                dict_put(batch_pending, pending->key, list);
+            }
+            gwlist_append(list, pending);
+            batch_count++;
+            mutex_unlock(batch_lock);
+            gw_queue_produce(batch_queue, pending);
+            return;
+        }
+        mutex_unlock(batch_lock);
+    }
+
     /* call registered function */
     handles->dlr_add(dlr);
 }
@@ -390,6 +794,7 @@ Msg *dlr_find(const Octstr *smsc, const Octstr *ts, const Octstr *dst, int typ,
     struct dlr_entry *dlr = NULL;
     Octstr *dst_min = NULL;
     Octstr *dlr_mask;
+    int pending;
     
     if(octstr_len(smsc) == 0) {
 	warning(0, "DLR[%s]: Can't find a dlr without smsc-id", dlr_type());
@@ -410,7 +815,11 @@ Msg *dlr_find(const Octstr *smsc, const Octstr *ts, const Octstr *dst, int typ,
     debug("dlr.dlr", 0, "DLR[%s]: Looking for DLR smsc=%s, ts=%s, dst=%s, type=%d",
                                  dlr_type(), octstr_get_cstr(smsc), octstr_get_cstr(ts), octstr_get_cstr(dst), typ);
 
-    dlr = handles->dlr_get(smsc, ts, dst_min);
+    pending = 0;
+    if (batch_queue != NULL)
+        dlr = pending_find(smsc, ts, dst_min, typ, &pending);
+    if (!pending)
+        dlr = handles->dlr_get(smsc, ts, dst_min);
     if (dlr == NULL)  {
         warning(0, "DLR[%s]: DLR from SMSC<%s> for DST<%s> not found.",
                 dlr_type(), octstr_get_cstr(smsc), octstr_get_cstr(dst));         
@@ -466,7 +875,9 @@ Msg *dlr_find(const Octstr *smsc, const Octstr *ts, const Octstr *dst, int typ,
 #undef O_SET
  
     /* check for end status and if so remove from storage */
-    if (DLR_IS_NOT_FINAL(typ) && DLR_IS_SUCCESS_OR_FAIL(dlr->mask)) {
+    if (pending) {
+        /* pending_find() has taken care of it */
+    } else if (DLR_IS_NOT_FINAL(typ) && DLR_IS_SUCCESS_OR_FAIL(dlr->mask)) {
         debug("dlr.dlr", 0, "DLR[%s]: DLR not destroyed, still waiting for other delivery report", dlr_type());
         /* update dlr entry status if function defined */
         if (handles != NULL && handles->dlr_update != NULL){
@@ -492,6 +903,24 @@ void dlr_flush(void)
 {
     info(0, "Flushing all %ld queued DLR messages in %s storage", dlr_messages(), 
             dlr_type());
+
+    /* pending entries are dropped, or removed once they are written */
+    if (batch_queue != NULL) {
+        List *keys, *list;
+        Octstr *key;
+        long i;
+
+        mutex_lock(batch_lock);
+        keys = dict_keys(batch_pending);
+        while ((key = gwlist_extract_first(keys)) != NULL) {
+            list = dict_get(batch_pending, key);
+            for (i = 0; i < gwlist_len(list); ++i)
+                ((struct dlr_pending *) gwlist_get(list, i))->removed = 1;
+            octstr_destroy(key);
+        }
+        gwlist_destroy(keys, NULL);
+        mutex_unlock(batch_lock);
+    }
  
     if (handles != NULL && handles->dlr_flush != NULL)
         handles->dlr_flush();
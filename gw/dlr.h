@@ -109,6 +109,22 @@ Msg* dlr_find(const Octstr *smsc, const Octstr *ts, const Octstr *dst, int type,
 /* return the number of DLR messages in the current waiting queue */
 long dlr_messages(void);
 
+/*
+ * Return statistics of the background writing of DLR entries: entries
+ * not yet written, number of storage writes, entries written and the
+ * average and longest write time in milliseconds. Returns -1 if
+ * entries are written synchronously.
+ */
+int dlr_batch_stats(long *pending, unsigned long *flushes,
+                    unsigned long *flushed, double *avg_ms, double *max_ms);
+
+/*
+ * Return the connection pool statistics of the DLR storage, see
+ * dbpool_stats(). Returns -1 if the storage does not use a DBPool.
+ */
+int dlr_dbpool_stats(unsigned long *checkouts, unsigned long *checks,
+                     double *avg_wait_ms, double *max_wait_ms);
+
 /* 
  * Flush all DLR messages in the current waiting queue.
  * Beware to take bearerbox to suspended state before doing this.
@@ -408,6 +408,7 @@ found:
 
     pool = dbpool_create(DBPOOL_CASS, db_conf, pool_size);
     gw_assert(pool != NULL);
+    handles.pool = pool;
 
     /*
      * XXX should a failing connect throw panic?!
@@ -69,21 +69,173 @@
 #include "dlr_p.h"
 
 /*
- * This is the global list where all messages being sent out are being kept track
- * of his list is looked up once a delivery report comes in
+ * The waiting entries are kept in a hash index keyed on (smsc, timestamp),
+ * split into DLR_MEM_SHARDS independent shards each with its own lock, so
+ * that adding, looking up and removing DLRs only ever contends with
+ * operations hashing into the same shard.
+ *
+ * Each shard additionally keeps all of its entries in a doubly linked list
+ * in insertion order. If 'dlr-internal-ttl' is set, entries older than the
+ * TTL are taken from the head of that list whenever a new entry is added,
+ * so stale DLRs age out without scanning the index.
+ */
+#define DLR_MEM_SHARDS 64
+#define DLR_MEM_MIN_BUCKETS 64
+
+typedef struct dlr_mem_node dlr_mem_node;
+struct dlr_mem_node {
+    struct dlr_entry *dlr;
+    unsigned long hash;
+    time_t added;
+    dlr_mem_node *next;         /* hash bucket chain */
+    dlr_mem_node *age_prev;     /* insertion order list */
+    dlr_mem_node *age_next;
+};
+
+typedef struct {
+    RWLock lock;
+    dlr_mem_node **buckets;
+    long size;
+    long count;
+    dlr_mem_node *oldest;
+    dlr_mem_node *newest;
+} dlr_mem_shard;
+
+static dlr_mem_shard shards[DLR_MEM_SHARDS];
+static Counter *dlr_count;
+static long dlr_ttl;
+
+
+static unsigned long dlr_mem_hash(const Octstr *smsc, const Octstr *ts)
+{
+    return octstr_hash_key((Octstr *) smsc) * 31 + octstr_hash_key((Octstr *) ts);
+}
+
+
+static dlr_mem_shard *dlr_mem_shard_of(unsigned long hash)
+{
+    return &shards[hash % DLR_MEM_SHARDS];
+}
+
+
+static long dlr_mem_bucket_of(dlr_mem_shard *shard, unsigned long hash)
+{
+    return (hash / DLR_MEM_SHARDS) % shard->size;
+}
+
+
+/*
+ * Double the bucket array of the shard. Caller holds the write lock.
+ */
+static void dlr_mem_shard_grow(dlr_mem_shard *shard)
+{
+    dlr_mem_node **old = shard->buckets;
+    long old_size = shard->size;
+    dlr_mem_node *node, *next, **tail;
+    long i, j;
+
+    shard->size = old_size * 2;
+    shard->buckets = gw_malloc(sizeof(shard->buckets[0]) * shard->size);
+    for (i = 0; i < shard->size; i++)
+        shard->buckets[i] = NULL;
+
+    /* keep insertion order inside the chains */
+    for (i = 0; i < old_size; i++) {
+        for (node = old[i]; node != NULL; node = next) {
+            next = node->next;
+            node->next = NULL;
+            j = dlr_mem_bucket_of(shard, node->hash);
+            for (tail = &shard->buckets[j]; *tail != NULL; tail = &(*tail)->next)
+                ;
+            *tail = node;
+        }
+    }
+    gw_free(old);
+}
+
+
+/*
+ * Unlink node from both the hash chain and the age list and destroy it.
+ * Caller holds the write lock.
+ */
+static void dlr_mem_node_delete(dlr_mem_shard *shard, dlr_mem_node *node)
+{
+    dlr_mem_node **pp;
+
+    for (pp = &shard->buckets[dlr_mem_bucket_of(shard, node->hash)]; *pp != node; pp = &(*pp)->next)
+        gw_assert(*pp != NULL);
+    *pp = node->next;
+
+    if (node->age_prev != NULL)
+        node->age_prev->age_next = node->age_next;
+    else
+        shard->oldest = node->age_next;
+    if (node->age_next != NULL)
+        node->age_next->age_prev = node->age_prev;
+    else
+        shard->newest = node->age_prev;
+
+    shard->count--;
+    counter_decrease(dlr_count);
+    dlr_entry_destroy(node->dlr);
+    gw_free(node);
+}
+
+
+/*
+ * Drop entries older than dlr_ttl from the head of the age list.
+ * Caller holds the write lock.
+ */
+static void dlr_mem_shard_expire(dlr_mem_shard *shard, time_t now)
+{
+    dlr_mem_node *node;
+
+    while ((node = shard->oldest) != NULL && node->added + dlr_ttl <= now) {
+        debug("dlr.mem", 0, "DLR[internal]: Expiring DLR smsc=%s, ts=%s, dst=%s",
+              octstr_get_cstr(node->dlr->smsc), octstr_get_cstr(node->dlr->timestamp),
+              octstr_get_cstr(node->dlr->destination));
+        dlr_mem_node_delete(shard, node);
+    }
+}
+
+
+/*
+ * Remove all entries of the shard. Caller holds the write lock.
  */
-static List *dlr_waiting_list;
-static RWLock rwlock;
+static void dlr_mem_shard_clear(dlr_mem_shard *shard)
+{
+    dlr_mem_node *node, *next;
+    long i;
+
+    for (node = shard->oldest; node != NULL; node = next) {
+        next = node->age_next;
+        dlr_entry_destroy(node->dlr);
+        gw_free(node);
+    }
+    counter_increase_with(dlr_count, -shard->count);
+    for (i = 0; i < shard->size; i++)
+        shard->buckets[i] = NULL;
+    shard->oldest = shard->newest = NULL;
+    shard->count = 0;
+}
+
 
 /*
- * Destroy dlr_waiting_list.
+ * Destroy the index.
  */
 static void dlr_mem_shutdown()
 {
-    gw_rwlock_wrlock(&rwlock);
-    gwlist_destroy(dlr_waiting_list, (gwlist_item_destructor_t *)dlr_entry_destroy);
-    gw_rwlock_unlock(&rwlock);
-    gw_rwlock_destroy(&rwlock);
+    long i;
+
+    for (i = 0; i < DLR_MEM_SHARDS; i++) {
+        gw_rwlock_wrlock(&shards[i].lock);
+        dlr_mem_shard_clear(&shards[i]);
+        gw_free(shards[i].buckets);
+        shards[i].buckets = NULL;
+        gw_rwlock_unlock(&shards[i].lock);
+        gw_rwlock_destroy(&shards[i].lock);
+    }
+    counter_destroy(dlr_count);
 }
 
 /*
@@ -91,32 +243,58 @@ static void dlr_mem_shutdown()
  */
 static long dlr_mem_messages(void)
 {
-    return gwlist_len(dlr_waiting_list);
+    return counter_value(dlr_count);
 }
 
 static void dlr_mem_flush(void)
 {
     long i;
-    long len;
-
-    gw_rwlock_wrlock(&rwlock);
-    len = gwlist_len(dlr_waiting_list);
-    for (i = 0; i < len; i++) {
-        struct dlr_entry *dlr = gwlist_get(dlr_waiting_list, 0);
-        gwlist_delete(dlr_waiting_list, 0, 1);
-        dlr_entry_destroy(dlr);
+
+    for (i = 0; i < DLR_MEM_SHARDS; i++) {
+        gw_rwlock_wrlock(&shards[i].lock);
+        dlr_mem_shard_clear(&shards[i]);
+        gw_rwlock_unlock(&shards[i].lock);
     }
-    gw_rwlock_unlock(&rwlock);
 }
 
 /*
- * add struct dlr_entry to list
+ * add struct dlr_entry to index
  */
 static void dlr_mem_add(struct dlr_entry *dlr)
 {
-    gw_rwlock_wrlock(&rwlock);
-    gwlist_append(dlr_waiting_list,dlr);
-    gw_rwlock_unlock(&rwlock);
+    dlr_mem_shard *shard;
+    dlr_mem_node *node, **tail;
+
+    node = gw_malloc(sizeof(*node));
+    node->dlr = dlr;
+    node->hash = dlr_mem_hash(dlr->smsc, dlr->timestamp);
+    node->added = time(NULL);
+    node->next = NULL;
+    node->age_next = NULL;
+
+    shard = dlr_mem_shard_of(node->hash);
+    gw_rwlock_wrlock(&shard->lock);
+
+    if (dlr_ttl > 0)
+        dlr_mem_shard_expire(shard, node->added);
+    if (shard->count >= shard->size * 2)
+        dlr_mem_shard_grow(shard);
+
+    /* append, lookups return the oldest matching entry first */
+    for (tail = &shard->buckets[dlr_mem_bucket_of(shard, node->hash)]; *tail != NULL; tail = &(*tail)->next)
+        ;
+    *tail = node;
+
+    node->age_prev = shard->newest;
+    if (shard->newest != NULL)
+        shard->newest->age_next = node;
+    else
+        shard->oldest = node;
+    shard->newest = node;
+
+    shard->count++;
+    counter_increase(dlr_count);
+    gw_rwlock_unlock(&shard->lock);
 }
 
 /*
@@ -142,26 +320,35 @@ static int dlr_mem_entry_match(struct dlr_entry *dlr, const Octstr *smsc, const
     return 1;
 }
 
+/*
+ * Find matching node in the shard. Caller holds the lock.
+ */
+static dlr_mem_node *dlr_mem_find(dlr_mem_shard *shard, unsigned long hash,
+                                  const Octstr *smsc, const Octstr *ts, const Octstr *dst)
+{
+    dlr_mem_node *node;
+
+    for (node = shard->buckets[dlr_mem_bucket_of(shard, hash)]; node != NULL; node = node->next) {
+        if (node->hash == hash && dlr_mem_entry_match(node->dlr, smsc, ts, dst) == 0)
+            return node;
+    }
+    return NULL;
+}
+
 /*
  * Find matching entry and return copy of it, otherwise NULL
  */
 static struct dlr_entry *dlr_mem_get(const Octstr *smsc, const Octstr *ts, const Octstr *dst)
 {
-    long i;
-    long len;
-    struct dlr_entry *dlr = NULL, *ret = NULL;
+    unsigned long hash = dlr_mem_hash(smsc, ts);
+    dlr_mem_shard *shard = dlr_mem_shard_of(hash);
+    dlr_mem_node *node;
+    struct dlr_entry *ret = NULL;
 
-    gw_rwlock_rdlock(&rwlock);
-    len = gwlist_len(dlr_waiting_list);
-    for (i=0; i < len; i++) {
-        dlr = gwlist_get(dlr_waiting_list, i);
-
-        if (dlr_mem_entry_match(dlr, smsc, ts, dst) == 0) {
-            ret = dlr_entry_duplicate(dlr);
-            break;
-        }
-    }
-    gw_rwlock_unlock(&rwlock);
+    gw_rwlock_rdlock(&shard->lock);
+    if ((node = dlr_mem_find(shard, hash, smsc, ts, dst)) != NULL)
+        ret = dlr_entry_duplicate(node->dlr);
+    gw_rwlock_unlock(&shard->lock);
 
     /* we couldnt find a matching entry */
     return ret;
@@ -172,22 +359,14 @@ static struct dlr_entry *dlr_mem_get(const Octstr *smsc, const Octstr *ts, const
  */
 static void dlr_mem_remove(const Octstr *smsc, const Octstr *ts, const Octstr *dst)
 {
-    long i;
-    long len;
-    struct dlr_entry *dlr = NULL;
-
-    gw_rwlock_wrlock(&rwlock);
-    len = gwlist_len(dlr_waiting_list);
-    for (i=0; i < len; i++) {
-        dlr = gwlist_get(dlr_waiting_list, i);
-
-        if (dlr_mem_entry_match(dlr, smsc, ts, dst) == 0) {
-            gwlist_delete(dlr_waiting_list, i, 1);
-            dlr_entry_destroy(dlr);
-            break;
-        }
-    }
-    gw_rwlock_unlock(&rwlock);
+    unsigned long hash = dlr_mem_hash(smsc, ts);
+    dlr_mem_shard *shard = dlr_mem_shard_of(hash);
+    dlr_mem_node *node;
+
+    gw_rwlock_wrlock(&shard->lock);
+    if ((node = dlr_mem_find(shard, hash, smsc, ts, dst)) != NULL)
+        dlr_mem_node_delete(shard, node);
+    gw_rwlock_unlock(&shard->lock);
 }
 
 static struct dlr_storage  handles = {
@@ -201,12 +380,31 @@ static struct dlr_storage  handles = {
 };
 
 /*
- * Initialize dlr_waiting_list and return out storage handles.
+ * Initialize the index and return out storage handles.
  */
 struct dlr_storage *dlr_init_mem(Cfg *cfg)
 {
-    dlr_waiting_list = gwlist_create();
-    gw_rwlock_init_static(&rwlock);
+    CfgGroup *grp;
+    long i;
+
+    dlr_ttl = 0;
+    if ((grp = cfg_get_single_group(cfg, octstr_imm("core"))) != NULL &&
+        cfg_get_integer(&dlr_ttl, grp, octstr_imm("dlr-internal-ttl")) == -1)
+        dlr_ttl = 0;
+    if (dlr_ttl < 0) {
+        warning(0, "DLR: internal: negative 'dlr-internal-ttl', entries won't expire.");
+        dlr_ttl = 0;
+    }
+
+    for (i = 0; i < DLR_MEM_SHARDS; i++) {
+        gw_rwlock_init_static(&shards[i].lock);
+        shards[i].size = DLR_MEM_MIN_BUCKETS;
+        shards[i].buckets = gw_malloc(sizeof(shards[i].buckets[0]) * shards[i].size);
+        memset(shards[i].buckets, 0, sizeof(shards[i].buckets[0]) * shards[i].size);
+        shards[i].count = 0;
+        shards[i].oldest = shards[i].newest = NULL;
+    }
+    dlr_count = counter_create();
 
     return &handles;
 }
@@ -136,6 +136,37 @@ static void dlr_mysql_add(struct dlr_entry *entry)
     dlr_entry_destroy(entry);
 }
 
+/*
+ * Add several entries with multi-row INSERTs of at most 1000 rows
+ * each, so a batch costs one round trip per thousand entries.
+ */
+#define MYSQL_BATCH_ROWS 1000
+
+static void dlr_mysql_add_batch(List *entries)
+{
+    Octstr *sql;
+    DBPoolConn *pconn;
+
+    debug("dlr.mysql", 0, "adding %ld DLR entries into database", gwlist_len(entries));
+
+    pconn = dbpool_conn_consume(pool);
+    /* just for sure */
+    if (pconn == NULL) {
+        gwlist_destroy(entries, (gwlist_item_destructor_t *) dlr_entry_destroy);
+        return;
+    }
+
+    sql = octstr_format("INSERT INTO `%S` (`%S`, `%S`, `%S`, `%S`, `%S`, `%S`, `%S`, `%S`, `%S`) VALUES ",
+                        fields->table, fields->field_smsc, fields->field_ts,
+                        fields->field_src, fields->field_dst, fields->field_serv,
+                        fields->field_url, fields->field_mask, fields->field_boxc,
+                        fields->field_status);
+    dlr_db_add_batch(pconn, sql, entries, MYSQL_BATCH_ROWS);
+
+    dbpool_conn_produce(pconn);
+    octstr_destroy(sql);
+}
+
 static struct dlr_entry* dlr_mysql_get(const Octstr *smsc, const Octstr *ts, const Octstr *dst)
 {
     Octstr *sql, *like;
@@ -353,6 +384,7 @@ static void dlr_mysql_flush(void)
 static struct dlr_storage handles = {
     .type = "mysql",
     .dlr_add = dlr_mysql_add,
+    .dlr_add_batch = dlr_mysql_add_batch,
     .dlr_get = dlr_mysql_get,
     .dlr_update = dlr_mysql_update,
     .dlr_remove = dlr_mysql_remove,
@@ -451,6 +483,7 @@ found:
 
     pool = dbpool_create(DBPOOL_MYSQL, db_conf, pool_size);
     gw_assert(pool != NULL);
+    handles.pool = pool;
 
     /*
      * XXX should a failing connect throw panic?!
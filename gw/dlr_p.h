@@ -68,6 +68,8 @@
 #ifndef	DLR_P_H
 #define	DLR_P_H 1
 
+#include "gwlib/dbpool.h"
+
 #define DLR_TRACE 1
 
 /* Used in destination based queries for EMI/UUCP DLRs */
@@ -115,6 +117,12 @@ struct dlr_storage {
      * NOTE: this function is responsible to destroy struct dlr_entry
      */
     void (*dlr_add) (struct dlr_entry *entry);
+    /*
+     * Add several dlr entries into storage at once. Optional, if present
+     * dlr_add() may queue entries and write them in the background.
+     * NOTE: this function is responsible to destroy the entries and list
+     */
+    void (*dlr_add_batch) (List *entries);
     /*
      * Find and return struct dlr_entry. If entry not found return NULL.
      * NOTE: Caller will destroy struct dlr_entry
@@ -140,6 +148,11 @@ struct dlr_storage {
      * Shutdown storage
      */
     void (*dlr_shutdown) (void);
+    /*
+     * Database pool of the storage, if it uses one. Set by the init
+     * function, only used for the status page.
+     */
+    DBPool *pool;
 };
 
 /*
@@ -163,6 +176,16 @@ struct dlr_db_fields {
 struct dlr_db_fields *dlr_db_fields_create(CfgGroup *grp);
 void dlr_db_fields_destroy(struct dlr_db_fields *fields);
 
+/*
+ * Add entries to a 'dlr-db' table using the given "INSERT INTO table
+ * (smsc, ts, src, dst, serv, url, mask, boxc, status) VALUES " prefix.
+ * Rows are written max_rows at a time, the remainder in halving chunks,
+ * so only a handful of distinct statements is ever prepared.
+ * NOTE: this function destroys the entries and the list
+ */
+void dlr_db_add_batch(DBPoolConn *pconn, const Octstr *insert, List *entries,
+                      long max_rows);
+
 /*
  * Storages we have already. This will gone in future
  * if we have module API implemented.
@@ -401,6 +401,7 @@ found:
 
     pool = dbpool_create(DBPOOL_PGSQL, db_conf, pool_size);
     gw_assert(pool != NULL);
+    handles.pool = pool;
 
     /*
      * XXX should a failing connect throw panic?!
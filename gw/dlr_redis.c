@@ -98,22 +98,14 @@ static void dlr_redis_shutdown()
     dlr_db_fields_destroy(fields);
 }
 
-static void dlr_redis_add(struct dlr_entry *entry)
+/*
+ * Return the key of an entry: table, smsc-id, timestamp and, if the
+ * destination is used, its last MIN_DST_LEN digits.
+ */
+static Octstr *dlr_redis_key(const struct dlr_entry *entry)
 {
-    Octstr *key, *sql, *os;
-    DBPoolConn *pconn;
-    List *binds;
-    int res, len;
-
-    debug("dlr.redis", 0, "Adding DLR into keystore");
-
-    pconn = dbpool_conn_consume(pool);
-    /* just for sure */
-    if (pconn == NULL) {
-        error(0, "DLR: REDIS: No connection available - dropping DLR");
-        dlr_entry_destroy(entry);
-        return;
-    }
+    Octstr *key;
+    int len;
 
     if (entry->use_dst && entry->destination) {
         Octstr *dst_min;
@@ -136,6 +128,28 @@ static void dlr_redis_add(struct dlr_entry *entry)
                 entry->timestamp);
     }
 
+    return key;
+}
+
+static void dlr_redis_add(struct dlr_entry *entry)
+{
+    Octstr *key, *sql, *os;
+    DBPoolConn *pconn;
+    List *binds;
+    int res;
+
+    debug("dlr.redis", 0, "Adding DLR into keystore");
+
+    pconn = dbpool_conn_consume(pool);
+    /* just for sure */
+    if (pconn == NULL) {
+        error(0, "DLR: REDIS: No connection available - dropping DLR");
+        dlr_entry_destroy(entry);
+        return;
+    }
+
+    key = dlr_redis_key(entry);
+
 #ifdef REDIS_PRECHECK
     binds = gwlist_create();
     sql = octstr_format("HSETNX %S %S ?", key, fields->field_smsc);
@@ -212,6 +226,93 @@ static void dlr_redis_add(struct dlr_entry *entry)
     dlr_entry_destroy(entry);
 }
 
+#ifndef REDIS_PRECHECK
+/*
+ * Add several entries with pipelined HMSET (and EXPIRE) commands, so
+ * the whole batch costs one round trip to redis.
+ */
+static void dlr_redis_add_batch(List *entries)
+{
+    struct dlr_entry *entry;
+    DBPoolConn *pconn;
+    List *cmds, *binds, *temp;
+    Octstr *sql, *key, *os, *ttl;
+    long i;
+    int res;
+
+    debug("dlr.redis", 0, "Adding %ld DLRs into keystore", gwlist_len(entries));
+
+    pconn = dbpool_conn_consume(pool);
+    /* just for sure */
+    if (pconn == NULL) {
+        error(0, "DLR: REDIS: No connection available - dropping %ld DLRs",
+              gwlist_len(entries));
+        gwlist_destroy(entries, (gwlist_item_destructor_t *) dlr_entry_destroy);
+        return;
+    }
+
+    cmds = gwlist_create();
+    temp = gwlist_create();
+    ttl = NULL;
+    if (fields->ttl) {
+        ttl = octstr_format("%ld", fields->ttl);
+        gwlist_append(temp, ttl);
+    }
+    for (i = 0; i < gwlist_len(entries); i++) {
+        entry = gwlist_get(entries, i);
+        key = dlr_redis_key(entry);
+        os = octstr_format("%d", entry->mask);
+        gwlist_append(temp, key);
+        gwlist_append(temp, os);
+
+        binds = gwlist_create();
+        gwlist_append(binds, octstr_imm("HMSET"));
+        gwlist_append(binds, key);
+        gwlist_append(binds, fields->field_smsc);
+        gwlist_append(binds, entry->smsc);
+        gwlist_append(binds, fields->field_ts);
+        gwlist_append(binds, entry->timestamp);
+        gwlist_append(binds, fields->field_src);
+        gwlist_append(binds, entry->source);
+        gwlist_append(binds, fields->field_dst);
+        gwlist_append(binds, entry->destination);
+        gwlist_append(binds, fields->field_serv);
+        gwlist_append(binds, entry->service);
+        gwlist_append(binds, fields->field_url);
+        octstr_url_encode(entry->url);
+        gwlist_append(binds, entry->url);
+        gwlist_append(binds, fields->field_mask);
+        gwlist_append(binds, os);
+        gwlist_append(binds, fields->field_boxc);
+        gwlist_append(binds, entry->boxc_id);
+        gwlist_append(cmds, binds);
+
+        if (ttl != NULL) {
+            binds = gwlist_create();
+            gwlist_append(binds, octstr_imm("EXPIRE"));
+            gwlist_append(binds, key);
+            gwlist_append(binds, ttl);
+            gwlist_append(cmds, binds);
+        }
+    }
+
+    sql = octstr_create("");
+    res = dbpool_conn_update_many(pconn, sql, cmds);
+    if (res < gwlist_len(cmds))
+        error(0, "DLR: REDIS: Error while adding %ld dlr entries, %ld of %ld commands failed",
+              gwlist_len(entries), gwlist_len(cmds) - (res > 0 ? res : 0),
+              gwlist_len(cmds));
+
+    dbpool_conn_produce(pconn);
+    octstr_destroy(sql);
+    while ((binds = gwlist_extract_first(cmds)) != NULL)
+        gwlist_destroy(binds, NULL);
+    gwlist_destroy(cmds, NULL);
+    gwlist_destroy(temp, octstr_destroy_item);
+    gwlist_destroy(entries, (gwlist_item_destructor_t *) dlr_entry_destroy);
+}
+#endif
+
 static inline void get_octstr_value(Octstr **os, const List *r, const int i)
 {
     *os = octstr_duplicate(gwlist_get((List*)r, i));
@@ -454,6 +555,9 @@ static void dlr_redis_flush(void)
 static struct dlr_storage handles = {
     .type = "redis",
     .dlr_add = dlr_redis_add,
+#ifndef REDIS_PRECHECK
+    .dlr_add_batch = dlr_redis_add_batch,
+#endif
     .dlr_get = dlr_redis_get,
     .dlr_update = dlr_redis_update,
     .dlr_remove = dlr_redis_remove,
@@ -550,6 +654,7 @@ found:
 
     pool = dbpool_create(DBPOOL_REDIS, db_conf, pool_size);
     gw_assert(pool != NULL);
+    handles.pool = pool;
 
     /*
      * Panic on failure to connect. Should we just try to reconnect?
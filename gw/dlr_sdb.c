@@ -460,6 +460,7 @@ found:
 
     pool = dbpool_create(DBPOOL_SDB, db_conf, pool_size);
     gw_assert(pool != NULL);
+    handles.pool = pool;
 
     /*
      * XXX should a failing connect throw panic?!
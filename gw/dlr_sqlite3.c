@@ -169,6 +169,37 @@ static void dlr_add_sqlite3(struct dlr_entry *entry)
     dlr_entry_destroy(entry);
 }
 
+/*
+ * Add several entries with multi-row INSERTs of at most 100 rows
+ * each, to stay below the default limit of 999 bound parameters.
+ */
+#define SQLITE3_BATCH_ROWS 100
+
+static void dlr_add_batch_sqlite3(List *entries)
+{
+    Octstr *sql;
+    DBPoolConn *pconn;
+
+    debug("dlr.sqlite3", 0, "adding %ld DLR entries into database", gwlist_len(entries));
+
+    pconn = dbpool_conn_consume(pool);
+    /* just for sure */
+    if (pconn == NULL) {
+        gwlist_destroy(entries, (gwlist_item_destructor_t *) dlr_entry_destroy);
+        return;
+    }
+
+    sql = octstr_format("INSERT INTO %S (%S, %S, %S, %S, %S, %S, %S, %S, %S) VALUES ",
+                        fields->table, fields->field_smsc, fields->field_ts,
+                        fields->field_src, fields->field_dst, fields->field_serv,
+                        fields->field_url, fields->field_mask, fields->field_boxc,
+                        fields->field_status);
+    dlr_db_add_batch(pconn, sql, entries, SQLITE3_BATCH_ROWS);
+
+    dbpool_conn_produce(pconn);
+    octstr_destroy(sql);
+}
+
 static void dlr_remove_sqlite3(const Octstr *smsc, const Octstr *ts, const Octstr *dst)
 {
     Octstr *sql, *like;
@@ -349,6 +380,7 @@ static struct dlr_storage handles = {
     .dlr_messages = dlr_messages_sqlite3,
     .dlr_shutdown = dlr_shutdown_sqlite3,
     .dlr_add = dlr_add_sqlite3,
+    .dlr_add_batch = dlr_add_batch_sqlite3,
     .dlr_get = dlr_get_sqlite3,
     .dlr_remove = dlr_remove_sqlite3,
     .dlr_update = dlr_update_sqlite3,
@@ -408,6 +440,7 @@ struct dlr_storage *dlr_init_sqlite3(Cfg *cfg)
 
     pool = dbpool_create(DBPOOL_SQLITE3, db_conf, pool_size);
     gw_assert(pool != NULL);
+    handles.pool = pool;
 
     if (dbpool_conn_count(pool) == 0)
         panic(0, "DLR: SQLite3: Could not establish sqlite3 connection(s).");
@@ -63,10 +63,25 @@
 #include "gwlib/gwlib.h"
 #include "load.h"
 
+/*
+ * Increases only add to a counter of the calling thread's slot, so the
+ * per-message path takes no lock and reads no clock. The slots are
+ * summed up in load_get(), which also advances the measure windows:
+ * each interval remembers the total count and the time its current
+ * window started, and the load is the difference to the current total.
+ */
+#define LOAD_SLOTS 16
+
+struct load_slot {
+    unsigned long long count;
+    /* keep slots of different threads in different cache lines */
+    char pad[64 - sizeof(unsigned long long)];
+};
+
 
 struct load_entry {
     float prev;
-    float curr;
+    unsigned long long base;
     double last;
     int interval;
     int dirty;
@@ -74,10 +89,11 @@ struct load_entry {
 
 
 struct load {
+    struct load_slot slots[LOAD_SLOTS];
     struct load_entry **entries;
     int len;
     int heuristic;
-    RWLock *lock;
+    Mutex *lock;
 };
 
 static double microtime(double *p) {
@@ -94,15 +110,29 @@ static double microtime(double *p) {
     return result;
 }
 
+
+static unsigned long long load_total(struct load *load)
+{
+    unsigned long long total = 0;
+    int i;
+
+    for (i = 0; i < LOAD_SLOTS; i++)
+        total += __atomic_load_n(&load->slots[i].count, __ATOMIC_RELAXED);
+
+    return total;
+}
+
+
 Load* load_create_real(int heuristic)
 {
     struct load *load;
     
     load = gw_malloc(sizeof(*load));
+    memset(load->slots, 0, sizeof(load->slots));
     load->len = 0;
     load->entries = NULL;
     load->heuristic = heuristic;
-    load->lock = gw_rwlock_create();
+    load->lock = mutex_create();
     
     return load;
 }
@@ -116,18 +146,19 @@ int load_add_interval(Load *load, int interval)
     if (load == NULL)
         return -1;
     
-    gw_rwlock_wrlock(load->lock);
+    mutex_lock(load->lock);
     
     /* first look if we have equal interval added already */
     for (i = 0; i < load->len; i++) {
         if (load->entries[i]->interval == interval) {
-            gw_rwlock_unlock(load->lock);
+            mutex_unlock(load->lock);
             return -1;
         }
     }
     /* so no equal interval there, add new one */
     entry = gw_malloc(sizeof(struct load_entry));
-    entry->prev = entry->curr = 0.0;
+    entry->prev = 0.0;
+    entry->base = load_total(load);
     entry->interval = interval;
     entry->dirty = 1;
     microtime(&entry->last);
@@ -136,7 +167,7 @@ int load_add_interval(Load *load, int interval)
     load->entries[load->len] = entry;
     load->len++;
     
-    gw_rwlock_unlock(load->lock);
+    mutex_unlock(load->lock);
     
     return 0;
 }
@@ -153,38 +184,18 @@ void load_destroy(Load *load)
         gw_free(load->entries[i]);
     }
     gw_free(load->entries);
-    gw_rwlock_destroy(load->lock);
+    mutex_destroy(load->lock);
     gw_free(load);
 }
 
 
 void load_increase_with(Load *load, unsigned long value)
 {
-    double now;
-    int i;
-    
     if (load == NULL)
         return;
 
-    gw_rwlock_wrlock(load->lock);
-    microtime(&now);
-    for (i = 0; i < load->len; i++) {
-        struct load_entry *entry = load->entries[i];
-        /* check for special case, load over whole live time */
-        if((entry->interval != -1 && now >= entry->last + entry->interval)) { 
-            /* rotate */
-            entry->curr /= entry->interval;
-            if (entry->prev > 0)
-                entry->prev = (2*entry->curr + entry->prev)/3;
-            else
-                entry->prev = entry->curr;
-            entry->last = now;
-            entry->curr = 0.0;
-            entry->dirty = 0;
-        }
-        entry->curr += value;
-    }
-    gw_rwlock_unlock(load->lock);
+    __atomic_add_fetch(&load->slots[(unsigned long) gwthread_self() % LOAD_SLOTS].count,
+                       value, __ATOMIC_RELAXED);
 }
 
 
@@ -192,27 +203,42 @@ double load_get(Load *load, int pos)
 {
     double ret;
     double now;
+    unsigned long long total;
     struct load_entry *entry;
 
-    if (load == NULL || pos >= load->len) {
+    if (load == NULL)
         return -1.0;
-    }
 
-    /* first maybe rotate load */
-    load_increase_with(load, 0);
-    
+    mutex_lock(load->lock);
+    if (pos >= load->len) {
+        mutex_unlock(load->lock);
+        return -1.0;
+    }
+    total = load_total(load);
     microtime(&now);
-    gw_rwlock_rdlock(load->lock);
     entry = load->entries[pos];
+    /* check for special case, load over whole live time */
+    if (entry->interval != -1 && now >= entry->last + entry->interval) {
+        /* rotate, the window may have been longer if nobody asked */
+        float curr = (total - entry->base) / (now - entry->last);
+        if (entry->prev > 0)
+            entry->prev = (2*curr + entry->prev)/3;
+        else
+            entry->prev = curr;
+        entry->last = now;
+        entry->base = total;
+        entry->dirty = 0;
+    }
     if (load->heuristic && !entry->dirty) {
         ret = entry->prev;
     } else {
+        double curr = total - entry->base;
         double diff = (now - entry->last);
         if (diff == 0) diff = 1;
-        ret = entry->curr/diff;
-        ret = (ret > entry->curr ? entry->curr : ret);
+        ret = curr/diff;
+        ret = (ret > curr ? curr : ret);
     }
-    gw_rwlock_unlock(load->lock);
+    mutex_unlock(load->lock);
 
     return ret;
 }
@@ -223,8 +249,8 @@ int load_len(Load *load)
     int ret;
     if (load == NULL)
         return 0;
-    gw_rwlock_rdlock(load->lock);
+    mutex_lock(load->lock);
     ret = load->len;
-    gw_rwlock_unlock(load->lock);
+    mutex_unlock(load->lock);
     return ret;
 }
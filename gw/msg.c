@@ -80,9 +80,17 @@ static void append_string(Octstr *os, Octstr *field);
 static void append_uuid(Octstr *os, uuid_t id);
 
 static int parse_integer(long *i, Octstr *packed, int *off);
-static int parse_string(Octstr **os, Octstr *packed, int *off);
+static int parse_string(Octstr **os, Octstr *packed, int *off, int intern);
 static int parse_uuid(uuid_t id, Octstr *packed, int *off);
 
+static void append_varint(Octstr *os, long i);
+static void append_packed_string(Octstr *os, Octstr *field);
+static int parse_varint(long *i, const unsigned char **p, const unsigned char *end);
+static int parse_packed_string(Octstr **os, const unsigned char **p,
+                               const unsigned char *end, int intern);
+
+static int is_interned_field(Msg *msg, Octstr **field);
+
 static char *type_as_str(Msg *msg);
 
 
@@ -98,6 +106,8 @@ Msg *msg_create_real(enum msg_type type, const char *file, long line,
     msg = gw_malloc_trace(sizeof(Msg), file, line, func);
 
     msg->type = type;
+    msg->refs = 0;
+    memset(msg->stamps, 0, sizeof(msg->stamps));
 #define INTEGER(name) p->name = MSG_PARAM_UNDEFINED;
 #define OCTSTR(name) p->name = NULL;
 #define UUID(name) uuid_generate(p->name);
@@ -113,10 +123,13 @@ Msg *msg_duplicate(Msg *msg)
     Msg *new;
 
     new = msg_create(msg->type);
+    memcpy(new->stamps, msg->stamps, sizeof(new->stamps));
 
 #define INTEGER(name) p->name = q->name;
 #define OCTSTR(name) \
     if (q->name == NULL) p->name = NULL; \
+    else if (is_interned_field(new, &p->name)) \
+        p->name = octstr_intern(q->name); \
     else p->name = octstr_duplicate(q->name);
 #define UUID(name) uuid_copy(p->name, q->name);
 #define VOID(name) p->name = q->name;
@@ -129,11 +142,73 @@ Msg *msg_duplicate(Msg *msg)
     return new;
 }
 
+Msg *msg_share(Msg *msg)
+{
+    Msg *new;
+
+    /* not msg_create, all fields get set and the uuid is copied anyway */
+    new = gw_malloc(sizeof(Msg));
+    new->type = msg->type;
+    new->refs = 0;
+    memcpy(new->stamps, msg->stamps, sizeof(new->stamps));
+
+#define INTEGER(name) p->name = q->name;
+#define OCTSTR(name) p->name = octstr_share(q->name);
+#define UUID(name) uuid_copy(p->name, q->name);
+#define VOID(name) p->name = q->name;
+#define MSG(type, stmt) { \
+    struct type *p = &new->type; \
+    struct type *q = &msg->type; \
+    stmt }
+#include "msg-decl.h"
+
+    return new;
+}
+
+Msg *msg_ref(Msg *msg)
+{
+    gw_assert(msg != NULL);
+
+    __atomic_add_fetch(&msg->refs, 1, __ATOMIC_RELAXED);
+    return msg;
+}
+
+void msg_stamp(Msg *msg, enum msg_stage stage)
+{
+    struct timeval tv;
+    int i;
+
+    gettimeofday(&tv, NULL);
+    msg->stamps[stage] = tv.tv_sec * 1000000LL + tv.tv_usec;
+    /* a message routed again must not keep the stamps of the last try */
+    for (i = stage + 1; i < msg_stage_count; i++)
+        msg->stamps[i] = 0;
+}
+
+Msg *msg_unshare(Msg *msg)
+{
+    Msg *new;
+
+    gw_assert(msg != NULL);
+
+    if (__atomic_load_n(&msg->refs, __ATOMIC_ACQUIRE) == 0)
+        return msg;
+
+    new = msg_share(msg);
+    msg_destroy(msg);
+    return new;
+}
+
 void msg_destroy(Msg *msg)
 {
     if (msg == NULL)
         return;
 
+    /* other holders left, they keep the fields */
+    if (__atomic_load_n(&msg->refs, __ATOMIC_ACQUIRE) > 0 &&
+        __atomic_fetch_sub(&msg->refs, 1, __ATOMIC_ACQ_REL) > 0)
+        return;
+
 #define INTEGER(name) p->name = 0;
 #define OCTSTR(name) octstr_destroy(p->name);
 #define UUID(name) uuid_clear(p->name);
@@ -222,7 +297,8 @@ Msg *msg_unpack_real(Octstr *os, const char *file, long line, const char *func)
 #define INTEGER(name) \
     if (parse_integer(&(p->name), os, &off) == -1) goto error;
 #define OCTSTR(name) \
-    if (parse_string(&(p->name), os, &off) == -1) goto error;
+    if (parse_string(&(p->name), os, &off, \
+                     is_interned_field(msg, &(p->name))) == -1) goto error;
 #define UUID(name) \
     if (parse_uuid(p->name, os, &off) == -1) goto error;
 #define VOID(name)
@@ -259,6 +335,87 @@ inline Msg *msg_unpack_wrapper(Octstr *os)
 }
 
 
+void msg_pack_packed(Msg *msg, Octstr *os)
+{
+    octstr_append_char(os, MSG_PACKED_VERSION);
+    append_varint(os, msg->type);
+
+#define INTEGER(name) append_varint(os, p->name);
+#define OCTSTR(name) append_packed_string(os, p->name);
+#define UUID(name) octstr_append_data(os, (char *) p->name, sizeof(uuid_t));
+#define VOID(name)
+#define MSG(type, stmt) \
+    case type: { struct type *p = &msg->type; stmt } break;
+
+    switch (msg->type) {
+#include "msg-decl.h"
+    default:
+        panic(0, "Internal error: unknown message type: %d",
+              msg->type);
+    }
+}
+
+
+Msg *msg_unpack_slice_real(Octstr *os, long off, long len, const char *file,
+                           long line, const char *func)
+{
+    Msg *msg;
+    Octstr *copy;
+    const unsigned char *p, *end;
+    long i;
+
+    if (off < 0 || len < 0 || off + len > octstr_len(os))
+        return NULL;
+
+    /* old format, just cut it out */
+    if (len == 0 || octstr_get_char(os, off) != MSG_PACKED_VERSION) {
+        copy = octstr_copy(os, off, len);
+        msg = msg_unpack_real(copy, file, line, func);
+        octstr_destroy(copy);
+        return msg;
+    }
+
+    p = (const unsigned char *) octstr_get_cstr(os) + off + 1;
+    end = p + len - 1;
+
+    msg = msg_create_real(0, file, line, func);
+    if (parse_varint(&i, &p, end) == -1)
+        goto error;
+    msg->type = i;
+
+#define INTEGER(name) \
+    if (parse_varint(&(q->name), &p, end) == -1) goto error;
+#define OCTSTR(name) \
+    if (parse_packed_string(&(q->name), &p, end, \
+                            is_interned_field(msg, &(q->name))) == -1) \
+        goto error;
+#define UUID(name) \
+    if (end - p < (long) sizeof(uuid_t)) goto error; \
+    memcpy(q->name, p, sizeof(uuid_t)); \
+    p += sizeof(uuid_t);
+#define VOID(name)
+#define MSG(type, stmt) \
+    case type: { struct type *q = &(msg->type); stmt } break;
+
+    switch (msg->type) {
+#include "msg-decl.h"
+    default:
+        error(0, "Internal error: unknown message type: %d",
+              msg->type);
+        msg->type = 0;
+        msg_destroy(msg);
+        return NULL;
+    }
+
+    return msg;
+
+error:
+    msg_destroy(msg);
+    error(0, "Packed Msg packet was invalid.");
+    return NULL;
+}
+
+
 /**********************************************************************
  * Implementations of private functions.
  */
@@ -308,7 +465,7 @@ static int parse_integer(long *i, Octstr *packed, int *off)
 }
 
 
-static int parse_string(Octstr **os, Octstr *packed, int *off)
+static int parse_string(Octstr **os, Octstr *packed, int *off, int intern)
 {
     long len;
 
@@ -322,7 +479,10 @@ static int parse_string(Octstr **os, Octstr *packed, int *off)
 
     /* XXX check that len is ok */
 
-    *os = octstr_copy(packed, *off, len);
+    if (intern && len >= 0 && *off + len <= octstr_len(packed))
+        *os = octstr_intern_data(octstr_get_cstr(packed) + *off, len);
+    else
+        *os = octstr_copy(packed, *off, len);
     if (*os == NULL)
         return -1;
     *off += len;
@@ -335,7 +495,7 @@ static int parse_uuid(uuid_t id, Octstr *packed, int *off)
 {
    Octstr *tmp = NULL;
 
-   if (parse_string(&tmp, packed, off) == -1) {
+   if (parse_string(&tmp, packed, off, 0) == -1) {
        octstr_destroy(tmp);
        return -1;
    }
@@ -350,6 +510,92 @@ static int parse_uuid(uuid_t id, Octstr *packed, int *off)
    return 0;
 }
 
+
+static void append_varint(Octstr *os, long i)
+{
+    unsigned char buf[10];
+    unsigned long u;
+    int n = 0;
+
+    /* zigzag, so that the frequent -1 (MSG_PARAM_UNDEFINED) is one byte */
+    u = ((unsigned long) i << 1) ^ (unsigned long) (i >> (sizeof(long) * 8 - 1));
+    while (u >= 0x80) {
+        buf[n++] = (u & 0x7f) | 0x80;
+        u >>= 7;
+    }
+    buf[n++] = u;
+    octstr_append_data(os, (char *) buf, n);
+}
+
+
+static void append_packed_string(Octstr *os, Octstr *field)
+{
+    if (field == NULL)
+        append_varint(os, 0);
+    else {
+        append_varint(os, octstr_len(field) + 1);
+        octstr_append(os, field);
+    }
+}
+
+
+static int parse_varint(long *i, const unsigned char **p, const unsigned char *end)
+{
+    unsigned long u = 0;
+    int shift = 0;
+
+    do {
+        if (*p >= end || shift >= (int) sizeof(long) * 8) {
+            error(0, "Packet too short while unpacking Msg.");
+            return -1;
+        }
+        u |= (unsigned long) (**p & 0x7f) << shift;
+        shift += 7;
+    } while (*(*p)++ & 0x80);
+
+    *i = (long) (u >> 1) ^ -(long) (u & 1);
+    return 0;
+}
+
+
+static int parse_packed_string(Octstr **os, const unsigned char **p,
+                               const unsigned char *end, int intern)
+{
+    long len;
+
+    if (parse_varint(&len, p, end) == -1)
+        return -1;
+    if (len == 0) {
+        *os = NULL;
+        return 0;
+    }
+    len--;
+    if (len < 0 || len > end - *p) {
+        error(0, "Packet too short while unpacking Msg.");
+        return -1;
+    }
+    if (intern)
+        *os = octstr_intern_data((char *) *p, len);
+    else
+        *os = octstr_create_from_data((char *) *p, len);
+    *p += len;
+    return 0;
+}
+
+
+/*
+ * The sms fields which only carry a handful of distinct values, taken
+ * from the configuration: service names and smsbox ids. They are
+ * interned when a message is unpacked or duplicated, so all messages
+ * share one immutable copy. Interned strings are never freed, so fields
+ * clients can set, such as the account or the smsc-id (smsc= of
+ * sendsms), must not be interned.
+ */
+static int is_interned_field(Msg *msg, Octstr **field)
+{
+    return field == &msg->sms.service || field == &msg->sms.boxc_id;
+}
+
 static char *type_as_str(Msg *msg)
 {
     switch (msg->type) {
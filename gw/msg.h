@@ -76,8 +76,25 @@ enum msg_type {
 	msg_type_count
 };
 
+/*
+ * Stages an sms passes in bearerbox, see msg_stamp(). Not packed, the
+ * stamps only live as long as the Msg stays in one process.
+ */
+enum msg_stage {
+	MSG_STAGE_ACCEPT = 0,	/* received from a box */
+	MSG_STAGE_ROUTE,	/* entered routing */
+	MSG_STAGE_QUEUE,	/* handed to an SMSC connection */
+	MSG_STAGE_SUBMIT,	/* written to the SMSC, if the driver tells */
+	MSG_STAGE_SENT,		/* acknowledged by the SMSC */
+	msg_stage_count
+};
+
 typedef struct {
 	enum msg_type type;
+	/* holders besides the creator, see msg_ref() */
+	int refs;
+	/* microseconds since the epoch each stage was reached, 0 if not */
+	long long stamps[msg_stage_count];
 
 	#define INTEGER(name) long name;
 	#define OCTSTR(name) Octstr *name;
@@ -142,6 +159,38 @@ Msg *msg_create_real(enum msg_type type, const char *file, long line,
  */
 Msg *msg_duplicate(Msg *msg);
 
+/*
+ * Create a new Msg object that shares all Octstr fields with an existing
+ * one using octstr_share(), so only the Msg itself is allocated. The
+ * shared fields become immutable in both messages; replace a field with
+ * a copy of its own before modifying it.
+ */
+Msg *msg_share(Msg *msg);
+
+/*
+ * Take another reference to an existing Msg object and return it. The
+ * Msg is destroyed when msg_destroy() has been called once for the
+ * creator and once for every msg_ref(). As long as there is more than
+ * one holder, none of them may modify the Msg; use msg_unshare() first.
+ */
+Msg *msg_ref(Msg *msg);
+
+/*
+ * Record that msg has reached the given stage now and forget the stamps
+ * of all later stages. Copies made with msg_duplicate() or msg_share()
+ * keep the stamps of the original.
+ */
+void msg_stamp(Msg *msg, enum msg_stage stage);
+
+/*
+ * Return a Msg the caller may modify. This is msg itself if the caller
+ * is its only holder. Otherwise the caller's reference to msg is given
+ * up and a private copy, made with msg_share(), is returned instead.
+ * Octstr fields of the copy are still shared and must be replaced, not
+ * modified in place.
+ */
+Msg *msg_unshare(Msg *msg);
+
 
 /*
  * Return type of the message
@@ -150,7 +199,8 @@ enum msg_type msg_type(Msg *msg);
 
 
 /*
- * Destroy an Msg object. All fields are also destroyed.
+ * Destroy an Msg object. All fields are also destroyed. If other holders
+ * took a reference with msg_ref(), only the caller's reference is given up.
  */
 void msg_destroy(Msg *msg);
 
@@ -184,4 +234,33 @@ Msg *msg_unpack_real(Octstr *os, const char *file, long line, const char *func);
     gw_claim_area(msg_unpack_real((os), __FILE__, __LINE__, __func__))
 Msg *msg_unpack_wrapper(Octstr *os);
 
+
+/*
+ * Compact binary format used on the link between bearerbox and the boxes
+ * once both sides agreed on it (see cmd_feature). Integers are zigzag
+ * varints, strings a varint length + 1 (0 for NULL) followed by the data
+ * and UUIDs 16 raw bytes. The first byte is MSG_PACKED_VERSION, which
+ * never starts a msg_pack() packet, so readers can accept both formats.
+ */
+#define MSG_PACKED_VERSION 0x82
+
+/* Feature name sent in admin.boxc_id of a cmd_feature message */
+#define MSG_FEATURE_PACKED "packed-msg"
+
+/*
+ * Append the packed form of an Msg to `os'.
+ */
+void msg_pack_packed(Msg *msg, Octstr *os);
+
+
+/*
+ * Unpack an Msg from `len' bytes of `os' starting at `off', either in
+ * packed or in msg_pack() format. The data is not copied out of `os'
+ * first. Return NULL for failure.
+ */
+Msg *msg_unpack_slice_real(Octstr *os, long off, long len, const char *file,
+                           long line, const char *func);
+#define msg_unpack_slice(os, off, len) \
+    gw_claim_area(msg_unpack_slice_real((os), (off), (len), __FILE__, __LINE__, __func__))
+
 #endif
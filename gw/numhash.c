@@ -53,7 +53,6 @@
  * Portions of this software are based upon software originally written at  
  * WapIT Ltd., Helsinki, Finland for the Kannel project.  
  */ 
-
 /*
  * numhash.c
  *
@@ -65,6 +64,17 @@
  * notes: read header file
  *
  * Kalle Marjola for project Kannel 1999-2000
+ *
+ * The numbers are no longer hashed but kept as a sorted, Elias-Fano
+ * coded sequence of keys, stored relative to the smallest one so that
+ * lists of numbers sharing a long common prefix stay compact and their
+ * buckets short: the low 'low_bits' bits of each key are
+ * stored verbatim in a packed bit array, the remaining high part in
+ * unary in a second bit array, where key i sets bit (key >> low_bits) + i.
+ * This needs about 2 + log2(key range / numbers) bits per number. To
+ * find the keys with a given high part h we need the position of the
+ * h'th zero bit in the high array, which is found from a sample of
+ * every ZERO_SAMPLE'th zero and a short scan.
  */
 
 #include <stdlib.h>
@@ -76,137 +86,262 @@
 #include "numhash.h"
 
 
-#define NUMHASH_AUTO_HASH -1
-
-/* set of pre-calculated prime numbers for hash generation... */
-
-static int primes[] = {
-  101, 503, 1009, 2003, 3001, 5003, 7001,
-  10007, 20011, 30011, 40009, 50021, 60013, 70001, 80021, 90001,
-  100003, 150001, 200003, 300007, 400009, 500009, 600011, 700001,
-  800011, 900001, 1000003, 1100009, 1200007, 1300021, 1400017, 1500007,
-  1600033, 1700021, 1800017, 1900009, 2000003, 3000017, 4000037, 5000111,
-  6000101, 7000127, 8000051, -1
-};
+#define ZERO_SAMPLE 256
+#define PREFIX_MAX 19
 
 struct numhash_table {
-  struct numhash_number *numbers;
-  long			number_total;
-  long			table_size;
-  struct numhash_number	**hash;
-  long			hash_size;
+    long		number_total;	/* distinct numbers */
+    unsigned long long	min_key;	/* keys are stored relative to this */
+    unsigned long long	max_key;
+    int			low_bits;
+    unsigned long long	*low;
+    unsigned long long	*high;
+    long		high_len;	/* in bits */
+    long		*zeros;		/* position of every ZERO_SAMPLE'th zero */
+    long		zeros_len;
+    /* prefix entries, sorted by value for each prefix length */
+    unsigned long long	*prefixes[PREFIX_MAX + 1];
+    long		prefix_count[PREFIX_MAX + 1];
+    long		prefix_total;
 }; /* Numhash */
 
-struct numhash_number {
-  long long		key;	/* (hopefully) unique key */
-  struct numhash_number	*next;	/* next in hash table, if any */
-};
 
+static int	precision = 19;		/* the precision (last numbers) used */
 
-struct nh_entry {
-    Numhash		*hash;
-    struct nh_entry	*next;
-};
-    
-struct numhashes {
-    struct nh_entry	*first;
-    struct nh_entry 	*last;
-}; /* Multitable */
 
+static unsigned long long get_bits(const unsigned long long *words, long pos, int width)
+{
+    long w = pos >> 6;
+    int off = pos & 63;
+    unsigned long long v;
+
+    if (width == 0)
+        return 0;
+    v = words[w] >> off;
+    if (off + width > 64)
+        v |= words[w + 1] << (64 - off);
+    return (width == 64 ? v : v & ((1ULL << width) - 1));
+}
 
-static int	precision = 19;		/* the precision (last numbers) used */
 
-/*
- * add new item (number) to hash table
- */
-static int add_item(Numhash *table, struct numhash_number *nro)
+static void set_bits(unsigned long long *words, long pos, int width, unsigned long long v)
 {
-    if (table->hash[nro->key % table->hash_size]) {    /* conflict */
-	struct numhash_number *ptr = table->hash[nro->key % table->hash_size];
+    long w = pos >> 6;
+    int off = pos & 63;
+
+    if (width == 0)
+        return;
+    words[w] |= v << off;
+    if (off + width > 64)
+        words[w + 1] |= v >> (64 - off);
+}
 
-	if (ptr->key == nro->key)
-	    goto duplicate;
 
-	while(ptr->next) {
-	    ptr = ptr->next;
-	    if (ptr->key == nro->key)
-		goto duplicate;
-	}
-	ptr->next = nro;				/* put as last of the linkage */
-    } else
-	table->hash[nro->key % table->hash_size] = nro;
+/* position of the k'th (from 0) zero bit in the high array */
+static long select_zero(Numhash *table, long k)
+{
+    unsigned long long bits;
+    long pos, w, left;
+    int c;
+
+    pos = table->zeros[k / ZERO_SAMPLE];
+    left = k % ZERO_SAMPLE;
+    if (left == 0)
+        return pos;
+
+    pos++;
+    w = pos >> 6;
+    bits = ~table->high[w] & (~0ULL << (pos & 63));
+    for (;;) {
+        c = __builtin_popcountll(bits);
+        if (c >= left)
+            break;
+        left -= c;
+        bits = ~table->high[++w];
+    }
+    while (--left > 0)
+        bits &= bits - 1;
+    return w * 64 + __builtin_ctzll(bits);
+}
 
-    return 0;
 
-duplicate:
-    warning(0, "Duplicate number %lld!", nro->key);
-    return -1;
+static int cmp_key(const void *a, const void *b)
+{
+    unsigned long long x = *(const unsigned long long *) a;
+    unsigned long long y = *(const unsigned long long *) b;
+
+    return (x < y ? -1 : x > y);
 }
 
-/* Add a new number to number list and hash
- * Return 0 if all went ok, -1 if out of room
+
+/*
+ * Sort keys, drop duplicates and return the number of distinct keys.
  */
-static int numhash_add_number(Numhash *table, char *nro)
+static long sort_keys(unsigned long long *keys, long n)
 {
-    struct numhash_number *newnro;
-
-    if (table->number_total == table->table_size) {
-	error(0, "Table limit %ld reached, cannot add %s!",
-	      table->table_size, nro);
-	return -1;
+    long i, j;
+
+    if (n == 0)
+        return 0;
+    qsort(keys, n, sizeof(*keys), cmp_key);
+    for (i = 1, j = 1; i < n; i++) {
+        if (keys[i] == keys[j - 1])
+            warning(0, "Duplicate number %llu!", keys[i]);
+        else
+            keys[j++] = keys[i];
     }
-    newnro =  &table->numbers[table->number_total++]; /* take the next free */
+    return j;
+}
 
-    newnro->key = numhash_get_char_key(nro);
-    newnro->next = NULL;
 
-    add_item(table, newnro);
+/*
+ * Build the Elias-Fano index out of n sorted distinct keys.
+ */
+static void encode_keys(Numhash *table, const unsigned long long *keys, long n)
+{
+    unsigned long long ratio, x;
+    long i, pos, zeros, words;
+    int l;
+
+    table->number_total = n;
+    table->min_key = (n > 0 ? keys[0] : 0);
+    table->max_key = (n > 0 ? keys[n - 1] : 0);
+    ratio = (n > 0 ? (table->max_key - table->min_key) / n + 1 : 1);
+    table->low_bits = l = (ratio > 1 ? 63 - __builtin_clzll(ratio) : 0);
+
+    words = (n * l) / 64 + 2;
+    table->low = gw_malloc(words * sizeof(*table->low));
+    memset(table->low, 0, words * sizeof(*table->low));
+
+    table->high_len = n + (long) ((table->max_key - table->min_key) >> l) + 1;
+    words = table->high_len / 64 + 2;
+    table->high = gw_malloc(words * sizeof(*table->high));
+    memset(table->high, 0, words * sizeof(*table->high));
+
+    for (i = 0; i < n; i++) {
+        x = keys[i] - table->min_key;
+        set_bits(table->low, i * l, l, x & ((1ULL << l) - 1));
+        pos = (long) (x >> l) + i;
+        table->high[pos >> 6] |= 1ULL << (pos & 63);
+    }
 
-    return 0;
+    zeros = table->high_len - n;
+    table->zeros_len = zeros / ZERO_SAMPLE + 1;
+    table->zeros = gw_malloc(table->zeros_len * sizeof(*table->zeros));
+    for (pos = 0, zeros = 0; pos < table->high_len; pos++) {
+        if (table->high[pos >> 6] & (1ULL << (pos & 63)))
+            continue;
+        if (zeros % ZERO_SAMPLE == 0)
+            table->zeros[zeros / ZERO_SAMPLE] = pos;
+        zeros++;
+    }
 }
 
 
-/* Init the number table and hash table with given sizes
- */
-static Numhash *numhash_init(int max_numbers, int hash_size)
+static int find_prefix(Numhash *table, const char *nro)
 {
-    Numhash	*ntable = NULL;
-
-    ntable = gw_malloc(sizeof(Numhash));
-
-    if (hash_size > 0)
-	ntable->hash_size = hash_size;
-    else if (hash_size == NUMHASH_AUTO_HASH) {
-	int i;
-	for(i=0 ; primes[i] > 0; i++) {
-	    ntable->hash_size = primes[i];
-	    if (ntable->hash_size > max_numbers)
-		break;
-	}
-    } else {
-	gw_free(ntable);
-	return NULL;
-    }
-    ntable->hash = gw_malloc(ntable->hash_size * sizeof(struct numhash_number *));
-    memset(ntable->hash, 0, sizeof(struct numhash_number *) * ntable->hash_size);
+    unsigned long long value = 0;
+    long lo, hi, mid;
+    int len;
 
-    ntable->table_size = max_numbers;
-    ntable->numbers = gw_malloc(ntable->table_size * sizeof(struct numhash_number));
+    if (*nro == '+')
+        nro++;
+    for (len = 1; len <= PREFIX_MAX && isdigit(*nro); len++, nro++) {
+        value = value * 10 + (*nro - '0');
+        if (table->prefix_count[len] == 0)
+            continue;
+        lo = 0;
+        hi = table->prefix_count[len] - 1;
+        while (lo <= hi) {
+            mid = (lo + hi) / 2;
+            if (table->prefixes[len][mid] == value)
+                return 1;
+            if (table->prefixes[len][mid] < value)
+                lo = mid + 1;
+            else
+                hi = mid - 1;
+        }
+    }
+    return 0;
+}
 
-    ntable->number_total = 0;
 
-    /* set our accuracy according to the size of long int
-     * Ok, we call this many times if we use multiple tables, but
-     * that is not a problem...
-     */
+/*
+ * Parse a list in the format described in numhash.h.
+ */
+static Numhash *numhash_parse(char *data)
+{
+    Numhash *table;
+    unsigned long long *keys, *prefixes[PREFIX_MAX + 1];
+    long n, len, lines, prefix_count[PREFIX_MAX + 1];
+    int	loc;
+    char *ptr, numbuf[100];
+
+    table = gw_malloc(sizeof(Numhash));
+    memset(table, 0, sizeof(Numhash));
+    memset(prefixes, 0, sizeof(prefixes));
+    memset(prefix_count, 0, sizeof(prefix_count));
+
+    /* set our accuracy according to the size of long int */
     if (sizeof(long long) >= 16)
         precision = 38;
     else if (sizeof(long long) >= 8)
         precision = 19;
 
-    return ntable;
-}
+    for (lines = 0, ptr = data; *ptr; ptr++)
+        if (*ptr == '\n')
+            lines++;
+    debug("numhash", 0, "Total %ld lines", lines);
 
+    keys = gw_malloc((lines + 1) * sizeof(*keys));
+    n = 0;
+
+    while((ptr = strchr(data, '\n'))) {	/* each line is ended with linefeed */
+	*ptr = '\0';
+	while(*data != '\0' && isspace(*data))
+	    data++;
+	if (*data != '#') {
+	    loc = 0;
+	    while (*data != '\0' && loc < (int) sizeof(numbuf) - 1) {
+		if (isdigit(*data))
+		    numbuf[loc++] = *data;
+		else if (*data == ' ' || *data == '+' || *data == '-')
+			;
+		else break;
+		data++;
+	    }
+	    numbuf[loc] = '\0';
+	    if (loc && *data == '*') {
+		/* prefix, matches every number starting with it */
+		len = loc;
+		if (len > PREFIX_MAX) {
+		    warning(0, "Prefix '%s' too long, ignored", numbuf);
+		} else {
+		    prefixes[len] = gw_realloc(prefixes[len],
+		        (prefix_count[len] + 1) * sizeof(**prefixes));
+		    prefixes[len][prefix_count[len]++] = strtoull(numbuf, NULL, 10);
+		}
+	    } else if (loc) {
+		keys[n++] = numhash_get_char_key(numbuf);
+	    }
+	    else
+		warning(0, "Corrupted line '%s'", data);
+	}
+	data = ptr+1;	/* next row... */
+    }
+
+    n = sort_keys(keys, n);
+    encode_keys(table, keys, n);
+    gw_free(keys);
+
+    for (len = 1; len <= PREFIX_MAX; len++) {
+        table->prefix_count[len] = sort_keys(prefixes[len], prefix_count[len]);
+        table->prefixes[len] = prefixes[len];
+        table->prefix_total += table->prefix_count[len];
+    }
+
+    return table;
+}
 
 
 /*------------------------------------------------------
@@ -221,18 +356,36 @@ int numhash_find_number(Numhash *table, Octstr *nro)
     if (key < 0)
         return key;
 
-    return numhash_find_key(table, key);
+    if (numhash_find_key(table, key))
+        return 1;
+
+    return (table->prefix_total > 0 && find_prefix(table, octstr_get_cstr(nro)));
 }
 
 
 int numhash_find_key(Numhash *table, long long key)
 {
-    struct numhash_number *ptr;
-
-    ptr = table->hash[key % table->hash_size];
-    while (ptr) {
-	if (ptr->key == key) return 1;
-	ptr = ptr->next;
+    unsigned long long x = key, high, low;
+    long pos, i;
+    int l = table->low_bits;
+
+    if (key < 0 || table->number_total == 0 ||
+        x < table->min_key || x > table->max_key)
+        return 0;
+
+    x -= table->min_key;
+    high = x >> l;
+    low = x & ((1ULL << l) - 1);
+
+    /* keys with this high part start right after the high'th zero */
+    pos = (high == 0 ? 0 : select_zero(table, high - 1) + 1);
+    for (i = pos - high; pos < table->high_len &&
+         (table->high[pos >> 6] & (1ULL << (pos & 63))); pos++, i++) {
+        unsigned long long v = get_bits(table->low, i * l, l);
+        if (v == low)
+            return 1;
+        if (v > low)
+            break;
     }
     return 0;	/* not found */
 }
@@ -274,50 +427,69 @@ long long numhash_get_char_key(char *nro)
 
 void numhash_destroy(Numhash *table)
 {
+    int i;
+
     if (table == NULL)
 	return;
-    gw_free(table->numbers);
-    gw_free(table->hash);
+    gw_free(table->low);
+    gw_free(table->high);
+    gw_free(table->zeros);
+    for (i = 0; i <= PREFIX_MAX; i++)
+        gw_free(table->prefixes[i]);
     gw_free(table);
 }
 
 
 double numhash_hash_fill(Numhash *table, int *longest)
 {
-    int i, l, max = 0, tot = 0;
-    struct numhash_number *ptr;
-
-    for (i=0; i < table->hash_size; i++)
-	if (table->hash[i]) {
-	    tot++;
-	    ptr = table->hash[i];
-	    for (l=0; ptr->next; ptr = ptr->next)
-		l++;
-	    if (l > max)
-		max = l;
-	}
-
+    /* there are no hash chains any more, every lookup is direct */
     if (longest != NULL)
-	*longest = max;
+	*longest = 0;
 
-    return (double)(tot*100.0/(table->hash_size));
+    return 100.0;
 }
 
 
 int numhash_size(Numhash *table)
 {
-    return table->number_total;
+    return table->number_total + table->prefix_total;
+}
+
+
+long numhash_memory(Numhash *table)
+{
+    long bytes;
+
+    bytes = sizeof(Numhash);
+    bytes += ((table->number_total * table->low_bits) / 64 + 2) * sizeof(*table->low);
+    bytes += (table->high_len / 64 + 2) * sizeof(*table->high);
+    bytes += table->zeros_len * sizeof(*table->zeros);
+    bytes += table->prefix_total * sizeof(**table->prefixes);
+
+    return bytes;
+}
+
+
+Numhash *numhash_create_from_octstr(Octstr *data)
+{
+    Octstr *copy;
+    Numhash *table;
+
+    /* the parser cuts the lines in place */
+    copy = octstr_duplicate(data);
+    table = numhash_parse(octstr_get_cstr(copy));
+    octstr_destroy(copy);
+
+    return table;
 }
 
 
 Numhash *numhash_create(const char *seek_url)
 {
-    int		loc, lines = 0;
     List	*request_headers, *reply_headers;
     Octstr	*url, *final_url, *reply_body;
     Octstr	*type, *charset;
 
-    char *data, *ptr, numbuf[100];
     int		status;
     Numhash	*table;
 
@@ -348,46 +520,11 @@ Numhash *numhash_create(const char *seek_url)
     }
     octstr_destroy(type);
 
-    ptr = data = octstr_get_cstr(reply_body);
-    while(*ptr) {
-	if (*ptr == '\n') lines++;
-	ptr++;
-    }
-    debug("numhash", 0, "Total %d lines in %s", lines, seek_url);
-
-    table = numhash_init(lines+10, NUMHASH_AUTO_HASH);  	/* automatic hash */
-
-    /* now, parse the number information */
-
-    lines = 0;
-
-    while((ptr = strchr(data, '\n'))) {	/* each line is ended with linefeed */
-	*ptr = '\0';
-	while(*data != '\0' && isspace(*data))
-	    data++;
-	if (*data != '#') {
-	    loc = 0;
-	    while (*data != '\0') {
-		if (isdigit(*data))
-		    numbuf[loc++] = *data;
-		else if (*data == ' ' || *data == '+' || *data == '-')
-			;
-		else break;
-		data++;
-	    }
-	    if (loc) {
-		numbuf[loc] = '\0';
-		numhash_add_number(table, numbuf);
-		lines++;
-	    }
-	    else
-		warning(0, "Corrupted line '%s'", data);
-	}
-	data = ptr+1;	/* next row... */
-    }
+    table = numhash_parse(octstr_get_cstr(reply_body));
     octstr_destroy(reply_body);
 
-    info(0, "Read from <%s> total of %ld numbers", seek_url, table->number_total);
+    info(0, "Read from <%s> total of %ld numbers and %ld prefixes, %ld kB",
+         seek_url, table->number_total, table->prefix_total,
+         numhash_memory(table) / 1024);
     return table;
 }
-
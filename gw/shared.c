@@ -79,6 +79,47 @@ volatile enum program_status program_status = starting_up;
  * established from a foobarbox to bearerbox. */
 static Connection *bb_conn;
 
+/* connection on which bearerbox offered the packed Msg format */
+static Connection *packed_conn;
+
+
+static void pack_msg(Octstr *out, void *data)
+{
+    msg_pack_packed(data, out);
+}
+
+
+static int unpack_msg(Octstr *in, long off, long len, void *data)
+{
+    Msg **msg = data;
+
+    *msg = msg_unpack_slice(in, off, len);
+    return *msg == NULL ? -1 : 0;
+}
+
+
+int box_write_msg(Connection *conn, Msg *msg, int packed)
+{
+    Octstr *pack;
+    int ret;
+
+    if (packed)
+        return conn_write_packed(conn, pack_msg, msg);
+
+    pack = msg_pack(msg);
+    ret = conn_write_withlen(conn, pack);
+    octstr_destroy(pack);
+
+    return ret;
+}
+
+
+int box_read_msg(Connection *conn, Msg **msg)
+{
+    *msg = NULL;
+    return conn_read_packed(conn, unpack_msg, msg);
+}
+
 
 Connection *connect_to_bearerbox_real(Octstr *host, int port, int ssl, Octstr *our_host)
 {
@@ -115,6 +156,8 @@ void connect_to_bearerbox(Octstr *host, int port, int ssl, Octstr *our_host)
 
 void close_connection_to_bearerbox_real(Connection *conn)
 {
+    if (conn == packed_conn)
+        packed_conn = NULL;
     conn_destroy(conn);
 }
 
@@ -128,14 +171,10 @@ void close_connection_to_bearerbox(void)
 
 void write_to_bearerbox_real(Connection *conn, Msg *pmsg)
 {
-    Octstr *pack;
-
-    pack = msg_pack(pmsg);
-    if (conn_write_withlen(conn, pack) == -1)
+    if (box_write_msg(conn, pmsg, conn == packed_conn) == -1)
     	error(0, "Couldn't write Msg to bearerbox.");
 
     msg_destroy(pmsg);
-    octstr_destroy(pack);
 }
 
 
@@ -147,17 +186,11 @@ void write_to_bearerbox(Msg *pmsg)
 
 int deliver_to_bearerbox_real(Connection *conn, Msg *msg) 
 {
-     
-    Octstr *pack;
-    
-    pack = msg_pack(msg);
-    if (conn_write_withlen(conn, pack) == -1) {
+    if (box_write_msg(conn, msg, conn == packed_conn) == -1) {
     	error(0, "Couldn't deliver Msg to bearerbox.");
-        octstr_destroy(pack);
         return -1;
     }
-                                   
-    octstr_destroy(pack);
+
     msg_destroy(msg);
     return 0;
 }
@@ -172,14 +205,29 @@ int deliver_to_bearerbox(Msg *msg)
 int read_from_bearerbox_real(Connection *conn, Msg **msg, double seconds)
 {
     int ret;
-    Octstr *pack;
 
-    pack = NULL;
     *msg = NULL;
     while (program_status != shutting_down) {
-        pack = conn_read_withlen(conn);
-        gw_claim_area(pack);
-        if (pack != NULL)
+        ret = box_read_msg(conn, msg);
+        if (ret == -1) {
+            error(0, "Failed to unpack data!");
+            return -1;
+        }
+        gw_claim_area(*msg);
+
+        /* bearerbox offers the packed format, accept and use it */
+        if (*msg != NULL && msg_type(*msg) == admin && (*msg)->admin.command == cmd_feature) {
+            if ((*msg)->admin.boxc_id != NULL &&
+                octstr_str_compare((*msg)->admin.boxc_id, MSG_FEATURE_PACKED) == 0) {
+                debug("gwlib.gwlib", 0, "Bearerbox supports packed messages, using them.");
+                box_write_msg(conn, *msg, 1);
+                packed_conn = conn;
+            }
+            msg_destroy(*msg);
+            *msg = NULL;
+            continue;
+        }
+        if (*msg != NULL)
             break;
 
         if (conn_error(conn)) {
@@ -202,17 +250,9 @@ int read_from_bearerbox_real(Connection *conn, Msg **msg, double seconds)
         }
     }
 
-    if (pack == NULL)
+    if (*msg == NULL)
         return -1;
 
-    *msg = msg_unpack(pack);
-    octstr_destroy(pack);
-
-    if (*msg == NULL) {
-        error(0, "Failed to unpack data!");
-        return -1;
-    }
-
     return 0;
 }
 
@@ -83,6 +83,23 @@ extern volatile enum program_status {
 } program_status;
 
 
+/*
+ * Write an Msg as one length-prefixed packet to a connection between
+ * bearerbox and a box, in the packed format if `packed' is set, otherwise
+ * in msg_pack() format. Return value is as for conn_write().
+ */
+int box_write_msg(Connection *conn, Msg *msg, int packed);
+
+
+/*
+ * Unpack the next Msg packet, in either format, from a connection between
+ * bearerbox and a box without copying it out of the input buffer first.
+ * Return 1 and set *msg if a Msg was read, 0 if no full packet is
+ * available yet and -1 if the packet was invalid.
+ */
+int box_read_msg(Connection *conn, Msg **msg);
+
+
 /*
  * Open a connection to the bearerbox.
  */
@@ -180,18 +180,15 @@ int dcs_to_fields(Msg **msg, int dcs)
 int sms_msgdata_len(Msg* msg) 
 {
 	int ret = 0;
-	Octstr* msgdata = NULL;
 	
 	/* got a bad input */
 	if (!msg || !msg->sms.msgdata) 
 		return -1;
 
-	if (msg->sms.coding == DC_7BIT) {
-		msgdata = octstr_duplicate(msg->sms.msgdata);
-		charset_utf8_to_gsm(msgdata);
-		ret = octstr_len(msgdata);
-		octstr_destroy(msgdata);
-	} else 
+	/* count only, no need to build the GSM string */
+	if (msg->sms.coding == DC_7BIT)
+		ret = charset_utf8_to_gsm_count(msg->sms.msgdata, 0, -1, 0, NULL, NULL);
+	else 
 		ret = octstr_len(msg->sms.msgdata);
 
 	return ret;
@@ -244,65 +241,62 @@ void prepend_catenation_udh(Msg *sms, int part_no, int num_messages,
 }
 
 
-static Octstr *extract_msgdata_part(Octstr *msgdata, Octstr *split_chars,
-    	    	    	    	    int max_part_len)
+/*
+ * Copy the next part of at most max_part_len octets out of msgdata,
+ * starting at *pos, and advance *pos past it. If split_chars is given,
+ * the part ends at the last of them that fits.
+ */
+static Octstr *extract_msgdata_part(Octstr *msgdata, long *pos,
+                                    Octstr *split_chars, long max_part_len)
 {
     long i, len;
     Octstr *part;
 
     len = max_part_len;
-    if (max_part_len < octstr_len(msgdata) && split_chars != NULL)
+    if (max_part_len < octstr_len(msgdata) - *pos && split_chars != NULL)
 	for (i = max_part_len; i > 0; i--)
 	    if (octstr_search_char(split_chars,
-				   octstr_get_char(msgdata, i - 1), 0) != -1) {
+				   octstr_get_char(msgdata, *pos + i - 1), 0) != -1) {
 		len = i;
 		break;
 	    }
-    part = octstr_copy(msgdata, 0, len);
-    octstr_delete(msgdata, 0, len);
+    part = octstr_copy(msgdata, *pos, len);
+    *pos += octstr_len(part);
     return part;
 }
 
 
-static Octstr *extract_msgdata_part_by_coding(Msg *msg, Octstr *split_chars,
-        int max_part_len)
+static Octstr *extract_msgdata_part_by_coding(Octstr *msgdata, int coding,
+        long *pos, Octstr *split_chars, long max_part_len)
 {
-    Octstr *temp = NULL, *temp_utf;
+    CharsetGsmCount count;
 
-    if (msg->sms.coding == DC_8BIT || msg->sms.coding == DC_UCS2) {
+    if (coding == DC_8BIT || coding == DC_UCS2) {
         /* nothing to do here, just call the original extract_msgdata_part */
-        return extract_msgdata_part(msg->sms.msgdata, split_chars, max_part_len);
+        return extract_msgdata_part(msgdata, pos, split_chars, max_part_len);
     }
 
     /*
-     * XXX TODO
-     * Convert to and the from gsm, so we drop all non GSM chars.
-     * This means effectively that we can NOT use any encoding specific
-     * characters in the SMSC module scope that are NOT in the GSM 03.38
-     * alphabet, i.e. UTF-8 0xC2 0xAE is latin1 0xAE and maps to an unknown
-     * character due to this round-trip transcoding.
-     */
-    charset_utf8_to_gsm(msg->sms.msgdata);
-    charset_gsm_to_utf8(msg->sms.msgdata);
-
-    /* 
-     * else we need to do something special. I'll just get charset_gsm_truncate to
-     * cut the string to the required length and then count real characters. 
+     * else we need to do something special. Count how many UTF-8 octets
+     * fit into max_part_len septets, without cutting escape sequences.
+     * The msgdata has been limited to GSM characters by sms_split().
      */
-     temp = octstr_duplicate(msg->sms.msgdata);
-     charset_utf8_to_gsm(temp);
-     charset_gsm_truncate(temp, max_part_len);
+    charset_utf8_to_gsm_count(msgdata, *pos, max_part_len > 0 ? max_part_len : 0,
+                              0, NULL, &count);
 
-     /* calculate utf-8 length */
-     temp_utf = octstr_duplicate(temp);
-     charset_gsm_to_utf8(temp_utf);
-     max_part_len = octstr_len(temp_utf);
+    /* now just call the original extract_msgdata_part with the new length */
+    return extract_msgdata_part(msgdata, pos, split_chars, count.octets);
+}
 
-     octstr_destroy(temp);
-     octstr_destroy(temp_utf);
 
-     /* now just call the original extract_msgdata_part with the new length */
-     return extract_msgdata_part(msg->sms.msgdata, split_chars, max_part_len);
+/*
+ * Same as sms_msgdata_len(), for a message body.
+ */
+static long msgdata_len(Octstr *msgdata, int coding)
+{
+    if (coding == DC_7BIT)
+        return charset_utf8_to_gsm_count(msgdata, 0, -1, 0, NULL, NULL);
+    return octstr_len(msgdata);
 }
 
 
@@ -311,11 +305,12 @@ List *sms_split(Msg *orig, Octstr *header, Octstr *footer,
                 int catenate, unsigned long msg_sequence,
                 int max_messages, int max_octets)
 {
-    long max_part_len, udh_len, hf_len, nlsuf_len;
+    long max_part_len, udh_len, hf_len, nlsuf_len, pos, left;
     unsigned long total_messages, msgno;
     long last;
     List *list;
     Msg *part, *temp;
+    Octstr *msgdata, *udhdata;
 
     hf_len = octstr_len(header) + octstr_len(footer);
     nlsuf_len = octstr_len(nonlast_suffix);
@@ -341,14 +336,43 @@ List *sms_split(Msg *orig, Octstr *header, Octstr *footer,
     /* ensure max_part_len is never negativ */
     max_part_len = max_part_len > 0 ? max_part_len : 0;
 
+    /*
+     * The parts share all fields but the body and the UDH with a single
+     * private copy of the original, so each part costs only its Msg and
+     * its body. The original stays untouched and mutable. The body is
+     * taken apart by offset instead of deleting from its front.
+     */
     temp = msg_duplicate(orig);
+    msgdata = temp->sms.msgdata;
+    udhdata = temp->sms.udhdata;
+    temp->sms.msgdata = NULL;
+    temp->sms.udhdata = NULL;
+    if (msgdata == NULL)
+        msgdata = octstr_create("");
+    if (temp->sms.coding != DC_8BIT && temp->sms.coding != DC_UCS2) {
+        /*
+         * XXX TODO
+         * Convert to and the from gsm, so we drop all non GSM chars.
+         * This means effectively that we can NOT use any encoding specific
+         * characters in the SMSC module scope that are NOT in the GSM 03.38
+         * alphabet, i.e. UTF-8 0xC2 0xAE is latin1 0xAE and maps to an unknown
+         * character due to this round-trip transcoding.
+         */
+        charset_utf8_to_gsm(msgdata);
+        charset_gsm_to_utf8(msgdata);
+    }
     msgno = 0;
+    pos = 0;
+    left = msgdata_len(msgdata, temp->sms.coding);
     list = gwlist_create();
 
     last = 0;
     do {
         msgno++;
-        part = msg_duplicate(orig);
+        part = msg_share(temp);
+
+        /* the catenation UDH gets appended to it, so each part needs its own */
+        part->sms.udhdata = (catenate ? octstr_duplicate(udhdata) : octstr_share(udhdata));
 
         /* 
          * if its a DLR request message getting split, 
@@ -359,13 +383,14 @@ List *sms_split(Msg *orig, Octstr *header, Octstr *footer,
             part->sms.dlr_url = NULL;
             part->sms.dlr_mask = 0;
         }
-        octstr_destroy(part->sms.msgdata);
-        if (sms_msgdata_len(temp) <= max_part_len || msgno == max_messages)
+        if (left <= max_part_len || msgno == max_messages)
             last = 1;
 
         part->sms.msgdata = 
-            extract_msgdata_part_by_coding(temp, split_chars,
-                                           max_part_len - nlsuf_len);
+            extract_msgdata_part_by_coding(msgdata, temp->sms.coding, &pos,
+                                           split_chars, max_part_len - nlsuf_len);
+        /* count the part instead of the whole rest of the body again */
+        left -= msgdata_len(part->sms.msgdata, temp->sms.coding);
         /* create new id for every part, except last */
         if (!last)
             uuid_generate(part->sms.id);
@@ -380,6 +405,8 @@ List *sms_split(Msg *orig, Octstr *header, Octstr *footer,
     } while (!last);
 
     total_messages = msgno;
+    octstr_destroy(msgdata);
+    octstr_destroy(udhdata);
     msg_destroy(temp);
     if (catenate && total_messages > 1) {
         for (msgno = 1; msgno <= total_messages; msgno++) {
@@ -416,6 +443,19 @@ int sms_priority_compare(const void *a, const void *b)
 }
 
 
+long sms_priority_bucket(const void *a)
+{
+    const Msg *msg = a;
+    gw_assert(msg->type == sms);
+
+    if (msg->sms.priority < 0)
+        return 0;
+    if (msg->sms.priority >= SMS_PRIORITY_BUCKETS - 1)
+        return SMS_PRIORITY_BUCKETS - 1;
+    return msg->sms.priority + 1;
+}
+
+
 int sms_charset_processing(Octstr *charset, Octstr *body, int coding)
 {
     int resultcode = 0;
@@ -202,6 +202,16 @@ void prepend_catenation_udh(Msg *sms, int part_no, int num_messages, int msg_seq
  */
 int sms_priority_compare(const void *a, const void *b);
 
+/* priorities 0 .. 3 and undefined, see sms_priority_bucket */
+#define SMS_PRIORITY_BUCKETS 5
+
+/**
+ * Map the priority of an sms to a bucket of gw_prioqueue_create_buckets(),
+ * undefined priority is the lowest one.
+ * @return 0 .. SMS_PRIORITY_BUCKETS - 1
+ */
+long sms_priority_bucket(const void *a);
+
 /*
  * Re-encode an SMSmessage , based on the 'charset' that defines the content
  * encoding and the 'coding' that defines the desired target encoding.
@@ -141,7 +141,8 @@ static long max_http_retries = HTTP_MAX_RETRIES;
 static long http_queue_delay = HTTP_RETRY_DELAY;
 static Octstr *ppg_service_name = NULL;
 
-static List *smsbox_requests = NULL;      /* the inbound request queue */
+static List **smsbox_requests = NULL;     /* the inbound request queues */
+static long smsbox_workers = 1;           /* one queue per worker */
 static List *smsbox_http_requests = NULL; /* the outbound HTTP request queue */
 
 /* Timerset for the HTTP retry mechanism. */
@@ -236,8 +237,9 @@ static void delayed_http_reply(Msg *msg)
 
 /*
  * Read an Msg from the bearerbox and send it to the proper receiver
- * via a List. At the moment all messages are sent to the smsbox_requests
- * List.
+ * via a List. SMS messages are sent to one of the smsbox_requests
+ * Lists, chosen by the sender so that messages of the same sender are
+ * handled in order by the same obey_request_thread.
  */
 static void read_messages_from_bearerbox(void)
 {
@@ -280,7 +282,8 @@ static void read_messages_from_bearerbox(void)
 	    if (total == 0)
 		start = time(NULL);
 	    total++;
-	    gwlist_produce(smsbox_requests, msg);
+	    gwlist_produce(smsbox_requests[msg->sms.sender == NULL ? 0 :
+	        octstr_hash_key(msg->sms.sender) % smsbox_workers], msg);
 	} else if (msg_type(msg) == ack) {
 	    if (!immediate_sendsms_reply)
 		delayed_http_reply(msg);
@@ -340,7 +343,7 @@ static int send_message(URLTranslation *trans, Msg *msg)
      * same smsbox, mainly for DLRs and SMS proxy modes.
      */
     if (smsbox_id != NULL) {
-        msg->sms.boxc_id = octstr_duplicate(smsbox_id);
+        msg->sms.boxc_id = octstr_intern(smsbox_id);
     }
 
     /*
@@ -459,7 +462,7 @@ static void *remember_receiver(Msg *msg, URLTranslation *trans, int method,
     /* ppg_service_name should always be not NULL here */
     if (trans != NULL && (msg->sms.service == NULL || ppg_service_name == NULL ||
         octstr_compare(msg->sms.service, ppg_service_name) != 0)) {
-        receiver->msg->sms.service = octstr_duplicate(urltrans_name(trans));
+        receiver->msg->sms.service = octstr_intern(urltrans_name(trans));
     } else {
         receiver->msg->sms.service = octstr_duplicate(msg->sms.service);
     }
@@ -1645,13 +1648,14 @@ static int obey_request(Octstr **result, URLTranslation *trans, Msg *msg)
 
 static void obey_request_thread(void *arg)
 {
+    List *requests = arg;
     Msg *msg, *mack, *reply_msg;
     Octstr *tmp, *reply;
     URLTranslation *trans;
     Octstr *p;
     int ret, dreport=0;
 
-    while ((msg = gwlist_consume(smsbox_requests)) != NULL) {
+    while ((msg = gwlist_consume(requests)) != NULL) {
 
     	if (msg->sms.sms_type == report_mo)
     	    dreport = 1;
@@ -1769,7 +1773,7 @@ static void obey_request_thread(void *arg)
         /* TODO: check if the sender is approved to use this service */
 
         if (msg->sms.service == NULL && trans != NULL)
-        	msg->sms.service = octstr_duplicate(urltrans_name(trans));
+        	msg->sms.service = octstr_intern(urltrans_name(trans));
         ret = obey_request(&reply, trans, msg);
         if (ret != 0) {
         	if (ret == -1) {
@@ -2137,7 +2141,7 @@ static Octstr *smsbox_req_handle(URLTranslation *t, Octstr *client_ip,
      */
     msg = msg_create(sms);
     
-    msg->sms.service = octstr_duplicate(urltrans_name(t));
+    msg->sms.service = octstr_intern(urltrans_name(t));
     msg->sms.sms_type = mt_push;
     msg->sms.sender = octstr_duplicate(newfrom);
     if(octstr_len(account)) {
@@ -3290,6 +3294,8 @@ static Cfg *init_smsbox(Cfg *cfg)
     Octstr *logfile;
     Octstr *p;
     long lvl, value;
+    long async_log_buffer;
+    int async_log;
     Octstr *http_proxy_host = NULL;
     long http_proxy_port = -1;
     int http_proxy_ssl = 0;
@@ -3298,7 +3304,7 @@ static Cfg *init_smsbox(Cfg *cfg)
     Octstr *http_proxy_password = NULL;
     Octstr *http_proxy_exceptions_regex = NULL;
     int ssl = 0;
-    int lf, m;
+    int lf, m, h2, h2c;
     long max_req;
 
     bb_port = BB_DEFAULT_SMSBOX_PORT;
@@ -3460,6 +3466,13 @@ static Cfg *init_smsbox(Cfg *cfg)
     } else {
         log_set_syslog(NULL, 0);
     }
+
+    cfg_get_bool(&async_log, grp, octstr_imm("log-async"));
+    if (async_log) {
+        if (cfg_get_integer(&async_log_buffer, grp, octstr_imm("log-async-buffer")) == -1)
+            async_log_buffer = 65536;
+        log_async_start(async_log_buffer);
+    }
     if (global_sender != NULL) {
 	info(0, "Service global sender set as '%s'", 
 	     octstr_get_cstr(global_sender));
@@ -3489,6 +3502,8 @@ static Cfg *init_smsbox(Cfg *cfg)
     cfg_get_integer(&http_queue_delay, grp, octstr_imm("http-queue-delay"));
 
     if (sendsms_port > 0) {
+        if (cfg_get_integer(&value, grp, octstr_imm("sendsms-poller-threads")) == 0)
+            http_set_server_pollers(value);
         if (http_open_port_if(sendsms_port, ssl, sendsms_interface) == -1) {	
             if (only_try_http)
                 error(0, "Failed to open HTTP socket, ignoring it");
@@ -3505,8 +3520,30 @@ static Cfg *init_smsbox(Cfg *cfg)
         max_req = HTTP_MAX_PENDING; 
     max_pending_requests = semaphore_create(max_req);
 
+    /* number of threads handling MO/DLR messages and HTTP results */
+    if (cfg_get_integer(&smsbox_workers, grp, octstr_imm("worker-threads")) == -1 ||
+        smsbox_workers < 1)
+        smsbox_workers = 1;
+
     if (cfg_get_integer(&value, grp, octstr_imm("http-timeout")) == 0)
        http_set_client_timeout(value);
+    if (cfg_get_integer(&value, grp, octstr_imm("dns-cache-ttl")) == 0)
+       gw_resolver_set_ttl(value, -1);
+    if (cfg_get_integer(&value, grp, octstr_imm("dns-negative-cache-ttl")) == 0)
+       gw_resolver_set_ttl(-1, value);
+    if (cfg_get_integer(&value, grp, octstr_imm("http-max-clients")) == 0)
+       http_set_server_max_clients(value);
+    if (cfg_get_integer(&value, grp, octstr_imm("http-max-host-connections")) == 0)
+       http_set_client_host_limits(value, -1);
+    if (cfg_get_integer(&value, grp, octstr_imm("http-max-host-queue")) == 0)
+       http_set_client_host_limits(-1, value);
+    if (cfg_get_integer(&value, grp, octstr_imm("http-pipeline-depth")) == 0)
+       http_set_client_pipeline_depth(value);
+    h2 = h2c = 0;
+    cfg_get_bool(&h2, grp, octstr_imm("http-h2"));
+    cfg_get_bool(&h2c, grp, octstr_imm("http-h2c"));
+    if (h2 || h2c)
+       http_set_client_h2(h2, h2c);
 
     /*
      * Reading the name we are using for ppg services from ppg core group
@@ -3545,6 +3582,7 @@ static int check_args(int i, int argc, char **argv) {
 int main(int argc, char **argv)
 {
     int cf_index;
+    long i;
     Octstr *filename;
     double heartbeat_freq = DEFAULT_HEARTBEAT;
 
@@ -3590,15 +3628,20 @@ int main(int argc, char **argv)
 
 
     caller = http_caller_create();
-    smsbox_requests = gwlist_create();
+    smsbox_requests = gw_malloc(smsbox_workers * sizeof(*smsbox_requests));
+    for (i = 0; i < smsbox_workers; i++) {
+        smsbox_requests[i] = gwlist_create();
+        gwlist_add_producer(smsbox_requests[i]);
+    }
     smsbox_http_requests = gwlist_create();
     timerset = gw_timerset_create();
-    gwlist_add_producer(smsbox_requests);
     gwlist_add_producer(smsbox_http_requests);
     num_outstanding_requests = counter_create();
     catenated_sms_counter = counter_create();
-    gwthread_create(obey_request_thread, NULL);
-    gwthread_create(url_result_thread, NULL);
+    for (i = 0; i < smsbox_workers; i++) {
+        gwthread_create(obey_request_thread, smsbox_requests[i]);
+        gwthread_create(url_result_thread, NULL);
+    }
     gwthread_create(http_queue_thread, NULL);
 
     connect_to_bearerbox(bb_host, bb_port, bb_ssl, NULL /* bb_our_host */);
@@ -3617,19 +3660,31 @@ int main(int argc, char **argv)
     heartbeat_stop(ALL_HEARTBEATS);
     http_close_all_ports();
     gwthread_join_every(sendsms_thread);
-    gwlist_remove_producer(smsbox_requests);
+    for (i = 0; i < smsbox_workers; i++)
+        gwlist_remove_producer(smsbox_requests[i]);
     gwlist_remove_producer(smsbox_http_requests);
     gwthread_join_every(obey_request_thread);
     http_caller_signal_shutdown(caller);
     gwthread_join_every(url_result_thread);
     gwthread_join_every(http_queue_thread);
 
+    {
+        unsigned long hits, misses, pipelined, queued, rejected;
+
+        if (http_client_pool_stats(&hits, &misses, &pipelined, &queued, &rejected) == 0)
+            info(0, "HTTP client: %lu reused, %lu new connections, %lu pipelined, "
+                 "%lu queued, %lu rejected", hits, misses, pipelined, queued, rejected);
+    }
+
     close_connection_to_bearerbox();
     alog_close();
     urltrans_destroy(translations);
-    gw_assert(gwlist_len(smsbox_requests) == 0);
+    for (i = 0; i < smsbox_workers; i++) {
+        gw_assert(gwlist_len(smsbox_requests[i]) == 0);
+        gwlist_destroy(smsbox_requests[i], NULL);
+    }
+    gw_free(smsbox_requests);
     gw_assert(gwlist_len(smsbox_http_requests) == 0);
-    gwlist_destroy(smsbox_requests, NULL);
     gwlist_destroy(smsbox_http_requests, NULL);
     http_caller_destroy(caller);
     gw_timerset_destroy(timerset);
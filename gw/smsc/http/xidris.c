@@ -139,8 +139,10 @@ static int xidris_send_sms(SMSCConn *conn, Msg *sms)
      * proxied parameters, ie. billing information.
      */
     if (octstr_len(sms->sms.account)) {
-        octstr_url_decode(sms->sms.account);
-        octstr_format_append(url, "&%s", octstr_get_cstr(sms->sms.account));
+        Octstr *account = octstr_duplicate(sms->sms.account);
+        octstr_url_decode(account);
+        octstr_format_append(url, "&%s", octstr_get_cstr(account));
+        octstr_destroy(account);
     }
 
     headers = gwlist_create();
@@ -1524,7 +1524,7 @@ int smsc_at2_create(SMSCConn *conn, CfgGroup *cfg)
 
     privdata = gw_malloc(sizeof(PrivAT2data));
     memset(privdata, 0, sizeof(PrivAT2data));
-    privdata->outgoing_queue = gw_prioqueue_create(sms_priority_compare);
+    privdata->outgoing_queue = gw_prioqueue_create_buckets(SMS_PRIORITY_BUCKETS, sms_priority_bucket);
     privdata->pending_incoming_messages = gwlist_create();
 
     privdata->configfile = cfg_get_configfile(cfg);
@@ -1660,7 +1660,7 @@ int smsc_emi2_create(SMSCConn *conn, CfgGroup *cfg)
     allow_ip = deny_ip = host = alt_host = NULL; 
 
     privdata = gw_malloc(sizeof(PrivData));
-    privdata->outgoing_queue = gw_prioqueue_create(sms_priority_compare);
+    privdata->outgoing_queue = gw_prioqueue_create_buckets(SMS_PRIORITY_BUCKETS, sms_priority_bucket);
     privdata->listening_socket = -1;
     privdata->can_write = 1;
     privdata->priv_nexttrn = 0;
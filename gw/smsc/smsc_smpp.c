@@ -121,10 +121,23 @@ enum smpp_pdu_dump_format {
 #define SMPP_DEFAULT_VERSION        0x34
 #define SMPP_DEFAULT_PRIORITY       0
 #define SMPP_THROTTLING_SLEEP_TIME  1
+#define SMPP_STEAL_INTERVAL         1
 #define SMPP_DEFAULT_CONNECTION_TIMEOUT  10 * SMPP_ENQUIRE_LINK_INTERVAL
 #define SMPP_DEFAULT_WAITACK        60
 #define SMPP_DEFAULT_SHUTDOWN_TIMEOUT 30
 #define SMPP_DEFAULT_PORT           2775
+#define SMPP_RTT_SAMPLES            1024
+
+
+/*
+ * Tuning of the adaptive window and rate, see flow_ack().
+ * Queueing delay is assumed once the smoothed round trip time exceeds
+ * the base (lowest recent) one by the factor and the slack seconds.
+ */
+#define SMPP_FLOW_RTT_FACTOR        2.0
+#define SMPP_FLOW_RTT_SLACK         0.010
+#define SMPP_FLOW_DECREASE          0.75
+#define SMPP_FLOW_RATE_STEP         0.0625
 
 
 /*
@@ -183,12 +196,24 @@ typedef struct {
     int esm_class;
     long log_format;
     Load *load;
+    /* adaptive window and send rate, guarded by flow_lock */
+    int adaptive;
+    Mutex *flow_lock;
+    double window;
+    double ssthresh;
+    double rate;
+    double srtt;
+    double base_rtt;
+    double last_decrease;
+    float rtts[SMPP_RTT_SAMPLES];
+    long rtt_count;
     SMSCConn *conn;
 } SMPP;
 
 
 struct smpp_msg {
     time_t sent_time;
+    double sent_at;
     Msg *msg;
 };
 
@@ -202,6 +227,7 @@ static inline struct smpp_msg* smpp_msg_create(Msg *msg)
 
     gw_assert(result != NULL);
     result->sent_time = time(NULL);
+    result->sent_at = date_precise_now();
     result->msg = msg;
 
     return result;
@@ -235,14 +261,15 @@ static SMPP *smpp_create(SMSCConn *conn, Octstr *host, int transmit_port,
                          Octstr *my_number, int smpp_msg_id_type,
                          int autodetect_addr, Octstr *alt_charset, Octstr *alt_addr_charset,
                          Octstr *service_type, long connection_timeout,
-                         long wait_ack, int wait_ack_action, int esm_class)
+                         long wait_ack, int wait_ack_action, int esm_class,
+                         int adaptive)
 {
     SMPP *smpp;
 
     smpp = gw_malloc(sizeof(*smpp));
     smpp->transmitter = -1;
     smpp->receiver = -1;
-    smpp->msgs_to_send = gw_prioqueue_create(sms_priority_compare);
+    smpp->msgs_to_send = gw_prioqueue_create_buckets(SMS_PRIORITY_BUCKETS, sms_priority_bucket);
     smpp->sent_msgs = dict_create(max_pending_submits, NULL);
     gw_prioqueue_add_producer(smpp->msgs_to_send);
     smpp->received_msgs = gwlist_create();
@@ -285,6 +312,15 @@ static SMPP *smpp_create(SMSCConn *conn, Octstr *host, int transmit_port,
     smpp->load = load_create_real(0);
     load_add_interval(smpp->load, 1);
     smpp->esm_class = esm_class;
+    smpp->adaptive = adaptive;
+    smpp->flow_lock = mutex_create();
+    smpp->window = adaptive ? 1 : max_pending_submits;
+    smpp->ssthresh = max_pending_submits;
+    smpp->rate = 0;
+    smpp->srtt = 0;
+    smpp->base_rtt = 0;
+    smpp->last_decrease = 0;
+    smpp->rtt_count = 0;
 
     return smpp;
 }
@@ -308,6 +344,7 @@ static void smpp_destroy(SMPP *smpp)
         octstr_destroy(smpp->alt_addr_charset);
         octstr_destroy(smpp->ssl_client_certkey_file);
         load_destroy(smpp->load);
+        mutex_destroy(smpp->flow_lock);
         gw_free(smpp);
     }
 }
@@ -1218,6 +1255,152 @@ static int send_pdu(Connection *conn, SMPP *smpp, SMPP_PDU *pdu)
 }
 
 
+/*
+ * Record the round trip time of an answered submit_sm and, if adaptive
+ * flow control is enabled, adjust window and send rate to it: grow the
+ * window like TCP does (slow start up to ssthresh, then one message per
+ * window) while the latency stays near its base, shrink it once the
+ * SMSC starts to queue, and halve both window and rate on throttling
+ * errors. Each decrease happens at most once per round trip.
+ */
+static void flow_ack(SMPP *smpp, struct smpp_msg *smpp_msg, int throttled)
+{
+    double now, rtt, sent;
+    long i, n;
+
+    now = date_precise_now();
+    rtt = now - smpp_msg->sent_at;
+    if (rtt < 0)
+        rtt = 0;
+
+    mutex_lock(smpp->flow_lock);
+    smpp->rtts[smpp->rtt_count++ % SMPP_RTT_SAMPLES] = rtt;
+    smpp->srtt = (smpp->srtt > 0 ? smpp->srtt * 7 / 8 + rtt / 8 : rtt);
+    if (smpp->base_rtt == 0 || rtt < smpp->base_rtt)
+        smpp->base_rtt = rtt;
+    /* let the base follow an SMSC that got slower for good */
+    if (smpp->rtt_count % SMPP_RTT_SAMPLES == 0) {
+        smpp->base_rtt = smpp->rtts[0];
+        for (i = 1, n = SMPP_RTT_SAMPLES; i < n; i++)
+            if (smpp->rtts[i] < smpp->base_rtt)
+                smpp->base_rtt = smpp->rtts[i];
+    }
+
+    if (!smpp->adaptive) {
+        mutex_unlock(smpp->flow_lock);
+        return;
+    }
+
+    if (throttled) {
+        if (now - smpp->last_decrease >= SMPP_THROTTLING_SLEEP_TIME) {
+            sent = load_get(smpp->load, 0);
+            smpp->window = (smpp->window > 2 ? smpp->window / 2 : 1);
+            smpp->ssthresh = smpp->window;
+            if (smpp->rate == 0 || (sent > 0 && sent < smpp->rate))
+                smpp->rate = sent;
+            smpp->rate = (smpp->rate > 2 ? smpp->rate / 2 : 1);
+            smpp->last_decrease = now;
+            warning(0, "SMPP[%s]: throttled, window %.1f, rate %.2f msg/sec.",
+                    octstr_get_cstr(smpp->conn->id), smpp->window, smpp->rate);
+        }
+    } else if (smpp->srtt > smpp->base_rtt * SMPP_FLOW_RTT_FACTOR &&
+               smpp->srtt - smpp->base_rtt > SMPP_FLOW_RTT_SLACK) {
+        if (now - smpp->last_decrease >= smpp->srtt) {
+            smpp->window *= SMPP_FLOW_DECREASE;
+            if (smpp->window < 1)
+                smpp->window = 1;
+            smpp->ssthresh = smpp->window;
+            smpp->last_decrease = now;
+            debug("bb.sms.smpp", 0, "SMPP[%s]: latency %.3f/%.3f sec, window %.1f",
+                  octstr_get_cstr(smpp->conn->id), smpp->srtt, smpp->base_rtt, smpp->window);
+        }
+    } else {
+        smpp->window += (smpp->window < smpp->ssthresh ? 1 : 1 / smpp->window);
+        if (smpp->window > smpp->max_pending_submits)
+            smpp->window = smpp->max_pending_submits;
+        if (smpp->rate > 0) {
+            smpp->rate += SMPP_FLOW_RATE_STEP;
+            /* back to the configured limit, if any */
+            if (smpp->conn->throughput > 0 && smpp->rate >= smpp->conn->throughput)
+                smpp->rate = 0;
+        }
+    }
+    mutex_unlock(smpp->flow_lock);
+}
+
+
+/*
+ * Number of submits we may have outstanding right now.
+ */
+static long flow_window(SMPP *smpp)
+{
+    long window;
+
+    if (!smpp->adaptive)
+        return smpp->max_pending_submits;
+    mutex_lock(smpp->flow_lock);
+    window = smpp->window;
+    mutex_unlock(smpp->flow_lock);
+    return window;
+}
+
+
+/*
+ * Messages per second we may send right now, 0 for no limit.
+ */
+static double flow_rate(SMPP *smpp)
+{
+    double rate;
+
+    if (!smpp->adaptive)
+        return smpp->conn->throughput;
+    mutex_lock(smpp->flow_lock);
+    rate = smpp->rate;
+    mutex_unlock(smpp->flow_lock);
+    if (rate > 0 && (smpp->conn->throughput <= 0 || rate < smpp->conn->throughput))
+        return rate;
+    return smpp->conn->throughput;
+}
+
+
+static int float_cmp(const void *a, const void *b)
+{
+    float x = *(const float *) a, y = *(const float *) b;
+
+    return (x < y ? -1 : x > y);
+}
+
+
+/*
+ * Report window, rate and submit_sm round trip times to the status page.
+ */
+static void smpp_flow_info(SMSCConn *conn, StatusInfo *info)
+{
+    SMPP *smpp = conn->data;
+    float *rtts;
+    long n;
+
+    if (smpp == NULL)
+        return;
+
+    rtts = gw_malloc(sizeof(smpp->rtts));
+    info->window = flow_window(smpp);
+    info->rate = flow_rate(smpp);
+    mutex_lock(smpp->flow_lock);
+    n = (smpp->rtt_count < SMPP_RTT_SAMPLES ? smpp->rtt_count : SMPP_RTT_SAMPLES);
+    memcpy(rtts, smpp->rtts, n * sizeof(*rtts));
+    mutex_unlock(smpp->flow_lock);
+
+    if (n > 0) {
+        qsort(rtts, n, sizeof(*rtts), float_cmp);
+        info->rtt_p50 = rtts[n * 50 / 100] * 1000;
+        info->rtt_p95 = rtts[n * 95 / 100] * 1000;
+        info->rtt_p99 = rtts[n * 99 / 100] * 1000;
+    }
+    gw_free(rtts);
+}
+
+
 static int send_messages(SMPP *smpp, Connection *conn, long *pending_submits)
 {
     Msg *msg;
@@ -1227,18 +1410,23 @@ static int send_messages(SMPP *smpp, Connection *conn, long *pending_submits)
     if (*pending_submits == -1)
         return 0;
 
-    while (*pending_submits < smpp->max_pending_submits) {
+    while (*pending_submits < flow_window(smpp)) {
+        double rate = flow_rate(smpp);
+
         /* check our throughput */
-        if (smpp->conn->throughput > 0 && load_get(smpp->load, 0) >= smpp->conn->throughput) {
+        if (rate > 0 && load_get(smpp->load, 0) >= rate) {
             debug("bb.sms.smpp", 0, "SMPP[%s]: throughput limit exceeded (%.02f,%.02f)",
-                  octstr_get_cstr(smpp->conn->id), load_get(smpp->load, 0), smpp->conn->throughput);
+                  octstr_get_cstr(smpp->conn->id), load_get(smpp->load, 0), rate);
             break;
         }
         debug("bb.sms.smpp", 0, "SMPP[%s]: throughput (%.02f,%.02f)",
-              octstr_get_cstr(smpp->conn->id), load_get(smpp->load, 0), smpp->conn->throughput);
+              octstr_get_cstr(smpp->conn->id), load_get(smpp->load, 0), rate);
 
-        /* Get next message, quit if none to be sent */
-        msg = gw_prioqueue_remove(smpp->msgs_to_send);
+        /*
+         * Get next message, quit if none to be sent. Take over messages
+         * of other instances of this smsc group if our queue is empty.
+         */
+        msg = gw_prioqueue_steal(smpp->msgs_to_send);
         if (msg == NULL)
             break;
 
@@ -1250,7 +1438,10 @@ static int send_messages(SMPP *smpp, Connection *conn, long *pending_submits)
         }
         /* check for write errors */
         if (send_pdu(conn, smpp, pdu) == 0) {
-            struct smpp_msg *smpp_msg = smpp_msg_create(msg);
+            struct smpp_msg *smpp_msg;
+
+            msg_stamp(msg, MSG_STAGE_SUBMIT);
+            smpp_msg = smpp_msg_create(msg);
             os = octstr_format("%ld", pdu->u.submit_sm.sequence_number);
             dict_put(smpp->sent_msgs, os, smpp_msg);
             smpp_pdu_destroy(pdu);
@@ -1906,6 +2097,8 @@ static int handle_pdu(SMPP *smpp, Connection *conn, SMPP_PDU *pdu,
                 break;
             }
             msg = smpp_msg->msg;
+            flow_ack(smpp, smpp_msg,
+                     pdu->u.submit_sm_resp.command_status == SMPP_ESME_RTHROTTLED);
             smpp_msg_destroy(smpp_msg, 0);
 
             /* pack submit_sm_resp TLVs into metadata */
@@ -2141,6 +2334,7 @@ static int handle_pdu(SMPP *smpp, Connection *conn, SMPP_PDU *pdu,
                 smpp_error_to_string(cmd_stat));
             } else {
                 msg = smpp_msg->msg;
+                flow_ack(smpp, smpp_msg, cmd_stat == SMPP_ESME_RTHROTTLED);
                 smpp_msg_destroy(smpp_msg, 0);
 
                 error(0, "SMPP[%s]: SMSC returned error code 0x%08lx (%s) in response to submit_sm PDU.",
@@ -2369,13 +2563,18 @@ static void io_thread(void *arg)
                 if (!IS_ACTIVE && timeout <= 0)
                     timeout = smpp->enquire_link_interval;
                 if (transmitter && gw_prioqueue_len(smpp->msgs_to_send) > 0 &&
-                    smpp->throttling_err_time > 0 && pending_submits < smpp->max_pending_submits) {
+                    smpp->throttling_err_time > 0 && pending_submits < flow_window(smpp)) {
                     time_t tr_timeout = smpp->throttling_err_time + SMPP_THROTTLING_SLEEP_TIME - now;
                     timeout = timeout > tr_timeout ? tr_timeout : timeout;
-                } else if (transmitter && gw_prioqueue_len(smpp->msgs_to_send) > 0 && smpp->conn->throughput > 0 &&
-                           smpp->max_pending_submits > pending_submits) {
-                    double t = 1.0 / smpp->conn->throughput;
+                } else if (transmitter && gw_prioqueue_len(smpp->msgs_to_send) > 0 && flow_rate(smpp) > 0 &&
+                           flow_window(smpp) > pending_submits) {
+                    double t = 1.0 / flow_rate(smpp);
                     timeout = t < timeout ? t : timeout;
+                } else if (transmitter && pending_submits != -1 &&
+                           flow_window(smpp) > pending_submits &&
+                           gw_prioqueue_group_len(smpp->msgs_to_send) > 0) {
+                    /* other instances have messages left, look again soon */
+                    timeout = timeout > SMPP_STEAL_INTERVAL ? SMPP_STEAL_INTERVAL : timeout;
                 }
                 /* sleep a while */
                 if (timeout > 0 && conn_wait(conn, timeout) == -1)
@@ -2591,6 +2790,7 @@ int smsc_smpp_create(SMSCConn *conn, CfgGroup *grp)
     Octstr *alt_addr_charset;
     long connection_timeout, wait_ack, wait_ack_action;
     long esm_class;
+    int adaptive;
 
     my_number = alt_addr_charset = alt_charset = NULL;
     transceiver_mode = 0;
@@ -2636,6 +2836,8 @@ int smsc_smpp_create(SMSCConn *conn, CfgGroup *grp)
     if (cfg_get_integer(&max_pending_submits, grp,
                         octstr_imm("max-pending-submits")) == -1)
         max_pending_submits = SMPP_MAX_PENDING_SUBMITS;
+    adaptive = 0;
+    cfg_get_bool(&adaptive, grp, octstr_imm("adaptive-window"));
 
     /* Check that config is OK */
     ok = 1;
@@ -2757,7 +2959,8 @@ int smsc_smpp_create(SMSCConn *conn, CfgGroup *grp)
                        dest_addr_npi, enquire_link_interval,
                        max_pending_submits, version, priority, validity, my_number,
                        smpp_msg_id_type, autodetect_addr, alt_charset, alt_addr_charset,
-                       service_type, connection_timeout, wait_ack, wait_ack_action, esm_class);
+                       service_type, connection_timeout, wait_ack, wait_ack_action, esm_class,
+                       adaptive);
 
     cfg_get_integer(&smpp->bind_addr_ton, grp, octstr_imm("bind-addr-ton"));
     cfg_get_integer(&smpp->bind_addr_npi, grp, octstr_imm("bind-addr-npi"));
@@ -2797,6 +3000,13 @@ int smsc_smpp_create(SMSCConn *conn, CfgGroup *grp)
 
     conn->status = SMSCCONN_CONNECTING;
 
+    /*
+     * All instances of this smsc group share their queues, so a bind
+     * that is throttled or slow does not keep messages from the others.
+     */
+    if (port != 0)
+        gw_prioqueue_join(smpp->msgs_to_send, conn->chksum);
+
     /*
      * I/O threads are only started if the corresponding ports
      * have been configured with positive numbers. Use 0 to
@@ -2829,6 +3039,7 @@ int smsc_smpp_create(SMSCConn *conn, CfgGroup *grp)
     conn->shutdown = shutdown_cb;
     conn->queued = queued_cb;
     conn->send_msg = send_msg_cb;
+    conn->flow_info = smpp_flow_info;
 
     return 0;
 }
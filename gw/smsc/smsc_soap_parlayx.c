@@ -1005,7 +1005,7 @@ int smsc_soap_parlayx_create(SMSCConn *conn, CfgGroup *cfg)
 #endif
     
     /* setup MT queue */
-    conndata->msgs_to_send = gw_prioqueue_create(sms_priority_compare);
+    conndata->msgs_to_send = gw_prioqueue_create_buckets(SMS_PRIORITY_BUCKETS, sms_priority_bucket);
     
     /* assign our SOAP operations */
     conndata->receive_sms = soap_receive_sms;
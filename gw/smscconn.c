@@ -170,6 +170,7 @@ SMSCConn *smscconn_create(CfgGroup *grp, int start_as_stopped)
     Octstr *denied_prefix_regex;
     Octstr *preferred_prefix_regex;
     Octstr *tmp;
+    int i;
 
     if (grp == NULL)
 	return NULL;
@@ -218,6 +219,8 @@ SMSCConn *smscconn_create(CfgGroup *grp, int start_as_stopped)
     conn->sent_dlr = counter_create();
     conn->failed = counter_create();
     conn->flow_mutex = mutex_create();
+    for (i = 0; i < msg_stage_count; i++)
+        conn->latency[i] = gw_histogram_create();
 
     conn->outgoing_sms_load = load_create();
     /* add 60,300,-1 entries */
@@ -405,6 +408,8 @@ void smscconn_shutdown(SMSCConn *conn, int finish_sending)
 
 int smscconn_destroy(SMSCConn *conn)
 {
+    int i;
+
     if (conn == NULL)
 	return 0;
     if (conn->status != SMSCCONN_DEAD)
@@ -421,6 +426,8 @@ int smscconn_destroy(SMSCConn *conn)
     load_destroy(conn->incoming_dlr_load);
     load_destroy(conn->outgoing_sms_load);
     load_destroy(conn->outgoing_dlr_load);
+    for (i = 0; i < msg_stage_count; i++)
+        gw_histogram_destroy(conn->latency[i]);
 
     octstr_destroy(conn->name);
     octstr_destroy(conn->id);
@@ -593,6 +600,347 @@ int smscconn_usable(SMSCConn *conn, Msg *msg)
 }
 
 
+/*
+ * Compiled routing table.
+ *
+ * The plain allowed/denied/preferred prefixes of all connections are put
+ * into one trie over the receiver number, each node carrying bitmaps of
+ * the connections that have a prefix ending there. The smsc-id rules,
+ * including the smsc-id regexes, only depend on msg->sms.smsc_id, so
+ * they are evaluated once per distinct smsc-id and cached. Only the
+ * receiver regexes have to be matched per message, and only for the
+ * connections that have one.
+ */
+
+#define ROUTE_ID_CACHE_MAX 1024
+#define ROUTE_MAX_DEPTH 64
+
+struct route_node {
+    unsigned char c;
+    struct route_node *child;
+    struct route_node *next;
+    unsigned long *allowed;
+    unsigned long *denied;
+    unsigned long *preferred;
+};
+
+typedef struct {
+    unsigned long *reject;
+    unsigned long *preferred;
+} IdRoute;
+
+struct SMSCConnRoutes {
+    long count;
+    long words;
+    SMSCConn **conns;
+    unsigned long *valid;
+    unsigned long *has_allowed_prefix;
+    unsigned long *has_denied_prefix;
+    struct route_node *root;
+    long *regex_conns;
+    long regex_count;
+    Dict *ids;
+    IdRoute *null_id;
+};
+
+
+static unsigned long *route_bits_create(long words)
+{
+    unsigned long *bits = gw_malloc(sizeof(bits[0]) * words);
+
+    memset(bits, 0, sizeof(bits[0]) * words);
+    return bits;
+}
+
+
+static void route_bits_set(unsigned long *bits, long i)
+{
+    bits[i / SMSCCONN_ROUTE_BITS] |= 1UL << (i % SMSCCONN_ROUTE_BITS);
+}
+
+
+static void route_node_destroy(struct route_node *node)
+{
+    struct route_node *next;
+
+    for (; node != NULL; node = next) {
+        next = node->next;
+        route_node_destroy(node->child);
+        gw_free(node->allowed);
+        gw_free(node->denied);
+        gw_free(node->preferred);
+        gw_free(node);
+    }
+}
+
+
+static struct route_node *route_node_create(unsigned char c)
+{
+    struct route_node *node = gw_malloc(sizeof(*node));
+
+    node->c = c;
+    node->child = node->next = NULL;
+    node->allowed = node->denied = node->preferred = NULL;
+    return node;
+}
+
+
+static struct route_node *route_node_child(struct route_node *node, unsigned char c)
+{
+    for (node = node->child; node != NULL; node = node->next)
+        if (node->c == c)
+            break;
+    return node;
+}
+
+
+enum { ROUTE_ALLOWED, ROUTE_DENIED, ROUTE_PREFERRED };
+
+/*
+ * Add all prefixes of a ';' separated list, as does_prefix_match()
+ * understands them, to the trie for connection i.
+ */
+static void route_add_prefixes(SMSCConnRoutes *routes, Octstr *prefixes, long i, int kind)
+{
+    struct route_node *node, *child;
+    unsigned long **bits;
+    char *p;
+    int first = 1;
+
+    p = octstr_get_cstr(prefixes);
+    while (*p != '\0') {
+        node = routes->root;
+        /* an empty prefix matches only in front of the list */
+        if (*p == ';' && !first)
+            node = NULL;
+        for (; node != NULL && *p != '\0' && *p != ';'; p++) {
+            if ((child = route_node_child(node, *p)) == NULL) {
+                child = route_node_create(*p);
+                child->next = node->child;
+                node->child = child;
+            }
+            node = child;
+        }
+        if (node != NULL) {
+            bits = (kind == ROUTE_ALLOWED ? &node->allowed :
+                    kind == ROUTE_DENIED ? &node->denied : &node->preferred);
+            if (*bits == NULL)
+                *bits = route_bits_create(routes->words);
+            route_bits_set(*bits, i);
+        }
+        while (*p != '\0' && *p != ';')
+            p++;
+        while (*p == ';')
+            p++;
+        first = 0;
+    }
+}
+
+
+static void id_route_destroy(void *p)
+{
+    IdRoute *id = p;
+
+    if (id == NULL)
+        return;
+    gw_free(id->reject);
+    gw_free(id->preferred);
+    gw_free(id);
+}
+
+
+static IdRoute *id_route_create(SMSCConnRoutes *routes, Octstr *smsc_id)
+{
+    IdRoute *id = gw_malloc(sizeof(*id));
+    SMSCConn *conn;
+    long i;
+    int reject;
+
+    id->reject = route_bits_create(routes->words);
+    id->preferred = route_bits_create(routes->words);
+
+    for (i = 0; i < routes->count; i++) {
+        conn = routes->conns[i];
+        reject = 0;
+
+        if (conn->allowed_smsc_id && (smsc_id == NULL ||
+                gwlist_search(conn->allowed_smsc_id, smsc_id, octstr_item_match) == NULL))
+            reject = 1;
+        else if (conn->denied_smsc_id && smsc_id != NULL &&
+                gwlist_search(conn->denied_smsc_id, smsc_id, octstr_item_match) != NULL)
+            reject = 1;
+
+        if (conn->allowed_smsc_id_regex) {
+            if (smsc_id == NULL || gw_regex_match_pre(conn->allowed_smsc_id_regex, smsc_id) == 0)
+                reject = 1;
+        }
+        else if (conn->denied_smsc_id_regex && smsc_id != NULL &&
+                gw_regex_match_pre(conn->denied_smsc_id_regex, smsc_id) == 1)
+            reject = 1;
+
+        if (reject)
+            route_bits_set(id->reject, i);
+        if (conn->preferred_smsc_id && smsc_id != NULL &&
+                gwlist_search(conn->preferred_smsc_id, smsc_id, octstr_item_match) != NULL)
+            route_bits_set(id->preferred, i);
+    }
+
+    return id;
+}
+
+
+SMSCConnRoutes *smscconn_routes_create(List *conns)
+{
+    SMSCConnRoutes *routes;
+    SMSCConn *conn;
+    long i;
+
+    routes = gw_malloc(sizeof(*routes));
+    routes->count = gwlist_len(conns);
+    routes->words = routes->count / SMSCCONN_ROUTE_BITS + 1;
+    routes->conns = gw_malloc(sizeof(routes->conns[0]) * (routes->count + 1));
+    routes->valid = route_bits_create(routes->words);
+    routes->has_allowed_prefix = route_bits_create(routes->words);
+    routes->has_denied_prefix = route_bits_create(routes->words);
+    routes->root = route_node_create('\0');
+    routes->regex_conns = gw_malloc(sizeof(routes->regex_conns[0]) * (routes->count + 1));
+    routes->regex_count = 0;
+    routes->ids = dict_create(ROUTE_ID_CACHE_MAX / 4, id_route_destroy);
+
+    for (i = 0; i < routes->count; i++) {
+        conn = routes->conns[i] = gwlist_get(conns, i);
+        route_bits_set(routes->valid, i);
+
+        if (conn->allowed_prefix) {
+            route_bits_set(routes->has_allowed_prefix, i);
+            route_add_prefixes(routes, conn->allowed_prefix, i, ROUTE_ALLOWED);
+        }
+        if (conn->denied_prefix) {
+            route_bits_set(routes->has_denied_prefix, i);
+            route_add_prefixes(routes, conn->denied_prefix, i, ROUTE_DENIED);
+        }
+        if (conn->preferred_prefix)
+            route_add_prefixes(routes, conn->preferred_prefix, i, ROUTE_PREFERRED);
+
+        if (conn->allowed_prefix_regex || conn->denied_prefix_regex || conn->preferred_prefix_regex)
+            routes->regex_conns[routes->regex_count++] = i;
+    }
+
+    routes->null_id = id_route_create(routes, NULL);
+
+    return routes;
+}
+
+
+void smscconn_routes_destroy(SMSCConnRoutes *routes)
+{
+    if (routes == NULL)
+        return;
+
+    route_node_destroy(routes->root);
+    dict_destroy(routes->ids);
+    id_route_destroy(routes->null_id);
+    gw_free(routes->conns);
+    gw_free(routes->valid);
+    gw_free(routes->has_allowed_prefix);
+    gw_free(routes->has_denied_prefix);
+    gw_free(routes->regex_conns);
+    gw_free(routes);
+}
+
+
+long smscconn_routes_words(SMSCConnRoutes *routes)
+{
+    return routes->words;
+}
+
+
+void smscconn_routes_lookup(SMSCConnRoutes *routes, Msg *msg,
+                            unsigned long *usable, unsigned long *preferred)
+{
+    struct route_node *stack_nodes[ROUTE_MAX_DEPTH + 1], **nodes, *node;
+    IdRoute *id, *tmp_id = NULL;
+    unsigned long ap, dp, pp, hap, hdp, rej;
+    long i, j, n, len, w;
+    SMSCConn *conn;
+    char *r;
+
+    gw_assert(msg != NULL && msg_type(msg) == sms);
+
+    /* smsc-id part, cached per smsc-id */
+    if (msg->sms.smsc_id == NULL)
+        id = routes->null_id;
+    else if ((id = dict_get(routes->ids, msg->sms.smsc_id)) == NULL) {
+        id = id_route_create(routes, msg->sms.smsc_id);
+        if (dict_key_count(routes->ids) >= ROUTE_ID_CACHE_MAX)
+            tmp_id = id;
+        else if (dict_put_once(routes->ids, msg->sms.smsc_id, id) == 0)
+            id = dict_get(routes->ids, msg->sms.smsc_id); /* lost the race, ours is gone */
+    }
+
+    /* collect all trie nodes that are prefixes of the receiver */
+    len = msg->sms.receiver ? octstr_len(msg->sms.receiver) : 0;
+    nodes = (len > ROUTE_MAX_DEPTH) ? gw_malloc(sizeof(nodes[0]) * (len + 1)) : stack_nodes;
+    n = 0;
+    node = routes->root;
+    if (node->allowed || node->denied || node->preferred)
+        nodes[n++] = node;
+    r = len ? octstr_get_cstr(msg->sms.receiver) : "";
+    for (; *r != '\0' && (node = route_node_child(node, *r)) != NULL; r++) {
+        if (node->allowed || node->denied || node->preferred)
+            nodes[n++] = node;
+    }
+
+    for (w = 0; w < routes->words; w++) {
+        ap = dp = pp = 0;
+        for (j = 0; j < n; j++) {
+            if (nodes[j]->allowed) ap |= nodes[j]->allowed[w];
+            if (nodes[j]->denied) dp |= nodes[j]->denied[w];
+            if (nodes[j]->preferred) pp |= nodes[j]->preferred[w];
+        }
+        hap = routes->has_allowed_prefix[w];
+        hdp = routes->has_denied_prefix[w];
+
+        /* same as the allowed/denied prefix checks of smscconn_usable() */
+        rej = id->reject[w] |
+              (hap & ~hdp & ~ap) |
+              (hdp & ~hap & dp) |
+              (hap & hdp & ~ap & dp);
+
+        usable[w] = routes->valid[w] & ~rej;
+        preferred[w] = usable[w] & (id->preferred[w] | pp);
+    }
+
+    if (nodes != stack_nodes)
+        gw_free(nodes);
+    id_route_destroy(tmp_id);
+
+    /* receiver regexes have to be matched per message */
+    for (j = 0; j < routes->regex_count; j++) {
+        i = routes->regex_conns[j];
+        if (!smscconn_route_isset(usable, i))
+            continue;
+        conn = routes->conns[i];
+
+        if ((conn->allowed_prefix_regex && !conn->denied_prefix_regex &&
+                gw_regex_match_pre(conn->allowed_prefix_regex, msg->sms.receiver) == 0) ||
+            (conn->denied_prefix_regex && !conn->allowed_prefix_regex &&
+                gw_regex_match_pre(conn->denied_prefix_regex, msg->sms.receiver) == 1) ||
+            (conn->allowed_prefix_regex && conn->denied_prefix_regex &&
+                gw_regex_match_pre(conn->allowed_prefix_regex, msg->sms.receiver) == 0 &&
+                gw_regex_match_pre(conn->denied_prefix_regex, msg->sms.receiver) == 1)) {
+            usable[i / SMSCCONN_ROUTE_BITS] &= ~(1UL << (i % SMSCCONN_ROUTE_BITS));
+            preferred[i / SMSCCONN_ROUTE_BITS] &= ~(1UL << (i % SMSCCONN_ROUTE_BITS));
+            continue;
+        }
+
+        if (conn->preferred_prefix_regex &&
+                gw_regex_match_pre(conn->preferred_prefix_regex, msg->sms.receiver) == 1)
+            route_bits_set(preferred, i);
+    }
+}
+
+
 int smscconn_send(SMSCConn *conn, Msg *msg)
 {
     int ret = -1;
@@ -604,6 +952,7 @@ int smscconn_send(SMSCConn *conn, Msg *msg)
         mutex_unlock(conn->flow_mutex);
         return -1;
     }
+    msg_stamp(msg, MSG_STAGE_QUEUE);
 
     /* if this a retry of splitted message, don't unify prefix and don't try to split */
     if (msg->sms.split_parts == NULL) {    
@@ -626,8 +975,11 @@ int smscconn_send(SMSCConn *conn, Msg *msg)
     else {
         long i, parts_len = gwlist_len(parts);
         struct split_parts *split = gw_malloc(sizeof(*split));
-         /* must duplicate, because smsc2_route will destroy this msg */
-        split->orig = msg_duplicate(msg);
+        /*
+         * must not hold the same Msg, because smsc2_route will destroy
+         * this one or route it again, sharing its fields is enough
+         */
+        split->orig = msg_share(msg);
         split->parts_left = counter_create();
         split->status = SMSCCONN_SUCCESS;
         counter_set(split->parts_left, parts_len);
@@ -639,6 +991,7 @@ int smscconn_send(SMSCConn *conn, Msg *msg)
             ret = conn->send_msg(conn, msg);
             if (ret < 0) {
                 if (i == 0) {
+                    msg_destroy(split->orig);
                     counter_destroy(split->parts_left);
                     gwlist_destroy(parts, msg_destroy_item);
                     gw_free(split);
@@ -694,6 +1047,12 @@ int smscconn_info(SMSCConn *conn, StatusInfo *infotable)
 	infotable->queued = -1;
 
     infotable->load = conn->load;
+
+    infotable->window = -1;
+    infotable->rate = 0;
+    infotable->rtt_p50 = infotable->rtt_p95 = infotable->rtt_p99 = -1;
+    if (conn->flow_info)
+        conn->flow_info(conn, infotable);
     
     mutex_unlock(conn->flow_mutex);
 
@@ -122,6 +122,11 @@ typedef struct smsc_state {
     long online;	/* in seconds */
     int load;		/* subjective value 'how loaded we are' for
 			 * routing purposes, similar to sms/wapbox load */
+    long window;	/* submits allowed in flight, -1 if not known */
+    double rate;	/* current send rate limit in msg/sec, 0 for none */
+    double rtt_p50;	/* submit round trip time percentiles in */
+    double rtt_p95;	/* milliseconds, -1 if not known */
+    double rtt_p99;
 } StatusInfo;
 
 /* create new SMS center connection from given configuration group,
@@ -181,6 +186,31 @@ const Octstr *smscconn_admin_id(SMSCConn *conn);
  */
 int smscconn_usable(SMSCConn *conn, Msg *msg);
 
+/*
+ * Routing table compiled from the allowed/denied/preferred rules of a
+ * list of SMSC Connections. Lookups return the same decisions as
+ * smscconn_usable() except for the connection status, as bitmaps
+ * indexed by the position of the connection in the list.
+ */
+typedef struct SMSCConnRoutes SMSCConnRoutes;
+
+#define SMSCCONN_ROUTE_BITS (sizeof(unsigned long) * 8)
+#define smscconn_route_isset(bits, i) \
+    (((bits)[(i) / SMSCCONN_ROUTE_BITS] >> ((i) % SMSCCONN_ROUTE_BITS)) & 1UL)
+
+/* Compile routing table for conns, which may not change until it
+ * is destroyed. */
+SMSCConnRoutes *smscconn_routes_create(List *conns);
+void smscconn_routes_destroy(SMSCConnRoutes *routes);
+
+/* Return number of unsigned longs in a lookup bitmap */
+long smscconn_routes_words(SMSCConnRoutes *routes);
+
+/* Set bit i of usable if connection i may send msg, and of preferred if
+ * it is also preferred for it (smscconn_usable() returning 0 or 1). */
+void smscconn_routes_lookup(SMSCConnRoutes *routes, Msg *msg,
+                            unsigned long *usable, unsigned long *preferred);
+
 /* Call SMSC specific function to handle sending of 'msg'
  * Returns immediately, with 0 if successful and -1 if failed.
  * In any case the caller is still responsible for 'msg' after this
@@ -215,6 +215,8 @@ struct smscconn {
     Load *incoming_sms_load;
     Load *incoming_dlr_load;
     Load *outgoing_dlr_load;
+    /* latency of messages sent via this connection, see bb_smscconn.c */
+    gw_histogram_t *latency[msg_stage_count];
 
     /* XXX: move rest global data from Smsc here
      */
@@ -239,6 +241,10 @@ struct smscconn {
      * to SMSCConn structure (above) */
     long (*queued) (SMSCConn *conn);
 
+    /* pointer to function which fills in the flow control fields of
+     * StatusInfo (window, rate and round trip times), if not NULL */
+    void (*flow_info) (SMSCConn *conn, StatusInfo *info);
+
     /* pointers to functions called when connection started/stopped
      * (suspend/resume), if not NULL */
 
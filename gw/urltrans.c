@@ -132,6 +132,9 @@ struct URLTranslation {
     long dlr_mask;       /* DLR event mask */
 
     regex_t *keyword_regex;       /* the compiled regular expression for the keyword*/
+    List *keywords;     /* lowercase keyword and aliases if all of them are
+                           plain words, these go into the keyword index */
+    long position;      /* position in URLTranslationList list */
     regex_t *accepted_smsc_regex;
     regex_t *accepted_account_regex;
     regex_t *allowed_prefix_regex;
@@ -150,6 +153,10 @@ struct URLTranslationList {
     List *list;
     List *defaults; /* List of default sms-services */
     Dict *names;	/* Dict of lowercase Octstr names */
+    Dict *keywords;	/* Dict of lowercase plain keywords -> List of translations */
+    long *keyword_lengths; /* distinct lengths of keywords, descending */
+    long num_keyword_lengths;
+    List *keyword_regexes; /* translations which keyword is a real regex */
 };
 
 
@@ -165,6 +172,7 @@ static URLTranslation *find_translation(URLTranslationList *trans, Msg *msg);
 static URLTranslation *find_default_translation(URLTranslationList *trans,
 						Octstr *smsc, Octstr *sender, Octstr *receiver,
 						Octstr *account);
+static void index_keywords(URLTranslationList *trans, URLTranslation *t);
 
 
 /***********************************************************************
@@ -187,6 +195,10 @@ URLTranslationList *urltrans_create(void)
     trans->list = gwlist_create();
     trans->defaults = gwlist_create();
     trans->names = dict_create(1024, destroy_keyword_list);
+    trans->keywords = dict_create(1024, destroy_keyword_list);
+    trans->keyword_lengths = NULL;
+    trans->num_keyword_lengths = 0;
+    trans->keyword_regexes = gwlist_create();
     return trans;
 }
 
@@ -196,6 +208,9 @@ void urltrans_destroy(URLTranslationList *trans)
     gwlist_destroy(trans->list, destroy_onetrans);
     gwlist_destroy(trans->defaults, destroy_onetrans);
     dict_destroy(trans->names);
+    dict_destroy(trans->keywords);
+    gw_free(trans->keyword_lengths);
+    gwlist_destroy(trans->keyword_regexes, NULL);
     gw_free(trans);
 }
 
@@ -211,8 +226,12 @@ int urltrans_add_one(URLTranslationList *trans, CfgGroup *grp)
 
     if (ot->type != TRANSTYPE_SENDSMS && ot->keyword_regex == NULL)
         gwlist_append(trans->defaults, ot);
-    else 
+    else {
+        ot->position = gwlist_len(trans->list);
         gwlist_append(trans->list, ot);
+        if (ot->keyword_regex != NULL)
+            index_keywords(trans, ot);
+    }
     
     list2 = dict_get(trans->names, ot->name);
     if (list2 == NULL) {
@@ -940,6 +959,42 @@ int urltrans_dlr_mask(URLTranslation *t)
  */
 
 
+/*
+ * Add a keyword or alias to the plain keywords of the translation. The
+ * keyword is part of a case insensitive regex '^[ ]*(kw|alias...)[ ]*',
+ * i.e. it matches any message beginning with it. If it is not a plain
+ * word it can only be matched with the regex, so the translation does
+ * not go into the keyword index at all.
+ */
+static void add_keyword(URLTranslation *ot, Octstr *word)
+{
+    long i;
+    int c;
+
+    if (ot->keywords == NULL)
+        return;
+
+    for (i = 0; i < octstr_len(word); i++) {
+        c = octstr_get_char(word, i);
+        if (c < 0x20 || c > 0x7e || (i == 0 && c == ' ') ||
+            strchr("\\^$.[]|()*+?{}", c) != NULL) {
+            gwlist_destroy(ot->keywords, octstr_destroy_item);
+            ot->keywords = NULL;
+            return;
+        }
+    }
+    if (i == 0) {
+        /* empty alias matches everything */
+        gwlist_destroy(ot->keywords, octstr_destroy_item);
+        ot->keywords = NULL;
+        return;
+    }
+    word = octstr_duplicate(word);
+    octstr_convert_range(word, 0, octstr_len(word), tolower);
+    gwlist_append(ot->keywords, word);
+}
+
+
 /*
  * Create one URLTranslation. Return NULL for failure, pointer to it for OK.
  */
@@ -1056,6 +1111,8 @@ static URLTranslation *create_onetrans(CfgGroup *grp)
 	    /* convert to regex */
 	    regex_flag |= REG_ICASE;
 	    keyword_regex = octstr_format("^[ ]*(%S", tmp);
+	    ot->keywords = gwlist_create();
+	    add_keyword(ot, tmp);
 	    octstr_destroy(tmp);
 
 	    aliases = cfg_get(grp, octstr_imm("aliases"));
@@ -1069,6 +1126,7 @@ static URLTranslation *create_onetrans(CfgGroup *grp)
 	        for (i = 0; i < gwlist_len(l); ++i) {
 	            os = gwlist_get(l, i);
 	            octstr_format_append(keyword_regex, "|%S", os);
+	            add_keyword(ot, os);
 	        }
 	        gwlist_destroy(l, octstr_destroy_item);
 	    }
@@ -1269,6 +1327,7 @@ static void destroy_onetrans(void *p)
 	octstr_destroy(ot->alt_charset);
 	gwlist_destroy(ot->accepted_smsc, octstr_destroy_item);
 	gwlist_destroy(ot->accepted_account, octstr_destroy_item);
+	gwlist_destroy(ot->keywords, octstr_destroy_item);
 	octstr_destroy(ot->name);
 	octstr_destroy(ot->username);
 	octstr_destroy(ot->password);
@@ -1409,30 +1468,100 @@ static int check_allowed_translation(URLTranslation *t,
 };
 
     
-/* get_matching_translations - iterate over all translations in trans. 
- * for each translation check whether 
- * the translation's keyword has already been interpreted as a regexp. 
- * if not, compile it now,
- * otherwise retrieve compilation result from dictionary.
+/*
+ * Put the plain keywords of a translation into the keyword index, or
+ * the translation into the list of regex keywords if it has none.
+ */
+static void index_keywords(URLTranslationList *trans, URLTranslation *t)
+{
+    Octstr *word;
+    List *list;
+    long i, j, len;
+
+    if (t->keywords == NULL) {
+        gwlist_append(trans->keyword_regexes, t);
+        return;
+    }
+
+    for (i = 0; i < gwlist_len(t->keywords); ++i) {
+        word = gwlist_get(t->keywords, i);
+        list = dict_get(trans->keywords, word);
+        if (list == NULL) {
+            list = gwlist_create();
+            dict_put(trans->keywords, word, list);
+        }
+        /* aliases may be equal to the keyword */
+        if (gwlist_len(list) == 0 || gwlist_get(list, gwlist_len(list) - 1) != t)
+            gwlist_append(list, t);
+
+        len = octstr_len(word);
+        for (j = 0; j < trans->num_keyword_lengths && trans->keyword_lengths[j] > len; ++j)
+            ;
+        if (j < trans->num_keyword_lengths && trans->keyword_lengths[j] == len)
+            continue;
+        trans->keyword_lengths = gw_realloc(trans->keyword_lengths,
+            sizeof(trans->keyword_lengths[0]) * (trans->num_keyword_lengths + 1));
+        memmove(trans->keyword_lengths + j + 1, trans->keyword_lengths + j,
+                sizeof(trans->keyword_lengths[0]) * (trans->num_keyword_lengths - j));
+        trans->keyword_lengths[j] = len;
+        trans->num_keyword_lengths++;
+    }
+}
+
+
+static int cmp_position(const void *a, const void *b)
+{
+    const URLTranslation *ta = a, *tb = b;
+
+    return (ta->position > tb->position) - (ta->position < tb->position);
+}
+
+
+/* get_matching_translations - find all translations in trans which
+ * keyword matches the message.
+ *
+ * Plain keywords are looked up in the keyword index, once for each
+ * distinct keyword length, with the lowercased beginning of the message.
+ * Only the keywords which are real regular expressions are matched
+ * one by one.
  *
  * the translations where the word matches the translation's pattern 
- * are returned in a list
+ * are returned in a list, in configuration order
  * 
  */
 static List *get_matching_translations(URLTranslationList *trans, Octstr *msg) 
 {
-    List *list;
-    long i;
+    List *list, *found;
+    long i, j, start;
     URLTranslation *t;
+    Octstr *word;
 
     gw_assert(trans != NULL && msg != NULL);
 
     list = gwlist_create();
-    for (i = 0; i < gwlist_len(trans->list); ++i) {
-        t = gwlist_get(trans->list, i);
-        
-        if (t->keyword_regex == NULL)
-            continue;
+
+    if (trans->num_keyword_lengths > 0) {
+        for (start = 0; octstr_get_char(msg, start) == ' '; ++start)
+            ;
+        word = octstr_copy(msg, start, trans->keyword_lengths[0]);
+        octstr_convert_range(word, 0, octstr_len(word), tolower);
+        for (i = 0; i < trans->num_keyword_lengths; ++i) {
+            if (trans->keyword_lengths[i] > octstr_len(word))
+                continue;
+            octstr_truncate(word, trans->keyword_lengths[i]);
+            if ((found = dict_get(trans->keywords, word)) == NULL)
+                continue;
+            for (j = 0; j < gwlist_len(found); ++j) {
+                t = gwlist_get(found, j);
+                debug("", 0, "match found: %s", octstr_get_cstr(t->name));
+                gwlist_append(list, t);
+            }
+        }
+        octstr_destroy(word);
+    }
+
+    for (i = 0; i < gwlist_len(trans->keyword_regexes); ++i) {
+        t = gwlist_get(trans->keyword_regexes, i);
 
         if (gw_regex_match_pre(t->keyword_regex, msg) == 1) {
             debug("", 0, "match found: %s", octstr_get_cstr(t->name));
@@ -1442,6 +1571,15 @@ static List *get_matching_translations(URLTranslationList *trans, Octstr *msg)
         }
     }
 
+    /* restore configuration order, a translation may match more than once */
+    if (gwlist_len(list) > 1) {
+        gwlist_sort(list, cmp_position);
+        for (i = gwlist_len(list) - 1; i > 0; --i) {
+            if (gwlist_get(list, i) == gwlist_get(list, i - 1))
+                gwlist_delete(list, i, 1);
+        }
+    }
+
     return list;
 }
 
@@ -126,8 +126,10 @@ static Cfg *init_wapbox(Cfg *cfg)
     CfgGroup *grp;
     Octstr *s;
     Octstr *logfile;
-    int lf, m;
+    int lf, m, h2, h2c;
     long value;
+    long async_log_buffer;
+    int async_log;
 
     lf = m = 1;
 
@@ -190,6 +192,13 @@ static Cfg *init_wapbox(Cfg *cfg)
         debug("wap", 0, "no syslog parameter");
     }
 
+    cfg_get_bool(&async_log, grp, octstr_imm("log-async"));
+    if (async_log) {
+        if (cfg_get_integer(&async_log_buffer, grp, octstr_imm("log-async-buffer")) == -1)
+            async_log_buffer = 65536;
+        log_async_start(async_log_buffer);
+    }
+
     /* determine which timezone we use for access logging */
     if ((s = cfg_get(grp, octstr_imm("access-log-time"))) != NULL) {
         lf = (octstr_case_compare(s, octstr_imm("gmt")) == 0) ? 0 : 1;
@@ -208,6 +217,23 @@ static Cfg *init_wapbox(Cfg *cfg)
 
     if (cfg_get_integer(&value, grp, octstr_imm("http-timeout")) == 0)
        http_set_client_timeout(value);
+    if (cfg_get_integer(&value, grp, octstr_imm("dns-cache-ttl")) == 0)
+       gw_resolver_set_ttl(value, -1);
+    if (cfg_get_integer(&value, grp, octstr_imm("dns-negative-cache-ttl")) == 0)
+       gw_resolver_set_ttl(-1, value);
+    if (cfg_get_integer(&value, grp, octstr_imm("http-max-clients")) == 0)
+       http_set_server_max_clients(value);
+    if (cfg_get_integer(&value, grp, octstr_imm("http-max-host-connections")) == 0)
+       http_set_client_host_limits(value, -1);
+    if (cfg_get_integer(&value, grp, octstr_imm("http-max-host-queue")) == 0)
+       http_set_client_host_limits(-1, value);
+    if (cfg_get_integer(&value, grp, octstr_imm("http-pipeline-depth")) == 0)
+       http_set_client_pipeline_depth(value);
+    h2 = h2c = 0;
+    cfg_get_bool(&h2, grp, octstr_imm("http-h2"));
+    cfg_get_bool(&h2c, grp, octstr_imm("http-h2c"));
+    if (h2 || h2c)
+       http_set_client_h2(h2, h2c);
 
     /* configure the 'wtls' group */
 #if (HAVE_WTLS_OPENSSL)
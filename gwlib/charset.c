@@ -197,6 +197,104 @@ alias_t chars_aliases[] = {
     { NULL }
 };
 
+/*
+ * Escaped GSM characters indexed by the character following the escape,
+ * built from gsm_esctouni at init time. 0 means no mapping.
+ */
+static int gsm_esc_to_unicode[128];
+
+#if HAVE_ICONV
+/*
+ * Conversion descriptors are cached per thread, keyed by the charset
+ * pair, so that charset_convert() does not need an iconv_open() for
+ * every message. The cache of a thread lives in the slot of its thread
+ * id, like the log rings. Threads not created via gwthread don't cache.
+ */
+#define ICONV_THREADS 1024
+#define ICONV_CACHE_SIZE 4
+#define ICONV_NAME_MAX 32
+
+typedef struct {
+    char from[ICONV_NAME_MAX];
+    char to[ICONV_NAME_MAX];
+    iconv_t cd;
+} IconvEntry;
+
+typedef struct {
+    IconvEntry entry[ICONV_CACHE_SIZE];
+    int used;
+    int next; /* slot to replace when full */
+} IconvCache;
+
+static IconvCache *iconv_caches[ICONV_THREADS];
+
+static iconv_t iconv_cache_get(const char *from, const char *to, int *cached)
+{
+    IconvCache *cache;
+    IconvEntry *e;
+    long tid;
+    int i;
+
+    *cached = 0;
+    tid = gwthread_self();
+    if (tid < 0 || strlen(from) >= ICONV_NAME_MAX || strlen(to) >= ICONV_NAME_MAX)
+        return iconv_open(to, from);
+
+    cache = iconv_caches[tid % ICONV_THREADS];
+    if (cache == NULL) {
+        cache = gw_malloc(sizeof(*cache));
+        cache->used = cache->next = 0;
+        iconv_caches[tid % ICONV_THREADS] = cache;
+    }
+
+    for (i = 0; i < cache->used; i++) {
+        e = &cache->entry[i];
+        if (strcmp(e->from, from) == 0 && strcmp(e->to, to) == 0) {
+            /* back to the initial shift state */
+            iconv(e->cd, NULL, NULL, NULL, NULL);
+            *cached = 1;
+            return e->cd;
+        }
+    }
+
+    if (cache->used < ICONV_CACHE_SIZE)
+        e = &cache->entry[cache->used++];
+    else {
+        e = &cache->entry[cache->next];
+        cache->next = (cache->next + 1) % ICONV_CACHE_SIZE;
+        iconv_close(e->cd);
+    }
+    e->cd = iconv_open(to, from);
+    if (e->cd == (iconv_t)(-1)) {
+        /* don't keep failures, the slot gets reused */
+        cache->used--;
+        if (e != &cache->entry[cache->used])
+            *e = cache->entry[cache->used];
+        return (iconv_t)(-1);
+    }
+    strcpy(e->from, from);
+    strcpy(e->to, to);
+    *cached = 1;
+
+    return e->cd;
+}
+
+static void iconv_cache_destroy(void)
+{
+    long i;
+    int j;
+
+    for (i = 0; i < ICONV_THREADS; i++) {
+        if (iconv_caches[i] == NULL)
+            continue;
+        for (j = 0; j < iconv_caches[i]->used; j++)
+            iconv_close(iconv_caches[i]->entry[j].cd);
+        gw_free(iconv_caches[i]);
+        iconv_caches[i] = NULL;
+    }
+}
+#endif
+
 void charset_init()
 {
     int i;
@@ -205,13 +303,69 @@ void charset_init()
       xmlAddEncodingAlias(chars_aliases[i].real,chars_aliases[i].alias);
       /*debug("encoding",0,"Add encoding for %s",chars_aliases[i].alias);*/
     }
+
+    for (i = 0; gsm_esctouni[i].gsmesc >= 0; i++)
+        gsm_esc_to_unicode[gsm_esctouni[i].gsmesc] = gsm_esctouni[i].unichar;
 }
 
 void charset_shutdown()
 {
+#if HAVE_ICONV
+    iconv_cache_destroy();
+#endif
     xmlCleanupEncodingAliases();
 }
 
+
+/*
+ * Output buffer of the transcoders. Data is collected on the stack and
+ * appended to the Octstr in chunks, which saves the per character
+ * octstr_append_char() calls. If os is NULL, data is only counted.
+ */
+typedef struct {
+    Octstr *os;
+    long len;
+    unsigned char buf[256];
+} CharsetOut;
+
+static void out_flush(CharsetOut *out)
+{
+    if (out->os != NULL && out->len > 0)
+        octstr_append_data(out->os, (char*) out->buf, out->len);
+    out->len = 0;
+}
+
+static inline void out_char(CharsetOut *out, int c)
+{
+    if (out->len == sizeof(out->buf))
+        out_flush(out);
+    out->buf[out->len++] = c;
+}
+
+
+/*
+ * Return the length of the pure ASCII prefix of data. Scans a machine
+ * word at a time, most message bodies are ASCII only.
+ */
+static long ascii_span(const unsigned char *data, long len)
+{
+    const unsigned long high = ~0UL / 0xFF * 0x80; /* 0x8080...80 */
+    unsigned long word;
+    long pos = 0;
+
+    while (pos + (long) sizeof(word) <= len) {
+        memcpy(&word, data + pos, sizeof(word));
+        if (word & high)
+            break;
+        pos += sizeof(word);
+    }
+    while (pos < len && data[pos] < 0x80)
+        pos++;
+
+    return pos;
+}
+
+
 /**
  * Convert octet string in GSM format to UTF-8.
  * Every GSM character can be represented with unicode, hence nothing will
@@ -220,64 +374,183 @@ void charset_shutdown()
 void charset_gsm_to_utf8(Octstr *ostr)
 {
     long pos, len;
+    const unsigned char *data;
+    CharsetOut out;
     Octstr *newostr;
 
     if (ostr == NULL)
         return;
 
     newostr = octstr_create("");
+    out.os = newostr;
+    out.len = 0;
     len = octstr_len(ostr);
-    
+    data = (unsigned char*) octstr_get_cstr(ostr);
+
     for (pos = 0; pos < len; pos++) {
-        int c, i;
-        
-        c = octstr_get_char(ostr, pos);
+        int c;
+
+        c = data[pos];
         if (c > 127) {
             warning(0, "Could not convert GSM (0x%02x) to Unicode.", c);
             continue;
         }
-        
-        if(c == 27 && pos + 1 < len) {
-            c = octstr_get_char(ostr, ++pos);
-            for (i = 0; gsm_esctouni[i].gsmesc >= 0; i++) {
-                if (gsm_esctouni[i].gsmesc == c)
-                    break;
-            }   
-            if (gsm_esctouni[i].gsmesc == c) {
+
+        if (c == 27 && pos + 1 < len) {
+            c = data[pos + 1];
+            if (c < 128 && gsm_esc_to_unicode[c] != 0) {
                 /* found a value for escaped char */
-                c = gsm_esctouni[i].unichar;
+                c = gsm_esc_to_unicode[c];
+                pos++;
             } else {
-	        /* nothing found, look esc in our table */
-		c = gsm_to_unicode[27];
-                pos--;
-	    }
-        } else if (c < 128) {
+                /* nothing found, look esc in our table */
+                c = gsm_to_unicode[27];
+            }
+        } else {
             c = gsm_to_unicode[c];
         }
         /* unicode to utf-8 */
-        if(c < 128) {
+        if (c < 128) {
             /* 0-127 are ASCII chars that need no conversion */
-            octstr_append_char(newostr, c);
-        } else { 
-            /* test if it can be converterd into a two byte char */
-            if(c < 0x0800) {
-                octstr_append_char(newostr, ((c >> 6) | 0xC0) & 0xFF); /* add 110xxxxx */
-                octstr_append_char(newostr, (c & 0x3F) | 0x80); /* add 10xxxxxx */
-            } else {
-                /* else we encode with 3 bytes. This only happens in case of euro symbol */
-                octstr_append_char(newostr, ((c >> 12) | 0xE0) & 0xFF); /* add 1110xxxx */
-                octstr_append_char(newostr, (((c >> 6) & 0x3F) | 0x80) & 0xFF); /* add 10xxxxxx */
-                octstr_append_char(newostr, ((c  & 0x3F) | 0x80) & 0xFF); /* add 10xxxxxx */
-            }
-            /* There are no 4 bytes encoded characters in GSM charset */
+            out_char(&out, c);
+        } else if (c < 0x0800) {
+            out_char(&out, ((c >> 6) | 0xC0) & 0xFF); /* add 110xxxxx */
+            out_char(&out, (c & 0x3F) | 0x80); /* add 10xxxxxx */
+        } else {
+            /* else we encode with 3 bytes. This only happens in case of euro symbol */
+            out_char(&out, ((c >> 12) | 0xE0) & 0xFF); /* add 1110xxxx */
+            out_char(&out, (((c >> 6) & 0x3F) | 0x80) & 0xFF); /* add 10xxxxxx */
+            out_char(&out, ((c  & 0x3F) | 0x80) & 0xFF); /* add 10xxxxxx */
         }
+        /* There are no 4 bytes encoded characters in GSM charset */
     }
+    out_flush(&out);
 
     octstr_truncate(ostr, 0);
     octstr_append(ostr, newostr);
     octstr_destroy(newostr);
 }
 
+
+/*
+ * Map an unicode code point to GSM 03.38. Characters that need an escape
+ * are returned negated, the ones that can't be represented as NRP.
+ */
+static int unicode_to_gsm(long c)
+{
+    if (c <= 255)
+        return latin1_to_gsm[c];
+
+    /* Its not a Latin1 char, test for allowed GSM chars */
+    switch (c) {
+    case 0x394: return 0x10; /* GREEK CAPITAL LETTER DELTA */
+    case 0x3A6: return 0x12; /* GREEK CAPITAL LETTER PHI */
+    case 0x393: return 0x13; /* GREEK CAPITAL LETTER GAMMA */
+    case 0x39B: return 0x14; /* GREEK CAPITAL LETTER LAMBDA */
+    case 0x3A9: return 0x15; /* GREEK CAPITAL LETTER OMEGA */
+    case 0x3A0: return 0x16; /* GREEK CAPITAL LETTER PI */
+    case 0x3A8: return 0x17; /* GREEK CAPITAL LETTER PSI */
+    case 0x3A3: return 0x18; /* GREEK CAPITAL LETTER SIGMA */
+    case 0x398: return 0x19; /* GREEK CAPITAL LETTER THETA */
+    case 0x39E: return 0x1A; /* GREEK CAPITAL LETTER XI */
+    case 0x20AC: return -'e'; /* EURO SIGN */
+    default: return NRP; /* character cannot be represented in GSM 03.38 */
+    }
+}
+
+
+long charset_utf8_to_gsm_count(const Octstr *utf8, long pos,
+                               long max_septets, long part_max, Octstr *gsm,
+                               CharsetGsmCount *count)
+{
+    long start, len, span, septets, parts, part_fill, lossy;
+    const unsigned char *data;
+    CharsetOut out;
+
+    out.os = gsm;
+    out.len = 0;
+    septets = parts = part_fill = lossy = 0;
+    len = octstr_len(utf8);
+    data = (len > 0 ? (unsigned char*) octstr_get_cstr(utf8) : NULL);
+    if (pos < 0)
+        pos = 0;
+    start = pos;
+
+    while (pos < len) {
+        long c, n;
+        int g, width;
+
+        /* fast path: ASCII needs no UTF-8 decoding, only the table */
+        span = ascii_span(data + pos, len - pos);
+        n = 1;
+        if (span > 0) {
+            c = data[pos];
+        } else {
+            /* Convert UTF-8 to unicode code */
+            c = data[pos];
+            if ((c & 0xE0) == 0xC0)
+                n = 2;
+            else if ((c & 0xF0) == 0xE0)
+                n = 3;
+            else if ((c & 0xF8) == 0xF0)
+                n = 4;
+            if (pos + n > len) {
+                /* incomplete, ignore it */
+                warning(0, "Incomplete UTF-8 char discovered, skipped.");
+                pos = len;
+                break;
+            }
+            if (n == 2)
+                c = ((c & 0x1F) << 6) | (data[pos + 1] & 0x3F);
+            else if (n == 3)
+                c = ((c & 0x0F) << 12) | ((data[pos + 1] & 0x3F) << 6) |
+                    (data[pos + 2] & 0x3F);
+            else if (n == 4)
+                c = 0x10000; /* outside BMP, never in GSM 03.38 */
+        }
+
+        do {
+            g = unicode_to_gsm(c);
+            width = (g < 0 ? 2 : 1);
+            if (max_septets >= 0 && septets + width > max_septets)
+                goto done;
+            if (g == NRP && c != NRP)
+                lossy++;
+            if (out.os != NULL) {
+                if (g < 0) {
+                    out_char(&out, 27);
+                    g = -g;
+                }
+                out_char(&out, g);
+            }
+            septets += width;
+            /* escape sequences are never split over two parts */
+            if (part_max > 0) {
+                if (parts == 0 || part_fill + width > part_max) {
+                    parts++;
+                    part_fill = 0;
+                }
+                part_fill += width;
+            }
+            pos += n;
+            if (--span > 0)
+                c = data[pos];
+        } while (span > 0);
+    }
+
+done:
+    out_flush(&out);
+    if (count != NULL) {
+        count->septets = septets;
+        count->octets = (pos > start ? pos - start : 0);
+        count->parts = parts;
+        count->lossy = lossy;
+    }
+
+    return septets;
+}
+
+
 /**
  * Convert octet string in UTF-8 format to GSM 03.38.
  * Because not all UTF-8 charater can be converted to GSM 03.38 non
@@ -287,103 +560,13 @@ void charset_gsm_to_utf8(Octstr *ostr)
  */
 void charset_utf8_to_gsm(Octstr *ostr)
 {
-    long pos, len;
-    int val1, val2;
     Octstr *newostr;
 
     if (ostr == NULL)
         return;
-    
-    newostr = octstr_create("");
-    len = octstr_len(ostr);
-    
-    for (pos = 0; pos < len; pos++) {
-        val1 = octstr_get_char(ostr, pos);
-        
-        /* check range */
-        if (val1 < 0 || val1 > 255) {
-            warning(0, "Char (0x%02x) in UTF-8 string not in the range (0, 255). Skipped.", val1);
-            continue;
-        }
-        
-        /* Convert UTF-8 to unicode code */
-        
-        /* test if two byte utf8 char */
-        if ((val1 & 0xE0) == 0xC0) {
-            /* test if incomplete utf char */
-            if(pos + 1 < len) {
-                val2 = octstr_get_char(ostr, ++pos);
-                val1 = (((val1 & ~0xC0) << 6) | (val2 & 0x3F));
-            } else {
-                /* incomplete, ignore it */
-                warning(0, "Incomplete UTF-8 char discovered, skipped. 1");
-                pos += 1;
-                continue;
-            }
-        } else if ((val1 & 0xF0) == 0xE0) { /* test for three byte utf8 char */
-            if(pos + 2 < len) {
-                val2 = octstr_get_char(ostr, ++pos);
-                val1 = (((val1 & ~0xE0) << 6) | (val2 & 0x3F));
-                val2 = octstr_get_char(ostr, ++pos);
-                val1 = (val1 << 6) | (val2 & 0x3F);
-            } else {
-                /* incomplete, ignore it */
-                warning(0, "Incomplete UTF-8 char discovered, skipped. 2");
-                pos += 2;
-                continue;
-            }
-        }
 
-        /* test Latin code page 1 char */
-        if(val1 <= 255) {
-            val1 = latin1_to_gsm[val1];
-            /* needs to be escaped ? */
-            if(val1 < 0) {
-                octstr_append_char(newostr, 27);
-                val1 *= -1;
-            }
-        } else {
-            /* Its not a Latin1 char, test for allowed GSM chars */
-            switch(val1) {
-            case 0x394:
-                val1 = 0x10; /* GREEK CAPITAL LETTER DELTA */
-                break;
-            case 0x3A6:
-                val1 = 0x12; /* GREEK CAPITAL LETTER PHI */
-                break;
-            case 0x393:
-                val1 = 0x13; /* GREEK CAPITAL LETTER GAMMA */
-                break;
-            case 0x39B:
-                val1 = 0x14; /* GREEK CAPITAL LETTER LAMBDA */
-                break;
-            case 0x3A9:
-                val1 = 0x15; /* GREEK CAPITAL LETTER OMEGA */
-                break;
-            case 0x3A0:
-                val1 = 0x16; /* GREEK CAPITAL LETTER PI */
-                break;
-            case 0x3A8:
-                val1 = 0x17; /* GREEK CAPITAL LETTER PSI */
-                break;
-            case 0x3A3:
-                val1 = 0x18; /* GREEK CAPITAL LETTER SIGMA */
-                break;
-            case 0x398:
-                val1 = 0x19; /* GREEK CAPITAL LETTER THETA */
-                break;
-            case 0x39E:
-                val1 = 0x1A; /* GREEK CAPITAL LETTER XI */
-                break;
-            case 0x20AC:
-                val1 = 'e'; /* EURO SIGN */
-                octstr_append_char(newostr, 27);
-                break;
-            default: val1 = NRP; /* character cannot be represented in GSM 03.38 */
-            }
-        }
-        octstr_append_char(newostr, val1);
-    }
+    newostr = octstr_create("");
+    charset_utf8_to_gsm_count(ostr, 0, -1, 0, newostr, NULL);
 
     octstr_truncate(ostr, 0);
     octstr_append(ostr, newostr);
@@ -592,6 +775,7 @@ int charset_convert(Octstr* string, char* charset_from, char* charset_to)
     char *from_buf, *to_buf, *pointer;
     size_t inbytesleft, outbytesleft, ret;
     iconv_t cd;
+    int cached;
      
     if (!charset_from || !charset_to || !string) /* sanity check */
         return -1;
@@ -599,7 +783,7 @@ int charset_convert(Octstr* string, char* charset_from, char* charset_to)
     if (octstr_len(string) < 1 || strcasecmp(charset_from, charset_to) == 0)
         return 0; /* we are done, nothing to convert */
         
-    cd = iconv_open(charset_to, charset_from);
+    cd = iconv_cache_get(charset_from, charset_to, &cached);
     /* Did I succeed in getting a conversion descriptor ? */
     if (cd == (iconv_t)(-1)) {
         /* I guess not */
@@ -651,7 +835,8 @@ int charset_convert(Octstr* string, char* charset_from, char* charset_to)
         }
     } while(inbytesleft && ret == 0); /* stop if error occurs and not handled above */
     
-    iconv_close(cd);
+    if (!cached)
+        iconv_close(cd);
     
     if (ret != -1) {
         /* conversion succeeded */
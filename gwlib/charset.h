@@ -105,6 +105,31 @@ void charset_gsm_to_utf8(Octstr *ostr);
  */
 void charset_utf8_to_gsm(Octstr *ostr);
 
+/*
+ * Result of charset_utf8_to_gsm_count().
+ */
+typedef struct {
+    long septets; /* GSM 03.38 septets, escaped characters count two */
+    long octets;  /* UTF-8 octets converted, counted from pos */
+    long parts;   /* messages of at most part_max septets needed */
+    long lossy;   /* characters not representable, replaced with '?' */
+} CharsetGsmCount;
+
+/*
+ * Convert UTF-8 to GSM 03.38 like charset_utf8_to_gsm(), but count the
+ * result in the same pass, starting at octet pos of utf8, which has to
+ * be at a character boundary. The GSM data is appended to gsm, unless gsm
+ * is NULL, in which case only counting is done and nothing allocated.
+ * If max_septets >= 0, conversion stops before the first character that
+ * would exceed it, escape sequences are never cut. If part_max > 0, the
+ * number of parts of at most part_max septets each is counted, again
+ * without splitting escape sequences. count may be NULL.
+ * Returns the number of septets.
+ */
+long charset_utf8_to_gsm_count(const Octstr *utf8, long pos,
+                               long max_septets, long part_max, Octstr *gsm,
+                               CharsetGsmCount *count);
+
 /*
  * Convert from GSM default character set to NRC ISO 21 (German)
  * and vise versa.
@@ -152,7 +177,7 @@ int charset_to_utf8(Octstr *from, Octstr **to, Octstr *charset_from);
 int charset_from_utf8(Octstr *utf8, Octstr **to, Octstr *charset_to);
 
 /* use iconv library to convert an Octstr in place, from source character set to
- * destination character set
+ * destination character set. Conversion descriptors are cached per thread.
  */
 int charset_convert(Octstr* string, char* charset_from, char* charset_to);
 
@@ -346,6 +346,19 @@ static void unlocked_read(Connection *conn)
             unlocked_register_pollin(conn, 0);
     } else {
         octstr_append_data(conn->inbuf, buf, len);
+#ifdef HAVE_LIBSSL
+        /*
+         * SSL may hold decrypted data of a record that did not fit into
+         * buf. The socket will not become readable for it again, so take
+         * it now.
+         */
+        while (conn->ssl != NULL && SSL_pending(conn->ssl) > 0) {
+            len = SSL_read(conn->ssl, buf, sizeof(buf));
+            if (len <= 0)
+                break;
+            octstr_append_data(conn->inbuf, buf, len);
+        }
+#endif /* HAVE_LIBSSL */
     }
 }
 
@@ -771,6 +784,17 @@ static void poll_callback(int fd, int revents, void *data)
     /* If unlocked_write manages to write all pending data, it will
      * tell the fdset to stop listening for POLLOUT. */
     if (revents & POLLOUT) {
+#ifdef HAVE_LIBSSL
+        /* A handshake that had to wait for the socket to become writable
+         * is driven on by reading. */
+        if (conn->ssl != NULL && !SSL_is_init_finished(conn->ssl) &&
+            !(revents & POLLIN)) {
+            lock_in(conn);
+            unlocked_read(conn);
+            unlock_in(conn);
+            do_callback = 1;
+        }
+#endif /* HAVE_LIBSSL */
         lock_out(conn);
         unlocked_write(conn);
         if (unlocked_outbuf_len(conn) == 0)
@@ -787,6 +811,21 @@ static void poll_callback(int fd, int revents, void *data)
         do_callback = 1;
     }
 
+#ifdef HAVE_LIBSSL
+    /*
+     * The SSL handshake runs inside of SSL_read. If it could not write
+     * its part, listen for POLLOUT so that it can go on without the
+     * peer having to send anything.
+     */
+    if (conn->ssl != NULL && !SSL_is_init_finished(conn->ssl) &&
+        SSL_want_write(conn->ssl)) {
+        lock_out(conn);
+        if (conn->registered)
+            unlocked_register_pollout(conn, 1);
+        unlock_out(conn);
+    }
+#endif /* HAVE_LIBSSL */
+
     if (do_callback && conn->callback)
         conn->callback(conn, conn->callback_data);
 }
@@ -1079,6 +1118,28 @@ int conn_write_withlen(Connection *conn, Octstr *data)
     return ret;
 }
 
+
+int conn_write_packed(Connection *conn, conn_pack_func *pack, void *data)
+{
+    int ret;
+    long pos;
+    unsigned char lengthbuf[4];
+
+    lock_out(conn);
+    pos = octstr_len(conn->outbuf);
+    octstr_append_data(conn->outbuf, "\0\0\0\0", 4);
+    pack(conn->outbuf, data);
+    encode_network_long(lengthbuf, octstr_len(conn->outbuf) - pos - 4);
+    octstr_set_char(conn->outbuf, pos, lengthbuf[0]);
+    octstr_set_char(conn->outbuf, pos + 1, lengthbuf[1]);
+    octstr_set_char(conn->outbuf, pos + 2, lengthbuf[2]);
+    octstr_set_char(conn->outbuf, pos + 3, lengthbuf[3]);
+    ret = unlocked_try_write(conn);
+    unlock_out(conn);
+
+    return ret;
+}
+
 Octstr *conn_read_everything(Connection *conn)
 {
     Octstr *result = NULL;
@@ -1201,6 +1262,47 @@ Octstr *conn_read_withlen(Connection *conn)
     return result;
 }
 
+int conn_read_packed(Connection *conn, conn_unpack_func *unpack, void *data)
+{
+    unsigned char lengthbuf[4];
+    long length = 0; /* for compiler please */
+    int try, retry, ret = 0;
+
+    lock_in(conn);
+
+    for (try = 1; try <= 2; try++) {
+        if (try > 1)
+            unlocked_read(conn);
+
+        do {
+            retry = 0;
+            /* First get the length. */
+            if (unlocked_inbuf_len(conn) < 4)
+                continue;
+
+            octstr_get_many_chars(lengthbuf, conn->inbuf, conn->inbufpos, 4);
+            length = decode_network_long(lengthbuf);
+
+            if (length < 0) {
+                warning(0, "conn_read_packed: got negative length, skipping");
+                conn->inbufpos += 4;
+                retry = 1;
+             }
+        } while(retry == 1);
+
+        /* Then unpack the data where it is. */
+        if (unlocked_inbuf_len(conn) - 4 < length)
+            continue;
+
+        ret = (unpack(conn->inbuf, conn->inbufpos + 4, length, data) == -1) ? -1 : 1;
+        conn->inbufpos += 4 + length;
+        break;
+    }
+
+    unlock_in(conn);
+    return ret;
+}
+
 Octstr *conn_read_packet(Connection *conn, int startmark, int endmark)
 {
     int startpos, endpos;
@@ -1334,6 +1436,15 @@ void server_ssl_init(void)
     if (!SSL_CTX_set_default_verify_paths(global_server_ssl_context)) {
 	   panic(0, "can not set default path for server");
     }
+    /*
+     * Let clients resume their sessions, either from our session cache
+     * or with session tickets, and so skip the expensive full handshake.
+     */
+    SSL_CTX_set_session_id_context(global_server_ssl_context,
+        (const unsigned char *) "kannel", 6);
+    SSL_CTX_set_session_cache_mode(global_server_ssl_context, SSL_SESS_CACHE_SERVER);
+    SSL_CTX_clear_options(global_server_ssl_context, SSL_OP_NO_TICKET);
+    SSL_CTX_set_timeout(global_server_ssl_context, 300);
 }
 
 void conn_shutdown_ssl(void)
@@ -1392,9 +1503,10 @@ static int verify_callback(int preverify_ok, X509_STORE_CTX *ctx)
     char    subject[256];
     char    issuer [256];
     char   *status;
+    X509   *cert = X509_STORE_CTX_get_current_cert(ctx);
 
-    X509_NAME_oneline(X509_get_subject_name(ctx->current_cert), subject, sizeof(subject));
-    X509_NAME_oneline(X509_get_issuer_name(ctx->current_cert), issuer, sizeof (issuer));
+    X509_NAME_oneline(X509_get_subject_name(cert), subject, sizeof(subject));
+    X509_NAME_oneline(X509_get_issuer_name(cert), issuer, sizeof (issuer));
 
     status = preverify_ok ? "Accepting" : "Rejecting";
     
@@ -1431,6 +1543,7 @@ void conn_config_ssl (CfgGroup *grp)
     Octstr *ssl_server_cert_file    = NULL;
     Octstr *ssl_server_key_file     = NULL;
     Octstr *ssl_trusted_ca_file     = NULL;
+    long ssl_session_timeout;
 
     /*
      * check if SSL is desired for HTTP servers and then
@@ -1453,6 +1566,17 @@ void conn_config_ssl (CfgGroup *grp)
     
     conn_use_global_trusted_ca_file(ssl_trusted_ca_file);
 
+    /* lifetime of resumable server sessions, 0 turns resumption off */
+    if (cfg_get_integer(&ssl_session_timeout, grp,
+                        octstr_imm("ssl-session-timeout")) == 0) {
+        if (ssl_session_timeout > 0) {
+            SSL_CTX_set_timeout(global_server_ssl_context, ssl_session_timeout);
+        } else {
+            SSL_CTX_set_session_cache_mode(global_server_ssl_context, SSL_SESS_CACHE_OFF);
+            SSL_CTX_set_options(global_server_ssl_context, SSL_OP_NO_TICKET);
+        }
+    }
+
     octstr_destroy(ssl_client_certkey_file);
     octstr_destroy(ssl_server_cert_file);
     octstr_destroy(ssl_server_key_file);
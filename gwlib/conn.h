@@ -252,6 +252,11 @@ int conn_write_data(Connection *conn, unsigned char *data, long length);
 /* Write the length of the octstr as a standard network long, then
  * write the octstr itself. */
 int conn_write_withlen(Connection *conn, Octstr *data);
+/* Same framing as conn_write_withlen, but the data is produced by calling
+ * `pack', which appends it directly to the output buffer of the connection.
+ * This saves building and copying an intermediate Octstr. */
+typedef void conn_pack_func(Octstr *out, void *data);
+int conn_write_packed(Connection *conn, conn_pack_func *pack, void *data);
 
 /* Input functions.  Each of these takes an open connection and
  * returns data if it's available, or NULL if it's not.  They will
@@ -278,6 +283,16 @@ Octstr *conn_read_line(Connection *conn);
  */
 Octstr *conn_read_withlen(Connection *conn);
 
+/* Like conn_read_withlen, but instead of copying the packet out of the
+ * input buffer call `unpack' with the buffer, offset and length of the
+ * packet data, then remove the packet from the input buffer. `unpack'
+ * must not keep references into the buffer.
+ * Return 1 if a packet was unpacked, 0 if no full packet is available
+ * yet and -1 if `unpack' failed (the packet is skipped then).
+ */
+typedef int conn_unpack_func(Octstr *in, long off, long len, void *data);
+int conn_read_packed(Connection *conn, conn_unpack_func *unpack, void *data);
+
 /* If the input buffer contains a packet delimited by the "startmark"
  * and "endmark" characters, then return that packet (including the marks)
  * and delete everything up to the end of that packet from the input buffer.
@@ -71,37 +71,25 @@
 
 #include "gwlib.h"
 
+/*
+ * The value is only ever touched with atomic operations, so no lock is
+ * needed; counter_decrease() is a compare-and-swap loop to stop at zero.
+ * Callers use counters to hand objects between threads (the last one to
+ * bring a split's parts_left to zero reads its status and frees it), so
+ * updates are acquire/release like the mutex they replace. Only the
+ * counter_stat_* functions, meant for pure statistics, are relaxed.
+ */
 struct Counter
 {
-#ifdef HAVE_PTHREAD_SPINLOCK_T
-    pthread_spinlock_t lock;
-#else
-    Mutex *lock;
-#endif
     unsigned long n;
 };
 
 
-#ifdef HAVE_PTHREAD_SPINLOCK_T
-#define lock(c) pthread_spin_lock(&c->lock)
-#define unlock(c) pthread_spin_unlock(&c->lock)
-#else
-#define lock(c) mutex_lock(c->lock)
-#define unlock(c) mutex_unlock(c->lock)
-#endif
-
-
 Counter *counter_create(void)
 {
     Counter *counter;
 
     counter = gw_malloc(sizeof(Counter));
-#ifdef HAVE_PTHREAD_SPINLOCK_T
-    pthread_spin_init(&counter->lock, 0);
-#else
-    counter->lock = mutex_create();
-#endif
-
     counter->n = 0;
     return counter;
 }
@@ -112,65 +100,47 @@ void counter_destroy(Counter *counter)
     if (counter == NULL)
         return;
 
-#ifdef HAVE_PTHREAD_SPINLOCK_T
-    pthread_spin_destroy(&counter->lock);
-#else
-    mutex_destroy(counter->lock);
-#endif
     gw_free(counter);
 }
 
 unsigned long counter_increase(Counter *counter)
 {
-    unsigned long ret;
-
-    lock(counter);
-    ret = counter->n;
-    ++counter->n;
-    unlock(counter);
-    return ret;
+    return __atomic_fetch_add(&counter->n, 1, __ATOMIC_ACQ_REL);
 }
 
 unsigned long counter_increase_with(Counter *counter, unsigned long value)
 {
-    unsigned long ret;
-
-    lock(counter);
-    ret = counter->n;
-    counter->n += value;
-    unlock(counter);
-    return ret;
+    return __atomic_fetch_add(&counter->n, value, __ATOMIC_ACQ_REL);
 }
 
 unsigned long counter_value(Counter *counter)
 {
-    unsigned long ret;
-
-    lock(counter);
-    ret = counter->n;
-    unlock(counter);
-    return ret;
+    return __atomic_load_n(&counter->n, __ATOMIC_ACQUIRE);
 }
 
 unsigned long counter_decrease(Counter *counter)
 {
     unsigned long ret;
 
-    lock(counter);
-    ret = counter->n;
-    if (counter->n > 0)
-        --counter->n;
-    unlock(counter);
+    ret = __atomic_load_n(&counter->n, __ATOMIC_ACQUIRE);
+    while (ret > 0 &&
+           !__atomic_compare_exchange_n(&counter->n, &ret, ret - 1, 1,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+        ;
     return ret;
 }
 
 unsigned long counter_set(Counter *counter, unsigned long n)
 {
-    unsigned long ret;
+    return __atomic_exchange_n(&counter->n, n, __ATOMIC_ACQ_REL);
+}
 
-    lock(counter);
-    ret = counter->n;
-    counter->n = n;
-    unlock(counter);
-    return ret;
+unsigned long counter_stat_increase(Counter *counter)
+{
+    return __atomic_fetch_add(&counter->n, 1, __ATOMIC_RELAXED);
+}
+
+unsigned long counter_stat_increase_with(Counter *counter, unsigned long value)
+{
+    return __atomic_fetch_add(&counter->n, value, __ATOMIC_RELAXED);
 }
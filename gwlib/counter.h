@@ -97,4 +97,11 @@ unsigned long counter_decrease(Counter *counter);
 /* return the current value of the counter and set it to the supplied value */
 unsigned long counter_set(Counter *, unsigned long);
 
+/*
+ * Same as counter_increase and counter_increase_with, but without any
+ * memory ordering. Only for statistics counters nobody synchronizes on.
+ */
+unsigned long counter_stat_increase(Counter *counter);
+unsigned long counter_stat_increase_with(Counter *counter, unsigned long value);
+
 #endif
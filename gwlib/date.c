@@ -62,6 +62,7 @@
 #include <unistd.h>
 #include <ctype.h>
 #include <string.h>
+#include <sys/time.h>
 
 #include "gwlib.h"
 
@@ -305,3 +306,12 @@ long date_universal_now(void)
 {
     return (long) time(NULL);
 }
+
+
+double date_precise_now(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
@@ -121,3 +121,9 @@ Octstr* date_create_iso(time_t unixtime);
  * Return the current date and time as a unix time value.
  */
 long date_universal_now(void);
+
+/*
+ * Return the current time as a unix time value with microsecond
+ * precision, for measuring how long something takes.
+ */
+double date_precise_now(void);
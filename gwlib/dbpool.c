@@ -67,6 +67,8 @@
  *      2009 Added support for MS-SQL using FreeTDS
  */
 
+#include <limits.h>
+
 #include "gwlib.h"
 #include "dbpool.h"
 #include "dbpool_p.h"
@@ -83,11 +85,87 @@
 #include "dbpool_redis.c"
 #include "dbpool_cass.c"
 
+/*
+ * Connections that have been idle for less than this many seconds and
+ * whose last statement succeeded are handed out without a check.
+ */
+#define DBPOOL_CHECK_IDLE 30
+
+/*
+ * Maximum number of prepared statements kept per connection. When full,
+ * the least recently used one is finalized.
+ */
+#define DBPOOL_STMT_CACHE 64
+
+/* A cached prepared statement and when it was last used */
+typedef struct {
+    void *stmt;
+    unsigned long used;
+} DBPoolStmt;
+
+
+static void dbpool_stmt_finalize(DBPoolConn *conn, DBPoolStmt *s)
+{
+    conn->pool->db_ops->finalize(s->stmt);
+    gw_free(s);
+}
+
+
+static void dbpool_stmts_flush(DBPoolConn *conn)
+{
+    List *keys;
+    Octstr *key;
+
+    if (conn->stmts == NULL)
+        return;
+
+    keys = dict_keys(conn->stmts);
+    while ((key = gwlist_extract_first(keys)) != NULL) {
+        dbpool_stmt_finalize(conn, dict_remove(conn->stmts, key));
+        octstr_destroy(key);
+    }
+    gwlist_destroy(keys, NULL);
+}
+
+
+/*
+ * Finalize the least recently used statement. Only done when a new
+ * statement is prepared on a full cache, so a linear scan is fine.
+ */
+static void dbpool_stmts_evict(DBPoolConn *conn)
+{
+    List *keys;
+    Octstr *key, *oldest = NULL;
+    DBPoolStmt *s;
+    unsigned long min = ULONG_MAX;
+
+    keys = dict_keys(conn->stmts);
+    while ((key = gwlist_extract_first(keys)) != NULL) {
+        s = dict_get(conn->stmts, key);
+        if (s->used < min) {
+            min = s->used;
+            octstr_destroy(oldest);
+            oldest = key;
+        } else
+            octstr_destroy(key);
+    }
+    gwlist_destroy(keys, NULL);
+
+    if (oldest != NULL) {
+        dbpool_stmt_finalize(conn, dict_remove(conn->stmts, oldest));
+        octstr_destroy(oldest);
+    }
+}
+
 
 static void dbpool_conn_destroy(DBPoolConn *conn)
 {
     gw_assert(conn != NULL);
 
+    /* statements have to go before their connection */
+    dbpool_stmts_flush(conn);
+    dict_destroy(conn->stmts);
+
     if (conn->conn != NULL)
         conn->pool->db_ops->close(conn->conn);
 
@@ -95,6 +173,46 @@ static void dbpool_conn_destroy(DBPoolConn *conn)
 }
 
 
+/*
+ * Return the cached prepared statement for sql, preparing it if
+ * needed. Returns NULL if the statement can not be prepared.
+ */
+static void *dbpool_stmt_get(DBPoolConn *conn, const Octstr *sql)
+{
+    DBPoolStmt *s;
+    void *stmt;
+
+    if ((s = dict_get(conn->stmts, (Octstr*) sql)) != NULL) {
+        s->used = ++conn->stmt_clock;
+        return s->stmt;
+    }
+
+    if ((stmt = conn->pool->db_ops->prepare(conn->conn, sql)) == NULL)
+        return NULL;
+
+    if (dict_key_count(conn->stmts) >= DBPOOL_STMT_CACHE)
+        dbpool_stmts_evict(conn);
+    s = gw_malloc(sizeof(*s));
+    s->stmt = stmt;
+    s->used = ++conn->stmt_clock;
+    dict_put(conn->stmts, (Octstr*) sql, s);
+
+    return stmt;
+}
+
+
+/*
+ * Drop a statement that failed, it is prepared again on next use.
+ */
+static void dbpool_stmt_drop(DBPoolConn *conn, const Octstr *sql)
+{
+    DBPoolStmt *s;
+
+    if ((s = dict_remove(conn->stmts, (Octstr*) sql)) != NULL)
+        dbpool_stmt_finalize(conn, s);
+}
+
+
 /*************************************************************************
  * public functions
  */
@@ -114,6 +232,9 @@ DBPool *dbpool_create(enum db_type db_type, DBConf *conf, unsigned int connectio
     p->curr_size = 0;
     p->conf = conf;
     p->db_type = db_type;
+    p->stats_lock = mutex_create();
+    p->checkouts = p->checks = 0;
+    p->wait_total = p->wait_max = 0;
 
     switch(db_type) {
 #ifdef HAVE_MSSQL
@@ -183,9 +304,15 @@ void dbpool_destroy(DBPool *p)
 
     gw_assert(p->pool != NULL && p->db_ops != NULL);
 
+    if (p->checkouts > 0)
+        debug("dbpool", 0, "DBPool: %lu checkouts, %lu checks, avg wait %.3f ms, "
+              "max wait %.3f ms", p->checkouts, p->checks,
+              p->wait_total * 1000 / p->checkouts, p->wait_max * 1000);
+
     gwlist_remove_producer(p->pool);
     gwlist_destroy(p->pool, (void*) dbpool_conn_destroy);
 
+    mutex_destroy(p->stats_lock);
     p->db_ops->conf_destroy(p->conf);
     gw_free(p);
 }
@@ -210,6 +337,10 @@ unsigned int dbpool_increase(DBPool *p, unsigned int count)
 
             pc->conn = conn;
             pc->pool = p;
+            pc->stmts = (p->db_ops->prepare != NULL ? dict_create(32, NULL) : NULL);
+            pc->stmt_clock = 0;
+            pc->last_used = time(NULL);
+            pc->failed = 0;
 
             p->curr_size++;
             opened++;
@@ -269,6 +400,8 @@ long dbpool_conn_count(DBPool *p)
 DBPoolConn *dbpool_conn_consume(DBPool *p)
 {
     DBPoolConn *pc;
+    unsigned long checks = 0;
+    double start, wait;
 
     gw_assert(p != NULL && p->pool != NULL);
     
@@ -285,14 +418,22 @@ DBPoolConn *dbpool_conn_consume(DBPool *p)
             gwthread_sleep(0.1);
     }
 
+    start = date_precise_now();
+
     /* garantee that you deliver a valid connection to the caller */
     while ((pc = gwlist_consume(p->pool)) != NULL) {
+        int check;
 
-        /* 
-         * XXX check that the connection is still existing.
-         * Is this a performance bottle-neck?!
+        /*
+         * Check that the connection is still existing, but only if it
+         * has been idle for a while or its last statement failed. A
+         * round trip to the database for every checkout is too expensive.
          */
-        if (!pc->conn || (p->db_ops->check && p->db_ops->check(pc->conn) != 0)) {
+        check = (pc->conn && p->db_ops->check &&
+                 (pc->failed || time(NULL) - pc->last_used >= DBPOOL_CHECK_IDLE));
+        if (check)
+            checks++;
+        if (!pc->conn || (check && p->db_ops->check(pc->conn) != 0)) {
             /* something was wrong, reinitialize the connection */
             /* lock dbpool for update */
             gwlist_lock(p->pool);
@@ -314,11 +455,21 @@ DBPoolConn *dbpool_conn_consume(DBPool *p)
             }
 
         } else {
+            pc->failed = 0;
             break;
         }
     }
 
-    return (pc->conn != NULL ? pc : NULL);
+    wait = date_precise_now() - start;
+    mutex_lock(p->stats_lock);
+    p->checkouts++;
+    p->checks += checks;
+    p->wait_total += wait;
+    if (wait > p->wait_max)
+        p->wait_max = wait;
+    mutex_unlock(p->stats_lock);
+
+    return (pc != NULL && pc->conn != NULL ? pc : NULL);
 }
 
 
@@ -326,6 +477,7 @@ void dbpool_conn_produce(DBPoolConn *pc)
 {
     gw_assert(pc != NULL && pc->conn != NULL && pc->pool != NULL && pc->pool->pool != NULL);
 
+    pc->last_used = time(NULL);
     gwlist_produce(pc->pool->pool, pc);
 }
 
@@ -373,27 +525,96 @@ unsigned int dbpool_check(DBPool *p)
 }
 
 
+void dbpool_stats(DBPool *p, unsigned long *checkouts, unsigned long *checks,
+                  double *avg_wait_ms, double *max_wait_ms)
+{
+    gw_assert(p != NULL);
+
+    mutex_lock(p->stats_lock);
+    if (checkouts != NULL)
+        *checkouts = p->checkouts;
+    if (checks != NULL)
+        *checks = p->checks;
+    if (avg_wait_ms != NULL)
+        *avg_wait_ms = (p->checkouts > 0 ? p->wait_total * 1000 / p->checkouts : 0);
+    if (max_wait_ms != NULL)
+        *max_wait_ms = p->wait_max * 1000;
+    mutex_unlock(p->stats_lock);
+}
+
+
 int dbpool_conn_select(DBPoolConn *conn, const Octstr *sql, List *binds, List **result)
 {
+    struct db_ops *ops;
+    void *stmt;
+    int ret;
+
     if (sql == NULL || conn == NULL)
         return -1;
 
-    if (conn->pool->db_ops->select == NULL)
+    ops = conn->pool->db_ops;
+    if (ops->select_stmt != NULL && conn->stmts != NULL) {
+        *result = NULL;
+        if ((stmt = dbpool_stmt_get(conn, sql)) == NULL)
+            ret = -1;
+        else if ((ret = ops->select_stmt(conn->conn, stmt, binds, result)) == -1)
+            dbpool_stmt_drop(conn, sql);
+    } else if (ops->select != NULL) {
+        ret = ops->select(conn->conn, sql, binds, result);
+    } else
         return -1; /* may be panic here ??? */
 
-    return conn->pool->db_ops->select(conn->conn, sql, binds, result);
+    if (ret == -1)
+        conn->failed = 1;
+
+    return ret;
 }
 
 
 int dbpool_conn_update(DBPoolConn *conn, const Octstr *sql, List *binds)
 {
+    struct db_ops *ops;
+    void *stmt;
+    int ret;
+
     if (sql == NULL || conn == NULL)
         return -1;
 
-    if (conn->pool->db_ops->update == NULL)
+    ops = conn->pool->db_ops;
+    if (ops->update_stmt != NULL && conn->stmts != NULL) {
+        if ((stmt = dbpool_stmt_get(conn, sql)) == NULL)
+            ret = -1;
+        else if ((ret = ops->update_stmt(conn->conn, stmt, binds)) == -1)
+            dbpool_stmt_drop(conn, sql);
+    } else if (ops->update != NULL) {
+        ret = ops->update(conn->conn, sql, binds);
+    } else
         return -1; /* may be panic here ??? */
 
-    return conn->pool->db_ops->update(conn->conn, sql, binds);
+    if (ret == -1)
+        conn->failed = 1;
+
+    return ret;
+}
+
+
+int dbpool_conn_update_many(DBPoolConn *conn, const Octstr *sql, List *binds_list)
+{
+    long i;
+    int ok;
+
+    if (sql == NULL || conn == NULL)
+        return -1;
+
+    if (conn->pool->db_ops->update_many != NULL)
+        return conn->pool->db_ops->update_many(conn->conn, sql, binds_list);
+
+    ok = 0;
+    for (i = 0; i < gwlist_len(binds_list); i++)
+        if (dbpool_conn_update(conn, sql, gwlist_get(binds_list, i)) >= 0)
+            ok++;
+
+    return ok > 0 ? ok : -1;
 }
 
 #endif /* HAVE_DBPOOL */
@@ -94,6 +94,10 @@ typedef struct DBPool DBPool;
  typedef struct {
     void *conn; /* the pointer holding the database specific connection */
     DBPool *pool; /* pointer of the pool where this connection belongs to */
+    Dict *stmts; /* prepared statements of this connection, keyed by sql */
+    unsigned long stmt_clock; /* statement uses, for evicting the oldest */
+    time_t last_used; /* when the connection was last returned to the pool */
+    int failed; /* last statement failed, check connection on next consume */
 }  DBPoolConn;
 
 typedef struct {
@@ -230,6 +234,13 @@ void dbpool_conn_produce(DBPoolConn *conn);
 int dbpool_conn_select(DBPoolConn *conn, const Octstr *sql, List *binds, List **result);
 int dbpool_conn_update(DBPoolConn *conn, const Octstr *sql, List *binds);
 
+/*
+ * Execute sql once for each list of binds in binds_list, in a single
+ * round trip if the database supports it. Returns the number of
+ * executions that succeeded or -1 if none did.
+ */
+int dbpool_conn_update_many(DBPoolConn *conn, const Octstr *sql, List *binds_list);
+
 /*
  * Perfoms a check of all connections within the pool and tries to
  * re-establish the same ammount of connections if there are broken
@@ -241,5 +252,14 @@ int dbpool_conn_update(DBPoolConn *conn, const Octstr *sql, List *binds);
  */
 unsigned int dbpool_check(DBPool *p);
 
+/*
+ * Return the usage statistics of the pool: how many connections were
+ * handed out by dbpool_conn_consume(), how many liveness checks these
+ * needed, and the average and longest time in milliseconds a caller
+ * had to wait for a free connection. Any pointer may be NULL.
+ */
+void dbpool_stats(DBPool *p, unsigned long *checkouts, unsigned long *checks,
+                  double *avg_wait_ms, double *max_wait_ms);
+
 
 #endif
@@ -159,53 +159,88 @@ static int mysql_check_conn(void *conn)
 }
 
 
-static int mysql_select(void *conn, const Octstr *sql, List *binds, List **res)
+static void *mysql_prepare_stmt(void *conn, const Octstr *sql)
 {
     MYSQL_STMT *stmt;
-    MYSQL_RES *result;
-    MYSQL_BIND *bind = NULL;
-    long i, binds_len;
-    int ret;
-
-    *res = NULL;
 
     /* allocate statement handle */
     stmt = mysql_stmt_init((MYSQL*) conn);
     if (stmt == NULL) {
         error(0, "MYSQL: mysql_stmt_init(), out of memory.");
-        return -1;
+        return NULL;
     }
     if (mysql_stmt_prepare(stmt, octstr_get_cstr(sql), octstr_len(sql))) {
-        error(0, "MYSQL: Unable to prepare statement: %s", mysql_stmt_error(stmt));
+        error(0, "MYSQL: Unable to prepare statement: `%s'", mysql_stmt_error(stmt));
         mysql_stmt_close(stmt);
-        return -1;
+        return NULL;
     }
-    /* bind params if any */
+
+    return stmt;
+}
+
+
+static void mysql_finalize_stmt(void *stmt)
+{
+    mysql_stmt_close((MYSQL_STMT*) stmt);
+}
+
+
+/*
+ * Bind the parameters of stmt. *bind is set to the bind buffers, which
+ * the caller has to free after execution.
+ */
+static int mysql_bind_params(MYSQL_STMT *stmt, List *binds, MYSQL_BIND **bind)
+{
+    long i, binds_len;
+
+    *bind = NULL;
     binds_len = gwlist_len(binds);
-    if (binds_len > 0) {
-        bind = gw_malloc(sizeof(MYSQL_BIND) * binds_len);
-        memset(bind, 0, sizeof(MYSQL_BIND) * binds_len);
-        for (i = 0; i < binds_len; i++) {
-            Octstr *str = gwlist_get(binds, i);
+    if (binds_len == 0)
+        return 0;
 
-            bind[i].buffer_type = MYSQL_TYPE_STRING;
-            bind[i].buffer = octstr_get_cstr(str);
-            bind[i].buffer_length = octstr_len(str);
-        }
-        /* Bind the buffers */
-        if (mysql_stmt_bind_param(stmt, bind)) {
-          error(0, "MYSQL: mysql_stmt_bind_param() failed: `%s'", mysql_stmt_error(stmt));
-          gw_free(bind);
-          mysql_stmt_close(stmt);
-          return -1;
-        }
+    *bind = gw_malloc(sizeof(MYSQL_BIND) * binds_len);
+    memset(*bind, 0, sizeof(MYSQL_BIND) * binds_len);
+    for (i = 0; i < binds_len; i++) {
+        Octstr *str = gwlist_get(binds, i);
+
+        (*bind)[i].buffer_type = MYSQL_TYPE_STRING;
+        (*bind)[i].buffer = octstr_get_cstr(str);
+        (*bind)[i].buffer_length = octstr_len(str);
     }
+    /* Bind the buffers */
+    if (mysql_stmt_bind_param(stmt, *bind)) {
+        error(0, "MYSQL: mysql_stmt_bind_param() failed: `%s'", mysql_stmt_error(stmt));
+        gw_free(*bind);
+        *bind = NULL;
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/*
+ * Execute a prepared select. The statement stays usable for the next
+ * execution, unless -1 is returned.
+ */
+static int mysql_select_stmt(void *conn, void *thestmt, List *binds, List **res)
+{
+    MYSQL_STMT *stmt = thestmt;
+    MYSQL_RES *result;
+    MYSQL_BIND *bind = NULL;
+    long i, binds_len;
+    int ret;
+
+    *res = NULL;
+
+    /* bind params if any */
+    if (mysql_bind_params(stmt, binds, &bind) == -1)
+        return -1;
 
     /* execute statement */
     if (mysql_stmt_execute(stmt)) {
         error(0, "MYSQL: mysql_stmt_execute() failed: `%s'", mysql_stmt_error(stmt));
         gw_free(bind);
-        mysql_stmt_close(stmt);
         return -1;
     }
     gw_free(bind);
@@ -223,9 +258,8 @@ static int mysql_select(void *conn, const Octstr *sql, List *binds, List **res)
 
     /* Fetch result set meta information */
     result = mysql_stmt_result_metadata(stmt);
-    if (res == NULL) {
+    if (result == NULL) {
         error(0, "MYSQL: mysql_stmt_result_metadata() failed: `%s'", mysql_stmt_error(stmt));
-        mysql_stmt_close(stmt);
         return -1;
     }
     /* Get total columns in the query */
@@ -262,7 +296,6 @@ static int mysql_select(void *conn, const Octstr *sql, List *binds, List **res)
     if (mysql_stmt_bind_result(stmt, bind)) {
         error(0, "MYSQL: mysql_stmt_bind_result() failed: `%s'", mysql_stmt_error(stmt));
         DESTROY_BIND(bind, binds_len);
-        mysql_stmt_close(stmt);
         return -1;
     }
 
@@ -307,7 +340,6 @@ static int mysql_select(void *conn, const Octstr *sql, List *binds, List **res)
     if (ret != MYSQL_NO_DATA) {
         List *row;
         error(0, "MYSQL: mysql_stmt_bind_result() failed: `%s'", mysql_stmt_error(stmt));
-        mysql_stmt_close(stmt);
         while((row = gwlist_extract_first(*res)) != NULL)
             gwlist_destroy(row, octstr_destroy_item);
         gwlist_destroy(*res, NULL);
@@ -315,50 +347,40 @@ static int mysql_select(void *conn, const Octstr *sql, List *binds, List **res)
         return -1;
     }
 
-    mysql_stmt_close(stmt);
+    mysql_stmt_free_result(stmt);
 
     return 0;
 }
 
 
-static int mysql_update(void *conn, const Octstr *sql, List *binds)
+static int mysql_select(void *conn, const Octstr *sql, List *binds, List **res)
 {
     MYSQL_STMT *stmt;
-    MYSQL_BIND *bind = NULL;
-    long i, binds_len;
     int ret;
 
-    /* allocate statement handle */
-    stmt = mysql_stmt_init((MYSQL*) conn);
-    if (stmt == NULL) {
-        error(0, "MYSQL: mysql_stmt_init(), out of memory.");
-        return -1;
-    }
-    if (mysql_stmt_prepare(stmt, octstr_get_cstr(sql), octstr_len(sql))) {
-        error(0, "MYSQL: Unable to prepare statement: `%s'", mysql_stmt_error(stmt));
-        mysql_stmt_close(stmt);
+    *res = NULL;
+    if ((stmt = mysql_prepare_stmt(conn, sql)) == NULL)
         return -1;
-    }
-    /* bind params if any */
-    binds_len = gwlist_len(binds);
-    if (binds_len > 0) {
-        bind = gw_malloc(sizeof(MYSQL_BIND) * binds_len);
-        memset(bind, 0, sizeof(MYSQL_BIND) * binds_len);
-        for (i = 0; i < binds_len; i++) {
-            Octstr *str = gwlist_get(binds, i);
+    ret = mysql_select_stmt(conn, stmt, binds, res);
+    mysql_stmt_close(stmt);
 
-            bind[i].buffer_type = MYSQL_TYPE_STRING;
-            bind[i].buffer = octstr_get_cstr(str);
-            bind[i].buffer_length = octstr_len(str);
-        }
-        /* Bind the buffers */
-        if (mysql_stmt_bind_param(stmt, bind)) {
-          error(0, "MYSQL: mysql_stmt_bind_param() failed: `%s'", mysql_stmt_error(stmt));
-          gw_free(bind);
-          mysql_stmt_close(stmt);
-          return -1;
-        }
-    }
+    return ret;
+}
+
+
+/*
+ * Execute a prepared update. The statement stays usable for the next
+ * execution, unless -1 is returned.
+ */
+static int mysql_update_stmt(void *conn, void *thestmt, List *binds)
+{
+    MYSQL_STMT *stmt = thestmt;
+    MYSQL_BIND *bind = NULL;
+    int ret;
+
+    /* bind params if any */
+    if (mysql_bind_params(stmt, binds, &bind) == -1)
+        return -1;
 
     /* execute statement */
 retry:
@@ -372,13 +394,23 @@ retry:
         else {
             error(0, "MYSQL: mysql_stmt_execute() failed: %d: `%s'", ret, mysql_stmt_error(stmt));
             gw_free(bind);
-            mysql_stmt_close(stmt);
             return -1;
         }
     }
     gw_free(bind);
 
-    ret = mysql_stmt_affected_rows(stmt);
+    return mysql_stmt_affected_rows(stmt);
+}
+
+
+static int mysql_update(void *conn, const Octstr *sql, List *binds)
+{
+    MYSQL_STMT *stmt;
+    int ret;
+
+    if ((stmt = mysql_prepare_stmt(conn, sql)) == NULL)
+        return -1;
+    ret = mysql_update_stmt(conn, stmt, binds);
     mysql_stmt_close(stmt);
 
     return ret;
@@ -405,7 +437,11 @@ static struct db_ops mysql_ops = {
     .check = mysql_check_conn,
     .select = mysql_select,
     .update = mysql_update,
-    .conf_destroy = mysql_conf_destroy
+    .conf_destroy = mysql_conf_destroy,
+    .prepare = mysql_prepare_stmt,
+    .finalize = mysql_finalize_stmt,
+    .select_stmt = mysql_select_stmt,
+    .update_stmt = mysql_update_stmt
 };
 
 #endif /* HAVE_MYSQL */
@@ -104,6 +104,33 @@ struct db_ops {
      * @return #rows processed ; -1 if a error occurs
      */
     int (*update) (void *conn, const Octstr *sql, List *binds);
+    /*
+     * Execute several updates in one round trip to the database.
+     * NOTE: this function is optional, dbpool_conn_update_many() calls
+     *       update for each statement if it is missing.
+     * @params conn - database specific connection ; sql - sql statement;
+     *         binds_list - list of lists of Octstr values, one per update
+     * @return #updates that succeeded ; -1 if none did
+     */
+    int (*update_many) (void *conn, const Octstr *sql, List *binds_list);
+    /*
+     * Prepare a sql statement for repeated execution on conn.
+     * NOTE: prepare, finalize, select_stmt and update_stmt are optional,
+     *       but have to be given all together. If present, dbpool keeps
+     *       the prepared statements cached per connection.
+     * @return database specific statement handle ; NULL if error occurs
+     */
+    void* (*prepare) (void *conn, const Octstr *sql);
+    /*
+     * Release a statement handle returned by prepare.
+     */
+    void (*finalize) (void *stmt);
+    /*
+     * Same as select and update, but execute a prepared statement.
+     * The statement has to be reusable afterwards, unless -1 is returned.
+     */
+    int (*select_stmt) (void *conn, void *stmt, List *binds, List **result);
+    int (*update_stmt) (void *conn, void *stmt, List *binds);
 };
 
 struct DBPool
@@ -114,6 +141,11 @@ struct DBPool
     DBConf *conf; /* the database type specific configuration block */
     struct db_ops *db_ops; /* the database operations callbacks */
     enum db_type db_type; /* the type of database */
+    Mutex *stats_lock; /* protects the statistics below */
+    unsigned long checkouts; /* #connections handed out */
+    unsigned long checks; /* #liveness checks done on checkout */
+    double wait_total; /* total seconds spent waiting for a connection */
+    double wait_max; /* longest wait for a connection in seconds */
 };
 
 
@@ -350,47 +350,17 @@ static int redis_select(void *conn, const Octstr *sql, List *binds, List **res)
 }
 
 
-static int redis_update(void *conn, const Octstr *sql, List *binds)
+/*
+ * Evaluate and free the reply to an update command. Returns the number
+ * of keys affected, 0 for commands without a count, -1 on error.
+ */
+static int redis_update_reply(redisReply *reply)
 {
-    long i, binds_len;
     int ret;
-    redisReply *reply;
-    const char **argv;
-
-    /* bind parameters if any */
-    binds_len = gwlist_len(binds);
-
-    if (binds_len > 0) {
-#if defined(REDIS_DEBUG)
-        Octstr *os = octstr_create("");;
-#endif
-
-        argv = gw_malloc(sizeof(*argv) * binds_len);
-        for (i = 0; i < binds_len; i++) {
-            argv[i] = (char*)octstr_get_cstr(gwlist_get(binds, i));
-#if defined(REDIS_DEBUG)
-            octstr_format_append(os, "\"%s\" ", argv[i]);
-#endif
-        }
-
-#if defined(REDIS_DEBUG)
-        debug("dbpool.redis",0,"redis cmd: %s", octstr_get_cstr(os));
-        octstr_destroy(os);
-#endif
-
-        /* execute statement */
-        reply = redisCommandArgv(conn, binds_len, argv, NULL);
-
-        gw_free(argv);
-
-    } else {
-
-#if defined(REDIS_DEBUG)
-        debug("dbpool.redis",0,"redis cmd: %s", octstr_get_cstr(sql));
-#endif
 
-        /* execute statement */
-        reply = redisCommand(conn, octstr_get_cstr(sql));
+    if (reply == NULL) {
+        error(0, "REDIS: no reply, connection failed?");
+        return -1;
     }
 
     /* evaluate reply */
@@ -458,6 +428,92 @@ static int redis_update(void *conn, const Octstr *sql, List *binds)
 }
 
 
+static int redis_update(void *conn, const Octstr *sql, List *binds)
+{
+    long i, binds_len;
+    redisReply *reply;
+    const char **argv;
+
+    /* bind parameters if any */
+    binds_len = gwlist_len(binds);
+
+    if (binds_len > 0) {
+#if defined(REDIS_DEBUG)
+        Octstr *os = octstr_create("");;
+#endif
+
+        argv = gw_malloc(sizeof(*argv) * binds_len);
+        for (i = 0; i < binds_len; i++) {
+            argv[i] = (char*)octstr_get_cstr(gwlist_get(binds, i));
+#if defined(REDIS_DEBUG)
+            octstr_format_append(os, "\"%s\" ", argv[i]);
+#endif
+        }
+
+#if defined(REDIS_DEBUG)
+        debug("dbpool.redis",0,"redis cmd: %s", octstr_get_cstr(os));
+        octstr_destroy(os);
+#endif
+
+        /* execute statement */
+        reply = redisCommandArgv(conn, binds_len, argv, NULL);
+
+        gw_free(argv);
+
+    } else {
+
+#if defined(REDIS_DEBUG)
+        debug("dbpool.redis",0,"redis cmd: %s", octstr_get_cstr(sql));
+#endif
+
+        /* execute statement */
+        reply = redisCommand(conn, octstr_get_cstr(sql));
+    }
+
+    return redis_update_reply(reply);
+}
+
+
+/*
+ * Send all commands at once and then collect the replies, so a batch
+ * costs a single round trip.
+ */
+static int redis_update_many(void *conn, const Octstr *sql, List *binds_list)
+{
+    long i, j, n, binds_len;
+    const char **argv;
+    redisReply *reply;
+    List *binds;
+    int ok;
+
+    n = gwlist_len(binds_list);
+    for (i = 0; i < n; i++) {
+        binds = gwlist_get(binds_list, i);
+        binds_len = gwlist_len(binds);
+        if (binds_len > 0) {
+            argv = gw_malloc(sizeof(*argv) * binds_len);
+            for (j = 0; j < binds_len; j++)
+                argv[j] = (char*)octstr_get_cstr(gwlist_get(binds, j));
+            redisAppendCommandArgv(conn, binds_len, argv, NULL);
+            gw_free(argv);
+        } else
+            redisAppendCommand(conn, octstr_get_cstr(sql));
+    }
+
+    ok = 0;
+    for (i = 0; i < n; i++) {
+        if (redisGetReply(conn, (void **) &reply) != REDIS_OK) {
+            error(0, "REDIS: failed to read reply %ld of %ld.", i + 1, n);
+            break;
+        }
+        if (redis_update_reply(reply) >= 0)
+            ok++;
+    }
+
+    return ok > 0 ? ok : -1;
+}
+
+
 static void redis_conf_destroy(DBConf *db_conf)
 {
     RedisConf *conf = db_conf->redis;
@@ -476,6 +532,7 @@ static struct db_ops redis_ops = {
     .check = redis_check_conn,
     .select = redis_select,
     .update = redis_update,
+    .update_many = redis_update_many,
     .conf_destroy = redis_conf_destroy
 };
 
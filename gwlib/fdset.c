@@ -56,6 +56,16 @@
 
 /*
  * fdset.c - module for managing a large collection of file descriptors
+ *
+ * An FDSet is served by one or more poller threads. Each fd is owned by
+ * exactly one of them (fd modulo the number of pollers), and only the
+ * owning thread touches its state; other threads submit requests to it
+ * through its action list. With more than one poller, callbacks for
+ * different fds may run concurrently.
+ *
+ * If configure found epoll (HAVE_EPOLL), each poller waits in
+ * epoll_wait() on level-triggered registrations and keeps its entries in
+ * a table indexed by fd. Otherwise it uses a poll() array as before.
  */
 
 #include "gw-config.h"
@@ -64,32 +74,75 @@
 #include <unistd.h>
 #include <errno.h>
 
+#ifdef HAVE_EPOLL
+#include <sys/epoll.h>
+#endif
+
 #include "gwlib/gwlib.h"
 
 
-struct FDSet
+#ifdef HAVE_EPOLL
+
+/* One registered fd of an epoll poller. */
+struct entry
+{
+    int fd;                     /* -1 once unregistered during a scan */
+    int events;
+    fdset_callback_t *callback;
+    void *data;
+    time_t time;                /* last event or events bitmask change */
+};
+
+#define MAX_EVENTS 256
+
+#endif
+
+struct poller
 {
-    /* Thread ID of the set's internal thread, which will spend most
-     * of its time blocking on poll().  This is set when the thread
-     * is created, and not changed after that.  It's not protected
-     * by any lock. */
+    /* Thread ID of the poller's internal thread, which will spend most
+     * of its time blocking on poll() or epoll_wait().  This is set when
+     * the thread is created, and not changed after that.  It's not
+     * protected by any lock. */
     long poll_thread;
 
     /* The following fields are for use by the polling thread only.
      * No-one else may touch them.  It's not protected by any lock. */
 
+    /* timeout for this poller */
+    long timeout;
+
+    /* Number of registered fds */
+    int entries;
+
+#ifdef HAVE_EPOLL
+    int epfd;
+
+    /* Other threads write a byte here to get the poller out of
+     * epoll_wait(), gwthread_wakeup() does not reach it. */
+    int wakeup_fds[2];
+
+    /* Entries indexed by fd, size elements allocated. */
+    struct entry **table;
+    int size;
+
+    struct epoll_event events[MAX_EVENTS];
+
+    /* Callbacks may unregister fds that still have events pending in
+     * the current batch. Such entries are marked with fd -1 and only
+     * freed after the batch, see poller(). */
+    int scanning;
+    List *deleted;
+
+    time_t last_timeout_check;
+#else
     /* Array for use with poll().  Elements 0 through size-1 are allocated.
      * Elements 0 through entries-1 are in use. */
     struct pollfd *pollinfo;
     int size;
-    int entries;
     
     /* Array of times when appropriate fd got any event or events bitmask changed */
     time_t *times;
 
-    /* timeout for this fdset */
-    long timeout;
-
     /* Arrays of callback and data fields.  They are kept in sync with
      * the pollinfo array, and are basically extra fields that we couldn't
      * put in struct pollfd because that structure is defined externally. */
@@ -116,6 +169,7 @@ struct FDSet
      * efficiently check if we need to scan the table to really 
      * delete those entries. */
     int deleted_entries;
+#endif
 
     
     /* The following fields are for general use, and are of types that
@@ -126,10 +180,16 @@ struct FDSet
     List *actions;
 };
 
-/* Datatype to describe changes to the fdset fields that only the polling
+struct FDSet
+{
+    struct poller **pollers;
+    int num_pollers;
+};
+
+/* Datatype to describe changes to the poller fields that only the polling
  * thread may touch.  Other threads use this type to submit requests to
  * change those fields. */
-/* Action life cycle: Created, then pushed on set->actions list by
+/* Action life cycle: Created, then pushed on poller->actions list by
  * action_submit.  Poller thread wakes up and takes it from the list,
  * then calls handle_action, which performs the action and pushes it
  * on the action's done list.  action_submit then takes it back and
@@ -151,6 +211,12 @@ struct action
     List *done;                 /* Used by LISTEN, UNREGISTER, and DESTROY */
 };
 
+static void poller_register(struct poller *p, int fd, int events,
+                            fdset_callback_t callback, void *data);
+static void poller_listen(struct poller *p, int fd, int mask, int events);
+static void poller_unregister(struct poller *p, int fd);
+static void poller_wakeup(struct poller *p);
+
 /* Return a new action structure of the given type, with all fields empty. */
 static struct action *action_create(int type)
 {
@@ -185,15 +251,15 @@ static void action_destroy_item(void *action)
 
 
 /*
- * Submit an action for this set, and wait for the polling thread to
+ * Submit an action for this poller, and wait for the polling thread to
  * confirm that it's been done, by pushing the action on its done list.
  */
-static void submit_action(FDSet *set, struct action *action)
+static void submit_action(struct poller *p, struct action *action)
 {
     List *done;
     void *sync;
 
-    gw_assert(set != NULL);
+    gw_assert(p != NULL);
     gw_assert(action != NULL);
 
     done = gwlist_create();
@@ -201,8 +267,8 @@ static void submit_action(FDSet *set, struct action *action)
 
     action->done = done;
 
-    gwlist_append(set->actions, action);
-    gwthread_wakeup(set->poll_thread);
+    gwlist_append(p->actions, action);
+    poller_wakeup(p);
 
     sync = gwlist_consume(done);
     gw_assert(sync == action);
@@ -213,43 +279,42 @@ static void submit_action(FDSet *set, struct action *action)
 /* 
  * As above, but don't wait for confirmation.
  */
-static void submit_action_nosync(FDSet *set, struct action *action)
+static void submit_action_nosync(struct poller *p, struct action *action)
 {
-    gwlist_append(set->actions, action);
-    gwthread_wakeup(set->poll_thread);
+    gwlist_append(p->actions, action);
+    poller_wakeup(p);
 }
 
 /* Do one action for this thread and confirm that it's been done by
  * appending the action to its done list.  May only be called by
  * the polling thread.  Returns 0 normally, and returns -1 if the
- * action destroyed the set. */
-static int handle_action(FDSet *set, struct action *action)
+ * action destroyed the poller. */
+static int handle_action(struct poller *p, struct action *action)
 {
     int result;
 
-    gw_assert(set != NULL);
-    gw_assert(set->poll_thread == gwthread_self());
+    gw_assert(p != NULL);
+    gw_assert(p->poll_thread == gwthread_self());
     gw_assert(action != NULL);
 
     result = 0;
 
     switch (action->type) {
     case REGISTER:
-        fdset_register(set, action->fd, action->events,
-                       action->callback, action->data);
+        poller_register(p, action->fd, action->events,
+                        action->callback, action->data);
         break;
     case LISTEN:
-        fdset_listen(set, action->fd, action->mask, action->events);
+        poller_listen(p, action->fd, action->mask, action->events);
         break;
     case UNREGISTER:
-        fdset_unregister(set, action->fd);
+        poller_unregister(p, action->fd);
         break;
     case DESTROY:
-        fdset_destroy(set);
         result = -1;
         break;
     case SET_TIMEOUT:
-        set->timeout = action->timeout;
+        p->timeout = action->timeout;
         break;
     default:
         panic(0, "fdset: handle_action got unknown action type %d.",
@@ -264,45 +329,333 @@ static int handle_action(FDSet *set, struct action *action)
     return result;
 }
 
+/* Process pending actions, returns -1 if the poller was destroyed. */
+static int handle_actions(struct poller *p)
+{
+    struct action *action;
+
+    while ((action = gwlist_extract_first(p->actions)) != NULL) {
+        /* handle_action returns -1 if the poller was destroyed. */
+        if (handle_action(p, action) < 0)
+            return -1;
+    }
+    return 0;
+}
+
+
+#ifdef HAVE_EPOLL
+
+static int poller_init(struct poller *p)
+{
+    struct epoll_event ev;
+
+    p->epfd = -1;
+    p->wakeup_fds[0] = p->wakeup_fds[1] = -1;
+    p->size = 0;
+    p->table = NULL;
+    p->scanning = 0;
+    p->deleted = gwlist_create();
+    time(&p->last_timeout_check);
+
+    if ((p->epfd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+        error(errno, "fdset: epoll_create1 failed.");
+        return -1;
+    }
+    if (pipe(p->wakeup_fds) < 0) {
+        error(errno, "fdset: cannot create wakeup pipe.");
+        return -1;
+    }
+    socket_set_blocking(p->wakeup_fds[0], 0);
+    socket_set_blocking(p->wakeup_fds[1], 0);
+
+    /* the wakeup pipe is the only registration with a NULL entry */
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL;
+    if (epoll_ctl(p->epfd, EPOLL_CTL_ADD, p->wakeup_fds[0], &ev) < 0) {
+        error(errno, "fdset: cannot add wakeup pipe to epoll set.");
+        return -1;
+    }
+    return 0;
+}
+
+static void poller_free(struct poller *p)
+{
+    int i;
+
+    for (i = 0; i < p->size; i++)
+        gw_free(p->table[i]);
+    gw_free(p->table);
+    gwlist_destroy(p->deleted, NULL);
+    if (p->epfd >= 0)
+        close(p->epfd);
+    if (p->wakeup_fds[0] >= 0) {
+        close(p->wakeup_fds[0]);
+        close(p->wakeup_fds[1]);
+    }
+}
+
+static void poller_wakeup(struct poller *p)
+{
+    unsigned char c = 0;
+
+    if (write(p->wakeup_fds[1], &c, 1) < 0 && errno != EAGAIN)
+        error(errno, "fdset: cannot wake up poller.");
+}
+
+static void drain_wakeup(struct poller *p)
+{
+    unsigned char buf[64];
+
+    while (read(p->wakeup_fds[0], buf, sizeof(buf)) > 0)
+        ;
+}
+
+static struct entry *find_entry(struct poller *p, int fd)
+{
+    gw_assert(gwthread_self() == p->poll_thread);
+
+    if (fd < 0 || fd >= p->size)
+        return NULL;
+    return p->table[fd];
+}
+
+static void check_timeouts(struct poller *p, time_t now)
+{
+    struct entry *e;
+    int i;
+
+    p->scanning = 1;
+    for (i = 0; i < p->size; i++) {
+        e = p->table[i];
+        if (e != NULL && difftime(e->time + p->timeout, now) <= 0) {
+            debug("gwlib.fdset", 0, "Timeout for fd:%d appears.", e->fd);
+            e->callback(e->fd, POLLERR, e->data);
+        }
+    }
+    p->scanning = 0;
+}
+
+/* Main function for polling thread.  Most its time is spent blocking
+ * in epoll_wait().  No-one else is allowed to change the fields it uses,
+ * so other threads just put something on the actions list and wake
+ * up this thread.  That's why it checks the actions list every time
+ * it goes through the loop.
+ */
+static void poller(void *arg)
+{
+    struct poller *p = arg;
+    struct entry *e;
+    int ret, i, revents;
+    time_t now;
+
+    gw_assert(p != NULL);
+
+    for (;;) {
+        if (handle_actions(p) < 0)
+            return;
+
+        ret = epoll_wait(p->epfd, p->events, MAX_EVENTS,
+                         p->timeout > 0 ? p->timeout * 1000 : -1);
+        if (ret < 0) {
+            if (errno != EINTR) {
+                error(errno, "Poller: can't handle error; sleeping 1 second.");
+                gwthread_sleep(1.0);
+            }
+            continue;
+        }
+        time(&now);
+        /* Callbacks may unregister entries of this batch, so be careful. */
+        p->scanning = 1;
+        for (i = 0; i < ret; i++) {
+            e = p->events[i].data.ptr;
+            if (e == NULL) {
+                drain_wakeup(p);
+                continue;
+            }
+            if (e->fd < 0)
+                continue;
+            /* Do not report events we stopped listening for. */
+            revents = p->events[i].events & (e->events | POLLERR | POLLHUP);
+            if (revents == 0)
+                continue;
+            e->callback(e->fd, revents, e->data);
+            /* update event time */
+            if (e->fd >= 0)
+                time(&e->time);
+        }
+        p->scanning = 0;
+        while ((e = gwlist_extract_first(p->deleted)) != NULL)
+            gw_free(e);
+
+        /* Entries are checked for timeouts at most once a second. */
+        if (p->timeout > 0 && now != p->last_timeout_check) {
+            p->last_timeout_check = now;
+            check_timeouts(p, now);
+            while ((e = gwlist_extract_first(p->deleted)) != NULL)
+                gw_free(e);
+        }
+    }
+}
+
+static void poller_register(struct poller *p, int fd, int events,
+                            fdset_callback_t callback, void *data)
+{
+    struct epoll_event ev;
+    struct entry *e;
+    int newsize;
+
+    if (fd >= p->size) {
+        newsize = (p->size > 0 ? p->size : 64);
+        while (newsize <= fd)
+            newsize *= 2;
+        p->table = gw_realloc(p->table, sizeof(p->table[0]) * newsize);
+        memset(p->table + p->size, 0, sizeof(p->table[0]) * (newsize - p->size));
+        p->size = newsize;
+    }
+    if (p->table[fd] != NULL) {
+        warning(0, "fdset_register called on already registered fd %d.", fd);
+        poller_unregister(p, fd);
+    }
+
+    e = gw_malloc(sizeof(*e));
+    e->fd = fd;
+    e->events = events;
+    e->callback = callback;
+    e->data = data;
+    time(&e->time);
+
+    ev.events = events;
+    ev.data.ptr = e;
+    if (epoll_ctl(p->epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        error(errno, "fdset: cannot add fd %d to epoll set.", fd);
+        gw_free(e);
+        return;
+    }
+    p->table[fd] = e;
+    p->entries++;
+}
+
+static void poller_listen(struct poller *p, int fd, int mask, int events)
+{
+    struct epoll_event ev;
+    struct entry *e;
+    int new_events;
+
+    e = find_entry(p, fd);
+    if (e == NULL) {
+        warning(0, "fdset_listen called on unregistered fd %d.", fd);
+        return;
+    }
+
+    /* Copy the bits from events specified by the mask, and preserve the
+     * bits not specified by the mask. The poller masks the reported
+     * events with these, so a scan in progress does not see bits that
+     * were turned off. */
+    new_events = (e->events & ~mask) | (events & mask);
+    if (new_events != e->events) {
+        e->events = new_events;
+        ev.events = new_events;
+        ev.data.ptr = e;
+        if (epoll_ctl(p->epfd, EPOLL_CTL_MOD, fd, &ev) < 0)
+            error(errno, "fdset: cannot modify fd %d in epoll set.", fd);
+    }
+
+    time(&e->time);
+}
+
+static void poller_unregister(struct poller *p, int fd)
+{
+    struct entry *e;
+
+    e = find_entry(p, fd);
+    if (e == NULL) {
+        warning(0, "fdset_unregister called on unregistered fd %d.", fd);
+        return;
+    }
+
+    /* The fd may be closed already, which removes it from the set. */
+    epoll_ctl(p->epfd, EPOLL_CTL_DEL, fd, NULL);
+    p->table[fd] = NULL;
+    p->entries--;
+
+    if (p->scanning) {
+        /* Events for it may still be in the current batch. */
+        e->fd = -1;
+        gwlist_append(p->deleted, e);
+    } else {
+        gw_free(e);
+    }
+}
+
+#else /* HAVE_EPOLL */
+
+static int poller_init(struct poller *p)
+{
+    /* Start off with space for one element because we can't malloc 0 bytes
+     * and we don't want to worry about these pointers being NULL. */
+    p->size = 1;
+    p->pollinfo = gw_malloc(sizeof(p->pollinfo[0]) * p->size);
+    p->callbacks = gw_malloc(sizeof(p->callbacks[0]) * p->size);
+    p->datafields = gw_malloc(sizeof(p->datafields[0]) * p->size);
+    p->times = gw_malloc(sizeof(p->times[0]) * p->size);
+    p->scanning = 0;
+    p->deleted_entries = 0;
+
+    return 0;
+}
+
+static void poller_free(struct poller *p)
+{
+    gw_free(p->pollinfo);
+    gw_free(p->callbacks);
+    gw_free(p->datafields);
+    gw_free(p->times);
+}
+
+static void poller_wakeup(struct poller *p)
+{
+    gwthread_wakeup(p->poll_thread);
+}
+
 /* Look up the entry number in the pollinfo array for this fd.
  * Right now it's a linear search, this may have to be improved. */
-static int find_entry(FDSet *set, int fd)
+static int find_entry(struct poller *p, int fd)
 {
     int i;
 
-    gw_assert(set != NULL);
-    gw_assert(gwthread_self() == set->poll_thread);
+    gw_assert(p != NULL);
+    gw_assert(gwthread_self() == p->poll_thread);
 
-    for (i = 0; i < set->entries; i++) {
-        if (set->pollinfo[i].fd == fd)
+    for (i = 0; i < p->entries; i++) {
+        if (p->pollinfo[i].fd == fd)
             return i;
     }
 
     return -1;
 }
 
-static void remove_entry(FDSet *set, int entry)
+static void remove_entry(struct poller *p, int entry)
 {
-    if (entry != set->entries - 1) {
+    if (entry != p->entries - 1) {
         /* We need to keep the array contiguous, so move the last element
          * to fill in the hole. */
-        set->pollinfo[entry] = set->pollinfo[set->entries - 1];
-        set->callbacks[entry] = set->callbacks[set->entries - 1];
-        set->datafields[entry] = set->datafields[set->entries - 1];
-        set->times[entry] = set->times[set->entries - 1];
+        p->pollinfo[entry] = p->pollinfo[p->entries - 1];
+        p->callbacks[entry] = p->callbacks[p->entries - 1];
+        p->datafields[entry] = p->datafields[p->entries - 1];
+        p->times[entry] = p->times[p->entries - 1];
     }
-    set->entries--;
+    p->entries--;
 }
 
-static void remove_deleted_entries(FDSet *set)
+static void remove_deleted_entries(struct poller *p)
 {
     int i;
 
     i = 0;
-    while (i < set->entries && set->deleted_entries > 0) {
-        if (set->pollinfo[i].fd < 0) {
-            remove_entry(set, i);
-	    set->deleted_entries--;
+    while (i < p->entries && p->deleted_entries > 0) {
+        if (p->pollinfo[i].fd < 0) {
+            remove_entry(p, i);
+	    p->deleted_entries--;
 	} else {
 	    i++;
         }
@@ -317,23 +670,19 @@ static void remove_deleted_entries(FDSet *set)
  */
 static void poller(void *arg)
 {
-    FDSet *set = arg;
-    struct action *action;
+    struct poller *p = arg;
     int ret;
     int i;
     time_t now;
 
-    gw_assert(set != NULL);
+    gw_assert(p != NULL);
 
     for (;;) {
-        while ((action = gwlist_extract_first(set->actions)) != NULL) {
-            /* handle_action returns -1 if the set was destroyed. */
-            if (handle_action(set, action) < 0)
-                return;
-        }
+        if (handle_actions(p) < 0)
+            return;
 
         /* Block for defined timeout, waiting for activity */
-        ret = gwthread_poll(set->pollinfo, set->entries, set->timeout);
+        ret = gwthread_poll(p->pollinfo, p->entries, p->timeout);
 
         if (ret < 0) {
             if (errno != EINTR) {
@@ -344,52 +693,172 @@ static void poller(void *arg)
         }
         time(&now);
         /* Callbacks may modify the table while we scan it, so be careful. */
-        set->scanning = 1;
-        for (i = 0; i < set->entries; i++) {
-            if (set->pollinfo[i].revents != 0) {
-                set->callbacks[i](set->pollinfo[i].fd,
-                                set->pollinfo[i].revents,
-                                set->datafields[i]);
+        p->scanning = 1;
+        for (i = 0; i < p->entries; i++) {
+            if (p->pollinfo[i].revents != 0) {
+                p->callbacks[i](p->pollinfo[i].fd,
+                                p->pollinfo[i].revents,
+                                p->datafields[i]);
                 /* update event time */
-                time(&set->times[i]);
-            } else if (set->timeout > 0 && difftime(set->times[i] + set->timeout, now) <= 0) {
-                debug("gwlib.fdset", 0, "Timeout for fd:%d appears.", set->pollinfo[i].fd);
-                set->callbacks[i](set->pollinfo[i].fd, POLLERR, set->datafields[i]);
+                time(&p->times[i]);
+            } else if (p->timeout > 0 && difftime(p->times[i] + p->timeout, now) <= 0) {
+                debug("gwlib.fdset", 0, "Timeout for fd:%d appears.", p->pollinfo[i].fd);
+                p->callbacks[i](p->pollinfo[i].fd, POLLERR, p->datafields[i]);
             }
         }
-        set->scanning = 0;
+        p->scanning = 0;
+
+    if (p->deleted_entries > 0)
+        remove_deleted_entries(p);
+    }
+}
+
+static void poller_register(struct poller *p, int fd, int events,
+                            fdset_callback_t callback, void *data)
+{
+    int new;
+
+    gw_assert(p->entries <= p->size);
+
+    if (p->entries >= p->size) {
+        int newsize = p->entries + 1;
+        p->pollinfo = gw_realloc(p->pollinfo,
+                                 sizeof(p->pollinfo[0]) * newsize);
+        p->callbacks = gw_realloc(p->callbacks,
+                                  sizeof(p->callbacks[0]) * newsize);
+        p->datafields = gw_realloc(p->datafields,
+                                   sizeof(p->datafields[0]) * newsize);
+        p->times = gw_realloc(p->times, sizeof(p->times[0]) * newsize);
+        p->size = newsize;
+    }
+
+    /* We don't check p->scanning.  Adding new entries is not harmful
+     * because their revents fields are 0. */
+
+    new = p->entries++;
+    p->pollinfo[new].fd = fd;
+    p->pollinfo[new].events = events;
+    p->pollinfo[new].revents = 0;
+    p->callbacks[new] = callback;
+    p->datafields[new] = data;
+    time(&p->times[new]);
+}
+
+static void poller_listen(struct poller *p, int fd, int mask, int events)
+{
+    int entry;
+
+    entry = find_entry(p, fd);   
+    if (entry < 0) {
+        warning(0, "fdset_listen called on unregistered fd %d.", fd);
+        return;
+    }
+
+    /* Copy the bits from events specified by the mask, and preserve the
+     * bits not specified by the mask. */
+    p->pollinfo[entry].events =
+	(p->pollinfo[entry].events & ~mask) | (events & mask);
+
+    /* If poller is currently scanning the array, then change the
+     * revents field so that the callback function will not be called
+     * for events we should no longer listen for.  The idea is the
+     * same as for the events field, except that we only turn bits off. */
+    if (p->scanning) {
+        p->pollinfo[entry].revents =
+            p->pollinfo[entry].revents & (events | ~mask);
+    }
+    
+    time(&p->times[entry]);
+}
+
+static void poller_unregister(struct poller *p, int fd)
+{
+    int entry;
+
+    /* Remove the entry from the pollinfo array */
+
+    entry = find_entry(p, fd);
+    if (entry < 0) {
+        warning(0, "fdset_unregister called on unregistered fd %d.", fd);
+        return;
+    }
 
-    if (set->deleted_entries > 0)
-        remove_deleted_entries(set);
+    if (entry == p->entries - 1) {
+        /* It's the last entry.  We can safely remove it even while
+         * the array is being scanned, because the scan checks p->entries. */
+        p->entries--;
+    } else if (p->scanning) {
+        /* We can't remove entries because the array is being
+         * scanned.  Mark it as deleted.  */
+        p->pollinfo[entry].fd = -1;
+        p->deleted_entries++;
+    } else {
+        remove_entry(p, entry);
     }
 }
 
+#endif /* HAVE_EPOLL */
+
+
+static void poller_destroy(struct poller *p)
+{
+    if (p == NULL)
+        return;
+
+    if (p->entries > 0) {
+        warning(0, "Destroying fdset with %d active entries.", p->entries);
+    }
+    poller_free(p);
+    if (gwlist_len(p->actions) > 0) {
+        error(0, "Destroying fdset with %ld pending actions.",
+              gwlist_len(p->actions));
+    }
+    gwlist_destroy(p->actions, action_destroy_item);
+    gw_free(p);
+}
+
+/* Return the poller owning this fd. */
+static struct poller *fd_poller(FDSet *set, int fd)
+{
+    gw_assert(set != NULL);
+    gw_assert(fd >= 0);
+
+    return set->pollers[fd % set->num_pollers];
+}
+
 
 FDSet *fdset_create_real(long timeout)
+{
+    return fdset_create_pollers(timeout, 1);
+}
+
+FDSet *fdset_create_pollers(long timeout, int pollers)
 {
     FDSet *new;
+    struct poller *p;
+    int i;
 
-    new = gw_malloc(sizeof(*new));
+    if (pollers < 1)
+        pollers = 1;
 
-    /* Start off with space for one element because we can't malloc 0 bytes
-     * and we don't want to worry about these pointers being NULL. */
-    new->size = 1;
-    new->entries = 0;
-    new->pollinfo = gw_malloc(sizeof(new->pollinfo[0]) * new->size);
-    new->callbacks = gw_malloc(sizeof(new->callbacks[0]) * new->size);
-    new->datafields = gw_malloc(sizeof(new->datafields[0]) * new->size);
-    new->times = gw_malloc(sizeof(new->times[0]) * new->size);
-    new->timeout = timeout > 0 ? timeout : -1;
-    new->scanning = 0;
-    new->deleted_entries = 0;
-
-    new->actions = gwlist_create();
-
-    new->poll_thread = gwthread_create(poller, new);
-    if (new->poll_thread < 0) {
-        error(0, "Could not start internal thread for fdset.");
-        fdset_destroy(new);
-        return NULL;
+    new = gw_malloc(sizeof(*new));
+    new->num_pollers = 0;
+    new->pollers = gw_malloc(sizeof(new->pollers[0]) * pollers);
+
+    for (i = 0; i < pollers; i++) {
+        p = gw_malloc(sizeof(*p));
+        p->poll_thread = -1;
+        p->entries = 0;
+        p->timeout = timeout > 0 ? timeout : -1;
+        p->actions = gwlist_create();
+        new->pollers[new->num_pollers++] = p;
+
+        if (poller_init(p) < 0 ||
+            (p->poll_thread = gwthread_create(poller, p)) < 0) {
+            error(0, "Could not start internal thread for fdset.");
+            fdset_destroy(new);
+            return NULL;
+        }
     }
 
     return new;
@@ -397,39 +866,35 @@ FDSet *fdset_create_real(long timeout)
 
 void fdset_destroy(FDSet *set)
 {
+    struct poller *p;
+    long thread;
+    int i;
+
     if (set == NULL)
         return;
 
-    if (set->poll_thread < 0 || gwthread_self() == set->poll_thread) {
-        if (set->entries > 0) {
-            warning(0, "Destroying fdset with %d active entries.",
-                    set->entries);
-        }
-        gw_free(set->pollinfo);
-        gw_free(set->callbacks);
-        gw_free(set->datafields);
-        gw_free(set->times);
-        if (gwlist_len(set->actions) > 0) {
-            error(0, "Destroying fdset with %ld pending actions.",
-                  gwlist_len(set->actions));
+    for (i = 0; i < set->num_pollers; i++) {
+        p = set->pollers[i];
+        gw_assert(p->poll_thread < 0 || p->poll_thread != gwthread_self());
+        if (p->poll_thread >= 0) {
+            thread = p->poll_thread;
+            submit_action(p, action_create(DESTROY));
+            gwthread_join(thread);
         }
-        gwlist_destroy(set->actions, action_destroy_item);
-        gw_free(set);
-    } else {
-        long thread = set->poll_thread;
-        submit_action(set, action_create(DESTROY));
-	gwthread_join(thread);
+        poller_destroy(p);
     }
+    gw_free(set->pollers);
+    gw_free(set);
 }
 
 void fdset_register(FDSet *set, int fd, int events,
                     fdset_callback_t callback, void *data)
 {
-    int new;
+    struct poller *p;
 
-    gw_assert(set != NULL);
+    p = fd_poller(set, fd);
 
-    if (gwthread_self() != set->poll_thread) {
+    if (gwthread_self() != p->poll_thread) {
         struct action *action;
 
         action = action_create(REGISTER);
@@ -437,124 +902,68 @@ void fdset_register(FDSet *set, int fd, int events,
         action->events = events;
         action->callback = callback;
         action->data = data;
-	submit_action_nosync(set, action);
+	submit_action_nosync(p, action);
         return;
     }
 
-    gw_assert(set->entries <= set->size);
-
-    if (set->entries >= set->size) {
-        int newsize = set->entries + 1;
-        set->pollinfo = gw_realloc(set->pollinfo,
-                                   sizeof(set->pollinfo[0]) * newsize);
-        set->callbacks = gw_realloc(set->callbacks,
-                                   sizeof(set->callbacks[0]) * newsize);
-        set->datafields = gw_realloc(set->datafields,
-                                   sizeof(set->datafields[0]) * newsize);
-        set->times = gw_realloc(set->times, sizeof(set->times[0]) * newsize);
-        set->size = newsize;
-    }
-
-    /* We don't check set->scanning.  Adding new entries is not harmful
-     * because their revents fields are 0. */
-
-    new = set->entries++;
-    set->pollinfo[new].fd = fd;
-    set->pollinfo[new].events = events;
-    set->pollinfo[new].revents = 0;
-    set->callbacks[new] = callback;
-    set->datafields[new] = data;
-    time(&set->times[new]);
+    poller_register(p, fd, events, callback, data);
 }
 
 void fdset_listen(FDSet *set, int fd, int mask, int events)
 {
-    int entry;
+    struct poller *p;
 
-    gw_assert(set != NULL);
+    p = fd_poller(set, fd);
 
-    if (gwthread_self() != set->poll_thread) {
+    if (gwthread_self() != p->poll_thread) {
         struct action *action;
 
         action = action_create(LISTEN);
         action->fd = fd;
 	action->mask = mask;
         action->events = events;
-        submit_action(set, action);
+        submit_action(p, action);
         return;
     }
 
-    entry = find_entry(set, fd);   
-    if (entry < 0) {
-        warning(0, "fdset_listen called on unregistered fd %d.", fd);
-        return;
-    }
-
-    /* Copy the bits from events specified by the mask, and preserve the
-     * bits not specified by the mask. */
-    set->pollinfo[entry].events =
-	(set->pollinfo[entry].events & ~mask) | (events & mask);
-
-    /* If poller is currently scanning the array, then change the
-     * revents field so that the callback function will not be called
-     * for events we should no longer listen for.  The idea is the
-     * same as for the events field, except that we only turn bits off. */
-    if (set->scanning) {
-        set->pollinfo[entry].revents =
-            set->pollinfo[entry].revents & (events | ~mask);
-    }
-    
-    time(&set->times[entry]);
+    poller_listen(p, fd, mask, events);
 }
 
 void fdset_unregister(FDSet *set, int fd)
 {
-    int entry;
+    struct poller *p;
 
-    gw_assert(set != NULL);
+    p = fd_poller(set, fd);
 
-    if (gwthread_self() != set->poll_thread) {
+    if (gwthread_self() != p->poll_thread) {
         struct action *action;
 
         action = action_create(UNREGISTER);
         action->fd = fd;
-        submit_action(set, action);
+        submit_action(p, action);
         return;
     }
 
-    /* Remove the entry from the pollinfo array */
-
-    entry = find_entry(set, fd);
-    if (entry < 0) {
-        warning(0, "fdset_listen called on unregistered fd %d.", fd);
-        return;
-    }
-
-    if (entry == set->entries - 1) {
-        /* It's the last entry.  We can safely remove it even while
-         * the array is being scanned, because the scan checks set->entries. */
-        set->entries--;
-    } else if (set->scanning) {
-        /* We can't remove entries because the array is being
-         * scanned.  Mark it as deleted.  */
-        set->pollinfo[entry].fd = -1;
-        set->deleted_entries++;
-    } else {
-        remove_entry(set, entry);
-    }
+    poller_unregister(p, fd);
 }
 
 void fdset_set_timeout(FDSet *set, long timeout)
 {
+    struct poller *p;
+    int i;
+
     gw_assert(set != NULL);
 
-    if (gwthread_self() != set->poll_thread) {
-        struct action *action;
+    for (i = 0; i < set->num_pollers; i++) {
+        p = set->pollers[i];
+        if (gwthread_self() != p->poll_thread) {
+            struct action *action;
 
-        action = action_create(SET_TIMEOUT);
-        action->timeout = timeout;
-        submit_action(set, action);
-        return;
+            action = action_create(SET_TIMEOUT);
+            action->timeout = timeout;
+            submit_action(p, action);
+        } else {
+            p->timeout = timeout;
+        }
     }
-    set->timeout = timeout;
 }
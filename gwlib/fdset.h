@@ -80,9 +80,18 @@ typedef void fdset_callback_t(int fd, int revents, void *data);
 #define fdset_create() fdset_create_real(-1)
 FDSet *fdset_create_real(long timeout);
 
+/*
+ * Same as fdset_create_real, but spread the file descriptors over
+ * the given number of poller threads.  Callbacks for different file
+ * descriptors may then run concurrently, callbacks for the same file
+ * descriptor always run in the same thread.
+ */
+FDSet *fdset_create_pollers(long timeout, int pollers);
+
 /*
  * Destroy a file descriptor set.  Will emit a warning if any file
- * descriptors are still registered with it.
+ * descriptors are still registered with it.  Must not be called from
+ * a callback of the set.
  */
 void fdset_destroy(FDSet *set);
 
@@ -0,0 +1,214 @@
+/* ==================================================================== 
+ * The Kannel Software License, Version 1.0 
+ * 
+ * Copyright (c) 2001-2016 Kannel Group  
+ * Copyright (c) 1998-2001 WapIT Ltd.   
+ * All rights reserved. 
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions 
+ * are met: 
+ * 
+ * 1. Redistributions of source code must retain the above copyright 
+ *    notice, this list of conditions and the following disclaimer. 
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright 
+ *    notice, this list of conditions and the following disclaimer in 
+ *    the documentation and/or other materials provided with the 
+ *    distribution. 
+ * 
+ * 3. The end-user documentation included with the redistribution, 
+ *    if any, must include the following acknowledgment: 
+ *       "This product includes software developed by the 
+ *        Kannel Group (http://www.kannel.org/)." 
+ *    Alternately, this acknowledgment may appear in the software itself, 
+ *    if and wherever such third-party acknowledgments normally appear. 
+ * 
+ * 4. The names "Kannel" and "Kannel Group" must not be used to 
+ *    endorse or promote products derived from this software without 
+ *    prior written permission. For written permission, please  
+ *    contact org@kannel.org. 
+ * 
+ * 5. Products derived from this software may not be called "Kannel", 
+ *    nor may "Kannel" appear in their name, without prior written 
+ *    permission of the Kannel Group. 
+ * 
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESSED OR IMPLIED 
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES 
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+ * DISCLAIMED.  IN NO EVENT SHALL THE KANNEL GROUP OR ITS CONTRIBUTORS 
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,  
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT  
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR  
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,  
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE  
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,  
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. 
+ * ==================================================================== 
+ * 
+ * This software consists of voluntary contributions made by many 
+ * individuals on behalf of the Kannel Group.  For more information on  
+ * the Kannel Group, please see <http://www.kannel.org/>. 
+ * 
+ * Portions of this software are based upon software originally written at  
+ * WapIT Ltd., Helsinki, Finland for the Kannel project.  
+ */ 
+
+/*
+ * gw-histogram.c - lock-free latency histograms.
+ *
+ * Bucket i < SUB_COUNT holds the value i. Above that a value v with its
+ * highest bit at position e lands in sub-bucket (v >> (e - SUB_BITS))
+ * of magnitude e, i.e. the SUB_BITS bits below the highest one select
+ * the linear sub-bucket.
+ *
+ * Each histogram keeps HISTOGRAM_SLOTS copies of the counters. A thread
+ * always records into the slot of its gwthread number, so threads
+ * rarely share cache lines, and the counters are plain relaxed atomic
+ * additions. Readers add up all slots; a reader racing with recorders
+ * may miss values recorded meanwhile, which is fine for statistics.
+ */
+
+#include "gw-config.h"
+
+#include "gwlib.h"
+#include "gw-histogram.h"
+
+#define SUB_BITS 4
+#define SUB_COUNT (1 << SUB_BITS)
+#define MAX_BITS 36
+#define BUCKETS ((MAX_BITS - SUB_BITS + 1) * SUB_COUNT)
+#define HISTOGRAM_SLOTS 8
+
+struct slot {
+    unsigned long long counts[BUCKETS];
+    long long max;
+};
+
+struct gw_histogram {
+    struct slot slots[HISTOGRAM_SLOTS];
+};
+
+
+static int bucket_index(long long value)
+{
+    int e;
+
+    if (value < SUB_COUNT)
+        return (value < 0 ? 0 : value);
+    if (value >= (1LL << MAX_BITS))
+        return BUCKETS - 1;
+    e = 63 - __builtin_clzll(value);
+    return (e - SUB_BITS + 1) * SUB_COUNT + ((value >> (e - SUB_BITS)) & (SUB_COUNT - 1));
+}
+
+
+/* highest value that falls into bucket i */
+static long long bucket_value(int i)
+{
+    int e;
+
+    if (i < SUB_COUNT)
+        return i;
+    e = i / SUB_COUNT + SUB_BITS - 1;
+    return ((long long) (SUB_COUNT + i % SUB_COUNT + 1) << (e - SUB_BITS)) - 1;
+}
+
+
+gw_histogram_t *gw_histogram_create(void)
+{
+    gw_histogram_t *hist;
+
+    hist = gw_malloc(sizeof(*hist));
+    memset(hist, 0, sizeof(*hist));
+
+    return hist;
+}
+
+
+void gw_histogram_destroy(gw_histogram_t *hist)
+{
+    gw_free(hist);
+}
+
+
+void gw_histogram_record(gw_histogram_t *hist, long long value)
+{
+    struct slot *slot;
+    long long max;
+
+    slot = &hist->slots[(unsigned long) gwthread_self() % HISTOGRAM_SLOTS];
+    __atomic_add_fetch(&slot->counts[bucket_index(value)], 1, __ATOMIC_RELAXED);
+
+    max = __atomic_load_n(&slot->max, __ATOMIC_RELAXED);
+    while (value > max &&
+           !__atomic_compare_exchange_n(&slot->max, &max, value, 1,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+
+long long gw_histogram_count(gw_histogram_t *hist)
+{
+    long long count = 0;
+    int i, s;
+
+    for (s = 0; s < HISTOGRAM_SLOTS; s++)
+        for (i = 0; i < BUCKETS; i++)
+            count += __atomic_load_n(&hist->slots[s].counts[i], __ATOMIC_RELAXED);
+
+    return count;
+}
+
+
+long long gw_histogram_percentiles(gw_histogram_t *hist, const double *percentiles,
+                                   long long *values, int n)
+{
+    unsigned long long counts[BUCKETS];
+    long long total, seen, rank, max, m;
+    int i, j, s;
+
+    memset(counts, 0, sizeof(counts));
+    total = max = 0;
+    for (s = 0; s < HISTOGRAM_SLOTS; s++) {
+        for (i = 0; i < BUCKETS; i++) {
+            counts[i] += __atomic_load_n(&hist->slots[s].counts[i], __ATOMIC_RELAXED);
+        }
+        m = __atomic_load_n(&hist->slots[s].max, __ATOMIC_RELAXED);
+        if (m > max)
+            max = m;
+    }
+    for (i = 0; i < BUCKETS; i++)
+        total += counts[i];
+
+    seen = 0;
+    for (i = 0, j = 0; j < n; j++) {
+        if (total == 0) {
+            values[j] = -1;
+            continue;
+        }
+        /* smallest rank covering the percentile, at least the first value */
+        rank = (long long) (percentiles[j] / 100.0 * total + 0.999999);
+        if (rank < 1)
+            rank = 1;
+        if (rank > total)
+            rank = total;
+        while (seen + (long long) counts[i] < rank)
+            seen += counts[i++];
+        values[j] = bucket_value(i);
+        if (values[j] > max)
+            values[j] = max;
+    }
+
+    return total;
+}
+
+
+long long gw_histogram_percentile(gw_histogram_t *hist, double percentile)
+{
+    long long value;
+
+    gw_histogram_percentiles(hist, &percentile, &value, 1);
+
+    return value;
+}
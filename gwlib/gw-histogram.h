@@ -0,0 +1,120 @@
+/* ==================================================================== 
+ * The Kannel Software License, Version 1.0 
+ * 
+ * Copyright (c) 2001-2016 Kannel Group  
+ * Copyright (c) 1998-2001 WapIT Ltd.   
+ * All rights reserved. 
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions 
+ * are met: 
+ * 
+ * 1. Redistributions of source code must retain the above copyright 
+ *    notice, this list of conditions and the following disclaimer. 
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright 
+ *    notice, this list of conditions and the following disclaimer in 
+ *    the documentation and/or other materials provided with the 
+ *    distribution. 
+ * 
+ * 3. The end-user documentation included with the redistribution, 
+ *    if any, must include the following acknowledgment: 
+ *       "This product includes software developed by the 
+ *        Kannel Group (http://www.kannel.org/)." 
+ *    Alternately, this acknowledgment may appear in the software itself, 
+ *    if and wherever such third-party acknowledgments normally appear. 
+ * 
+ * 4. The names "Kannel" and "Kannel Group" must not be used to 
+ *    endorse or promote products derived from this software without 
+ *    prior written permission. For written permission, please  
+ *    contact org@kannel.org. 
+ * 
+ * 5. Products derived from this software may not be called "Kannel", 
+ *    nor may "Kannel" appear in their name, without prior written 
+ *    permission of the Kannel Group. 
+ * 
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESSED OR IMPLIED 
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES 
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+ * DISCLAIMED.  IN NO EVENT SHALL THE KANNEL GROUP OR ITS CONTRIBUTORS 
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,  
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT  
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR  
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,  
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE  
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,  
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. 
+ * ==================================================================== 
+ * 
+ * This software consists of voluntary contributions made by many 
+ * individuals on behalf of the Kannel Group.  For more information on  
+ * the Kannel Group, please see <http://www.kannel.org/>. 
+ * 
+ * Portions of this software are based upon software originally written at  
+ * WapIT Ltd., Helsinki, Finland for the Kannel project.  
+ */ 
+
+/*
+ * gw-histogram.h - lock-free latency histograms.
+ *
+ * Values (typically durations in microseconds) are counted in log-linear
+ * buckets in the style of HdrHistogram: each power of two is split into
+ * 16 linear sub-buckets, so any reported percentile is within 1/16 of
+ * the recorded value. Recording is a couple of relaxed atomic additions
+ * on a slot picked by the calling thread and never takes a lock, so it
+ * can be used on every message. Reading merges all slots.
+ */
+
+#ifndef GW_HISTOGRAM_H
+#define GW_HISTOGRAM_H 1
+
+typedef struct gw_histogram gw_histogram_t;
+
+/**
+ * Create an empty histogram
+ * @return newly created histogram
+ */
+gw_histogram_t *gw_histogram_create(void);
+
+/**
+ * Destroy histogram
+ * @hist - histogram to destroy, may be NULL
+ */
+void gw_histogram_destroy(gw_histogram_t *hist);
+
+/**
+ * Record a value, never blocks. Negative values count as 0, values
+ * beyond the range of the histogram (about 2^36) count as its maximum.
+ * @hist - histogram
+ * @value - value to record
+ */
+void gw_histogram_record(gw_histogram_t *hist, long long value);
+
+/**
+ * Return number of recorded values
+ * @hist - histogram
+ * @return number of values
+ */
+long long gw_histogram_count(gw_histogram_t *hist);
+
+/**
+ * Return a percentile of the recorded values
+ * @hist - histogram
+ * @percentile - percentile between 0 and 100, e.g. 99.9
+ * @return highest value equivalent to the percentile, -1 if empty
+ */
+long long gw_histogram_percentile(gw_histogram_t *hist, double percentile);
+
+/**
+ * Return several percentiles at once, cheaper than calling
+ * gw_histogram_percentile() for each of them
+ * @hist - histogram
+ * @percentiles - array of n percentiles, in increasing order
+ * @values - array of n results, -1 if the histogram is empty
+ * @n - number of percentiles
+ * @return number of recorded values
+ */
+long long gw_histogram_percentiles(gw_histogram_t *hist, const double *percentiles,
+                                   long long *values, int n);
+
+#endif
@@ -64,18 +64,42 @@
 
 #include "gw-config.h"
 #include <pthread.h>
+#include <string.h>
 #include "thread.h"
 #include "gwmem.h"
 #include "gwassert.h"
 #include "gwthread.h"
+#include "octstr.h"
+#include "list.h"
 #include "gw-prioqueue.h"
 
+/* bucket count is limited by the bits of the non-empty mask */
+#define MAX_BUCKETS 64
+
+/* initial ring size of one bucket, must be a power of two */
+#define BUCKET_MIN_SIZE 16
+
 
 struct element {
     void *item;
     long long seq;
 };
 
+/* FIFO ring of the items with one priority */
+struct bucket {
+    void **items;
+    long size;
+    long head;
+    long len;
+};
+
+/* queues sharing their items, see gw_prioqueue_join() */
+struct group {
+    Octstr *name;
+    Mutex *lock;
+    List *shards;
+};
+
 struct gw_prioqueue {
     Mutex *mutex;
     struct element **tab;
@@ -85,8 +109,18 @@ struct gw_prioqueue {
     long long seq;
     pthread_cond_t nonempty;
     int (*cmp)(const void*, const void *);
+    /* set for bucketed queues, tab and cmp are unused then */
+    long (*bucket)(const void *);
+    struct bucket *buckets;
+    long nbuckets;
+    unsigned long long used;
+    struct group *group;
 };
 
+/* all groups, only touched when queues join or leave */
+static pthread_mutex_t groups_lock = PTHREAD_MUTEX_INITIALIZER;
+static List *groups = NULL;
+
 
 static void inline queue_lock(gw_prioqueue_t *queue)
 {
@@ -171,6 +205,91 @@ static void downheap(gw_prioqueue_t *queue, register long index)
 }
 
 
+static void bucket_put(gw_prioqueue_t *queue, void *item)
+{
+    struct bucket *b;
+    long n;
+
+    n = queue->bucket(item);
+    if (n < 0)
+        n = 0;
+    else if (n >= queue->nbuckets)
+        n = queue->nbuckets - 1;
+    b = &queue->buckets[n];
+
+    if (b->len == b->size) {
+        void **items;
+        long i, size = b->size ? b->size * 2 : BUCKET_MIN_SIZE;
+
+        items = gw_malloc(size * sizeof(*items));
+        for (i = 0; i < b->len; i++)
+            items[i] = b->items[(b->head + i) & (b->size - 1)];
+        gw_free(b->items);
+        b->items = items;
+        b->size = size;
+        b->head = 0;
+    }
+    b->items[(b->head + b->len) & (b->size - 1)] = item;
+    b->len++;
+    queue->used |= 1ULL << n;
+}
+
+
+/* the highest non-empty bucket, the queue must not be empty */
+static struct bucket *bucket_top(gw_prioqueue_t *queue)
+{
+    return &queue->buckets[63 - __builtin_clzll(queue->used)];
+}
+
+
+static void *bucket_take(gw_prioqueue_t *queue)
+{
+    struct bucket *b = bucket_top(queue);
+    void *item;
+
+    item = b->items[b->head];
+    b->head = (b->head + 1) & (b->size - 1);
+    if (--b->len == 0)
+        queue->used &= ~(1ULL << (b - queue->buckets));
+
+    return item;
+}
+
+
+static void queue_put(gw_prioqueue_t *queue, void *item)
+{
+    if (queue->buckets != NULL) {
+        bucket_put(queue, item);
+        queue->len++;
+        return;
+    }
+    make_bigger(queue, 1);
+    queue->tab[queue->len] = gw_malloc(sizeof(**queue->tab));
+    queue->tab[queue->len]->item = item;
+    queue->tab[queue->len]->seq = queue->seq++;
+    upheap(queue, queue->len);
+    queue->len++;
+}
+
+
+/* remove the biggest item, the queue must not be empty */
+static void *queue_take(gw_prioqueue_t *queue)
+{
+    void *ret;
+
+    if (queue->buckets != NULL) {
+        queue->len--;
+        return bucket_take(queue);
+    }
+    ret = queue->tab[1]->item;
+    gw_free(queue->tab[1]);
+    queue->tab[1] = queue->tab[--queue->len];
+    downheap(queue, 1);
+
+    return ret;
+}
+
+
 gw_prioqueue_t *gw_prioqueue_create(int(*cmp)(const void*, const void *))
 {
     gw_prioqueue_t *ret;
@@ -186,6 +305,11 @@ gw_prioqueue_t *gw_prioqueue_create(int(*cmp)(const void*, const void *))
     ret->len = 0;
     ret->seq = 0;
     ret->cmp = cmp;
+    ret->bucket = NULL;
+    ret->buckets = NULL;
+    ret->nbuckets = 0;
+    ret->used = 0;
+    ret->group = NULL;
     
     /* put NULL item at pos 0 that is our stop marker */
     make_bigger(ret, 1);
@@ -198,14 +322,55 @@ gw_prioqueue_t *gw_prioqueue_create(int(*cmp)(const void*, const void *))
 }
 
 
+gw_prioqueue_t *gw_prioqueue_create_buckets(long buckets, long(*bucket)(const void *))
+{
+    gw_prioqueue_t *ret;
+
+    gw_assert(bucket != NULL);
+    gw_assert(buckets > 0 && buckets <= MAX_BUCKETS);
+
+    ret = gw_malloc(sizeof(*ret));
+    ret->producers = 0;
+    pthread_cond_init(&ret->nonempty, NULL);
+    ret->mutex = mutex_create();
+    ret->tab = NULL;
+    ret->size = 0;
+    /* keep len one above the item count like the heap with its marker */
+    ret->len = 1;
+    ret->seq = 0;
+    ret->cmp = NULL;
+    ret->bucket = bucket;
+    ret->buckets = gw_malloc(buckets * sizeof(*ret->buckets));
+    memset(ret->buckets, 0, buckets * sizeof(*ret->buckets));
+    ret->nbuckets = buckets;
+    ret->used = 0;
+    ret->group = NULL;
+
+    return ret;
+}
+
+
 void gw_prioqueue_destroy(gw_prioqueue_t *queue, void(*item_destroy)(void*))
 {
     long i;
 
     if (queue == NULL)
         return;
+
+    gw_prioqueue_leave(queue);
+
+    if (queue->buckets != NULL) {
+        while (queue->len > 1) {
+            void *item = queue_take(queue);
+            if (item_destroy != NULL)
+                item_destroy(item);
+        }
+        for (i = 0; i < queue->nbuckets; i++)
+            gw_free(queue->buckets[i].items);
+        gw_free(queue->buckets);
+    }
     
-    for (i = 0; i < queue->len; i++) {
+    for (i = 0; queue->tab != NULL && i < queue->len; i++) {
         if (item_destroy != NULL && queue->tab[i]->item != NULL)
             item_destroy(queue->tab[i]->item);
         gw_free(queue->tab[i]);
@@ -238,12 +403,7 @@ void gw_prioqueue_insert(gw_prioqueue_t *queue, void *item)
     gw_assert(item != NULL);
     
     queue_lock(queue);
-    make_bigger(queue, 1);
-    queue->tab[queue->len] = gw_malloc(sizeof(**queue->tab));
-    queue->tab[queue->len]->item = item;
-    queue->tab[queue->len]->seq = queue->seq++;
-    upheap(queue, queue->len);
-    queue->len++;
+    queue_put(queue, item);
     pthread_cond_signal(&queue->nonempty);
     queue_unlock(queue);
 }
@@ -256,8 +416,19 @@ void gw_prioqueue_foreach(gw_prioqueue_t *queue, void(*fn)(const void *, long))
     gw_assert(queue != NULL && fn != NULL);
     
     queue_lock(queue);
-    for (i = 1; i < queue->len; i++)
-        fn(queue->tab[i]->item, i - 1);
+    if (queue->buckets != NULL) {
+        long n, j;
+
+        /* in removal order, unlike the heap */
+        for (i = 0, n = queue->nbuckets - 1; n >= 0; n--) {
+            struct bucket *b = &queue->buckets[n];
+            for (j = 0; j < b->len; j++)
+                fn(b->items[(b->head + j) & (b->size - 1)], i++);
+        }
+    } else {
+        for (i = 1; i < queue->len; i++)
+            fn(queue->tab[i]->item, i - 1);
+    }
     queue_unlock(queue);
 }
 
@@ -273,10 +444,7 @@ void *gw_prioqueue_remove(gw_prioqueue_t *queue)
         queue_unlock(queue);
         return NULL;
     }
-    ret = queue->tab[1]->item;
-    gw_free(queue->tab[1]);
-    queue->tab[1] = queue->tab[--queue->len];
-    downheap(queue, 1);
+    ret = queue_take(queue);
     queue_unlock(queue);
     
     return ret;
@@ -290,10 +458,13 @@ void *gw_prioqueue_get(gw_prioqueue_t *queue)
     gw_assert(queue != NULL);
     
     queue_lock(queue);
-    if (queue->len > 1)
-        ret = queue->tab[1]->item;
-    else
+    if (queue->len <= 1)
         ret = NULL;
+    else if (queue->buckets != NULL) {
+        struct bucket *b = bucket_top(queue);
+        ret = b->items[b->head];
+    } else
+        ret = queue->tab[1]->item;
     queue_unlock(queue);
     
     return ret;
@@ -315,10 +486,7 @@ void *gw_prioqueue_consume(gw_prioqueue_t *queue)
         queue->mutex->owner = gwthread_self();
     }
     if (queue->len > 1) {
-        ret = queue->tab[1]->item;
-        gw_free(queue->tab[1]);
-        queue->tab[1] = queue->tab[--queue->len];
-        downheap(queue, 1);
+        ret = queue_take(queue);
     } else {
         ret = NULL;
     }
@@ -363,3 +531,116 @@ long gw_prioqueue_producer_count(gw_prioqueue_t *queue)
     return ret;
 }
 
+
+void gw_prioqueue_join(gw_prioqueue_t *queue, const Octstr *name)
+{
+    struct group *group = NULL;
+    long i;
+
+    gw_assert(queue != NULL && name != NULL);
+    gw_assert(queue->group == NULL);
+
+    pthread_mutex_lock(&groups_lock);
+    if (groups == NULL)
+        groups = gwlist_create();
+    for (i = 0; i < gwlist_len(groups); i++) {
+        group = gwlist_get(groups, i);
+        if (octstr_compare(group->name, name) == 0)
+            break;
+        group = NULL;
+    }
+    if (group == NULL) {
+        group = gw_malloc(sizeof(*group));
+        group->name = octstr_duplicate(name);
+        group->lock = mutex_create();
+        group->shards = gwlist_create();
+        gwlist_append(groups, group);
+    }
+    mutex_lock(group->lock);
+    gwlist_append(group->shards, queue);
+    queue->group = group;
+    mutex_unlock(group->lock);
+    pthread_mutex_unlock(&groups_lock);
+}
+
+
+void gw_prioqueue_leave(gw_prioqueue_t *queue)
+{
+    struct group *group;
+
+    gw_assert(queue != NULL);
+
+    if (queue->group == NULL)
+        return;
+
+    pthread_mutex_lock(&groups_lock);
+    group = queue->group;
+    /* no steal from this queue is running after we got the lock */
+    mutex_lock(group->lock);
+    gwlist_delete_equal(group->shards, queue);
+    queue->group = NULL;
+    mutex_unlock(group->lock);
+    if (gwlist_len(group->shards) == 0) {
+        gwlist_delete_equal(groups, group);
+        gwlist_destroy(group->shards, NULL);
+        mutex_destroy(group->lock);
+        octstr_destroy(group->name);
+        gw_free(group);
+        if (gwlist_len(groups) == 0) {
+            gwlist_destroy(groups, NULL);
+            groups = NULL;
+        }
+    }
+    pthread_mutex_unlock(&groups_lock);
+}
+
+
+void *gw_prioqueue_steal(gw_prioqueue_t *queue)
+{
+    gw_prioqueue_t *victim, *q;
+    long i, len, most;
+    void *ret;
+
+    gw_assert(queue != NULL);
+
+    if ((ret = gw_prioqueue_remove(queue)) != NULL || queue->group == NULL)
+        return ret;
+
+    /* take the first item of the sibling with the longest queue */
+    mutex_lock(queue->group->lock);
+    victim = NULL;
+    most = 0;
+    for (i = 0; i < gwlist_len(queue->group->shards); i++) {
+        q = gwlist_get(queue->group->shards, i);
+        if (q == queue)
+            continue;
+        len = __atomic_load_n(&q->len, __ATOMIC_RELAXED) - 1;
+        if (len > most) {
+            most = len;
+            victim = q;
+        }
+    }
+    if (victim != NULL)
+        ret = gw_prioqueue_remove(victim);
+    mutex_unlock(queue->group->lock);
+
+    return ret;
+}
+
+
+long gw_prioqueue_group_len(gw_prioqueue_t *queue)
+{
+    long i, len;
+
+    gw_assert(queue != NULL);
+
+    if (queue->group == NULL)
+        return gw_prioqueue_len(queue);
+
+    mutex_lock(queue->group->lock);
+    for (i = len = 0; i < gwlist_len(queue->group->shards); i++)
+        len += gw_prioqueue_len(gwlist_get(queue->group->shards, i));
+    mutex_unlock(queue->group->lock);
+
+    return len;
+}
@@ -74,6 +74,17 @@ typedef struct gw_prioqueue gw_prioqueue_t;
  */
 gw_prioqueue_t *gw_prioqueue_create(int(*cmp)(const void*, const void *));
 
+/**
+ * Create priority queue for a small fixed range of priorities. Items are
+ * kept in one FIFO per priority, so insert and remove take constant time
+ * and items of the same priority leave the queue in insert order.
+ * @buckets - number of priorities, at most 64
+ * @bucket - returns the priority of an item, higher ones are removed first;
+ *           values outside of 0 .. buckets - 1 are clamped to that range
+ * @return newly created priority queue
+ */
+gw_prioqueue_t *gw_prioqueue_create_buckets(long buckets, long(*bucket)(const void *));
+
 /**
  * Destroy priority queue
  * @queue - queue to destroy
@@ -140,4 +151,37 @@ void gw_prioqueue_remove_producer(gw_prioqueue_t *queue);
  */
 long gw_prioqueue_producer_count(gw_prioqueue_t *queue);
 
+/**
+ * Make the queue a shard of the named group, the group is created by
+ * the first queue joining it. Consumers of a shard may take over items
+ * of the other shards with gw_prioqueue_steal(), so several consumers
+ * of one logical queue can each have their own shard without stranding
+ * items behind a slow consumer.
+ * @queue - priority queue, must not be in a group yet
+ * @name - group name
+ */
+void gw_prioqueue_join(gw_prioqueue_t *queue, const Octstr *name);
+
+/**
+ * Remove the queue from its group, items stay in the queue. Called by
+ * gw_prioqueue_destroy too.
+ * @queue - priority queue
+ */
+void gw_prioqueue_leave(gw_prioqueue_t *queue);
+
+/**
+ * Remove biggest item from the priority queue, or if it is empty the
+ * biggest item of the longest other queue of its group. Does not block.
+ * @queue - priority queue
+ * @return - item or NULL if the queue and its group are empty
+ */
+void *gw_prioqueue_steal(gw_prioqueue_t *queue);
+
+/**
+ * Return the number of items in all queues of the group of this queue
+ * @queue - priority queue
+ * @return length of the group, or of the queue if not in a group
+ */
+long gw_prioqueue_group_len(gw_prioqueue_t *queue);
+
 #endif
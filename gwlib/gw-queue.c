@@ -0,0 +1,484 @@
+/* ==================================================================== 
+ * The Kannel Software License, Version 1.0 
+ * 
+ * Copyright (c) 2001-2016 Kannel Group  
+ * Copyright (c) 1998-2001 WapIT Ltd.   
+ * All rights reserved. 
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions 
+ * are met: 
+ * 
+ * 1. Redistributions of source code must retain the above copyright 
+ *    notice, this list of conditions and the following disclaimer. 
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright 
+ *    notice, this list of conditions and the following disclaimer in 
+ *    the documentation and/or other materials provided with the 
+ *    distribution. 
+ * 
+ * 3. The end-user documentation included with the redistribution, 
+ *    if any, must include the following acknowledgment: 
+ *       "This product includes software developed by the 
+ *        Kannel Group (http://www.kannel.org/)." 
+ *    Alternately, this acknowledgment may appear in the software itself, 
+ *    if and wherever such third-party acknowledgments normally appear. 
+ * 
+ * 4. The names "Kannel" and "Kannel Group" must not be used to 
+ *    endorse or promote products derived from this software without 
+ *    prior written permission. For written permission, please  
+ *    contact org@kannel.org. 
+ * 
+ * 5. Products derived from this software may not be called "Kannel", 
+ *    nor may "Kannel" appear in their name, without prior written 
+ *    permission of the Kannel Group. 
+ * 
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESSED OR IMPLIED 
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES 
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+ * DISCLAIMED.  IN NO EVENT SHALL THE KANNEL GROUP OR ITS CONTRIBUTORS 
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,  
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT  
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR  
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,  
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE  
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,  
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. 
+ * ==================================================================== 
+ * 
+ * This software consists of voluntary contributions made by many 
+ * individuals on behalf of the Kannel Group.  For more information on  
+ * the Kannel Group, please see <http://www.kannel.org/>. 
+ * 
+ * Portions of this software are based upon software originally written at  
+ * WapIT Ltd., Helsinki, Finland for the Kannel project.  
+ */ 
+
+/*
+ * gw-queue.c - lock-light multi-producer/multi-consumer FIFO queue.
+ *
+ * The fast path is a bounded array of cells, each carrying a sequence
+ * number which tells producers and consumers whether the cell is free
+ * or filled for their current lap around the ring (Dmitry Vyukov's
+ * bounded MPMC queue). Producers and consumers claim cells with a single
+ * compare-and-swap on the tail and head index respectively, so neither
+ * side ever takes a lock while the queue is non-empty and not full.
+ *
+ * Consumers that find the queue empty spin for a short while and then
+ * park on a condition variable, after announcing themselves in 'waiters'.
+ * Producers only touch the mutex when 'waiters' is non-zero. Both sides
+ * use a full memory barrier between their store and the load of the
+ * other side's variable, so either the consumer sees the new item or
+ * the producer sees the sleeping consumer and wakes it up.
+ *
+ * When the ring is full items are appended to an overflow List under the
+ * mutex. While the overflow is non-empty all producers append to it,
+ * and consumers move items back into the ring once they have drained
+ * it, so the order of items from a single producer is preserved.
+ *
+ * Items put back at the head go to a separate List under the mutex,
+ * which consumers empty before the ring. Counting them in 'ahead' keeps
+ * the fast path to a single load while that List is empty.
+ */
+
+#include "gw-config.h"
+
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "gwlib.h"
+#include "gw-queue.h"
+
+#define QUEUE_DEFAULT_CAPACITY 8192
+#define QUEUE_SPIN 32
+#define QUEUE_CACHE_LINE 64
+
+#define atomic_load(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define atomic_store(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#define atomic_add(p, v) __atomic_add_fetch((p), (v), __ATOMIC_SEQ_CST)
+#define atomic_cas(p, e, v) __atomic_compare_exchange_n((p), (e), (v), 1, \
+                                __ATOMIC_RELAXED, __ATOMIC_RELAXED)
+#define memory_barrier() __atomic_thread_fence(__ATOMIC_SEQ_CST)
+
+struct cell {
+    unsigned long seq;
+    void *item;
+};
+
+struct gw_queue {
+    struct cell *cells;
+    unsigned long mask;
+    char pad0[QUEUE_CACHE_LINE];
+    unsigned long head;         /* next cell to consume */
+    char pad1[QUEUE_CACHE_LINE];
+    unsigned long tail;         /* next cell to produce */
+    char pad2[QUEUE_CACHE_LINE];
+    long len;
+    long spilled;               /* items in overflow */
+    long ahead;                 /* items in front */
+    long producers;
+    long waiters;               /* consumers sleeping on nonempty */
+    int spin;                   /* tries before a consumer sleeps */
+    Mutex *mutex;
+    pthread_cond_t nonempty;
+    List *overflow;
+    List *front;                /* items inserted at the head */
+};
+
+
+static int ring_push(gw_queue_t *queue, void *item)
+{
+    struct cell *cell;
+    unsigned long pos, seq;
+    long dif;
+
+    pos = __atomic_load_n(&queue->tail, __ATOMIC_RELAXED);
+    for (;;) {
+        cell = &queue->cells[pos & queue->mask];
+        seq = atomic_load(&cell->seq);
+        dif = (long) seq - (long) pos;
+        if (dif == 0) {
+            if (atomic_cas(&queue->tail, &pos, pos + 1))
+                break;
+        } else if (dif < 0) {
+            return 0; /* full */
+        } else {
+            pos = __atomic_load_n(&queue->tail, __ATOMIC_RELAXED);
+        }
+    }
+    cell->item = item;
+    atomic_store(&cell->seq, pos + 1);
+
+    return 1;
+}
+
+
+static void *ring_pop(gw_queue_t *queue)
+{
+    struct cell *cell;
+    unsigned long pos, seq;
+    long dif;
+    void *item;
+
+    pos = __atomic_load_n(&queue->head, __ATOMIC_RELAXED);
+    for (;;) {
+        cell = &queue->cells[pos & queue->mask];
+        seq = atomic_load(&cell->seq);
+        dif = (long) seq - (long) (pos + 1);
+        if (dif == 0) {
+            if (atomic_cas(&queue->head, &pos, pos + 1))
+                break;
+        } else if (dif < 0) {
+            return NULL; /* empty */
+        } else {
+            pos = __atomic_load_n(&queue->head, __ATOMIC_RELAXED);
+        }
+    }
+    item = cell->item;
+    atomic_store(&cell->seq, pos + queue->mask + 1);
+
+    return item;
+}
+
+
+/*
+ * Move spilled items back into the ring, oldest first. The spilled
+ * counter drops to zero only after the last one is in the ring, so
+ * producers keep appending to the overflow until then.
+ * Caller must hold the mutex.
+ */
+static void refill(gw_queue_t *queue)
+{
+    void *item;
+
+    while (gwlist_len(queue->overflow) > 0) {
+        item = gwlist_get(queue->overflow, 0);
+        if (!ring_push(queue, item))
+            break;
+        gwlist_delete(queue->overflow, 0, 1);
+        atomic_add(&queue->spilled, -1);
+    }
+}
+
+
+static void *take(gw_queue_t *queue, int locked)
+{
+    void *item;
+
+    item = NULL;
+    if (atomic_load(&queue->ahead) > 0) {
+        if (!locked)
+            mutex_lock(queue->mutex);
+        if ((item = gwlist_extract_first(queue->front)) != NULL)
+            atomic_add(&queue->ahead, -1);
+        if (!locked)
+            mutex_unlock(queue->mutex);
+    }
+    if (item == NULL)
+        item = ring_pop(queue);
+    if (item == NULL && atomic_load(&queue->spilled) > 0) {
+        if (!locked)
+            mutex_lock(queue->mutex);
+        refill(queue);
+        if (!locked)
+            mutex_unlock(queue->mutex);
+        item = ring_pop(queue);
+    }
+    /*
+     * A sleeping consumer may have seen our item still counted in len
+     * and gone back to sleep. If we took the last item after the last
+     * producer went away, nobody else is going to wake it up.
+     */
+    if (item != NULL && atomic_add(&queue->len, -1) == 0 &&
+        atomic_load(&queue->producers) == 0 &&
+        __atomic_load_n(&queue->waiters, __ATOMIC_RELAXED) > 0) {
+        if (!locked)
+            mutex_lock(queue->mutex);
+        pthread_cond_broadcast(&queue->nonempty);
+        if (!locked)
+            mutex_unlock(queue->mutex);
+    }
+
+    return item;
+}
+
+
+static int drained(gw_queue_t *queue)
+{
+    return atomic_load(&queue->producers) == 0 && atomic_load(&queue->len) <= 0;
+}
+
+
+/*
+ * Sleep until an item can be taken, the last producer goes away or
+ * abstime (if not NULL) passes.
+ */
+static void *take_wait(gw_queue_t *queue, struct timespec *abstime)
+{
+    void *item;
+    int rc = 0;
+
+    mutex_lock(queue->mutex);
+    atomic_add(&queue->waiters, 1);
+    memory_barrier();
+    while ((item = take(queue, 1)) == NULL && !drained(queue) && rc != ETIMEDOUT) {
+        queue->mutex->owner = -1;
+        pthread_cleanup_push((void(*)(void*))pthread_mutex_unlock, &queue->mutex->mutex);
+        if (abstime != NULL)
+            rc = pthread_cond_timedwait(&queue->nonempty, &queue->mutex->mutex, abstime);
+        else
+            pthread_cond_wait(&queue->nonempty, &queue->mutex->mutex);
+        pthread_cleanup_pop(0);
+        queue->mutex->owner = gwthread_self();
+    }
+    atomic_add(&queue->waiters, -1);
+    mutex_unlock(queue->mutex);
+
+    return item;
+}
+
+
+static void wakeup(gw_queue_t *queue)
+{
+    memory_barrier();
+    if (__atomic_load_n(&queue->waiters, __ATOMIC_RELAXED) > 0) {
+        mutex_lock(queue->mutex);
+        pthread_cond_signal(&queue->nonempty);
+        mutex_unlock(queue->mutex);
+    }
+}
+
+
+gw_queue_t *gw_queue_create(long capacity)
+{
+    gw_queue_t *ret;
+    unsigned long size, i;
+
+    if (capacity <= 0)
+        capacity = QUEUE_DEFAULT_CAPACITY;
+    for (size = 2; size < (unsigned long) capacity; size <<= 1)
+        ;
+
+    ret = gw_malloc(sizeof(*ret));
+    ret->cells = gw_malloc(sizeof(*ret->cells) * size);
+    for (i = 0; i < size; i++) {
+        ret->cells[i].seq = i;
+        ret->cells[i].item = NULL;
+    }
+    ret->mask = size - 1;
+    ret->head = ret->tail = 0;
+    ret->len = 0;
+    ret->spilled = 0;
+    ret->ahead = 0;
+    ret->producers = 0;
+    ret->waiters = 0;
+    /* spinning only makes sense if the producer can run meanwhile */
+    ret->spin = (sysconf(_SC_NPROCESSORS_ONLN) > 1 ? QUEUE_SPIN : 1);
+    ret->mutex = mutex_create();
+    pthread_cond_init(&ret->nonempty, NULL);
+    ret->overflow = gwlist_create();
+    ret->front = gwlist_create();
+
+    return ret;
+}
+
+
+void gw_queue_destroy(gw_queue_t *queue, void(*item_destroy)(void*))
+{
+    void *item;
+
+    if (queue == NULL)
+        return;
+
+    while ((item = take(queue, 0)) != NULL) {
+        if (item_destroy != NULL)
+            item_destroy(item);
+    }
+    gwlist_destroy(queue->overflow, item_destroy);
+    gwlist_destroy(queue->front, item_destroy);
+    mutex_destroy(queue->mutex);
+    pthread_cond_destroy(&queue->nonempty);
+    gw_free(queue->cells);
+    gw_free(queue);
+}
+
+
+long gw_queue_len(gw_queue_t *queue)
+{
+    long len;
+
+    gw_assert(queue != NULL);
+
+    len = atomic_load(&queue->len);
+    return len > 0 ? len : 0;
+}
+
+
+void gw_queue_produce(gw_queue_t *queue, void *item)
+{
+    gw_assert(queue != NULL);
+    gw_assert(item != NULL);
+
+    atomic_add(&queue->len, 1);
+    if (atomic_load(&queue->spilled) > 0 || !ring_push(queue, item)) {
+        mutex_lock(queue->mutex);
+        gwlist_append(queue->overflow, item);
+        atomic_add(&queue->spilled, 1);
+        mutex_unlock(queue->mutex);
+    }
+    wakeup(queue);
+}
+
+
+void gw_queue_insert_head(gw_queue_t *queue, void *item)
+{
+    gw_assert(queue != NULL);
+    gw_assert(item != NULL);
+
+    atomic_add(&queue->len, 1);
+    mutex_lock(queue->mutex);
+    gwlist_insert(queue->front, 0, item);
+    atomic_add(&queue->ahead, 1);
+    mutex_unlock(queue->mutex);
+    wakeup(queue);
+}
+
+
+void *gw_queue_remove(gw_queue_t *queue)
+{
+    gw_assert(queue != NULL);
+
+    return take(queue, 0);
+}
+
+
+void *gw_queue_consume(gw_queue_t *queue)
+{
+    void *item;
+    int i;
+
+    gw_assert(queue != NULL);
+
+    for (i = 0; i < queue->spin; i++) {
+        if ((item = take(queue, 0)) != NULL)
+            return item;
+        if (drained(queue))
+            return NULL;
+    }
+
+    return take_wait(queue, NULL);
+}
+
+
+void *gw_queue_timed_consume(gw_queue_t *queue, long sec)
+{
+    struct timespec abstime;
+    void *item;
+
+    gw_assert(queue != NULL);
+
+    if ((item = take(queue, 0)) != NULL || drained(queue))
+        return item;
+
+    abstime.tv_sec = time(NULL) + sec;
+    abstime.tv_nsec = 0;
+
+    return take_wait(queue, &abstime);
+}
+
+
+int gw_queue_wait_until_nonempty(gw_queue_t *queue)
+{
+    int ret;
+
+    gw_assert(queue != NULL);
+
+    mutex_lock(queue->mutex);
+    atomic_add(&queue->waiters, 1);
+    memory_barrier();
+    while (atomic_load(&queue->len) <= 0 && atomic_load(&queue->producers) > 0) {
+        queue->mutex->owner = -1;
+        pthread_cleanup_push((void(*)(void*))pthread_mutex_unlock, &queue->mutex->mutex);
+        pthread_cond_wait(&queue->nonempty, &queue->mutex->mutex);
+        pthread_cleanup_pop(0);
+        queue->mutex->owner = gwthread_self();
+    }
+    ret = (atomic_load(&queue->len) > 0 ? 1 : -1);
+    /* we did not take the item, pass the wakeup on to a consumer */
+    if (ret == 1)
+        pthread_cond_signal(&queue->nonempty);
+    atomic_add(&queue->waiters, -1);
+    mutex_unlock(queue->mutex);
+
+    return ret;
+}
+
+
+void gw_queue_add_producer(gw_queue_t *queue)
+{
+    gw_assert(queue != NULL);
+
+    atomic_add(&queue->producers, 1);
+}
+
+
+void gw_queue_remove_producer(gw_queue_t *queue)
+{
+    gw_assert(queue != NULL);
+
+    mutex_lock(queue->mutex);
+    gw_assert(queue->producers > 0);
+    atomic_add(&queue->producers, -1);
+    pthread_cond_broadcast(&queue->nonempty);
+    mutex_unlock(queue->mutex);
+}
+
+
+long gw_queue_producer_count(gw_queue_t *queue)
+{
+    gw_assert(queue != NULL);
+
+    return atomic_load(&queue->producers);
+}
@@ -0,0 +1,165 @@
+/* ==================================================================== 
+ * The Kannel Software License, Version 1.0 
+ * 
+ * Copyright (c) 2001-2016 Kannel Group  
+ * Copyright (c) 1998-2001 WapIT Ltd.   
+ * All rights reserved. 
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions 
+ * are met: 
+ * 
+ * 1. Redistributions of source code must retain the above copyright 
+ *    notice, this list of conditions and the following disclaimer. 
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright 
+ *    notice, this list of conditions and the following disclaimer in 
+ *    the documentation and/or other materials provided with the 
+ *    distribution. 
+ * 
+ * 3. The end-user documentation included with the redistribution, 
+ *    if any, must include the following acknowledgment: 
+ *       "This product includes software developed by the 
+ *        Kannel Group (http://www.kannel.org/)." 
+ *    Alternately, this acknowledgment may appear in the software itself, 
+ *    if and wherever such third-party acknowledgments normally appear. 
+ * 
+ * 4. The names "Kannel" and "Kannel Group" must not be used to 
+ *    endorse or promote products derived from this software without 
+ *    prior written permission. For written permission, please  
+ *    contact org@kannel.org. 
+ * 
+ * 5. Products derived from this software may not be called "Kannel", 
+ *    nor may "Kannel" appear in their name, without prior written 
+ *    permission of the Kannel Group. 
+ * 
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESSED OR IMPLIED 
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES 
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+ * DISCLAIMED.  IN NO EVENT SHALL THE KANNEL GROUP OR ITS CONTRIBUTORS 
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,  
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT  
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR  
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,  
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE  
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,  
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. 
+ * ==================================================================== 
+ * 
+ * This software consists of voluntary contributions made by many 
+ * individuals on behalf of the Kannel Group.  For more information on  
+ * the Kannel Group, please see <http://www.kannel.org/>. 
+ * 
+ * Portions of this software are based upon software originally written at  
+ * WapIT Ltd., Helsinki, Finland for the Kannel project.  
+ */ 
+
+/*
+ * gw-queue.h - lock-light multi-producer/multi-consumer FIFO queue.
+ *
+ * A drop-in replacement for the gwlist_produce()/gwlist_consume() usage
+ * pattern on hot producer/consumer paths. Items go through a bounded
+ * lock-free ring; a consumer only takes a lock when it has to sleep and a
+ * producer only takes one when a consumer is sleeping. If the ring fills
+ * up, items spill over into an unbounded list, so producers never block
+ * and the queue keeps the unbounded semantics of a List.
+ *
+ * Producer counting works as for List: consumers block while the queue
+ * is empty and there are producers, and get NULL once the queue is empty
+ * and the last producer has been removed.
+ */
+
+#ifndef GW_QUEUE_H
+#define GW_QUEUE_H 1
+
+typedef struct gw_queue gw_queue_t;
+
+/**
+ * Create queue
+ * @capacity - size of the lock-free ring, rounded up to a power of two;
+ *             zero or negative selects the default
+ * @return newly created queue
+ */
+gw_queue_t *gw_queue_create(long capacity);
+
+/**
+ * Destroy queue
+ * @queue - queue to destroy
+ * @item_destroy - item destructor, may be NULL
+ */
+void gw_queue_destroy(gw_queue_t *queue, void(*item_destroy)(void*));
+
+/**
+ * Return queue length
+ * @queue - queue
+ * @return number of items in the queue
+ */
+long gw_queue_len(gw_queue_t *queue);
+
+/**
+ * Append item to the end of the queue, never blocks
+ * @queue - queue
+ * @item - item to append, must not be NULL
+ */
+void gw_queue_produce(gw_queue_t *queue, void *item);
+
+/**
+ * Insert item at the head of the queue, so it is consumed next; takes
+ * the queue mutex, meant for putting back an item that could not be
+ * handled yet
+ * @queue - queue
+ * @item - item to insert, must not be NULL
+ */
+void gw_queue_insert_head(gw_queue_t *queue, void *item);
+
+/**
+ * Remove first item from the queue, but do not block if producers
+ * are available and the queue is empty
+ * @queue - queue
+ * @return first item or NULL if the queue is empty
+ */
+void *gw_queue_remove(gw_queue_t *queue);
+
+/**
+ * Remove first item from the queue, block if the queue is empty
+ * and producers are available
+ * @queue - queue
+ * @return first item or NULL if the queue is empty and has no producers
+ */
+void *gw_queue_consume(gw_queue_t *queue);
+
+/**
+ * Same as gw_queue_consume, but wait at most sec seconds
+ * @queue - queue
+ * @sec - timeout in seconds
+ * @return first item or NULL on timeout or shutdown
+ */
+void *gw_queue_timed_consume(gw_queue_t *queue, long sec);
+
+/**
+ * Block until the queue is non-empty or has no producers
+ * @queue - queue
+ * @return 1 if the queue is non-empty, -1 otherwise
+ */
+int gw_queue_wait_until_nonempty(gw_queue_t *queue);
+
+/**
+ * Add producer to the queue
+ * @queue - queue
+ */
+void gw_queue_add_producer(gw_queue_t *queue);
+
+/**
+ * Remove producer from the queue, wakes up all sleeping consumers
+ * @queue - queue
+ */
+void gw_queue_remove_producer(gw_queue_t *queue);
+
+/**
+ * Return producer count for the queue
+ * @queue - queue
+ * @return producer count
+ */
+long gw_queue_producer_count(gw_queue_t *queue);
+
+#endif
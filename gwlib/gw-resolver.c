@@ -0,0 +1,470 @@
+/* ==================================================================== 
+ * The Kannel Software License, Version 1.0 
+ * 
+ * Copyright (c) 2001-2016 Kannel Group  
+ * Copyright (c) 1998-2001 WapIT Ltd.   
+ * All rights reserved. 
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions 
+ * are met: 
+ * 
+ * 1. Redistributions of source code must retain the above copyright 
+ *    notice, this list of conditions and the following disclaimer. 
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright 
+ *    notice, this list of conditions and the following disclaimer in 
+ *    the documentation and/or other materials provided with the 
+ *    distribution. 
+ * 
+ * 3. The end-user documentation included with the redistribution, 
+ *    if any, must include the following acknowledgment: 
+ *       "This product includes software developed by the 
+ *        Kannel Group (http://www.kannel.org/)." 
+ *    Alternately, this acknowledgment may appear in the software itself, 
+ *    if and wherever such third-party acknowledgments normally appear. 
+ * 
+ * 4. The names "Kannel" and "Kannel Group" must not be used to 
+ *    endorse or promote products derived from this software without 
+ *    prior written permission. For written permission, please  
+ *    contact org@kannel.org. 
+ * 
+ * 5. Products derived from this software may not be called "Kannel", 
+ *    nor may "Kannel" appear in their name, without prior written 
+ *    permission of the Kannel Group. 
+ * 
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESSED OR IMPLIED 
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES 
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+ * DISCLAIMED.  IN NO EVENT SHALL THE KANNEL GROUP OR ITS CONTRIBUTORS 
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,  
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT  
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR  
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,  
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE  
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,  
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. 
+ * ==================================================================== 
+ * 
+ * This software consists of voluntary contributions made by many 
+ * individuals on behalf of the Kannel Group.  For more information on  
+ * the Kannel Group, please see <http://www.kannel.org/>. 
+ * 
+ * Portions of this software are based upon software originally written at  
+ * WapIT Ltd., Helsinki, Finland for the Kannel project.  
+ */ 
+
+/*
+ * gw-resolver.c - caching host name resolver, see gw-resolver.h
+ */
+
+#include <string.h>
+#include <time.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+
+#include "gwlib.h"
+
+/* number of threads doing asynchronous lookups */
+#define RESOLVER_THREADS 4
+
+/* expired entries are dropped once the cache has grown beyond this */
+#define RESOLVER_CACHE_MAX 4096
+
+typedef struct {
+    List *addrs;        /* NULL if the name could not be resolved */
+    time_t expires;
+    List *waiters;      /* non-NULL while an asynchronous lookup runs */
+} ResolverEntry;
+
+typedef struct {
+    gw_resolver_callback_t *callback;
+    void *data;
+} ResolverWaiter;
+
+static Dict *cache = NULL;
+static Mutex *cache_lock = NULL;
+/* held while callbacks run, so gw_resolve_cancel() can wait for them */
+static Mutex *callback_lock = NULL;
+static List *lookups = NULL;
+static Mutex *thread_lock = NULL;
+static volatile sig_atomic_t threads_are_running = 0;
+static long positive_ttl = 300;
+static long negative_ttl = 30;
+
+
+static void waiter_destroy(void *p)
+{
+    gw_free(p);
+}
+
+
+static void entry_destroy(void *p)
+{
+    ResolverEntry *entry = p;
+
+    if (entry == NULL)
+        return;
+    gwlist_destroy(entry->addrs, octstr_destroy_item);
+    gwlist_destroy(entry->waiters, waiter_destroy);
+    gw_free(entry);
+}
+
+
+static List *addrs_duplicate(List *addrs)
+{
+    List *copy;
+    long i;
+
+    if (addrs == NULL)
+        return NULL;
+    copy = gwlist_create();
+    for (i = 0; i < gwlist_len(addrs); i++)
+        gwlist_append(copy, octstr_duplicate(gwlist_get(addrs, i)));
+    return copy;
+}
+
+
+/*
+ * Return a list with the address if host is a numeric IPv4 or IPv6
+ * address, NULL if it is a name.
+ */
+static List *numeric_address(Octstr *host)
+{
+    struct sockaddr_in sin;
+#ifdef AF_INET6
+    struct sockaddr_in6 sin6;
+#endif
+    List *addrs;
+
+    memset(&sin, 0, sizeof(sin));
+    if (inet_pton(AF_INET, octstr_get_cstr(host), &sin.sin_addr) == 1) {
+        sin.sin_family = AF_INET;
+        addrs = gwlist_create();
+        gwlist_append(addrs, octstr_create_from_data((char *) &sin, sizeof(sin)));
+        return addrs;
+    }
+#ifdef AF_INET6
+    memset(&sin6, 0, sizeof(sin6));
+    if (inet_pton(AF_INET6, octstr_get_cstr(host), &sin6.sin6_addr) == 1) {
+        sin6.sin6_family = AF_INET6;
+        addrs = gwlist_create();
+        gwlist_append(addrs, octstr_create_from_data((char *) &sin6, sizeof(sin6)));
+        return addrs;
+    }
+#endif
+    return NULL;
+}
+
+
+/*
+ * Do the actual lookup, IPv4 addresses first.
+ */
+static List *lookup(Octstr *host)
+{
+    struct addrinfo hints, *res, *ai;
+    List *addrs, *addrs6;
+    Octstr *addr;
+    int rc;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    rc = getaddrinfo(octstr_get_cstr(host), NULL, &hints, &res);
+    if (rc != 0) {
+        error(0, "Could not resolve host name `%s': %s",
+              octstr_get_cstr(host), gai_strerror(rc));
+        return NULL;
+    }
+
+    addrs = gwlist_create();
+    addrs6 = gwlist_create();
+    for (ai = res; ai != NULL; ai = ai->ai_next) {
+        addr = octstr_create_from_data((char *) ai->ai_addr, ai->ai_addrlen);
+        if (ai->ai_family == AF_INET)
+            gwlist_append(addrs, addr);
+#ifdef AF_INET6
+        else if (ai->ai_family == AF_INET6)
+            gwlist_append(addrs6, addr);
+#endif
+        else
+            octstr_destroy(addr);
+    }
+    freeaddrinfo(res);
+
+    while ((addr = gwlist_extract_first(addrs6)) != NULL)
+        gwlist_append(addrs, addr);
+    gwlist_destroy(addrs6, NULL);
+
+    if (gwlist_len(addrs) == 0) {
+        gwlist_destroy(addrs, NULL);
+        error(0, "Host name `%s' has no addresses", octstr_get_cstr(host));
+        return NULL;
+    }
+    return addrs;
+}
+
+
+/*
+ * Drop expired entries without running lookups. Called with cache_lock
+ * held once the cache has grown too big.
+ */
+static void cache_expire(time_t now)
+{
+    ResolverEntry *entry;
+    List *keys;
+    Octstr *key;
+
+    keys = dict_keys(cache);
+    while ((key = gwlist_extract_first(keys)) != NULL) {
+        entry = dict_get(cache, key);
+        if (entry != NULL && entry->waiters == NULL && entry->expires <= now)
+            entry_destroy(dict_remove(cache, key));
+        octstr_destroy(key);
+    }
+    gwlist_destroy(keys, NULL);
+}
+
+
+/*
+ * Store the answer for host in the cache and return the entry. Called
+ * with cache_lock held, takes over addrs.
+ */
+static ResolverEntry *cache_store(Octstr *host, List *addrs)
+{
+    ResolverEntry *entry;
+    time_t now = time(NULL);
+
+    entry = dict_get(cache, host);
+    if (entry == NULL) {
+        if (dict_key_count(cache) >= RESOLVER_CACHE_MAX)
+            cache_expire(now);
+        entry = gw_malloc(sizeof(*entry));
+        entry->addrs = NULL;
+        entry->expires = 0;
+        entry->waiters = NULL;
+        dict_put(cache, host, entry);
+    }
+    gwlist_destroy(entry->addrs, octstr_destroy_item);
+    entry->addrs = addrs;
+    entry->expires = now + (addrs != NULL ? positive_ttl : negative_ttl);
+    return entry;
+}
+
+
+static void resolver_thread(void *arg)
+{
+    ResolverEntry *entry;
+    ResolverWaiter *waiter;
+    List *addrs, *waiters;
+    Octstr *host;
+    int found;
+
+    while ((host = gwlist_consume(lookups)) != NULL) {
+        addrs = lookup(host);
+        found = (addrs != NULL);
+
+        mutex_lock(cache_lock);
+        entry = cache_store(host, addrs);
+        waiters = entry->waiters;
+        entry->waiters = NULL;
+        mutex_unlock(cache_lock);
+
+        debug("gwlib.resolver", 0, "Resolved `%s' (%s) for %ld waiting requests",
+              octstr_get_cstr(host), found ? "found" : "not found",
+              gwlist_len(waiters));
+
+        mutex_lock(callback_lock);
+        while ((waiter = gwlist_extract_first(waiters)) != NULL) {
+            waiter->callback(waiter->data, found);
+            gw_free(waiter);
+        }
+        mutex_unlock(callback_lock);
+        gwlist_destroy(waiters, NULL);
+        octstr_destroy(host);
+    }
+}
+
+
+static void start_resolver_threads(void)
+{
+    long i;
+
+    if (threads_are_running)
+        return;
+
+    mutex_lock(thread_lock);
+    if (!threads_are_running) {
+        for (i = 0; i < RESOLVER_THREADS; i++) {
+            if (gwthread_create(resolver_thread, NULL) == -1)
+                error(0, "Could not start resolver thread.");
+        }
+        threads_are_running = 1;
+    }
+    mutex_unlock(thread_lock);
+}
+
+
+void gw_resolver_init(void)
+{
+    cache = dict_create(1024, entry_destroy);
+    cache_lock = mutex_create();
+    callback_lock = mutex_create();
+    thread_lock = mutex_create();
+    lookups = gwlist_create();
+    gwlist_add_producer(lookups);
+}
+
+
+void gw_resolver_shutdown(void)
+{
+    gwlist_remove_producer(lookups);
+    gwthread_join_every(resolver_thread);
+    threads_are_running = 0;
+    gwlist_destroy(lookups, octstr_destroy_item);
+    lookups = NULL;
+    dict_destroy(cache);
+    cache = NULL;
+    mutex_destroy(cache_lock);
+    mutex_destroy(callback_lock);
+    mutex_destroy(thread_lock);
+}
+
+
+void gw_resolver_set_ttl(long positive, long negative)
+{
+    if (positive >= 0)
+        positive_ttl = positive;
+    if (negative >= 0)
+        negative_ttl = negative;
+}
+
+
+List *gw_resolve(Octstr *host)
+{
+    ResolverEntry *entry;
+    List *addrs;
+
+    if (host == NULL)
+        return NULL;
+    if ((addrs = numeric_address(host)) != NULL)
+        return addrs;
+
+    mutex_lock(cache_lock);
+    entry = dict_get(cache, host);
+    if (entry != NULL && entry->expires > time(NULL)) {
+        addrs = addrs_duplicate(entry->addrs);
+        mutex_unlock(cache_lock);
+        return addrs;
+    }
+    mutex_unlock(cache_lock);
+
+    addrs = lookup(host);
+
+    mutex_lock(cache_lock);
+    cache_store(host, addrs_duplicate(addrs));
+    mutex_unlock(cache_lock);
+
+    return addrs;
+}
+
+
+int gw_resolve_async(Octstr *host, gw_resolver_callback_t *callback, void *data)
+{
+    ResolverEntry *entry;
+    ResolverWaiter *waiter;
+    List *addrs;
+    int start = 0;
+
+    if (host == NULL)
+        return 0;
+    if ((addrs = numeric_address(host)) != NULL) {
+        gwlist_destroy(addrs, octstr_destroy_item);
+        return 0;
+    }
+
+    mutex_lock(cache_lock);
+    entry = dict_get(cache, host);
+    if (entry != NULL && entry->expires > time(NULL)) {
+        mutex_unlock(cache_lock);
+        return 0;
+    }
+    if (entry == NULL) {
+        /* an expired placeholder until the lookup is done */
+        entry = cache_store(host, NULL);
+        entry->expires = 0;
+    }
+    if (entry->waiters == NULL) {
+        entry->waiters = gwlist_create();
+        start = 1;
+    }
+    waiter = gw_malloc(sizeof(*waiter));
+    waiter->callback = callback;
+    waiter->data = data;
+    gwlist_append(entry->waiters, waiter);
+    mutex_unlock(cache_lock);
+
+    if (start) {
+        debug("gwlib.resolver", 0, "Resolving `%s' in the background",
+              octstr_get_cstr(host));
+        start_resolver_threads();
+        gwlist_produce(lookups, octstr_duplicate(host));
+    }
+    return 1;
+}
+
+
+void gw_resolve_cancel(gw_resolver_callback_t *callback, void (*data_destroy)(void *))
+{
+    ResolverEntry *entry;
+    ResolverWaiter *waiter;
+    List *keys;
+    Octstr *key;
+    long i;
+
+    /* lookups being answered may have taken their waiters already */
+    mutex_lock(callback_lock);
+    mutex_lock(cache_lock);
+    keys = dict_keys(cache);
+    while ((key = gwlist_extract_first(keys)) != NULL) {
+        entry = dict_get(cache, key);
+        for (i = 0; entry != NULL && i < gwlist_len(entry->waiters); ) {
+            waiter = gwlist_get(entry->waiters, i);
+            if (waiter->callback != callback) {
+                i++;
+                continue;
+            }
+            gwlist_delete(entry->waiters, i, 1);
+            if (data_destroy != NULL)
+                data_destroy(waiter->data);
+            gw_free(waiter);
+        }
+        octstr_destroy(key);
+    }
+    gwlist_destroy(keys, NULL);
+    mutex_unlock(cache_lock);
+    mutex_unlock(callback_lock);
+}
+
+
+socklen_t gw_resolver_sockaddr(Octstr *address, struct sockaddr_storage *sa, int port)
+{
+    socklen_t len;
+
+    len = octstr_len(address);
+    gw_assert(len <= sizeof(*sa));
+    memset(sa, 0, sizeof(*sa));
+    octstr_get_many_chars((char *) sa, address, 0, len);
+    if (sa->ss_family == AF_INET)
+        ((struct sockaddr_in *) sa)->sin_port = htons(port);
+#ifdef AF_INET6
+    else if (sa->ss_family == AF_INET6)
+        ((struct sockaddr_in6 *) sa)->sin6_port = htons(port);
+#endif
+    return len;
+}
@@ -0,0 +1,140 @@
+/* ==================================================================== 
+ * The Kannel Software License, Version 1.0 
+ * 
+ * Copyright (c) 2001-2016 Kannel Group  
+ * Copyright (c) 1998-2001 WapIT Ltd.   
+ * All rights reserved. 
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions 
+ * are met: 
+ * 
+ * 1. Redistributions of source code must retain the above copyright 
+ *    notice, this list of conditions and the following disclaimer. 
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright 
+ *    notice, this list of conditions and the following disclaimer in 
+ *    the documentation and/or other materials provided with the 
+ *    distribution. 
+ * 
+ * 3. The end-user documentation included with the redistribution, 
+ *    if any, must include the following acknowledgment: 
+ *       "This product includes software developed by the 
+ *        Kannel Group (http://www.kannel.org/)." 
+ *    Alternately, this acknowledgment may appear in the software itself, 
+ *    if and wherever such third-party acknowledgments normally appear. 
+ * 
+ * 4. The names "Kannel" and "Kannel Group" must not be used to 
+ *    endorse or promote products derived from this software without 
+ *    prior written permission. For written permission, please  
+ *    contact org@kannel.org. 
+ * 
+ * 5. Products derived from this software may not be called "Kannel", 
+ *    nor may "Kannel" appear in their name, without prior written 
+ *    permission of the Kannel Group. 
+ * 
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESSED OR IMPLIED 
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES 
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+ * DISCLAIMED.  IN NO EVENT SHALL THE KANNEL GROUP OR ITS CONTRIBUTORS 
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,  
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT  
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR  
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,  
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE  
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,  
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. 
+ * ==================================================================== 
+ * 
+ * This software consists of voluntary contributions made by many 
+ * individuals on behalf of the Kannel Group.  For more information on  
+ * the Kannel Group, please see <http://www.kannel.org/>. 
+ * 
+ * Portions of this software are based upon software originally written at  
+ * WapIT Ltd., Helsinki, Finland for the Kannel project.  
+ */ 
+
+/*
+ * gw-resolver.h - caching host name resolver.
+ *
+ * Host names are resolved with getaddrinfo(), so IPv4 and IPv6 addresses
+ * and everything configured in nsswitch.conf are supported. Answers are
+ * cached, found names for dns-cache-ttl seconds and names that could not
+ * be resolved for dns-negative-cache-ttl seconds. getaddrinfo() does
+ * not report the TTL of the DNS records, so the cache uses these fixed
+ * times instead.
+ *
+ * gw_resolve() blocks the calling thread on a cache miss. Callers that
+ * must not block, like the HTTP client, use gw_resolve_async(), which
+ * hands the lookup to a small pool of resolver threads and calls back
+ * once the answer is in the cache. Several requests for the same name
+ * share one lookup.
+ *
+ * Addresses are returned as a List of Octstr, each holding a struct
+ * sockaddr_in or sockaddr_in6 with port 0. IPv4 addresses come first,
+ * so hosts with both kinds of addresses are connected to over IPv4
+ * as before.
+ */
+
+#ifndef GW_RESOLVER_H
+#define GW_RESOLVER_H 1
+
+#include <sys/socket.h>
+
+/**
+ * Function called when an asynchronous lookup is done. It runs in a
+ * resolver thread, so it should just hand the work back to the caller.
+ * @data - data given to gw_resolve_async()
+ * @found - 1 if the name was resolved, 0 if not
+ */
+typedef void gw_resolver_callback_t(void *data, int found);
+
+void gw_resolver_init(void);
+void gw_resolver_shutdown(void);
+
+/**
+ * Set cache times, negative values keep the current setting
+ * @positive - seconds to keep resolved names, default 300
+ * @negative - seconds to keep names that could not be resolved, default 30
+ */
+void gw_resolver_set_ttl(long positive, long negative);
+
+/**
+ * Resolve host name, may block on a cache miss. Numeric addresses are
+ * returned as they are.
+ * @host - host name or numeric IPv4/IPv6 address
+ * @return List of Octstr addresses, destroy with
+ *         gwlist_destroy(list, octstr_destroy_item); NULL if not found
+ */
+List *gw_resolve(Octstr *host);
+
+/**
+ * Make sure host name is in the cache without blocking.
+ * @host - host name or numeric IPv4/IPv6 address
+ * @callback - called from a resolver thread once the lookup is done,
+ *             only if 1 is returned
+ * @data - passed to callback
+ * @return 0 if the answer is cached (or host is numeric), so that
+ *         gw_resolve() will not block; 1 if the lookup was started
+ */
+int gw_resolve_async(Octstr *host, gw_resolver_callback_t *callback, void *data);
+
+/**
+ * Forget all asynchronous lookups waited for with callback, e.g. when
+ * the caller shuts down before the resolver. Returns once no such
+ * callback is running, and callback is not called for them any more.
+ * @callback - as given to gw_resolve_async()
+ * @data_destroy - called for the data of each waiter, may be NULL
+ */
+void gw_resolve_cancel(gw_resolver_callback_t *callback, void (*data_destroy)(void *));
+
+/**
+ * Copy an address returned by gw_resolve() and set its port
+ * @address - one of the Octstr returned by gw_resolve()
+ * @sa - where to copy the address
+ * @port - port number
+ * @return length of the address in sa
+ */
+socklen_t gw_resolver_sockaddr(Octstr *address, struct sockaddr_storage *sa, int port);
+
+#endif
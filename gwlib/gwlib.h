@@ -103,6 +103,9 @@
 #include "gw_uuid.h"
 #include "gw-rwlock.h"
 #include "gw-prioqueue.h"
+#include "gw-queue.h"
+#include "gw-histogram.h"
+#include "gw-resolver.h"
 
 void gwlib_assert_init(void);
 void gwlib_init(void);
@@ -83,15 +83,30 @@
 
 #include "gwlib.h"
 #include "gwlib/regex.h"
+#ifdef HAVE_NGHTTP2
+#include "gwlib/http2.h"
+#endif
 
 /* comment this out if you don't want HTTP responses to be dumped */
 #define DUMP_RESPONSE 1
 
 /* define http client connections timeout in seconds (set to -1 for disable) */
 static int http_client_timeout = 240;
+/* max http client connections and queued requests per server, 0 is no limit */
+static long http_client_max_host_connections = 0;
+static long http_client_max_host_queue = 0;
+/* max requests in flight on one http client connection, 1 is no pipelining */
+static long http_client_pipeline_depth = 1;
+#ifdef HAVE_NGHTTP2
+/* talk HTTP/2 to https (with ALPN) and to http servers (prior knowledge) */
+static int http_client_h2 = 0;
+static int http_client_h2c = 0;
+#endif
 
 /* define http server connections timeout in seconds (set to -1 for disable) */
 #define HTTP_SERVER_TIMEOUT 60
+/* number of poller threads for the connections of each server port */
+static int http_server_pollers = 1;
 /* max accepted clients */
 #define HTTP_SERVER_MAX_ACTIVE_CONNECTIONS 500
 
@@ -217,6 +232,7 @@ static void proxy_add_authentication(List *headers)
     octstr_binary_to_base64(os);
     octstr_strip_blanks(os);
     octstr_insert(os, octstr_imm("Basic "), 0);
+    http_header_remove_all(headers, "Proxy-Authorization");
     http_header_add(headers, "Proxy-Authorization", octstr_get_cstr(os));
     octstr_destroy(os);
 }
@@ -661,6 +677,9 @@ static char *http_methods[] = {
     "GET", "POST", "HEAD"
 };
 
+typedef struct HTTPHost HTTPHost;
+typedef struct HTTPPipeline HTTPPipeline;
+
 /*
  * Information about a server we've connected to.
  */
@@ -673,6 +692,7 @@ typedef struct {
     List *request_headers;
     Octstr *request_body;   /* NULL for GET or HEAD, non-NULL for POST */
     enum {
+	resolving,
 	connecting,
 	request_not_sent,
 	reading_status,
@@ -690,10 +710,17 @@ typedef struct {
     int ssl;
     Octstr *username;	/* For basic authentication */
     Octstr *password;
+    HTTPHost *pool;           /* server or proxy we connect to */
+    HTTPPipeline *pipeline;   /* NULL unless conn may be shared */
+    int reused;               /* conn was taken from the pool */
+    int slot;                 /* we got the slot of a closed conn */
+    int retried;              /* sent again after a reused conn failed */
+    int no_h2;                /* server did not agree to HTTP/2 */
 } HTTPServer;
 
 
 static int send_request(HTTPServer *trans);
+static void handle_transaction(Connection *conn, void *data);
 static Octstr *build_response(List *headers, Octstr *body);
 static int header_is_called(Octstr *header, char *name);
 
@@ -723,6 +750,12 @@ static HTTPServer *server_create(HTTPCaller *caller, int method, Octstr *url,
     trans->follow_remaining = follow_remaining;
     trans->certkeyfile = octstr_duplicate(certkeyfile);
     trans->ssl = 0;
+    trans->pool = NULL;
+    trans->pipeline = NULL;
+    trans->reused = 0;
+    trans->slot = 0;
+    trans->retried = 0;
+    trans->no_h2 = 0;
     return trans;
 }
 
@@ -747,102 +780,223 @@ static void server_destroy(void *p)
 
 
 /*
- * Pool of open, but unused connections to servers or proxies. Key is
- * "servername:port", value is List with Connection objects.
+ * Servers or proxies we connect to, one HTTPHost for each combination
+ * of host, port, SSL, client certificate and local interface. Hosts are
+ * created on first use and kept while they have connections or queued
+ * requests, so looking up a busy one does not allocate anything. Unused
+ * hosts are freed when a new host is added to their hash bucket. A
+ * request only uses its trans->pool while it holds a connection or a
+ * slot of the host. All of it is protected by conn_pool_lock.
+ */
+struct HTTPHost {
+    Octstr *host;
+    int port;
+    int ssl;
+    Octstr *certkeyfile;
+    Octstr *our_host;
+    HTTPHost *next;         /* in the same hash bucket */
+    List *idle;             /* open, but unused keep-alive connections */
+    List *pipelines;        /* busy connections that take more requests */
+    List *queue;            /* requests waiting for a connection */
+    long connections;       /* open connections, idle or busy */
+    List *sessions;         /* HTTP/2 connections */
+    int no_h2;              /* server did not agree to HTTP/2 */
+};
+
+/*
+ * A reused keep-alive connection on which more GET and HEAD requests are
+ * sent before the responses to the earlier ones have arrived. The server
+ * answers them in order, the first request is the one being read.
+ * The lock is held while a request is written to the connection and
+ * while the request being read releases it, so neither happens during
+ * the other.
  */
-static Dict *conn_pool;
+struct HTTPPipeline {
+    Connection *conn;
+    List *requests;
+    Mutex *lock;
+};
+
+#define POOL_HOST_BUCKETS 256
+
+static HTTPHost *pool_hosts[POOL_HOST_BUCKETS];
 static Mutex *conn_pool_lock;
 
+static Counter *pool_hits;      /* requests sent on a reused connection */
+static Counter *pool_misses;    /* connections opened */
+static Counter *pool_pipelined; /* requests pipelined on a busy connection */
+static Counter *pool_queued;    /* requests that had to wait for a connection */
+static Counter *pool_rejected;  /* requests failed because the queue was full */
 
-static void conn_pool_item_destroy(void *item)
-{
-    gwlist_destroy(item, (void(*)(void*))conn_destroy);
-}
 
 static void conn_pool_init(void)
 {
-    conn_pool = dict_create(1024, conn_pool_item_destroy);
+    memset(pool_hosts, 0, sizeof(pool_hosts));
     conn_pool_lock = mutex_create();
+    pool_hits = counter_create();
+    pool_misses = counter_create();
+    pool_pipelined = counter_create();
+    pool_queued = counter_create();
+    pool_rejected = counter_create();
+}
+
+
+static void pipeline_destroy(void *item)
+{
+    HTTPPipeline *p = item;
+
+    gwlist_destroy(p->requests, NULL);
+    mutex_destroy(p->lock);
+    gw_free(p);
+}
+
+
+static void pool_host_destroy(HTTPHost *h)
+{
+    gwlist_destroy(h->idle, (void(*)(void*))conn_destroy);
+    gwlist_destroy(h->pipelines, pipeline_destroy);
+    gwlist_destroy(h->queue, server_destroy);
+#ifdef HAVE_NGHTTP2
+    gwlist_destroy(h->sessions, (void(*)(void*))http2_session_destroy);
+#else
+    gwlist_destroy(h->sessions, NULL);
+#endif
+    octstr_destroy(h->host);
+    octstr_destroy(h->certkeyfile);
+    octstr_destroy(h->our_host);
+    gw_free(h);
+}
+
+
+/*
+ * Return 1 if nothing refers to the host any more: no connections, so
+ * no idle or pipelined ones either, no queued requests and no HTTP/2
+ * session that is still open.
+ */
+static int pool_host_unused(HTTPHost *h)
+{
+#ifdef HAVE_NGHTTP2
+    long i;
+#endif
+
+    if (h->connections > 0 || gwlist_len(h->idle) > 0 ||
+        gwlist_len(h->pipelines) > 0 || gwlist_len(h->queue) > 0)
+        return 0;
+#ifdef HAVE_NGHTTP2
+    for (i = 0; i < gwlist_len(h->sessions); i++) {
+        if (http2_session_status(gwlist_get(h->sessions, i)) != -1)
+            return 0;
+    }
+#endif
+    return 1;
 }
 
 
 static void conn_pool_shutdown(void)
 {
-    dict_destroy(conn_pool);
+    HTTPHost *h;
+    long i;
+
+    for (i = 0; i < POOL_HOST_BUCKETS; i++) {
+        while ((h = pool_hosts[i]) != NULL) {
+            pool_hosts[i] = h->next;
+            pool_host_destroy(h);
+        }
+    }
     mutex_destroy(conn_pool_lock);
+    counter_destroy(pool_hits);
+    counter_destroy(pool_misses);
+    counter_destroy(pool_pipelined);
+    counter_destroy(pool_queued);
+    counter_destroy(pool_rejected);
 }
 
 
-static inline Octstr *conn_pool_key(Octstr *host, int port, int ssl, Octstr *certfile, Octstr *our_host)
+static int pool_same(Octstr *a, Octstr *b)
 {
-    return octstr_format("%S:%d:%d:%S:%S", host, port, ssl?1:0, certfile?certfile:octstr_imm(""),
-                         our_host?our_host:octstr_imm(""));
+    if (a == NULL || b == NULL)
+        return a == b;
+    return octstr_compare(a, b) == 0;
 }
 
 
-static Connection *conn_pool_get(Octstr *host, int port, int ssl, Octstr *certkeyfile,
-		Octstr *our_host)
+/*
+ * Return the HTTPHost of a server, create it if it is not known (any
+ * more), freeing the unused hosts of the same bucket. Must be called
+ * with conn_pool_lock held, and only from write_request_thread, which
+ * is the only one using HTTP/2 sessions outside the lock.
+ */
+static HTTPHost *pool_host(Octstr *host, int port, int ssl, Octstr *certkeyfile,
+                           Octstr *our_host)
 {
-    Octstr *key;
-    List *list = NULL;
-    Connection *conn = NULL;
-    int retry;
+    HTTPHost *h, **prev;
+    unsigned long bucket;
+
+    ssl = ssl ? 1 : 0;
+    bucket = (octstr_hash_key(host) + port) % POOL_HOST_BUCKETS;
+    for (h = pool_hosts[bucket]; h != NULL; h = h->next) {
+        if (h->port == port && h->ssl == ssl && octstr_compare(h->host, host) == 0 &&
+            pool_same(h->certkeyfile, certkeyfile) && pool_same(h->our_host, our_host))
+            return h;
+    }
 
-    do {
-        retry = 0;
-        key = conn_pool_key(host, port, ssl, certkeyfile, our_host);
-        mutex_lock(conn_pool_lock);
-        list = dict_get(conn_pool, key);
-        if (list != NULL)
-            conn = gwlist_extract_first(list);
-        mutex_unlock(conn_pool_lock);
-        /*
-         * Note: we don't hold conn_pool_lock when we check/destroy/unregister
-         *       connection because otherwise we can deadlock! And it's even better
-         *       not to delay other threads while we check connection.
-         */
-        if (conn != NULL) {
-#ifdef USE_KEEPALIVE
-            /* unregister our server disconnect callback */
-            conn_unregister(conn);
-#endif 
-            /*
-             * Check whether the server has closed the connection while
-             * it has been in the pool.
-             */
-            conn_wait(conn, 0);
-            if (conn_eof(conn) || conn_error(conn)) {
-                debug("gwlib.http", 0, "HTTP:conn_pool_get: Server closed connection, destroying it <%s><%p><fd:%d>.",
-                      octstr_get_cstr(key), conn, conn_get_id(conn));
-                conn_destroy(conn);
-                retry = 1;
-                conn = NULL;
-            }
-        }
-        octstr_destroy(key);
-    } while(retry == 1);
-    
-    if (conn == NULL) {
-#ifdef HAVE_LIBSSL
-        if (ssl) 
-            conn = conn_open_ssl_nb(host, port, certkeyfile, our_host);
-        else
-#endif /* HAVE_LIBSSL */
-            conn = conn_open_tcp_nb(host, port, our_host);
-        debug("gwlib.http", 0, "HTTP: Opening connection to `%s:%d' (fd=%d).",
-              octstr_get_cstr(host), port, conn_get_id(conn));
-    } else {
-        debug("gwlib.http", 0, "HTTP: Reusing connection to `%s:%d' (fd=%d).",
-              octstr_get_cstr(host), port, conn_get_id(conn)); 
+    /* keep the chain as long as the number of hosts in use */
+    for (prev = &pool_hosts[bucket]; (h = *prev) != NULL; ) {
+        if (pool_host_unused(h)) {
+            debug("gwlib.http", 0, "HTTP: Forgetting unused host `%s:%d'.",
+                  octstr_get_cstr(h->host), h->port);
+            *prev = h->next;
+            pool_host_destroy(h);
+        } else
+            prev = &h->next;
     }
-    
-    return conn;
+
+    h = gw_malloc(sizeof(*h));
+    h->host = octstr_duplicate(host);
+    h->port = port;
+    h->ssl = ssl;
+    h->certkeyfile = octstr_duplicate(certkeyfile);
+    h->our_host = octstr_duplicate(our_host);
+    h->idle = gwlist_create();
+    h->pipelines = gwlist_create();
+    h->queue = gwlist_create();
+    h->connections = 0;
+    h->sessions = gwlist_create();
+    h->no_h2 = 0;
+    h->next = pool_hosts[bucket];
+    pool_hosts[bucket] = h;
+
+    return h;
 }
 
+
+/*
+ * A connection to the host has been closed. Its slot goes to the first
+ * queued request, if there is one. Must be called with conn_pool_lock held.
+ */
+static void pool_slot_free(HTTPHost *h)
+{
+    HTTPServer *trans;
+
+    if ((trans = gwlist_extract_first(h->queue)) != NULL) {
+        trans->slot = 1;
+        gwlist_insert(pending_requests, 0, trans);
+    } else
+        h->connections--;
+}
+
+
+/* Only requests without side effects may be pipelined, and sent again. */
+static int pipelinable(HTTPServer *trans)
+{
+    return trans->method != HTTP_METHOD_POST && !trans->retried;
+}
+
+
 #ifdef USE_KEEPALIVE
 static void check_pool_conn(Connection *conn, void *data)
 {
-    Octstr *key = data;
+    HTTPHost *h = data;
     
     if (run_status != running) {
         conn_unregister(conn);
@@ -850,49 +1004,269 @@ static void check_pool_conn(Connection *conn, void *data)
     }
     /* check if connection still ok */
     if (conn_error(conn) || conn_eof(conn)) {
-        List *list;
         mutex_lock(conn_pool_lock);
-        list = dict_get(conn_pool, key);
-        if (gwlist_delete_equal(list, conn) > 0) {
+        if (gwlist_delete_equal(h->idle, conn) > 0) {
             /*
              * ok, connection was still within pool. So it's
              * safe to destroy this connection.
              */
-            debug("gwlib.http", 0, "HTTP: Server closed connection, destroying it <%s><%p><fd:%d>.",
-                  octstr_get_cstr(key), conn, conn_get_id(conn));
+            debug("gwlib.http", 0, "HTTP: Server closed connection, destroying it <%s:%d><%p><fd:%d>.",
+                  octstr_get_cstr(h->host), h->port, conn, conn_get_id(conn));
             conn_unregister(conn);
             conn_destroy(conn);
+            pool_slot_free(h);
         }
         /*
          * it's perfectly valid if connection was not found in connection pool because
-         * in 'conn_pool_get' we first removed connection from pool with conn_pool_lock locked
+         * in 'pool_get' we first removed connection from pool with conn_pool_lock locked
          * and then check connection for errors with conn_pool_lock unlocked. In the meantime
          * fdset's poller may call us. So just ignore such "dummy" call.
         */
         mutex_unlock(conn_pool_lock);
     }
 }
+#endif
 
 
-static void conn_pool_put(Connection *conn, Octstr *host, int port, int ssl, Octstr *certfile, Octstr *our_host)
+/*
+ * Find a connection for the request: an idle one from the pool, a new
+ * one if the host has a free slot, a place in the pipeline of a busy one
+ * or, failing all that, a place in the queue of the host. Return 0 if
+ * trans->conn is ready for the request, 1 if the request was pipelined
+ * or queued and -1 on failure.
+ */
+static int pool_get(HTTPServer *trans, Octstr *host, int port, int ssl)
 {
-    Octstr *key;
-    List *list;
+    HTTPHost *h;
+    HTTPPipeline *p;
+    Connection *conn;
+    long i;
+
+    mutex_lock(conn_pool_lock);
+    h = trans->pool = pool_host(host, port, ssl, trans->certkeyfile, http_interface);
+
+    /* we got the slot of a closed connection */
+    if (trans->slot) {
+        trans->slot = 0;
+        mutex_unlock(conn_pool_lock);
+        goto open;
+    }
+
+    while ((conn = gwlist_extract_first(h->idle)) != NULL) {
+        mutex_unlock(conn_pool_lock);
+        /*
+         * Note: we don't hold conn_pool_lock when we check/destroy/unregister
+         *       connection because otherwise we can deadlock! And it's even better
+         *       not to delay other threads while we check connection.
+         */
+#ifdef USE_KEEPALIVE
+        /* unregister our server disconnect callback */
+        conn_unregister(conn);
+#endif 
+        /*
+         * Check whether the server has closed the connection while
+         * it has been in the pool.
+         */
+        conn_wait(conn, 0);
+        if (!conn_eof(conn) && !conn_error(conn)) {
+            debug("gwlib.http", 0, "HTTP: Reusing connection to `%s:%d' (fd=%d).",
+                  octstr_get_cstr(host), port, conn_get_id(conn)); 
+            counter_stat_increase(pool_hits);
+            trans->conn = conn;
+            trans->reused = 1;
+            return 0;
+        }
+        debug("gwlib.http", 0, "HTTP:pool_get: Server closed connection, destroying it <%s:%d><%p><fd:%d>.",
+              octstr_get_cstr(host), port, conn, conn_get_id(conn));
+        conn_destroy(conn);
+        mutex_lock(conn_pool_lock);
+        pool_slot_free(h);
+    }
+
+    if (http_client_max_host_connections <= 0 ||
+        h->connections < http_client_max_host_connections) {
+        h->connections++;
+        mutex_unlock(conn_pool_lock);
+        goto open;
+    }
+
+    /* all connections are busy, GET and HEAD may go into a pipeline */
+    if (http_client_pipeline_depth > 1 && pipelinable(trans)) {
+        for (i = 0; i < gwlist_len(h->pipelines); i++) {
+            p = gwlist_get(h->pipelines, i);
+            /* if the lock is busy, the connection is being released */
+            if (gwlist_len(p->requests) >= http_client_pipeline_depth ||
+                mutex_trylock(p->lock) != 0)
+                continue;
+            gwlist_append(p->requests, trans);
+            trans->conn = p->conn;
+            trans->pipeline = p;
+            mutex_unlock(conn_pool_lock);
+
+            /* p->lock keeps the connection open and ours while writing */
+            if (send_request(trans) == 0) {
+                debug("gwlib.http", 0, "HTTP: Pipelining request to `%s:%d' (fd=%d).",
+                      octstr_get_cstr(host), port, conn_get_id(p->conn));
+                trans->state = reading_status;
+                /* the response may be read and trans gone as soon as we unlock */
+                mutex_unlock(p->lock);
+                counter_stat_increase(pool_pipelined);
+                return 1;
+            }
+
+            /*
+             * The connection is broken, take it out of the pipelines. It
+             * is closed by the request being read on it, which still owns
+             * it, so trans only has to find another way.
+             */
+            mutex_lock(conn_pool_lock);
+            gwlist_delete_equal(p->requests, trans);
+            gwlist_delete_equal(h->pipelines, p);
+            mutex_unlock(p->lock);
+            trans->conn = NULL;
+            trans->pipeline = NULL;
+            break;
+        }
+    }
+
+    if (http_client_max_host_queue > 0 &&
+        gwlist_len(h->queue) >= http_client_max_host_queue) {
+        mutex_unlock(conn_pool_lock);
+        counter_stat_increase(pool_rejected);
+        error(0, "HTTP: Too many requests queued for `%s:%d'.",
+              octstr_get_cstr(host), port);
+        return -1;
+    }
+    debug("gwlib.http", 0, "HTTP: All %ld connections to `%s:%d' busy, request queued.",
+          h->connections, octstr_get_cstr(host), port);
+    gwlist_append(h->queue, trans);
+    mutex_unlock(conn_pool_lock);
+    counter_stat_increase(pool_queued);
+    return 1;
+
+open:
+#ifdef HAVE_LIBSSL
+    if (ssl) 
+        conn = conn_open_ssl_nb(host, port, trans->certkeyfile, http_interface);
+    else
+#endif /* HAVE_LIBSSL */
+        conn = conn_open_tcp_nb(host, port, http_interface);
+    if (conn == NULL) {
+        mutex_lock(conn_pool_lock);
+        pool_slot_free(h);
+        mutex_unlock(conn_pool_lock);
+        return -1;
+    }
+    debug("gwlib.http", 0, "HTTP: Opening connection to `%s:%d' (fd=%d).",
+          octstr_get_cstr(host), port, conn_get_id(conn));
+    counter_stat_increase(pool_misses);
+    trans->conn = conn;
+    return 0;
+}
+
+
+/*
+ * The request is about to be sent on a reused connection. Let further
+ * requests to the host be pipelined behind it.
+ */
+static void pipeline_start(HTTPServer *trans)
+{
+    HTTPPipeline *p;
+
+    if (http_client_pipeline_depth <= 1 || !pipelinable(trans))
+        return;
+
+    p = gw_malloc(sizeof(*p));
+    p->conn = trans->conn;
+    p->lock = mutex_create();
+    p->requests = gwlist_create();
+    gwlist_append(p->requests, trans);
+    trans->pipeline = p;
 
-    key = conn_pool_key(host, port, ssl, certfile, our_host);
     mutex_lock(conn_pool_lock);
-    list = dict_get(conn_pool, key);
-    if (list == NULL) {
-    	list = gwlist_create();
-        dict_put(conn_pool, key, list);
-    }
-    gwlist_append(list, conn);
-    /* register connection to get server disconnect */
-    conn_register_real(conn, client_fdset, check_pool_conn, key, octstr_destroy_item);
+    gwlist_append(trans->pool->pipelines, p);
     mutex_unlock(conn_pool_lock);
 }
+
+
+/*
+ * The request is done with its connection. If keep is set, the connection
+ * goes on to the next pipelined request, which is returned, or to the
+ * first queued request or back into the pool. Otherwise it is closed and
+ * the requests pipelined behind this one are sent again.
+ */
+static HTTPServer *pool_release(HTTPServer *trans, int keep)
+{
+    HTTPHost *h = trans->pool;
+    HTTPPipeline *p = trans->pipeline;
+    Connection *conn = trans->conn;
+    HTTPServer *next;
+
+    trans->conn = NULL;
+    trans->pipeline = NULL;
+    trans->reused = 0;
+    if (conn == NULL)
+        return NULL;
+#ifndef USE_KEEPALIVE
+    keep = 0;
 #endif
 
+    if (p != NULL) {
+        /* wait for a request being written to the connection */
+        mutex_lock(p->lock);
+        mutex_lock(conn_pool_lock);
+        gwlist_delete_equal(p->requests, trans);
+        if (keep && gwlist_len(p->requests) > 0) {
+            next = gwlist_get(p->requests, 0);
+            conn_register(conn, client_fdset, handle_transaction, next);
+            mutex_unlock(conn_pool_lock);
+            mutex_unlock(p->lock);
+            return next;
+        }
+        gwlist_delete_equal(h->pipelines, p);
+        while ((next = gwlist_extract_first(p->requests)) != NULL) {
+            debug("gwlib.http", 0, "HTTP: Sending pipelined request <%s> again.",
+                  octstr_get_cstr(next->url));
+            /* not retried, it did not fail itself */
+            next->conn = NULL;
+            next->pipeline = NULL;
+            next->reused = 0;
+            next->state = resolving;
+            gwlist_insert(pending_requests, 0, next);
+        }
+        mutex_unlock(conn_pool_lock);
+        /* nobody can find p any more */
+        mutex_unlock(p->lock);
+        pipeline_destroy(p);
+    }
+
+    conn_unregister(conn);
+
+    mutex_lock(conn_pool_lock);
+    if (!keep) {
+        conn_destroy(conn);
+        /* unless the request keeps the slot to be sent again */
+        if (!trans->slot)
+            pool_slot_free(h);
+    }
+#ifdef USE_KEEPALIVE
+    else if ((next = gwlist_extract_first(h->queue)) != NULL) {
+        /* hand the connection over to a waiting request */
+        next->conn = conn;
+        next->reused = 1;
+        counter_stat_increase(pool_hits);
+        gwlist_insert(pending_requests, 0, next);
+    } else {
+        gwlist_append(h->idle, conn);
+        /* register connection to get server disconnect */
+        conn_register(conn, client_fdset, check_pool_conn, h);
+    }
+#endif
+    mutex_unlock(conn_pool_lock);
+
+    return NULL;
+}
+
 
 HTTPCaller *http_caller_create(void)
 {
@@ -1035,19 +1409,91 @@ static int response_expectation(int method, int status)
         return expect_body;
 }
 
-static void handle_transaction(Connection *conn, void *data)
+/*
+ * The response has been read. Follow a redirection or hand the response
+ * to the caller.
+ */
+static void finish_transaction(HTTPServer *trans)
 {
-    HTTPServer *trans;
-    int ret;
     Octstr *h;
-    int rc;
-    
-    trans = data;
 
-    if (run_status != running) {
-        conn_unregister(conn);
-        return;
+    /* 
+     * Check if the HTTP server told us to look somewhere else,
+     * hence if we got one of the following response codes:
+     *   HTTP_MOVED_PERMANENTLY (301)
+     *   HTTP_FOUND (302)
+     *   HTTP_SEE_OTHER (303)
+     *   HTTP_TEMPORARY_REDIRECT (307)
+     */
+    if ((h = get_redirection_location(trans)) != NULL) {
+
+        /* 
+         * This is a redirected response, we have to follow.
+         * 
+         * According to HTTP/1.1 (RFC 2616), section 14.30 any Location
+         * header value should be 'absoluteURI', which is defined in
+         * RFC 2616, section 3.2.1 General Syntax, and specifically in
+         * RFC 2396, section 3 URI Syntactic Components as
+         * 
+         *   absoluteURI   = scheme ":" ( hier_part | opaque_part )
+         * 
+         * Some HTTP servers 'interpret' a leading UDI / as that kind
+         * of absoluteURI, which is not correct, following the protocol in
+         * detail. But we'll try to recover from that misleaded 
+         * interpreation and try to convert the partly absoluteURI to a
+         * fully qualified absoluteURI.
+         * 
+         *   http_URL = "http:" "//" [ userid : password "@"] host 
+         *      [ ":" port ] [ abs_path [ "?" query ]] 
+         * 
+         */
+        octstr_strip_blanks(h);
+        recover_absolute_uri(trans, h);
+        
+        /*
+         * Clean up all trans stuff for the next request we do.
+         */
+        octstr_destroy(trans->url);
+        octstr_destroy(trans->host);
+        trans->port = 0;
+        octstr_destroy(trans->uri);
+        octstr_destroy(trans->username);
+        octstr_destroy(trans->password);
+        trans->host = NULL;
+        trans->port = 0;
+        trans->uri = NULL;
+        trans->username = NULL;
+        trans->password = NULL;
+        trans->ssl = 0;
+        trans->url = h; /* apply new absolute URL to next request */
+        trans->state = request_not_sent;
+        trans->status = -1;
+        entity_destroy(trans->response);
+        trans->response = NULL;
+        --trans->follow_remaining;
+        trans->pool = NULL;
+
+        /* re-inject request to the front of the queue */
+        gwlist_insert(pending_requests, 0, trans);
+
+    } else {
+        /* handle this response as usual */
+        gwlist_produce(trans->caller, trans);
     }
+}
+
+
+/*
+ * Go on with the transaction as far as the data that has arrived allows.
+ * Return the next pipelined transaction on the connection if this one is
+ * done, it may find its response already read, else NULL.
+ */
+static HTTPServer *read_response(Connection *conn, HTTPServer *trans)
+{
+    int ret;
+    Octstr *h;
+    int rc, retry;
+    HTTPServer *next;
 
     while (trans->state != transaction_done) {
         switch (trans->state) {
@@ -1081,7 +1527,7 @@ static void handle_transaction(Connection *conn, void *data)
                 trans->state = reading_entity;
                 trans->response = entity_create(response_expectation(trans->method, trans->status));
             } else {
-                return;
+                return NULL;
             }
             break;
 
@@ -1106,7 +1552,7 @@ static void handle_transaction(Connection *conn, void *data)
                 octstr_destroy(h);
 #endif
             } else {
-                return;
+                return NULL;
             }
             break;
 
@@ -1115,8 +1561,6 @@ static void handle_transaction(Connection *conn, void *data)
         }
     }
 
-    conn_unregister(trans->conn);
-
     /* 
      * Take care of persistent connection handling. 
      * At this point we have only obeyed if server responds in HTTP/1.0 or 1.1
@@ -1139,91 +1583,49 @@ static void handle_transaction(Connection *conn, void *data)
         octstr_destroy(h);
     }
 
-#ifdef USE_KEEPALIVE 
-    if (trans->persistent) {
-        if (proxy_used_for_host(trans->host, trans->url))
-            conn_pool_put(trans->conn, proxy_hostname, proxy_port, trans->ssl, trans->certkeyfile, http_interface);
-        else 
-            conn_pool_put(trans->conn, trans->host, trans->port, trans->ssl, trans->certkeyfile, http_interface);
-    } else
-#endif
-        conn_destroy(trans->conn);
+    /* keep the connection in the pool, or pass it on, or close it */
+    next = pool_release(trans, trans->persistent);
 
-    trans->conn = NULL;
+    finish_transaction(trans);
+    return next;
 
-    /* 
-     * Check if the HTTP server told us to look somewhere else,
-     * hence if we got one of the following response codes:
-     *   HTTP_MOVED_PERMANENTLY (301)
-     *   HTTP_FOUND (302)
-     *   HTTP_SEE_OTHER (303)
-     *   HTTP_TEMPORARY_REDIRECT (307)
+error:
+    /*
+     * The server may have closed a reused connection just before our
+     * request got there. Send requests without side effects once more.
      */
-    if ((h = get_redirection_location(trans)) != NULL) {
-
-        /* 
-         * This is a redirected response, we have to follow.
-         * 
-         * According to HTTP/1.1 (RFC 2616), section 14.30 any Location
-         * header value should be 'absoluteURI', which is defined in
-         * RFC 2616, section 3.2.1 General Syntax, and specifically in
-         * RFC 2396, section 3 URI Syntactic Components as
-         * 
-         *   absoluteURI   = scheme ":" ( hier_part | opaque_part )
-         * 
-         * Some HTTP servers 'interpret' a leading UDI / as that kind
-         * of absoluteURI, which is not correct, following the protocol in
-         * detail. But we'll try to recover from that misleaded 
-         * interpreation and try to convert the partly absoluteURI to a
-         * fully qualified absoluteURI.
-         * 
-         *   http_URL = "http:" "//" [ userid : password "@"] host 
-         *      [ ":" port ] [ abs_path [ "?" query ]] 
-         * 
-         */
-        octstr_strip_blanks(h);
-        recover_absolute_uri(trans, h);
-        
-        /*
-         * Clean up all trans stuff for the next request we do.
-         */
-        octstr_destroy(trans->url);
-        octstr_destroy(trans->host);
-        trans->port = 0;
-        octstr_destroy(trans->uri);
-        octstr_destroy(trans->username);
-        octstr_destroy(trans->password);
-        trans->host = NULL;
-        trans->port = 0;
-        trans->uri = NULL;
-        trans->username = NULL;
-        trans->password = NULL;
-        trans->ssl = 0;
-        trans->url = h; /* apply new absolute URL to next request */
-        trans->state = request_not_sent;
-        trans->status = -1;
-        entity_destroy(trans->response);
-        trans->response = NULL;
-        --trans->follow_remaining;
-        conn_destroy(trans->conn);
-        trans->conn = NULL;
-
-        /* re-inject request to the front of the queue */
+    retry = (trans->reused || trans->pipeline != NULL) &&
+            trans->state == reading_status && pipelinable(trans);
+    /* on a new connection, in the slot of this one */
+    trans->slot = retry;
+    pool_release(trans, 0);
+    if (retry) {
+        debug("gwlib.http", 0, "HTTP: Sending request <%s> again.",
+              octstr_get_cstr(trans->url));
+        trans->retried = 1;
+        trans->state = resolving;
         gwlist_insert(pending_requests, 0, trans);
-
-    } else {
-        /* handle this response as usual */
-        gwlist_produce(trans->caller, trans);
+        return NULL;
     }
-    return;
-
-error:
-    conn_unregister(trans->conn);
-    conn_destroy(trans->conn);
-    trans->conn = NULL;
     error(0, "Couldn't fetch <%s>", octstr_get_cstr(trans->url));
     trans->status = -1;
     gwlist_produce(trans->caller, trans);
+    return NULL;
+}
+
+
+static void handle_transaction(Connection *conn, void *data)
+{
+    HTTPServer *trans;
+
+    if (run_status != running) {
+        conn_unregister(conn);
+        return;
+    }
+
+    /* responses to pipelined requests may all have arrived at once */
+    for (trans = data; trans != NULL; trans = read_response(conn, trans))
+        ;
 }
 
 
@@ -1549,12 +1951,180 @@ static void parse2trans(HTTPURLParse *p, HTTPServer *t)
               && !t->ssl) ? 1 : 0;
 }
 
-static Connection *get_connection(HTTPServer *trans) 
+#ifdef HAVE_NGHTTP2
+
+/* how often a request refused by HTTP/2 servers is sent again */
+#define HTTP2_MAX_REFUSED 10
+
+/*
+ * Result of a request sent over HTTP/2, see http2_response_cb_t. Runs
+ * with the session locked, so it must not touch conn_pool_lock or the
+ * host; a refused upgrade is left in trans for pool_h2() to apply.
+ */
+static void h2_response(void *data, long status, List *headers, Octstr *body)
+{
+    HTTPServer *trans = data;
+    int retry;
+
+    switch (status) {
+    case HTTP2_NOT_NEGOTIATED:
+        /* talk HTTP/1.1 to the host from now on */
+        trans->no_h2 = 1;
+        retry = 1;
+        break;
+    case HTTP2_NOT_SENT:
+        retry = 1;
+        break;
+    case HTTP2_REFUSED:
+        /* not processed, e.g. the server is going away */
+        retry = (++trans->retried <= HTTP2_MAX_REFUSED);
+        break;
+    case HTTP2_FAILED:
+        /* processed or not, send requests without side effects again */
+        retry = pipelinable(trans);
+        trans->retried = 1;
+        break;
+    default:
+        retry = 0;
+    }
+
+    if (retry) {
+        debug("gwlib.http", 0, "HTTP: Sending request <%s> again.",
+              octstr_get_cstr(trans->url));
+        trans->state = resolving;
+        gwlist_insert(pending_requests, 0, trans);
+        return;
+    }
+    if (status < 0) {
+        error(0, "Couldn't fetch <%s>", octstr_get_cstr(trans->url));
+        trans->status = -1;
+        gwlist_produce(trans->caller, trans);
+        return;
+    }
+
+    trans->status = status;
+    trans->response = entity_create(expect_no_body);
+    http_destroy_headers(trans->response->headers);
+    trans->response->headers = headers;
+    octstr_destroy(trans->response->body);
+    trans->response->body = body;
+    trans->state = transaction_done;
+    finish_transaction(trans);
+}
+
+
+/*
+ * Send the request over an HTTP/2 connection to the server, open one if
+ * none takes more requests. Return 1 if the request was taken care of,
+ * 0 if the server does not speak HTTP/2 and -1 on failure.
+ *
+ * The session is picked under conn_pool_lock, connecting and writing
+ * happen after unlocking. Sessions are only destroyed here and at
+ * shutdown, and only write_request_thread gets here, so the session
+ * stays valid.
+ */
+static int pool_h2(HTTPServer *trans, Octstr *host, int port, int ssl)
+{
+    HTTPHost *h;
+    HTTP2Session *s, *t;
+    Connection *conn;
+    Octstr *authority, *body;
+    List *closed;
+    char buf[128];
+    long i;
+    int ret;
+
+    mutex_lock(conn_pool_lock);
+    h = trans->pool = pool_host(host, port, ssl, trans->certkeyfile, http_interface);
+    if (trans->no_h2) {
+        /* refused on the last try, set here under conn_pool_lock */
+        h->no_h2 = 1;
+        trans->no_h2 = 0;
+    }
+    if (h->no_h2) {
+        mutex_unlock(conn_pool_lock);
+        return 0;
+    }
+
+    /* forget closed connections, those going away finish what they have */
+    s = NULL;
+    closed = gwlist_create();
+    for (i = 0; i < gwlist_len(h->sessions); ) {
+        t = gwlist_get(h->sessions, i);
+        ret = http2_session_status(t);
+        if (ret == -1) {
+            gwlist_delete(h->sessions, i, 1);
+            gwlist_append(closed, t);
+            continue;
+        }
+        if (ret == 1 && s == NULL)
+            s = t;
+        i++;
+    }
+    mutex_unlock(conn_pool_lock);
+    gwlist_destroy(closed, (void(*)(void*))http2_session_destroy);
+
+    if (s == NULL) {
+#ifdef HAVE_LIBSSL
+        if (ssl)
+            conn = conn_open_ssl_nb(host, port, trans->certkeyfile, http_interface);
+        else
+#endif /* HAVE_LIBSSL */
+            conn = conn_open_tcp_nb(host, port, http_interface);
+        if (conn == NULL)
+            return -1;
+        debug("gwlib.http", 0, "HTTP: Opening HTTP/2 connection to `%s:%d' (fd=%d).",
+              octstr_get_cstr(host), port, conn_get_id(conn));
+        counter_stat_increase(pool_misses);
+        s = http2_session_create(conn, client_fdset, h2_response);
+        mutex_lock(conn_pool_lock);
+        gwlist_append(h->sessions, s);
+        mutex_unlock(conn_pool_lock);
+    } else
+        counter_stat_increase(pool_hits);
+
+    authority = octstr_duplicate(trans->host);
+    if ((trans->port != HTTP_PORT && !trans->ssl) ||
+        (trans->port != HTTPS_PORT && trans->ssl))
+        octstr_format_append(authority, ":%ld", trans->port);
+
+    if (trans->username != NULL) {
+        http_header_remove_all(trans->request_headers, "Authorization");
+        http_add_basic_auth(trans->request_headers, trans->username,
+                            trans->password);
+    }
+    body = NULL;
+    if (trans->method == HTTP_METHOD_POST) {
+        http_header_remove_all(trans->request_headers, "Content-Length");
+        snprintf(buf, sizeof(buf), "%ld", octstr_len(trans->request_body));
+        http_header_add(trans->request_headers, "Content-Length", buf);
+        body = trans->request_body != NULL ? trans->request_body : octstr_imm("");
+    }
+
+    trans->state = reading_status;
+    /* the response may be handled and trans gone as soon as it is sent */
+    if (http2_session_submit(s, http_method2name(trans->method),
+                             octstr_imm(ssl ? "https" : "http"), authority,
+                             trans->uri, trans->request_headers, body, trans) == -1) {
+        /* the connection has just been closed, try another one */
+        h2_response(trans, HTTP2_REFUSED, NULL, NULL);
+    }
+    octstr_destroy(authority);
+
+    return 1;
+}
+
+#endif /* HAVE_NGHTTP2 */
+
+
+/*
+ * Get a connection for the request, see pool_get() for the return value.
+ */
+static int get_connection(HTTPServer *trans) 
 {
-    Connection *conn = NULL;
     Octstr *host;
     HTTPURLParse *p;
-    int port, ssl;
+    int port, ssl, ret, proxy;
     
     /* if the parsing has not yet been done, then do it now */
     if (!trans->host && trans->port == 0 && trans->url != NULL) {
@@ -1566,7 +2136,8 @@ static Connection *get_connection(HTTPServer *trans)
         }
     }
 
-    if (proxy_used_for_host(trans->host, trans->url)) {
+    proxy = proxy_used_for_host(trans->host, trans->url);
+    if (proxy) {
         host = proxy_hostname;
         port = proxy_port;
         ssl = proxy_ssl;
@@ -1576,17 +2147,24 @@ static Connection *get_connection(HTTPServer *trans)
         ssl = trans->ssl;
     }
 
-    conn = conn_pool_get(host, port, ssl, trans->certkeyfile,
-                         http_interface);
-    if (conn == NULL)
+#ifdef HAVE_NGHTTP2
+    /* HTTP/2 only to the server itself, not through a proxy */
+    if (!proxy && (ssl ? http_client_h2 : http_client_h2c)) {
+        if ((ret = pool_h2(trans, host, port, ssl)) == -1)
+            goto error;
+        if (ret == 1)
+            return 1;
+    }
+#endif
+
+    if ((ret = pool_get(trans, host, port, ssl)) == -1)
         goto error;
 
-    return conn;
+    return ret;
 
 error:
-    conn_destroy(conn);
     error(0, "Couldn't send request to <%s>", octstr_get_cstr(trans->url));
-    return NULL;
+    return -1;
 }
 
 
@@ -1623,9 +2201,12 @@ static int send_request(HTTPServer *trans)
      * by parse_url() before calling this.
      */
 
-    if (trans->username != NULL)
+    if (trans->username != NULL) {
+        /* the request may be sent again */
+        http_header_remove_all(trans->request_headers, "Authorization");
         http_add_basic_auth(trans->request_headers, trans->username,
                             trans->password);
+    }
 
     if (proxy_used_for_host(trans->host, trans->url)) {
         proxy_add_authentication(trans->request_headers);
@@ -1650,18 +2231,56 @@ static int send_request(HTTPServer *trans)
     return 0;
 
 error:
-    conn_destroy(trans->conn);
-    trans->conn = NULL;
     octstr_destroy(request);
     error(0, "Couldn't send request to <%s>", octstr_get_cstr(trans->url));
     return -1;
 }
 
 
+/*
+ * Called by a resolver thread once the host name of a request is known,
+ * whether it was found or not. Put the request back to the queue, the
+ * connection is then opened (or fails) with the cached answer.
+ */
+static void server_resolved(void *data, int found)
+{
+    gwlist_produce(pending_requests, data);
+}
+
+
+/*
+ * Look up the host name of the server, or of the proxy, in the background
+ * unless the resolver has it cached already. Return 1 if the request
+ * comes back through server_resolved(), 0 if it can be sent right away.
+ */
+static int resolve_server(HTTPServer *trans)
+{
+    HTTPURLParse *p;
+    Octstr *host;
+
+    if (!trans->host && trans->port == 0 && trans->url != NULL) {
+        /* get_connection() reports parse errors */
+        if ((p = parse_url(trans->url)) == NULL)
+            return 0;
+        parse2trans(p, trans);
+        http_urlparse_destroy(p);
+    }
+
+    if (proxy_used_for_host(trans->host, trans->url))
+        host = proxy_hostname;
+    else
+        host = trans->host;
+
+    return gw_resolve_async(host, server_resolved, trans);
+}
+
+
 /*
  * This thread starts the transaction: it connects to the server and sends
  * the request. It then sends the transaction to the read_response_thread
- * via started_requests_queue.
+ * via started_requests_queue. Requests whose host name is not yet known
+ * are parked in the resolving state and come back once it is, so a slow
+ * name server does not hold up requests to other hosts.
  */
 static void write_request_thread(void *arg)
 {
@@ -1673,26 +2292,45 @@ static void write_request_thread(void *arg)
         if (trans == NULL)
             break;
 
-        gw_assert(trans->state == request_not_sent);
+        gw_assert(trans->state == request_not_sent || trans->state == resolving);
 
         debug("gwlib.http", 0, "Queue contains %ld pending requests.", gwlist_len(pending_requests));
 
+        if (trans->state == request_not_sent) {
+            trans->state = resolving;
+            if (resolve_server(trans) == 1) {
+                debug("gwlib.http", 0, "HTTP: Resolving `%s'.",
+                      octstr_get_cstr(trans->host));
+                continue;
+            }
+        }
+
         /* 
-         * get the connection to use
+         * get the connection to use, unless we were handed one
          * also calls parse_url() to populate the trans values
          */
-        trans->conn = get_connection(trans);
+        if (trans->conn == NULL) {
+            rc = get_connection(trans);
+            if (rc == -1) {
+                gwlist_produce(trans->caller, trans);
+                continue;
+            } else if (rc == 1) {
+                /* pipelined or queued, the connection takes it from here */
+                continue;
+            }
+        }
 
-        if (trans->conn == NULL)
-            gwlist_produce(trans->caller, trans);
-        else if (conn_is_connected(trans->conn) == 0) {
+        if (conn_is_connected(trans->conn) == 0) {
             debug("gwlib.http", 0, "Socket connected at once");
 
+            if (trans->reused)
+                pipeline_start(trans);
             if ((rc = send_request(trans)) == 0) {
                 trans->state = reading_status;
                 conn_register(trans->conn, client_fdset, handle_transaction, 
                                 trans);
             } else {
+                pool_release(trans, 0);
                 gwlist_produce(trans->caller, trans);
             }
 
@@ -1733,6 +2371,45 @@ void http_set_interface(const Octstr *our_host)
     http_interface = octstr_duplicate(our_host);
 }
 
+void http_set_client_host_limits(long max_connections, long max_queued)
+{
+    if (max_connections >= 0)
+        http_client_max_host_connections = max_connections;
+    if (max_queued >= 0)
+        http_client_max_host_queue = max_queued;
+}
+
+void http_set_client_pipeline_depth(long depth)
+{
+    http_client_pipeline_depth = (depth > 1 ? depth : 1);
+}
+
+void http_set_client_h2(int tls, int cleartext)
+{
+#ifdef HAVE_NGHTTP2
+    http_client_h2 = tls;
+    http_client_h2c = cleartext;
+#else
+    if (tls || cleartext)
+        warning(0, "HTTP: Kannel was compiled without nghttp2, HTTP/2 is not available.");
+#endif
+}
+
+int http_client_pool_stats(unsigned long *hits, unsigned long *misses,
+                           unsigned long *pipelined, unsigned long *queued,
+                           unsigned long *rejected)
+{
+    if (!client_threads_are_running)
+        return -1;
+
+    *hits = counter_value(pool_hits);
+    *misses = counter_value(pool_misses);
+    *pipelined = counter_value(pool_pipelined);
+    *queued = counter_value(pool_queued);
+    *rejected = counter_value(pool_rejected);
+    return 0;
+}
+
 void http_set_client_timeout(long timeout)
 {
     http_client_timeout = timeout;
@@ -1835,7 +2512,10 @@ static void client_shutdown(void)
     gwlist_remove_producer(pending_requests);
     gwthread_join_every(write_request_thread);
     client_threads_are_running = 0;
+    /* requests still being resolved would come back to pending_requests */
+    gw_resolve_cancel(server_resolved, server_destroy);
     gwlist_destroy(pending_requests, server_destroy);
+    pending_requests = NULL;
     mutex_destroy(client_thread_lock);
     fdset_destroy(client_fdset);
     client_fdset = NULL;
@@ -1868,6 +2548,7 @@ struct HTTPClient {
     int persistent_conn;
     unsigned long conn_time; /* store time for timeouting */
     HTTPEntity *request;
+    HTTPClient *prev, *next; /* in active_clients */
 };
 
 
@@ -1880,8 +2561,14 @@ static long server_thread_id = -1;
 static List *new_server_sockets = NULL;
 static List *closed_server_sockets = NULL;
 static int keep_servers_open = 0;
-/* List with all active HTTPClient's */
-static List *active_connections;
+/*
+ * All active HTTPClient's, in a doubly linked list so that a client can
+ * be dropped in constant time. Protected by active_lock.
+ */
+static Mutex *active_lock = NULL;
+static HTTPClient *active_clients = NULL;
+static volatile long active_count = 0;
+static long max_active_connections = HTTP_SERVER_MAX_ACTIVE_CONNECTIONS;
 
 
 static HTTPClient *client_create(int port, Connection *conn, Octstr *ip)
@@ -1907,8 +2594,15 @@ static HTTPClient *client_create(int port, Connection *conn, Octstr *ip)
     p->request = NULL;
     debug("gwlib.http", 0, "HTTP: Created HTTPClient area %p.", p);
     
-    /* add this client to active_connections */
-    gwlist_produce(active_connections, p);
+    /* add this client to active_clients */
+    mutex_lock(active_lock);
+    p->prev = NULL;
+    p->next = active_clients;
+    if (active_clients != NULL)
+        active_clients->prev = p;
+    active_clients = p;
+    active_count++;
+    mutex_unlock(active_lock);
     
     return p;
 }
@@ -1924,16 +2618,23 @@ static void client_destroy(void *client)
 
     p = client;
     
-    /* drop this client from active_connections list */
-    gwlist_lock(active_connections);
-    if (gwlist_delete_equal(active_connections, p) != 1)
+    /* drop this client from active_clients */
+    mutex_lock(active_lock);
+    if (p->prev == NULL ? active_clients != p : p->prev->next != p)
         panic(0, "HTTP: Race condition in client_destroy(%p) detected!", client);
+    if (p->prev != NULL)
+        p->prev->next = p->next;
+    else
+        active_clients = p->next;
+    if (p->next != NULL)
+        p->next->prev = p->prev;
+    p->prev = p->next = NULL;
 
     /* signal server thread that client slot is free */
-    a_len = gwlist_len(active_connections);
-    gwlist_unlock(active_connections);
+    a_len = active_count--;
+    mutex_unlock(active_lock);
 
-    if (a_len >= HTTP_SERVER_MAX_ACTIVE_CONNECTIONS - 1)
+    if (a_len >= max_active_connections)
         gwthread_wakeup(server_thread_id);
     
     debug("gwlib.http", 0, "HTTP: Destroying HTTPClient area %p.", p);
@@ -2009,9 +2710,27 @@ static Mutex *port_mutex = NULL;
 static Dict *port_collection = NULL;
 
 
-static int port_match(void *client, void *port)
+/*
+ * Return an active client of the given port, NULL if there is none.
+ * If unregister is set, unregister all of them from their fdset.
+ */
+static HTTPClient *port_client(int port, int unregister)
 {
-    return ((HTTPClient*)client)->port == *((int*)port);
+    HTTPClient *p, *found = NULL;
+
+    mutex_lock(active_lock);
+    for (p = active_clients; p != NULL; p = p->next) {
+        if (p->port != port)
+            continue;
+        if (found == NULL)
+            found = p;
+        if (!unregister)
+            break;
+        conn_unregister(p->conn);
+    }
+    mutex_unlock(active_lock);
+
+    return found;
 }
 
 
@@ -2019,16 +2738,17 @@ static void port_init(void)
 {
     port_mutex = mutex_create();
     port_collection = dict_create(1024, NULL);
-    /* create list with all active_connections */
-    active_connections = gwlist_create();
+    active_lock = mutex_create();
 }
 
 static void port_shutdown(void)
 {
     mutex_destroy(port_mutex);
     dict_destroy(port_collection);
-    /* destroy active_connections list */
-    gwlist_destroy(active_connections, client_destroy);
+    /* destroy all remaining clients */
+    while (active_clients != NULL)
+        client_destroy(active_clients);
+    mutex_destroy(active_lock);
 }
 
 
@@ -2050,7 +2770,7 @@ static struct port *port_add(int port)
         p->clients_with_requests = gwlist_create();
         gwlist_add_producer(p->clients_with_requests);
         p->active_consumers = counter_create();
-        p->server_fdset = fdset_create_real(HTTP_SERVER_TIMEOUT);
+        p->server_fdset = fdset_create_pollers(HTTP_SERVER_TIMEOUT, http_server_pollers);
         dict_put(port_collection, key, p);
     } else {
         warning(0, "HTTP: port_add called for existing port (%d)", port);
@@ -2066,7 +2786,6 @@ static void port_remove(int port)
 {
     Octstr *key;
     struct port *p;
-    List *l;
     HTTPClient *client;
 
     key = port_key(port);
@@ -2090,19 +2809,16 @@ static void port_remove(int port)
     /*
      * In order to avoid race conditions with FDSet thread, we
      * destroy Clients for this port in two steps:
-     * 1) unregister from fdset with gwlist_lock held, so client_destroy
+     * 1) unregister from fdset with active_lock held, so client_destroy
      *    cannot destroy our client that we currently use
-     * 2) without gwlist_lock held destroy every client, we can do this
+     * 2) without active_lock held destroy every client, we can do this
      *    because we only one thread that can use this client struct
      */
-    gwlist_lock(active_connections);
-    l = gwlist_search_all(active_connections, &port, port_match);
-    while(l != NULL && (client = gwlist_extract_first(l)) != NULL)
-        conn_unregister(client->conn);
-    gwlist_unlock(active_connections);
-    gwlist_destroy(l, NULL);
-    while((client = gwlist_search(active_connections, &port, port_match)) != NULL)
+    client = port_client(port, 1);
+    while (client != NULL) {
         client_destroy(client);
+        client = port_client(port, 0);
+    }
 
     /* now destroy fdset */
     fdset_destroy(p->server_fdset);
@@ -2257,6 +2973,8 @@ static void receive_request(Connection *conn, void *data)
                 if (line == NULL) {
                     if (conn_eof(conn) || conn_error(conn))
                         goto error;
+                    /* we may have been called directly, wait for more */
+                    conn_register(conn, port_get_fdset(client->port), receive_request, client);
                     return;
                 }
                 ret = parse_request_line(&client->method, &client->url,
@@ -2290,7 +3008,8 @@ static void receive_request(Connection *conn, void *data)
                     client->state = request_is_being_handled;
                     conn_unregister(conn);
                     port_put_request(client);
-                }
+                } else
+                    conn_register(conn, port_get_fdset(client->port), receive_request, client);
                 return;
                 
             case sending_reply:
@@ -2367,7 +3086,7 @@ static void server_thread(void *dummy)
             n++;
         }
 
-        if (max_clients_reached && gwlist_len(active_connections) >= HTTP_SERVER_MAX_ACTIVE_CONNECTIONS) {
+        if (max_clients_reached && active_count >= max_active_connections) {
             /* TODO start cleanup of stale connections */
             /* wait for slots to become free */
             gwthread_sleep(1.0);
@@ -2380,7 +3099,7 @@ static void server_thread(void *dummy)
         for (i = 0; i < n; ++i) {
             if (tab[i].revents & POLLIN) {
                 /* check our limit */
-                if (gwlist_len(active_connections) >= HTTP_SERVER_MAX_ACTIVE_CONNECTIONS) {
+                if (active_count >= max_active_connections) {
                     max_clients_reached = 1;
                     break;
                 } else {
@@ -2469,6 +3188,18 @@ void http_set_server_timeout(int port, long timeout)
 }
 
 
+void http_set_server_max_clients(long max)
+{
+    max_active_connections = (max > 0 ? max : HTTP_SERVER_MAX_ACTIVE_CONNECTIONS);
+}
+
+
+void http_set_server_pollers(int pollers)
+{
+    http_server_pollers = (pollers > 0 ? pollers : 1);
+}
+
+
 int http_open_port_if(int port, int ssl, Octstr *interface)
 {
     struct port *p;
@@ -2717,7 +3448,12 @@ void http_send_reply(HTTPClient *client, int status, List *headers,
         } else {
             /* XXX mark this HTTPClient in the keep-alive cleaner thread */
             client_reset(client);
-            conn_register(client->conn, port_get_fdset(client->port), receive_request, client);
+            /*
+             * A pipelining client may have sent the next request already,
+             * then it is waiting in the input buffer and no POLLIN comes
+             * for it. receive_request() registers us if it needs more.
+             */
+            receive_request(client->conn, client);
         }
     }
     /* queued for sending, we don't want to block */
@@ -302,6 +302,43 @@ void http_set_interface(const Octstr *our_host);
  */
 void http_set_client_timeout(long timeout);
 
+/**
+ * Limit the connections the HTTP client opens to one server (or proxy),
+ * and the requests that wait for one of them to become free. When the
+ * queue is full too, requests fail at once with status -1. 0 means no
+ * limit, which is the default, a negative value leaves a limit as it is.
+ */
+void http_set_client_host_limits(long max_connections, long max_queued);
+
+/**
+ * Allow up to depth GET and HEAD requests in flight on a reused
+ * keep-alive connection (HTTP/1.1 pipelining). Requests are pipelined
+ * only when the connection limit of the server has been reached.
+ * Default is 1, no pipelining.
+ */
+void http_set_client_pipeline_depth(long depth);
+
+/**
+ * Send requests over HTTP/2, many of them at a time over one connection
+ * to each server. With tls, https servers are asked for HTTP/2 during
+ * the SSL handshake and are talked to in HTTP/1.1 if they don't agree.
+ * With cleartext, http servers are talked to in HTTP/2 right away
+ * (h2c with prior knowledge), so use it only if all of them support it.
+ * Requests through a proxy always use HTTP/1.1. Default is neither.
+ * Needs Kannel to be compiled with nghttp2.
+ */
+void http_set_client_h2(int tls, int cleartext);
+
+/**
+ * Get statistics of the HTTP client connection pool: requests sent on a
+ * reused connection, connections opened, requests pipelined, requests
+ * that were queued and requests rejected because the queue was full.
+ * Return -1 if the HTTP client has not been used.
+ */
+int http_client_pool_stats(unsigned long *hits, unsigned long *misses,
+                           unsigned long *pipelined, unsigned long *queued,
+                           unsigned long *rejected);
+
 /*
  * Functions for doing a GET request. The difference is that _real follows
  * redirections, plain http_get does not. Return value is the status
@@ -401,6 +438,19 @@ typedef struct HTTPClient HTTPClient;
  */
 void http_set_server_timeout(int port, long timeout);
 
+/*
+ * Set the number of threads polling the client connections of each
+ * server port opened afterwards. Defaults to 1.
+ */
+void http_set_server_pollers(int pollers);
+
+/*
+ * Set the maximum number of client connections the HTTP server keeps
+ * open on all ports together. Further clients wait in the listen queue
+ * until a connection is closed. Defaults to 500.
+ */
+void http_set_server_max_clients(long max);
+
 /*
  * Open an HTTP server at a given port. Return -1 for errors (invalid
  * port number, etc), 0 for OK. This will also start a background thread
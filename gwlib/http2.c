@@ -0,0 +1,659 @@
+/* ==================================================================== 
+ * The Kannel Software License, Version 1.0 
+ * 
+ * Copyright (c) 2001-2016 Kannel Group  
+ * Copyright (c) 1998-2001 WapIT Ltd.   
+ * All rights reserved. 
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions 
+ * are met: 
+ * 
+ * 1. Redistributions of source code must retain the above copyright 
+ *    notice, this list of conditions and the following disclaimer. 
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright 
+ *    notice, this list of conditions and the following disclaimer in 
+ *    the documentation and/or other materials provided with the 
+ *    distribution. 
+ * 
+ * 3. The end-user documentation included with the redistribution, 
+ *    if any, must include the following acknowledgment: 
+ *       "This product includes software developed by the 
+ *        Kannel Group (http://www.kannel.org/)." 
+ *    Alternately, this acknowledgment may appear in the software itself, 
+ *    if and wherever such third-party acknowledgments normally appear. 
+ * 
+ * 4. The names "Kannel" and "Kannel Group" must not be used to 
+ *    endorse or promote products derived from this software without 
+ *    prior written permission. For written permission, please  
+ *    contact org@kannel.org. 
+ * 
+ * 5. Products derived from this software may not be called "Kannel", 
+ *    nor may "Kannel" appear in their name, without prior written 
+ *    permission of the Kannel Group. 
+ * 
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESSED OR IMPLIED 
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES 
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+ * DISCLAIMED.  IN NO EVENT SHALL THE KANNEL GROUP OR ITS CONTRIBUTORS 
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,  
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT  
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR  
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,  
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE  
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,  
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. 
+ * ==================================================================== 
+ * 
+ * This software consists of voluntary contributions made by many 
+ * individuals on behalf of the Kannel Group.  For more information on  
+ * the Kannel Group, please see <http://www.kannel.org/>. 
+ * 
+ * Portions of this software are based upon software originally written at  
+ * WapIT Ltd., Helsinki, Finland for the Kannel project.  
+ */ 
+
+/*
+ * http2.c - HTTP/2 client sessions, see http2.h
+ */
+
+#include <ctype.h>
+#include <string.h>
+
+#include "gwlib.h"
+
+#ifdef HAVE_NGHTTP2
+
+#include <nghttp2/nghttp2.h>
+
+#include "http2.h"
+
+/* receive window of each stream, larger than the default of 64 KB */
+#define HTTP2_STREAM_WINDOW (1 << 20)
+
+typedef struct HTTP2Stream HTTP2Stream;
+
+/*
+ * A request waiting for its response.
+ */
+struct HTTP2Stream {
+    void *data;             /* of the caller */
+    Octstr *body;           /* of the request, NULL if none */
+    long body_pos;          /* how much of it has been sent */
+    int sent;               /* its HEADERS frame has gone out */
+    long status;            /* of the response, 0 until known */
+    List *headers;          /* of the response */
+    Octstr *response;       /* body of the response */
+    HTTP2Stream *prev;
+    HTTP2Stream *next;
+};
+
+struct HTTP2Session {
+    Mutex *lock;
+    Connection *conn;           /* NULL once closed */
+    nghttp2_session *session;   /* NULL once closed */
+    http2_response_cb_t *callback;
+    HTTP2Stream *streams;       /* submitted, waiting for the response */
+    long stream_count;
+    int connected;              /* nonblocking connect has finished */
+    int negotiated;             /* server has agreed to HTTP/2 */
+};
+
+
+static HTTP2Stream *stream_create(void *data, Octstr *body)
+{
+    HTTP2Stream *stream;
+
+    stream = gw_malloc(sizeof(*stream));
+    stream->data = data;
+    stream->body = octstr_duplicate(body);
+    stream->body_pos = 0;
+    stream->sent = 0;
+    stream->status = 0;
+    stream->headers = http_create_empty_headers();
+    stream->response = octstr_create("");
+    stream->prev = NULL;
+    stream->next = NULL;
+    return stream;
+}
+
+
+static void stream_destroy(HTTP2Stream *stream)
+{
+    octstr_destroy(stream->body);
+    http_destroy_headers(stream->headers);
+    octstr_destroy(stream->response);
+    gw_free(stream);
+}
+
+
+static void stream_link(HTTP2Session *s, HTTP2Stream *stream)
+{
+    stream->prev = NULL;
+    stream->next = s->streams;
+    if (s->streams != NULL)
+        s->streams->prev = stream;
+    s->streams = stream;
+    s->stream_count++;
+}
+
+
+static void stream_unlink(HTTP2Session *s, HTTP2Stream *stream)
+{
+    if (stream->prev != NULL)
+        stream->prev->next = stream->next;
+    else
+        s->streams = stream->next;
+    if (stream->next != NULL)
+        stream->next->prev = stream->prev;
+    stream->prev = stream->next = NULL;
+    s->stream_count--;
+}
+
+
+/*
+ * Hand the result of the stream to the caller and forget about it.
+ */
+static void stream_done(HTTP2Session *s, HTTP2Stream *stream, long status)
+{
+    stream_unlink(s, stream);
+    if (status >= 0) {
+        s->callback(stream->data, status, stream->headers, stream->response);
+        stream->headers = NULL;
+        stream->response = NULL;
+    } else
+        s->callback(stream->data, status, NULL, NULL);
+    stream_destroy(stream);
+}
+
+
+/*
+ * Close the connection and fail all requests that are still open with
+ * status, or, if status is 0, with HTTP2_NOT_SENT those that never got
+ * out and with HTTP2_FAILED the others. Only called from the FDSet
+ * thread, others can't unregister conn while holding the lock.
+ */
+static void session_close(HTTP2Session *s, long status)
+{
+    HTTP2Stream *stream;
+
+    if (s->conn == NULL)
+        return;
+
+    conn_unregister(s->conn);
+    conn_destroy(s->conn);
+    s->conn = NULL;
+    nghttp2_session_del(s->session);
+    s->session = NULL;
+
+    while ((stream = s->streams) != NULL) {
+        if (status != 0)
+            stream_done(s, stream, status);
+        else
+            stream_done(s, stream, stream->sent ? HTTP2_FAILED : HTTP2_NOT_SENT);
+    }
+}
+
+
+/*
+ * Write out whatever the session has to send. Return -1 if the
+ * connection broke.
+ */
+static int session_flush(HTTP2Session *s)
+{
+    const uint8_t *data;
+    ssize_t len;
+    Octstr *out;
+    int ret;
+
+    if (!s->connected)
+        return 0;
+
+    /* frames go out in one write, small ones would wait for Nagle */
+    out = octstr_create("");
+    while ((len = nghttp2_session_mem_send(s->session, &data)) > 0)
+        octstr_append_data(out, (char *) data, len);
+    if (len < 0) {
+        error(0, "HTTP2: Sending failed: %s", nghttp2_strerror(len));
+        octstr_destroy(out);
+        return -1;
+    }
+    ret = 0;
+    if (octstr_len(out) > 0)
+        ret = conn_write(s->conn, out);
+    octstr_destroy(out);
+    return ret == -1 ? -1 : 0;
+}
+
+
+/*
+ * Over SSL, check which protocol the server has selected once the
+ * handshake is done. Return 1 if it is HTTP/2, 0 if not known yet
+ * and -1 if it is something else.
+ */
+static int session_negotiated(HTTP2Session *s)
+{
+#ifdef HAVE_LIBSSL
+    SSL *ssl;
+    const unsigned char *proto;
+    unsigned int len;
+
+    if ((ssl = conn_get_ssl(s->conn)) != NULL) {
+        if (!SSL_is_init_finished(ssl))
+            return 0;
+        SSL_get0_alpn_selected(ssl, &proto, &len);
+        if (len != 2 || memcmp(proto, "h2", 2) != 0)
+            return -1;
+    }
+#endif /* HAVE_LIBSSL */
+    return 1;
+}
+
+
+static void session_io(Connection *conn, void *data)
+{
+    HTTP2Session *s = data;
+    Octstr *in;
+    ssize_t ret;
+
+    mutex_lock(s->lock);
+    if (s->conn == NULL)
+        goto done;
+
+    if (!s->connected) {
+        if (conn_get_connect_result(conn) != 0) {
+            debug("gwlib.http2", 0, "HTTP2: Connect failed (fd=%d).",
+                  conn_get_id(conn));
+            session_close(s, HTTP2_FAILED);
+            goto done;
+        }
+        s->connected = 1;
+    }
+
+    in = conn_read_everything(conn);
+
+    if (!s->negotiated) {
+        ret = session_negotiated(s);
+        if (ret == -1) {
+            debug("gwlib.http2", 0, "HTTP2: Server did not agree to HTTP/2 (fd=%d).",
+                  conn_get_id(conn));
+            octstr_destroy(in);
+            session_close(s, HTTP2_NOT_NEGOTIATED);
+            goto done;
+        }
+        s->negotiated = ret;
+    }
+
+    if (in != NULL) {
+        ret = nghttp2_session_mem_recv(s->session,
+                                       (const uint8_t *) octstr_get_cstr(in),
+                                       octstr_len(in));
+        octstr_destroy(in);
+        if (ret < 0) {
+            error(0, "HTTP2: Receiving failed: %s", nghttp2_strerror(ret));
+            session_close(s, 0);
+            goto done;
+        }
+    }
+
+    if (conn_eof(conn) || conn_error(conn) || session_flush(s) == -1) {
+        debug("gwlib.http2", 0, "HTTP2: Connection closed (fd=%d).",
+              conn_get_id(conn));
+        session_close(s, 0);
+        goto done;
+    }
+
+    /* GOAWAY exchanged and nothing left to do */
+    if (!nghttp2_session_want_read(s->session) &&
+        !nghttp2_session_want_write(s->session)) {
+        debug("gwlib.http2", 0, "HTTP2: Session finished (fd=%d).",
+              conn_get_id(conn));
+        session_close(s, 0);
+    }
+
+done:
+    mutex_unlock(s->lock);
+}
+
+
+/***********************************************************************
+ * nghttp2 callbacks, called with the session locked.
+ */
+
+static int on_header(nghttp2_session *session, const nghttp2_frame *frame,
+                     const uint8_t *name, size_t namelen,
+                     const uint8_t *value, size_t valuelen,
+                     uint8_t flags, void *user_data)
+{
+    HTTP2Stream *stream;
+    Octstr *header;
+
+    if (frame->hd.type != NGHTTP2_HEADERS)
+        return 0;
+    stream = nghttp2_session_get_stream_user_data(session, frame->hd.stream_id);
+    if (stream == NULL)
+        return 0;
+
+    if (namelen == 7 && memcmp(name, ":status", 7) == 0) {
+        header = octstr_create_from_data((char *) value, valuelen);
+        if (octstr_parse_long(&stream->status, header, 0, 10) == -1)
+            stream->status = 0;
+        octstr_destroy(header);
+    } else if (namelen > 0 && name[0] != ':') {
+        header = octstr_create_from_data((char *) name, namelen);
+        octstr_append_cstr(header, ": ");
+        octstr_append_data(header, (char *) value, valuelen);
+        gwlist_append(stream->headers, header);
+    }
+    return 0;
+}
+
+
+static int on_frame_recv(nghttp2_session *session, const nghttp2_frame *frame,
+                         void *user_data)
+{
+    HTTP2Stream *stream;
+
+    if (frame->hd.type != NGHTTP2_HEADERS)
+        return 0;
+    stream = nghttp2_session_get_stream_user_data(session, frame->hd.stream_id);
+    if (stream == NULL)
+        return 0;
+
+    /* an informational response, the real one comes next */
+    if (stream->status > 0 && stream->status < 200) {
+        stream->status = 0;
+        http_destroy_headers(stream->headers);
+        stream->headers = http_create_empty_headers();
+    }
+    return 0;
+}
+
+
+static int on_data_chunk_recv(nghttp2_session *session, uint8_t flags,
+                              int32_t stream_id, const uint8_t *data,
+                              size_t len, void *user_data)
+{
+    HTTP2Stream *stream;
+
+    stream = nghttp2_session_get_stream_user_data(session, stream_id);
+    if (stream != NULL)
+        octstr_append_data(stream->response, (char *) data, len);
+    return 0;
+}
+
+
+static int on_frame_send(nghttp2_session *session, const nghttp2_frame *frame,
+                         void *user_data)
+{
+    HTTP2Stream *stream;
+
+    if (frame->hd.type != NGHTTP2_HEADERS)
+        return 0;
+    stream = nghttp2_session_get_stream_user_data(session, frame->hd.stream_id);
+    if (stream != NULL)
+        stream->sent = 1;
+    return 0;
+}
+
+
+static int on_stream_close(nghttp2_session *session, int32_t stream_id,
+                           uint32_t error_code, void *user_data)
+{
+    HTTP2Session *s = user_data;
+    HTTP2Stream *stream;
+
+    stream = nghttp2_session_get_stream_user_data(session, stream_id);
+    if (stream == NULL)
+        return 0;
+    nghttp2_session_set_stream_user_data(session, stream_id, NULL);
+
+    if (error_code == NGHTTP2_NO_ERROR && stream->status >= 200)
+        stream_done(s, stream, stream->status);
+    else if (!stream->sent)
+        stream_done(s, stream, HTTP2_NOT_SENT);
+    else if (error_code == NGHTTP2_REFUSED_STREAM)
+        stream_done(s, stream, HTTP2_REFUSED);
+    else {
+        debug("gwlib.http2", 0, "HTTP2: Stream %ld closed: %s.",
+              (long) stream_id, nghttp2_http2_strerror(error_code));
+        stream_done(s, stream, HTTP2_FAILED);
+    }
+    return 0;
+}
+
+
+static ssize_t read_body(nghttp2_session *session, int32_t stream_id,
+                         uint8_t *buf, size_t length, uint32_t *data_flags,
+                         nghttp2_data_source *source, void *user_data)
+{
+    HTTP2Stream *stream = source->ptr;
+    long len;
+
+    len = octstr_len(stream->body) - stream->body_pos;
+    if (len > (long) length)
+        len = length;
+    octstr_get_many_chars((char *) buf, stream->body, stream->body_pos, len);
+    stream->body_pos += len;
+    if (stream->body_pos >= octstr_len(stream->body))
+        *data_flags |= NGHTTP2_DATA_FLAG_EOF;
+    return len;
+}
+
+
+/***********************************************************************
+ * Public functions.
+ */
+
+HTTP2Session *http2_session_create(Connection *conn, FDSet *fdset,
+                                   http2_response_cb_t *callback)
+{
+    HTTP2Session *s;
+    nghttp2_session_callbacks *callbacks;
+    nghttp2_settings_entry settings[] = {
+        { NGHTTP2_SETTINGS_ENABLE_PUSH, 0 },
+        { NGHTTP2_SETTINGS_INITIAL_WINDOW_SIZE, HTTP2_STREAM_WINDOW }
+    };
+
+    s = gw_malloc(sizeof(*s));
+    s->lock = mutex_create();
+    s->conn = conn;
+    s->callback = callback;
+    s->streams = NULL;
+    s->stream_count = 0;
+    s->connected = (conn_is_connected(conn) == 0);
+    s->negotiated = 1;
+
+    /* window updates and acks are small and must not wait for Nagle */
+    socket_set_nodelay(conn_get_id(conn), 1);
+
+#ifdef HAVE_LIBSSL
+    if (conn_get_ssl(conn) != NULL) {
+        /* offer HTTP/2 only, the handshake has not started yet */
+        SSL_set_alpn_protos(conn_get_ssl(conn), (const unsigned char *) "\x02h2", 3);
+        s->negotiated = 0;
+    }
+#endif /* HAVE_LIBSSL */
+
+    nghttp2_session_callbacks_new(&callbacks);
+    nghttp2_session_callbacks_set_on_header_callback(callbacks, on_header);
+    nghttp2_session_callbacks_set_on_frame_recv_callback(callbacks, on_frame_recv);
+    nghttp2_session_callbacks_set_on_data_chunk_recv_callback(callbacks, on_data_chunk_recv);
+    nghttp2_session_callbacks_set_on_frame_send_callback(callbacks, on_frame_send);
+    nghttp2_session_callbacks_set_on_stream_close_callback(callbacks, on_stream_close);
+    nghttp2_session_client_new(&s->session, callbacks, s);
+    nghttp2_session_callbacks_del(callbacks);
+
+    /* the connection preface goes out with the first request */
+    nghttp2_submit_settings(s->session, NGHTTP2_FLAG_NONE, settings,
+                            sizeof(settings) / sizeof(settings[0]));
+    nghttp2_session_set_local_window_size(s->session, NGHTTP2_FLAG_NONE, 0,
+                                          HTTP2_STREAM_WINDOW);
+
+    conn_register(conn, fdset, session_io, s);
+
+    return s;
+}
+
+
+void http2_session_destroy(HTTP2Session *s)
+{
+    HTTP2Stream *stream;
+    Connection *conn;
+
+    if (s == NULL)
+        return;
+
+    /* session_io() may be waiting for the lock, it must find conn gone */
+    mutex_lock(s->lock);
+    conn = s->conn;
+    s->conn = NULL;
+    mutex_unlock(s->lock);
+    if (conn != NULL) {
+        conn_unregister(conn);
+        conn_destroy(conn);
+        nghttp2_session_del(s->session);
+    }
+
+    mutex_lock(s->lock);
+    while ((stream = s->streams) != NULL) {
+        stream_unlink(s, stream);
+        stream_destroy(stream);
+    }
+    mutex_unlock(s->lock);
+
+    mutex_destroy(s->lock);
+    gw_free(s);
+}
+
+
+/* headers that only make sense on a HTTP/1 connection */
+static int connection_header(Octstr *name, Octstr *value)
+{
+    static char *names[] = {
+        "connection", "keep-alive", "proxy-connection", "transfer-encoding",
+        "upgrade", "host", NULL
+    };
+    int i;
+
+    for (i = 0; names[i] != NULL; i++) {
+        if (octstr_str_compare(name, names[i]) == 0)
+            return 1;
+    }
+    /* TE may only ask for trailers */
+    return octstr_str_compare(name, "te") == 0 &&
+           octstr_case_compare(value, octstr_imm("trailers")) != 0;
+}
+
+
+static void nv_set(nghttp2_nv *nv, Octstr *name, Octstr *value)
+{
+    nv->name = (uint8_t *) octstr_get_cstr(name);
+    nv->namelen = octstr_len(name);
+    nv->value = (uint8_t *) octstr_get_cstr(value);
+    nv->valuelen = octstr_len(value);
+    nv->flags = NGHTTP2_NV_FLAG_NONE;
+}
+
+
+int http2_session_submit(HTTP2Session *s, const char *method,
+                         Octstr *scheme, Octstr *authority, Octstr *path,
+                         List *headers, Octstr *body, void *data)
+{
+    HTTP2Stream *stream;
+    nghttp2_data_provider provider;
+    nghttp2_nv *nva;
+    List *strings;
+    Octstr *name, *value, *host;
+    long i, n, count;
+    int32_t id;
+
+    mutex_lock(s->lock);
+    if (s->conn == NULL || !nghttp2_session_check_request_allowed(s->session)) {
+        mutex_unlock(s->lock);
+        return -1;
+    }
+
+    /* a Host header set by the caller wins, as with HTTP/1 */
+    host = http_header_find_first(headers, "Host");
+
+    count = gwlist_len(headers);
+    nva = gw_malloc((count + 4) * sizeof(*nva));
+    strings = gwlist_create();
+    gwlist_append(strings, octstr_create(method));
+    nv_set(&nva[0], octstr_imm(":method"), gwlist_get(strings, 0));
+    nv_set(&nva[1], octstr_imm(":scheme"), scheme);
+    nv_set(&nva[2], octstr_imm(":authority"), host != NULL ? host : authority);
+    nv_set(&nva[3], octstr_imm(":path"), path);
+    n = 4;
+    for (i = 0; i < count; i++) {
+        http_header_get(headers, i, &name, &value);
+        octstr_convert_range(name, 0, octstr_len(name), tolower);
+        gwlist_append(strings, name);
+        gwlist_append(strings, value);
+        if (connection_header(name, value))
+            continue;
+        nv_set(&nva[n++], name, value);
+    }
+
+    stream = stream_create(data, body);
+    if (body != NULL) {
+        provider.source.ptr = stream;
+        provider.read_callback = read_body;
+    }
+    id = nghttp2_submit_request(s->session, NULL, nva, n,
+                                body != NULL ? &provider : NULL, stream);
+
+    gw_free(nva);
+    gwlist_destroy(strings, octstr_destroy_item);
+    octstr_destroy(host);
+
+    if (id < 0) {
+        error(0, "HTTP2: Could not submit request: %s", nghttp2_strerror(id));
+        stream_destroy(stream);
+        mutex_unlock(s->lock);
+        return -1;
+    }
+    stream_link(s, stream);
+
+    /*
+     * If the connection breaks, session_io() closes it, we can't while
+     * the FDSet thread may be waiting for the lock. If the server has
+     * sent something, it may be a GOAWAY before closing, and writing now
+     * would fail. session_io() reads it first and then flushes for us.
+     */
+    if (!conn_eof(s->conn) && !conn_error(s->conn) &&
+        gwthread_pollfd(conn_get_id(s->conn), POLLIN, 0.0) == 0)
+        session_flush(s);
+
+    mutex_unlock(s->lock);
+    return 0;
+}
+
+
+int http2_session_status(HTTP2Session *s)
+{
+    int ret;
+
+    mutex_lock(s->lock);
+    if (s->conn == NULL)
+        ret = -1;
+    else
+        ret = nghttp2_session_check_request_allowed(s->session) ? 1 : 0;
+    mutex_unlock(s->lock);
+    return ret;
+}
+
+
+long http2_session_streams(HTTP2Session *s)
+{
+    long ret;
+
+    mutex_lock(s->lock);
+    ret = s->stream_count;
+    mutex_unlock(s->lock);
+    return ret;
+}
+
+#endif /* HAVE_NGHTTP2 */
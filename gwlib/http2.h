@@ -0,0 +1,137 @@
+/* ==================================================================== 
+ * The Kannel Software License, Version 1.0 
+ * 
+ * Copyright (c) 2001-2016 Kannel Group  
+ * Copyright (c) 1998-2001 WapIT Ltd.   
+ * All rights reserved. 
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions 
+ * are met: 
+ * 
+ * 1. Redistributions of source code must retain the above copyright 
+ *    notice, this list of conditions and the following disclaimer. 
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright 
+ *    notice, this list of conditions and the following disclaimer in 
+ *    the documentation and/or other materials provided with the 
+ *    distribution. 
+ * 
+ * 3. The end-user documentation included with the redistribution, 
+ *    if any, must include the following acknowledgment: 
+ *       "This product includes software developed by the 
+ *        Kannel Group (http://www.kannel.org/)." 
+ *    Alternately, this acknowledgment may appear in the software itself, 
+ *    if and wherever such third-party acknowledgments normally appear. 
+ * 
+ * 4. The names "Kannel" and "Kannel Group" must not be used to 
+ *    endorse or promote products derived from this software without 
+ *    prior written permission. For written permission, please  
+ *    contact org@kannel.org. 
+ * 
+ * 5. Products derived from this software may not be called "Kannel", 
+ *    nor may "Kannel" appear in their name, without prior written 
+ *    permission of the Kannel Group. 
+ * 
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESSED OR IMPLIED 
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES 
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+ * DISCLAIMED.  IN NO EVENT SHALL THE KANNEL GROUP OR ITS CONTRIBUTORS 
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,  
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT  
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR  
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,  
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE  
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,  
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. 
+ * ==================================================================== 
+ * 
+ * This software consists of voluntary contributions made by many 
+ * individuals on behalf of the Kannel Group.  For more information on  
+ * the Kannel Group, please see <http://www.kannel.org/>. 
+ * 
+ * Portions of this software are based upon software originally written at  
+ * WapIT Ltd., Helsinki, Finland for the Kannel project.  
+ */ 
+
+/*
+ * http2.h - HTTP/2 client sessions for the HTTP client
+ *
+ * An HTTP2Session speaks HTTP/2 (RFC 7540) over one Connection and
+ * multiplexes any number of requests over it as concurrent streams.
+ * Frames and header compression are handled by libnghttp2, this module
+ * only feeds it with what the connection reads and writes out what it
+ * produces, from the callback of the FDSet the connection is registered
+ * with.
+ *
+ * Over SSL the session offers "h2" with ALPN and gives up if the server
+ * does not select it. Over plain TCP it starts talking HTTP/2 right
+ * away (h2c with prior knowledge), so it must only be used with servers
+ * that are known to support that.
+ *
+ * This is used by http.c, which decides which requests go over HTTP/2
+ * and keeps the sessions per host. Only compiled with HAVE_NGHTTP2.
+ */
+
+#ifndef HTTP2_H
+#define HTTP2_H
+
+typedef struct HTTP2Session HTTP2Session;
+
+/*
+ * Status passed to the response callback if there is no response.
+ */
+enum {
+    HTTP2_FAILED = -1,          /* the request may have been processed */
+    HTTP2_REFUSED = -2,         /* the server did not process the request */
+    HTTP2_NOT_NEGOTIATED = -3,  /* the server does not speak HTTP/2 */
+    HTTP2_NOT_SENT = -4         /* connection closed before the request got out */
+};
+
+/*
+ * Called once for each submitted request, from the FDSet thread or from
+ * within http2_session_submit(), with the session locked, so it must not
+ * call back into the session. On success status is the HTTP status and
+ * the callee gets headers (a List of "Name: value" Octstr, names in lower
+ * case) and body. Otherwise status is one of the values above and
+ * headers and body are NULL.
+ */
+typedef void http2_response_cb_t(void *data, long status, List *headers,
+                                 Octstr *body);
+
+/*
+ * Start an HTTP/2 session on a newly opened, possibly not yet connected
+ * client connection and register it with fdset. The session owns conn.
+ */
+HTTP2Session *http2_session_create(Connection *conn, FDSet *fdset,
+                                   http2_response_cb_t *callback);
+
+/*
+ * Close the connection if still open and free the session. Requests
+ * that are still open are dropped without calling the callback.
+ */
+void http2_session_destroy(HTTP2Session *session);
+
+/*
+ * Send a request. headers are HTTP/1 style "Name: value" lines, those
+ * that are specific to HTTP/1 connections are left out. body is NULL
+ * for requests without one. Return 0 if the request was submitted, the
+ * callback then gets its result, or -1 if the session does not take new
+ * requests.
+ */
+int http2_session_submit(HTTP2Session *session, const char *method,
+                         Octstr *scheme, Octstr *authority, Octstr *path,
+                         List *headers, Octstr *body, void *data);
+
+/*
+ * Return 1 if the session takes new requests, 0 if it does not, but
+ * still has responses to read, and -1 if its connection is closed.
+ */
+int http2_session_status(HTTP2Session *session);
+
+/*
+ * Return the number of requests waiting for their response.
+ */
+long http2_session_streams(HTTP2Session *session);
+
+#endif
@@ -67,6 +67,8 @@
 #include <stdarg.h>
 #include <string.h>
 #include <ctype.h>
+#include <unistd.h>
+#include <sys/uio.h>
 
 #ifdef HAVE_EXECINFO_H
 #include <execinfo.h>
@@ -174,6 +176,40 @@ static int sysloglevel;
 static int syslogfacility = LOG_DAEMON;
 static int dosyslog = 0;
 
+/*
+ * Asynchronous logging state, see "Asynchronous logging" below.
+ */
+#define LOG_ALIGN 8
+#define LOG_LINE_MAX 4096
+#define LOG_IOV_MAX 64
+#define LOG_ROUND(n) (((n) + LOG_ALIGN - 1) & ~((unsigned long) LOG_ALIGN - 1))
+
+typedef struct {
+    unsigned int len;
+    short level;
+    short excl;
+} LogRecord;
+
+typedef struct {
+    char *buf;
+    unsigned long size; /* power of two */
+    unsigned long head; /* written by the logging thread */
+    unsigned long tail; /* written by the writer thread */
+    time_t stamp_time;
+    char stamp[32];
+} LogRing;
+
+static LogRing *log_rings[THREADTABLE_SIZE];
+static unsigned long log_ring_size;
+static volatile int log_async_running = 0;
+static int log_async_used = 0;
+static long log_async_inflight;
+static long log_writer_thread = -1;
+static int log_writer_kicked;
+static unsigned long log_async_written;
+static unsigned long log_async_dropped;
+static unsigned long log_async_blocked;
+
 /*
  * Make sure stderr is included in the list.
  */
@@ -208,7 +244,16 @@ void log_init(void)
 
 void log_shutdown(void)
 {
+    long i;
+
     log_close_all();
+    for (i = 0; i < THREADTABLE_SIZE; i++) {
+        if (log_rings[i] != NULL) {
+            gw_native_free(log_rings[i]->buf);
+            gw_native_free(log_rings[i]);
+            log_rings[i] = NULL;
+        }
+    }
     /* destroy rwlock */
     gw_rwlock_destroy(&rwlock);
 }
@@ -304,6 +349,9 @@ void log_reopen(void)
 
 void log_close_all(void)
 {
+    /* write out what's still queued */
+    log_async_stop();
+
     /*
      * Writer lock.
      */
@@ -390,19 +438,21 @@ int log_open(char *filename, int level, enum excl_state excl)
 }
 
 
+static char *tab[] = {
+    "DEBUG: ",
+    "INFO: ",
+    "WARNING: ",
+    "ERROR: ",
+    "PANIC: ",
+    "LOG: "
+};
+static int tab_size = sizeof(tab) / sizeof(tab[0]);
+
+
 #define FORMAT_SIZE (1024)
 static void format(char *buf, int level, const char *place, int e,
 		   const char *fmt, int with_timestamp_and_pid)
 {
-    static char *tab[] = {
-        "DEBUG: ",
-        "INFO: ",
-        "WARNING: ",
-        "ERROR: ",
-        "PANIC: ",
-        "LOG: "
-    };
-    static int tab_size = sizeof(tab) / sizeof(tab[0]);
     time_t t;
     struct tm tm;
     char *p, prefix[1024];
@@ -496,6 +546,365 @@ static void PRINTFLIKE(1,0) kannel_syslog(char *format, va_list args, int level)
 }
 
 
+/*
+ * Asynchronous logging.
+ *
+ * When enabled, every gwthread formats its log lines into a private
+ * single-producer/single-consumer ring buffer and a dedicated writer
+ * thread drains all rings and writes them to the log files with writev().
+ * Logging threads then neither take the global rwlock nor do any file I/O.
+ * Lines from different threads may be written slightly out of order.
+ *
+ * A record in the ring is a LogRecord header followed by the formatted
+ * line, padded to LOG_ALIGN bytes.  A record with level -1 marks unused
+ * space at the end of the ring, the reader skips to the start.
+ *
+ * If a ring is full, debug and info lines are dropped while warnings and
+ * above wait for the writer.  Both cases are counted, see log_async_stats().
+ * Threads not created via gwthread, panics, and syslog stay synchronous.
+ */
+static LogRing *log_ring_get(long tid)
+{
+    LogRing *ring = log_rings[tid % THREADTABLE_SIZE];
+
+    if (ring != NULL)
+        return ring;
+
+    /*
+     * Not gw_malloc'ed, rings live until log_shutdown() which runs after
+     * the leak check.  Only this thread may create the ring of its slot.
+     */
+    ring = gw_native_malloc(sizeof(*ring));
+    ring->buf = gw_native_malloc(log_ring_size);
+    ring->size = log_ring_size;
+    ring->head = ring->tail = 0;
+    ring->stamp_time = 0;
+    ring->stamp[0] = '\0';
+    __atomic_store_n(&log_rings[tid % THREADTABLE_SIZE], ring, __ATOMIC_RELEASE);
+
+    return ring;
+}
+
+
+static void log_writer_kick(void)
+{
+    long writer = log_writer_thread;
+
+    if (writer >= 0 && __atomic_exchange_n(&log_writer_kicked, 1, __ATOMIC_ACQ_REL) == 0)
+        gwthread_wakeup(writer);
+}
+
+
+static int log_async_wanted(int level, int excl)
+{
+    int i;
+
+    if (excl)
+        return logfiles[excl].exclusive == GW_EXCL &&
+               level >= logfiles[excl].minimum_output_level &&
+               logfiles[excl].file != NULL;
+
+    for (i = 0; i < num_logfiles; ++i) {
+        if (logfiles[i].exclusive == GW_NON_EXCL &&
+            level >= logfiles[i].minimum_output_level &&
+            logfiles[i].file != NULL)
+            return 1;
+    }
+    return 0;
+}
+
+
+static int PRINTFLIKE(5,0) log_async_format(LogRing *ring, char *line, int level,
+                                            int e, const char *fmt, va_list args)
+{
+    struct tm tm;
+    time_t t;
+    long tid, pid;
+    int n, prefix_len, len;
+
+    time(&t);
+    if (t != ring->stamp_time) {
+#if LOG_TIMESTAMP_LOCALTIME
+        tm = gw_localtime(t);
+#else
+        tm = gw_gmtime(t);
+#endif
+        gw_strftime(ring->stamp, sizeof(ring->stamp), "%Y-%m-%d %H:%M:%S ", &tm);
+        ring->stamp_time = t;
+    }
+
+    gwthread_self_ids(&tid, &pid);
+    prefix_len = snprintf(line, LOG_LINE_MAX, "%s[%ld] [%ld] %s", ring->stamp, pid, tid,
+                          (level < 0 || level >= tab_size) ? "UNKNOWN: " : tab[level]);
+
+    n = vsnprintf(line + prefix_len, LOG_LINE_MAX - prefix_len, fmt, args);
+    len = prefix_len + (n < 0 ? 0 : n);
+    if (len > LOG_LINE_MAX - 2)
+        len = LOG_LINE_MAX - 2;
+    line[len++] = '\n';
+
+    if (e != 0 && len + prefix_len < LOG_LINE_MAX - 2) {
+        memmove(line + len, line, prefix_len);
+        len += prefix_len;
+        n = snprintf(line + len, LOG_LINE_MAX - len, "System error %d: %s\n", e, strerror(e));
+        len += n;
+        if (len > LOG_LINE_MAX - 1) {
+            len = LOG_LINE_MAX - 1;
+            line[len - 1] = '\n';
+        }
+    }
+
+    return len;
+}
+
+
+/*
+ * Queue a log line for the writer thread. Returns 1 if the line was handled
+ * (queued, dropped or not wanted at all), 0 if the caller has to log it
+ * synchronously.
+ */
+static int PRINTFLIKE(4,0) log_async_put(int level, int excl, int e,
+                                         const char *fmt, va_list args)
+{
+    char line[LOG_LINE_MAX];
+    LogRing *ring;
+    LogRecord *rec;
+    unsigned long head, tail, pos, need, pad;
+    long tid;
+    int len, done = 0;
+
+    tid = gwthread_self();
+    if (tid < 0 || tid == log_writer_thread)
+        return 0;
+
+    __atomic_add_fetch(&log_async_inflight, 1, __ATOMIC_SEQ_CST);
+    if (!log_async_running)
+        goto out;
+
+    done = 1;
+    if (!log_async_wanted(level, excl))
+        goto out;
+
+    ring = log_ring_get(tid);
+    len = log_async_format(ring, line, level, e, fmt, args);
+    need = LOG_ROUND(sizeof(LogRecord) + len);
+
+    head = ring->head;
+    for (;;) {
+        tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+        pos = head & (ring->size - 1);
+        pad = (pos + need > ring->size) ? ring->size - pos : 0;
+        if (ring->size - (head - tail) >= pad + need)
+            break;
+        if (level < GW_WARNING) {
+            __atomic_add_fetch(&log_async_dropped, 1, __ATOMIC_RELAXED);
+            log_writer_kick();
+            goto out;
+        }
+        __atomic_add_fetch(&log_async_blocked, 1, __ATOMIC_RELAXED);
+        log_writer_kick();
+        gwthread_sleep(0.01);
+        if (!log_async_running) {
+            done = 0;
+            goto out;
+        }
+    }
+
+    if (pad > 0) {
+        rec = (LogRecord*) (ring->buf + pos);
+        rec->level = -1;
+        head += pad;
+        pos = 0;
+    }
+    rec = (LogRecord*) (ring->buf + pos);
+    rec->len = len;
+    rec->level = level;
+    rec->excl = excl;
+    memcpy(rec + 1, line, len);
+    head += need;
+    __atomic_store_n(&ring->head, head, __ATOMIC_RELEASE);
+
+    if (head - tail > ring->size / 2 || level >= GW_WARNING)
+        log_writer_kick();
+
+out:
+    __atomic_sub_fetch(&log_async_inflight, 1, __ATOMIC_SEQ_CST);
+    return done;
+}
+
+
+static void log_writev(FILE *f, struct iovec *iov, int cnt)
+{
+    ssize_t ret;
+    int fd = fileno(f);
+
+    while (cnt > 0) {
+        ret = writev(fd, iov, cnt);
+        if (ret == -1) {
+            if (errno == EINTR || errno == EAGAIN)
+                continue;
+            return;
+        }
+        while (cnt > 0 && (size_t) ret >= iov->iov_len) {
+            ret -= iov->iov_len;
+            iov++;
+            cnt--;
+        }
+        if (cnt > 0) {
+            iov->iov_base = (char*) iov->iov_base + ret;
+            iov->iov_len -= ret;
+        }
+    }
+}
+
+
+/*
+ * Write out everything queued so far. Called with the rwlock held, only
+ * from the writer thread or after it has stopped. Returns number of lines.
+ */
+static long log_async_drain(void)
+{
+    static struct iovec iov[MAX_LOGFILES][LOG_IOV_MAX];
+    static int iovcnt[MAX_LOGFILES];
+    LogRing *ring;
+    LogRecord *rec;
+    unsigned long head, tail, pos;
+    long slot, lines = 0;
+    int i, full;
+
+    for (slot = 0; slot < THREADTABLE_SIZE; slot++) {
+        ring = __atomic_load_n(&log_rings[slot], __ATOMIC_ACQUIRE);
+        if (ring == NULL)
+            continue;
+        head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        tail = ring->tail;
+        while (tail != head) {
+            full = 0;
+            while (tail != head && !full) {
+                pos = tail & (ring->size - 1);
+                rec = (LogRecord*) (ring->buf + pos);
+                if (rec->level == -1) {
+                    tail += ring->size - pos;
+                    continue;
+                }
+                for (i = 0; i < num_logfiles; i++) {
+                    if ((rec->excl ? (i == rec->excl && logfiles[i].exclusive == GW_EXCL) :
+                                     logfiles[i].exclusive == GW_NON_EXCL) &&
+                        rec->level >= logfiles[i].minimum_output_level &&
+                        logfiles[i].file != NULL) {
+                        iov[i][iovcnt[i]].iov_base = rec + 1;
+                        iov[i][iovcnt[i]].iov_len = rec->len;
+                        if (++iovcnt[i] == LOG_IOV_MAX)
+                            full = 1;
+                    }
+                }
+                tail += LOG_ROUND(sizeof(LogRecord) + rec->len);
+                lines++;
+            }
+            for (i = 0; i < num_logfiles; i++) {
+                if (iovcnt[i] > 0)
+                    log_writev(logfiles[i].file, iov[i], iovcnt[i]);
+                iovcnt[i] = 0;
+            }
+            __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+        }
+    }
+    if (lines > 0)
+        __atomic_add_fetch(&log_async_written, lines, __ATOMIC_RELAXED);
+
+    return lines;
+}
+
+
+static void log_writer(void *arg)
+{
+    long lines;
+
+    while (log_async_running) {
+        __atomic_store_n(&log_writer_kicked, 0, __ATOMIC_RELEASE);
+        gw_rwlock_rdlock(&rwlock);
+        lines = log_async_drain();
+        gw_rwlock_unlock(&rwlock);
+        if (lines == 0)
+            gwthread_sleep(0.1);
+    }
+}
+
+
+int log_async_start(long buffer_size)
+{
+    unsigned long size;
+
+    if (log_async_running)
+        return 0;
+
+    /* power of two, holding at least a few maximum sized lines */
+    if (buffer_size < (long) (4 * LOG_ROUND(sizeof(LogRecord) + LOG_LINE_MAX)))
+        buffer_size = 4 * LOG_ROUND(sizeof(LogRecord) + LOG_LINE_MAX);
+    for (size = 1; size < (unsigned long) buffer_size; size <<= 1)
+        ;
+    if (log_async_used && size != log_ring_size) {
+        warning(0, "Async log buffer size can't be changed once used, keeping %ld bytes.",
+                log_ring_size);
+        size = log_ring_size;
+    }
+    log_ring_size = size;
+
+    log_async_running = 1;
+    log_async_used = 1;
+    if ((log_writer_thread = gwthread_create(log_writer, NULL)) == -1) {
+        log_async_running = 0;
+        error(0, "Failed to start async log writer thread.");
+        return -1;
+    }
+    info(0, "Async logging enabled, %ld bytes buffer per thread.", log_ring_size);
+
+    return 0;
+}
+
+
+void log_async_stop(void)
+{
+    long writer = log_writer_thread;
+    int i;
+
+    if (!log_async_running)
+        return;
+
+    /*
+     * New lines go the synchronous way, give lines being queued a moment.
+     * This is bounded since we may be called from a panic within the
+     * logging code itself.
+     */
+    log_async_running = 0;
+    for (i = 0; i < 1000 && __atomic_load_n(&log_async_inflight, __ATOMIC_SEQ_CST) > 0; i++)
+        gwthread_sleep(0.001);
+
+    if (writer != -1 && gwthread_self() != writer) {
+        gwthread_wakeup(writer);
+        gwthread_join(writer);
+    }
+    log_writer_thread = -1;
+
+    gw_rwlock_rdlock(&rwlock);
+    log_async_drain();
+    gw_rwlock_unlock(&rwlock);
+}
+
+
+int log_async_stats(unsigned long *written, unsigned long *dropped, unsigned long *blocked)
+{
+    if (written != NULL)
+        *written = __atomic_load_n(&log_async_written, __ATOMIC_RELAXED);
+    if (dropped != NULL)
+        *dropped = __atomic_load_n(&log_async_dropped, __ATOMIC_RELAXED);
+    if (blocked != NULL)
+        *blocked = __atomic_load_n(&log_async_blocked, __ATOMIC_RELAXED);
+
+    return log_async_running ? 0 : -1;
+}
+
+
 /*
  * Almost all of the message printing functions are identical, except for
  * the output level they use. This macro contains the identical parts of
@@ -508,12 +917,17 @@ static void PRINTFLIKE(1,0) kannel_syslog(char *format, va_list args, int level)
 #define FUNCTION_GUTS(level, place) \
 	do { \
 	    int i; \
-	    int formatted = 0; \
+	    int formatted = 0, queued = 0; \
 	    char buf[FORMAT_SIZE]; \
 	    va_list args; \
 	    \
-            gw_rwlock_rdlock(&rwlock); \
-	    for (i = 0; i < num_logfiles; ++i) { \
+	    if (log_async_running) { \
+		va_start(args, fmt); \
+		queued = log_async_put(level, 0, err, fmt, args); \
+		va_end(args); \
+	    } \
+            if (!queued) gw_rwlock_rdlock(&rwlock); \
+	    for (i = 0; !queued && i < num_logfiles; ++i) { \
 		if (logfiles[i].exclusive == GW_NON_EXCL && \
                     level >= logfiles[i].minimum_output_level && \
                     logfiles[i].file != NULL) { \
@@ -526,7 +940,7 @@ static void PRINTFLIKE(1,0) kannel_syslog(char *format, va_list args, int level)
 		        va_end(args); \
 		} \
 	    } \
-            gw_rwlock_unlock(&rwlock); \
+            if (!queued) gw_rwlock_unlock(&rwlock); \
 	    if (dosyslog) { \
 	        format(buf, level, place, err, fmt, 0); \
 		va_start(args, fmt); \
@@ -539,7 +953,15 @@ static void PRINTFLIKE(1,0) kannel_syslog(char *format, va_list args, int level)
 	do { \
 	    char buf[FORMAT_SIZE]; \
 	    va_list args; \
+	    int queued = 0; \
 	    \
+	    if (log_async_running) { \
+		va_start(args, fmt); \
+		queued = log_async_put(level, e, err, fmt, args); \
+		va_end(args); \
+	    } \
+	    if (queued) \
+		break; \
             gw_rwlock_rdlock(&rwlock); \
             if (logfiles[e].exclusive == GW_EXCL && \
                 level >= logfiles[e].minimum_output_level && \
@@ -596,7 +1018,9 @@ void gw_panic(int err, const char *fmt, ...)
     /*
      * we don't want PANICs to spread accross smsc logs, so
      * this will be always within the main core log.
+     * Flush queued lines first, the panic itself is logged synchronously.
      */
+    log_async_stop();
     FUNCTION_GUTS(GW_PANIC, "");
 
     gw_backtrace(NULL, 0, 0);
@@ -176,4 +176,26 @@ void log_close_all(void);
  */
 void log_thread_to(int idx);
 
+/*
+ * Switch to asynchronous logging: gwthreads queue formatted lines into
+ * per-thread ring buffers of `buffer_size' bytes and a writer thread
+ * writes them to the log files. Returns 0 on success, -1 on error.
+ */
+int log_async_start(long buffer_size);
+
+/*
+ * Write out all queued lines, stop the writer thread and return to
+ * synchronous logging. Called by log_close_all() and panic().
+ */
+void log_async_stop(void);
+
+/*
+ * Get the number of lines written by the writer thread, debug and info
+ * lines dropped because a ring buffer was full and the number of times
+ * a warning or error had to wait for space. Returns 0 if asynchronous
+ * logging is active, -1 otherwise.
+ */
+int log_async_stats(unsigned long *written, unsigned long *dropped,
+                    unsigned long *blocked);
+
 #endif
@@ -114,6 +114,14 @@
  * always work.
  *
  * `immutable' defines whether the octet string is immutable or not.
+ *
+ * `refs' counts the holders of a string shared with octstr_share(); it
+ * is 0 for strings that have never been shared. Shared strings are
+ * immutable and freed when the last holder destroys them.
+ *
+ * `inline_data' holds the octets of short strings, which are allocated
+ * together with the Octstr itself; `data' then points at it. The data is
+ * moved to a separate buffer when the string grows beyond that.
  */
 struct Octstr
 {
@@ -121,19 +129,56 @@ struct Octstr
     long len;
     long size;
     int immutable;
+    int refs;
+    unsigned char inline_data[];
 };
 
+/* Strings of up to this many octets (plus NUL) are stored inline. */
+#define OCTSTR_INLINE_MAX 64
+
+#define OCTSTR_IS_INLINE(ostr) ((ostr)->data == (ostr)->inline_data)
+
 
 /**********************************************************************
- * Hash table of immutable octet strings.
+ * Hash tables of immutable octet strings.
+ *
+ * There are two: one for octstr_imm, keyed by the address of the C string
+ * literal, and one for octstr_intern, keyed by contents. Lookups do not
+ * take any locks, inserts are serialised by the table's mutex. When a
+ * table gets too full it is replaced by a copy twice its size; the old
+ * one is kept around until shutdown, as readers may still be using it.
  */
 
-#define MAX_IMMUTABLES 1024
+typedef struct ImmTable ImmTable;
+
+struct ImmTable {
+    ImmTable *retired;
+    unsigned long mask;
+    Octstr *slots[];
+};
+
+typedef struct {
+    ImmTable *table;
+    long count;
+    long max;
+    int by_address;
+    Mutex lock;
+} ImmSet;
 
-static Octstr *immutables[MAX_IMMUTABLES];
-static Mutex immutables_mutex;
+#define IMM_INITIAL_SIZE 1024
+#define INTERN_MAX_STRINGS 65536
+
+static ImmSet immutables;
+static ImmSet intern_set;
 static int immutables_init = 0;
 
+static unsigned long octstr_stat_strings;
+static unsigned long octstr_stat_buffers;
+static unsigned long octstr_stat_interned;
+
+#define stat_add(counter) \
+    __atomic_add_fetch(&(counter), 1, __ATOMIC_RELAXED)
+
 static char is_safe[UCHAR_MAX + 1];
 
 /*
@@ -180,6 +225,8 @@ static void seems_valid_real(const Octstr *ostr, const char *filename, long line
 /* Reserve space for at least 'size' octets */
 static void octstr_grow(Octstr *ostr, long size)
 {
+    unsigned char *data;
+
     gw_assert(!ostr->immutable);
     seems_valid(ostr);
     gw_assert(size >= 0);
@@ -189,12 +236,248 @@ static void octstr_grow(Octstr *ostr, long size)
     if (size > ostr->size) {
         /* always reallocate in 1kB chunks */
         size += 1024 - (size % 1024);
-        ostr->data = gw_realloc(ostr->data, size);
+        if (ostr->data == NULL || OCTSTR_IS_INLINE(ostr)) {
+            data = gw_malloc(size);
+            if (ostr->data != NULL)
+                memcpy(data, ostr->data, ostr->len + 1);
+            ostr->data = data;
+            stat_add(octstr_stat_buffers);
+        } else
+            ostr->data = gw_realloc(ostr->data, size);
         ostr->size = size;
     }
 }
 
 
+/* Free the data of ostr unless it is stored inline. */
+static void octstr_free_data(Octstr *ostr)
+{
+    if (!OCTSTR_IS_INLINE(ostr))
+        gw_free(ostr->data);
+}
+
+
+/*
+ * Allocate an octet string of length len with uninitialised contents
+ * apart from the terminating NUL. Short strings, and all strings when
+ * force_inline is set, keep their data in the same allocation.
+ */
+static Octstr *octstr_alloc(long len, int force_inline, const char *file,
+                            long line, const char *func)
+{
+    Octstr *ostr;
+    long size;
+
+    stat_add(octstr_stat_strings);
+    if (len == 0 && !force_inline) {
+        ostr = gw_malloc_trace(sizeof(*ostr), file, line, func);
+        ostr->len = 0;
+        ostr->size = 0;
+        ostr->data = NULL;
+    } else if (len + 1 <= OCTSTR_INLINE_MAX || force_inline) {
+        /* round up to keep the allocator's alignment */
+        size = (len + 1 + sizeof(long) - 1) & ~(sizeof(long) - 1);
+        ostr = gw_malloc_trace(sizeof(*ostr) + size, file, line, func);
+        ostr->len = len;
+        ostr->size = size;
+        ostr->data = ostr->inline_data;
+        ostr->data[len] = '\0';
+    } else {
+        ostr = gw_malloc_trace(sizeof(*ostr), file, line, func);
+        ostr->len = len;
+        ostr->size = len + 1;
+        ostr->data = gw_malloc_trace(ostr->size, file, line, func);
+        ostr->data[len] = '\0';
+        stat_add(octstr_stat_buffers);
+    }
+    ostr->immutable = 0;
+    ostr->refs = 0;
+    return ostr;
+}
+
+
+/*
+ * Hash the contents of an octet string for the intern table, and the
+ * address of a C string literal for the octstr_imm table.
+ */
+static unsigned long hash_data(const unsigned char *data, long len)
+{
+    unsigned long h;
+
+    h = 2166136261UL;
+    while (len-- > 0)
+        h = (h ^ *data++) * 16777619UL;
+    return h ^ (h >> 16);
+}
+
+
+static unsigned long hash_address(const void *ptr)
+{
+    unsigned long h;
+
+    h = CSTR_TO_LONG(ptr) * 2654435761UL;
+    return h ^ (h >> 16);
+}
+
+
+static unsigned long imm_hash(ImmSet *set, Octstr *os)
+{
+    if (set->by_address)
+        return hash_address(os->data);
+    return hash_data(os->data, os->len);
+}
+
+
+static ImmTable *imm_table_create(unsigned long size)
+{
+    ImmTable *table;
+
+    table = gw_malloc(sizeof(*table) + size * sizeof(table->slots[0]));
+    memset(table->slots, 0, size * sizeof(table->slots[0]));
+    table->retired = NULL;
+    table->mask = size - 1;
+    return table;
+}
+
+
+static void imm_set_init(ImmSet *set, long max, int by_address)
+{
+    set->table = imm_table_create(IMM_INITIAL_SIZE);
+    set->count = 0;
+    set->max = max;
+    set->by_address = by_address;
+    mutex_init_static(&set->lock);
+}
+
+
+static long imm_set_destroy(ImmSet *set)
+{
+    ImmTable *table, *next;
+    unsigned long i;
+    long n;
+
+    n = set->count;
+    for (i = 0; i <= set->table->mask; ++i)
+        gw_free(set->table->slots[i]);
+    for (table = set->table; table != NULL; table = next) {
+        next = table->retired;
+        gw_free(table);
+    }
+    set->table = NULL;
+    set->count = 0;
+    mutex_destroy(&set->lock);
+    return n;
+}
+
+
+/*
+ * Look up a string in the set without locking. Slots are only ever
+ * filled, never emptied, so an empty slot ends the probe.
+ */
+static Octstr *imm_find(ImmSet *set, ImmTable *table, unsigned long hash,
+                        const unsigned char *data, long len)
+{
+    unsigned long i;
+    Octstr *os;
+
+    for (i = hash & table->mask; ; i = (i + 1) & table->mask) {
+        os = __atomic_load_n(&table->slots[i], __ATOMIC_ACQUIRE);
+        if (os == NULL)
+            return NULL;
+        if (set->by_address) {
+            if (os->data == data)
+                return os;
+        } else if (os->len == len && memcmp(os->data, data, len) == 0)
+            return os;
+    }
+}
+
+
+/* Put os into an empty slot of table. */
+static void imm_place(ImmTable *table, unsigned long hash, Octstr *os)
+{
+    unsigned long i;
+
+    for (i = hash & table->mask; table->slots[i] != NULL;
+         i = (i + 1) & table->mask)
+        ;
+    __atomic_store_n(&table->slots[i], os, __ATOMIC_RELEASE);
+}
+
+
+/*
+ * Add the string created by make_os to the set unless an equal one is
+ * already there, and return the string in the set. Returns NULL if the
+ * set is full.
+ */
+static Octstr *imm_insert(ImmSet *set, unsigned long hash,
+                          const unsigned char *data, long len,
+                          Octstr *(*make_os)(const unsigned char *, long))
+{
+    ImmTable *table, *bigger;
+    Octstr *os;
+    unsigned long i;
+
+    mutex_lock(&set->lock);
+    table = set->table;
+    if ((os = imm_find(set, table, hash, data, len)) != NULL) {
+        mutex_unlock(&set->lock);
+        return os;
+    }
+    if (set->max > 0 && set->count >= set->max) {
+        mutex_unlock(&set->lock);
+        return NULL;
+    }
+    /* keep the load factor under 3/4 */
+    if ((unsigned long) (set->count + 1) * 4 > (table->mask + 1) * 3) {
+        bigger = imm_table_create((table->mask + 1) * 2);
+        for (i = 0; i <= table->mask; ++i)
+            if (table->slots[i] != NULL)
+                imm_place(bigger, imm_hash(set, table->slots[i]),
+                          table->slots[i]);
+        bigger->retired = table;
+        __atomic_store_n(&set->table, bigger, __ATOMIC_RELEASE);
+        table = bigger;
+    }
+    os = make_os(data, len);
+    imm_place(table, hash, os);
+    set->count++;
+    mutex_unlock(&set->lock);
+    return os;
+}
+
+
+static Octstr *make_imm(const unsigned char *data, long len)
+{
+    Octstr *os;
+
+    /*
+     * Can't use octstr_create() because it copies the string,
+     * which would break our hashing.
+     */
+    os = gw_malloc(sizeof(*os));
+    os->data = (unsigned char *) data;
+    os->len = len;
+    os->size = len + 1;
+    os->immutable = 1;
+    os->refs = 0;
+    seems_valid(os);
+    return os;
+}
+
+
+static Octstr *make_interned(const unsigned char *data, long len)
+{
+    Octstr *os;
+
+    os = octstr_alloc(len, 1, __FILE__, __LINE__, __func__);
+    memcpy(os->data, data, len);
+    os->immutable = 1;
+    seems_valid(os);
+    return os;
+}
+
+
 /*
  * Fill is_safe table. is_safe[c] means that c can be left as such when
  * url-encoded.
@@ -216,25 +499,22 @@ static void urlcode_init(void)
 void octstr_init(void)
 {
     urlcode_init();
-    mutex_init_static(&immutables_mutex);
+    imm_set_init(&immutables, 0, 1);
+    imm_set_init(&intern_set, INTERN_MAX_STRINGS, 0);
     immutables_init = 1;
 }
 
 
 void octstr_shutdown(void)
 {
-    long i, n;
+    long n;
 
-    n = 0;
-    for (i = 0; i < MAX_IMMUTABLES; ++i) {
-        if (immutables[i] != NULL) {
-	    gw_free(immutables[i]);
-            ++n;
-        }
-    }
+    n = imm_set_destroy(&immutables);
     if(n>0)
         debug("gwlib.octstr", 0, "Immutable octet strings: %ld.", n);
-    mutex_destroy(&immutables_mutex);
+    n = imm_set_destroy(&intern_set);
+    if (n > 0)
+        debug("gwlib.octstr", 0, "Interned octet strings: %ld.", n);
 }
 
 
@@ -260,19 +540,9 @@ Octstr *octstr_create_from_data_real(const char *data, long len, const char *fil
     if (len < 0 || (data == NULL && len != 0))
         return NULL;
 
-    ostr = gw_malloc_trace(sizeof(*ostr), file, line, func);
-    if (len == 0) {
-        ostr->len = 0;
-        ostr->size = 0;
-        ostr->data = NULL;
-    } else {
-        ostr->len = len;
-        ostr->size = len + 1;
-        ostr->data = gw_malloc_trace(ostr->size, file, line, func);
+    ostr = octstr_alloc(len, 0, file, line, func);
+    if (len > 0)
         memcpy(ostr->data, data, len);
-        ostr->data[len] = '\0';
-    }
-    ostr->immutable = 0;
     seems_valid(ostr);
     return ostr;
 }
@@ -281,56 +551,109 @@ Octstr *octstr_create_from_data_real(const char *data, long len, const char *fil
 Octstr *octstr_imm(const char *cstr)
 {
     Octstr *os;
-    long i, index;
-    unsigned char *data;
+    unsigned long hash;
+    const unsigned char *data;
 
     gw_assert(immutables_init);
     gw_assert(cstr != NULL);
 
-    index = CSTR_TO_LONG(cstr) % MAX_IMMUTABLES;
-    data = (unsigned char *) cstr;
+    data = (const unsigned char *) cstr;
+    hash = hash_address(data);
+    os = imm_find(&immutables,
+                  __atomic_load_n(&immutables.table, __ATOMIC_ACQUIRE),
+                  hash, data, 0);
+    if (os == NULL)
+        os = imm_insert(&immutables, hash, data, strlen(cstr), make_imm);
 
-    mutex_lock(&immutables_mutex);
-    i = index;
-    for (; ; ) {
-	if (immutables[i] == NULL || immutables[i]->data == data)
-            break;
-        i = (i + 1) % MAX_IMMUTABLES;
-        if (i == index)
-            panic(0, "Too many immutable strings.");
-    }
-    os = immutables[i];
-    if (os == NULL) {
-	/*
-	 * Can't use octstr_create() because it copies the string,
-	 * which would break our hashing.
-	 */
-	os = gw_malloc(sizeof(*os));
-        os->data = data;
-        os->len = strlen(data);
-        os->size = os->len + 1;
-        os->immutable = 1;
-	immutables[i] = os;
-	seems_valid(os);
-    }
-    mutex_unlock(&immutables_mutex);
+    return os;
+}
+
+
+Octstr *octstr_intern_data(const char *data, long len)
+{
+    Octstr *os;
+    unsigned long hash;
+
+    gw_assert(immutables_init);
+    gw_assert(len >= 0);
+    if (data == NULL)
+        return NULL;
 
+    hash = hash_data((const unsigned char *) data, len);
+    os = imm_find(&intern_set,
+                  __atomic_load_n(&intern_set.table, __ATOMIC_ACQUIRE),
+                  hash, (const unsigned char *) data, len);
+    if (os != NULL) {
+        stat_add(octstr_stat_interned);
+        return os;
+    }
+    os = imm_insert(&intern_set, hash, (const unsigned char *) data, len,
+                    make_interned);
+    if (os == NULL)
+        return octstr_create_from_data(data, len);
     return os;
 }
 
 
+Octstr *octstr_intern(const Octstr *ostr)
+{
+    if (ostr == NULL)
+        return NULL;
+    seems_valid(ostr);
+    if (ostr->len == 0)
+        return octstr_intern_data("", 0);
+    return octstr_intern_data((const char *) ostr->data, ostr->len);
+}
+
+
+void octstr_alloc_stats(unsigned long *strings, unsigned long *buffers,
+                        unsigned long *interned)
+{
+    if (strings != NULL)
+        *strings = __atomic_load_n(&octstr_stat_strings, __ATOMIC_RELAXED);
+    if (buffers != NULL)
+        *buffers = __atomic_load_n(&octstr_stat_buffers, __ATOMIC_RELAXED);
+    if (interned != NULL)
+        *interned = __atomic_load_n(&octstr_stat_interned, __ATOMIC_RELAXED);
+}
+
+
 void octstr_destroy(Octstr *ostr)
 {
     if (ostr != NULL) {
         seems_valid(ostr);
-	if (!ostr->immutable) {
-            gw_free(ostr->data);
+	if (!ostr->immutable ||
+            (ostr->refs > 0 &&
+             __atomic_sub_fetch(&ostr->refs, 1, __ATOMIC_ACQ_REL) == 0)) {
+            octstr_free_data(ostr);
             gw_free(ostr);
         }
     }
 }
 
 
+Octstr *octstr_share(Octstr *ostr)
+{
+    if (ostr == NULL)
+        return NULL;
+
+    seems_valid(ostr);
+
+    /* octstr_imm and interned strings live until shutdown anyway */
+    if (ostr->immutable && ostr->refs == 0)
+        return ostr;
+
+    if (ostr->refs == 0) {
+        /* only the single holder can get here */
+        ostr->immutable = 1;
+        ostr->refs = 1;
+    }
+    __atomic_add_fetch(&ostr->refs, 1, __ATOMIC_RELAXED);
+
+    return ostr;
+}
+
+
 void octstr_destroy_item(void *os)
 {
     octstr_destroy(os);
@@ -385,16 +708,12 @@ Octstr *octstr_cat(Octstr *ostr1, Octstr *ostr2)
     seems_valid(ostr1);
     seems_valid(ostr2);
 
-    ostr = octstr_create("");
-    ostr->len = ostr1->len + ostr2->len;
-    ostr->size = ostr->len + 1;
-    ostr->data = gw_malloc(ostr->size);
-
+    ostr = octstr_alloc(ostr1->len + ostr2->len, 0, __FILE__, __LINE__,
+                        __func__);
     if (ostr1->len > 0)
         memcpy(ostr->data, ostr1->data, ostr1->len);
     if (ostr2->len > 0)
         memcpy(ostr->data + ostr1->len, ostr2->data, ostr2->len);
-    ostr->data[ostr->len] = '\0';
 
     seems_valid(ostr);
     return ostr;
@@ -1731,8 +2050,9 @@ void octstr_url_encode(Octstr *ostr)
     
     /* we made replace in place */
     if (n) {
-        gw_free(ostr->data);
+        octstr_free_data(ostr);
         ostr->data = res;
+        stat_add(octstr_stat_buffers);
         ostr->size = len;
         ostr->len = len - 1;
     }
@@ -2562,7 +2882,7 @@ static void seems_valid_real(const Octstr *ostr, const char *filename, long line
                         filename, lineno, function);
         gw_assert_place(ostr->data != NULL,
                         filename, lineno, function);
-	if (!ostr->immutable)
+	if ((!ostr->immutable || ostr->refs > 0) && !OCTSTR_IS_INLINE(ostr))
             gw_assert_allocated(ostr->data,
                                 filename, lineno, function);
         gw_assert_place(ostr->data[ostr->len] == '\0',
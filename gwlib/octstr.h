@@ -147,6 +147,42 @@ Octstr *octstr_create_from_data_real(const char *data, long len, const char *fil
 Octstr *octstr_imm(const char *cstr);
 
 
+/*
+ * Return an immutable octet string with the same contents as the given
+ * data. All callers interning equal contents get the same octet string,
+ * so this is meant for values that repeat a lot, such as smsc-ids,
+ * service names and accounts. Like for octstr_imm, octstr_destroy is a
+ * no-op for the result, it is freed when octstr_shutdown is called.
+ * When the intern table is full a normal, mutable copy is returned
+ * instead, so callers must still destroy the result when done.
+ * A NULL argument returns NULL.
+ */
+Octstr *octstr_intern(const Octstr *ostr);
+Octstr *octstr_intern_data(const char *data, long len);
+
+
+/*
+ * Share an octet string with another holder instead of copying it. The
+ * same octet string is returned; from then on it is immutable and every
+ * holder has to call octstr_destroy, the last call frees it. Holders that
+ * need to modify it must use their own octstr_duplicate copy. Sharing
+ * octstr_imm or interned strings simply returns them. Sharing and
+ * destroying from different threads is safe. NULL gives NULL.
+ */
+Octstr *octstr_share(Octstr *ostr);
+
+
+/*
+ * Return the number of octet strings created so far, the number of
+ * separately allocated data buffers (short strings keep their data in
+ * the same allocation as the octet string itself) and the number of
+ * octstr_intern calls which found an existing string. Any of the
+ * pointers may be NULL.
+ */
+void octstr_alloc_stats(unsigned long *strings, unsigned long *buffers,
+                        unsigned long *interned);
+
+
 /*
  * Destroy an octet string, freeing all memory it uses. A NULL argument
  * is ignored.
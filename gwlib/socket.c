@@ -129,7 +129,8 @@ int make_server_socket(int port, const char *interface_name)
         goto error;
     }
 
-    if (listen(s, 10) == -1) {
+    /* let bursts of clients queue up instead of retrying their SYNs */
+    if (listen(s, SOMAXCONN) == -1) {
         error(errno, "listen failed");
         goto error;
     }
@@ -153,42 +154,50 @@ int tcpip_connect_to_server(char *hostname, int port, const char *source_addr)
 }
 
 
-int tcpip_connect_to_server_with_port(char *hostname, int port, int our_port, const char *source_addr)
+/*
+ * Create a socket of the given address family and bind it to our_port
+ * and source_addr, if they are set.
+ */
+static int client_socket(int family, int our_port, const char *source_addr)
 {
-    struct sockaddr_in addr;
-    struct sockaddr_in o_addr;
-    struct hostent hostinfo;
-    struct hostent o_hostinfo;
-    int s, rc = -1, i;
-    char *buff, *buff1;
-
-    buff = buff1 = NULL;
-
-    s = socket(PF_INET, SOCK_STREAM, 0);
+    struct sockaddr_storage o_addr;
+    socklen_t o_len;
+    Octstr *source;
+    List *addrs;
+    int s, reuse;
+    long i;
+
+    s = socket(family, SOCK_STREAM, 0);
     if (s == -1) {
         error(errno, "Couldn't create new socket.");
-        goto error;
-    }
-
-    if (gw_gethostbyname(&hostinfo, hostname, &buff) == -1) {
-        error(errno, "gethostbyname failed");
-        goto error;
+        return -1;
     }
 
-    if (our_port > 0 || (source_addr != NULL && strcmp(source_addr, "*") != 0))  {
-        int reuse;
-
-        o_addr = empty_sockaddr_in;
-        o_addr.sin_family = AF_INET;
-        o_addr.sin_port = htons(our_port);
-        if (source_addr == NULL || strcmp(source_addr, "*") == 0)
-            o_addr.sin_addr.s_addr = htonl(INADDR_ANY);
-        else {
-            if (gw_gethostbyname(&o_hostinfo, source_addr, &buff1) == -1) {
-                error(errno, "gethostbyname failed");
+    if (our_port > 0 || (source_addr != NULL && strcmp(source_addr, "*") != 0)) {
+        memset(&o_addr, 0, sizeof(o_addr));
+        o_addr.ss_family = family;
+        o_len = (family == AF_INET ? sizeof(struct sockaddr_in) : sizeof(o_addr));
+        if (source_addr != NULL && strcmp(source_addr, "*") != 0) {
+            source = octstr_create(source_addr);
+            addrs = gw_resolve(source);
+            octstr_destroy(source);
+            o_len = 0;
+            for (i = 0; o_len == 0 && i < gwlist_len(addrs); i++) {
+                if (((struct sockaddr *) octstr_get_cstr(gwlist_get(addrs, i)))->sa_family == family)
+                    o_len = gw_resolver_sockaddr(gwlist_get(addrs, i), &o_addr, our_port);
+            }
+            gwlist_destroy(addrs, octstr_destroy_item);
+            if (o_len == 0) {
+                error(0, "No address of the same family for source address `%s'", source_addr);
                 goto error;
             }
-            o_addr.sin_addr = *(struct in_addr *) o_hostinfo.h_addr;
+        } else if (family == AF_INET) {
+            ((struct sockaddr_in *) &o_addr)->sin_port = htons(our_port);
+#ifdef AF_INET6
+        } else if (family == AF_INET6) {
+            ((struct sockaddr_in6 *) &o_addr)->sin6_port = htons(our_port);
+            o_len = sizeof(struct sockaddr_in6);
+#endif
         }
 
         reuse = 1;
@@ -196,48 +205,98 @@ int tcpip_connect_to_server_with_port(char *hostname, int port, int our_port, co
             error(errno, "setsockopt failed before bind");
             goto error;
         }
-        if (bind(s, (struct sockaddr *) &o_addr, sizeof(o_addr)) == -1) {
+        if (bind(s, (struct sockaddr *) &o_addr, o_len) == -1) {
             error(errno, "bind to local port %d failed", our_port);
             goto error;
         }
     }
+    return s;
 
-    i = 0;
-    do {
-        Octstr *ip2;
+error:
+    close(s);
+    return -1;
+}
 
-        addr = empty_sockaddr_in;
-        addr.sin_family = AF_INET;
-        addr.sin_port = htons(port);
-        addr.sin_addr = *(struct in_addr *) hostinfo.h_addr_list[i];
 
-        ip2 = gw_netaddr_to_octstr(AF_INET, &addr.sin_addr);
+/*
+ * Connect to the addresses of hostname in turn until one succeeds. If
+ * done is not NULL, connect without blocking and set *done to 0 if the
+ * socket got connected at once, 1 if the connect is in progress.
+ */
+static int connect_to_server(char *hostname, int port, int our_port,
+                             const char *source_addr, int *done)
+{
+    struct sockaddr_storage addr;
+    socklen_t addrlen;
+    Octstr *host, *ip2;
+    List *addrs;
+    int s = -1, rc = -1, err, flags;
+    long i;
+
+    if (done != NULL)
+        *done = 1;
+
+    host = octstr_create(hostname);
+    addrs = gw_resolve(host);
+    octstr_destroy(host);
+    if (addrs == NULL) {
+        error(0, "Could not resolve host name `%s'", hostname);
+        goto error;
+    }
 
-        debug("gwlib.socket", 0, "Connecting to <%s>", octstr_get_cstr(ip2));
+    for (i = 0; rc == -1 && i < gwlist_len(addrs); i++) {
+        addrlen = gw_resolver_sockaddr(gwlist_get(addrs, i), &addr, port);
+        if (s >= 0)
+            close(s);
+        if ((s = client_socket(addr.ss_family, our_port, source_addr)) == -1)
+            continue;
+        if (done != NULL) {
+            flags = fcntl(s, F_GETFL, 0);
+            fcntl(s, F_SETFL, flags | O_NONBLOCK);
+        }
 
-        rc = connect(s, (struct sockaddr *) &addr, sizeof(addr));
-        if (rc == -1) {
-            error(errno, "connect to <%s> failed", octstr_get_cstr(ip2));
+        if (addr.ss_family == AF_INET)
+            ip2 = gw_netaddr_to_octstr(AF_INET, &((struct sockaddr_in *) &addr)->sin_addr);
+        else
+            ip2 = gw_netaddr_to_octstr(AF_INET6, &((struct sockaddr_in6 *) &addr)->sin6_addr);
+
+        debug("gwlib.socket", 0, "Connecting%s to <%s>",
+              done != NULL ? " nonblocking" : "", octstr_get_cstr(ip2));
+
+        rc = connect(s, (struct sockaddr *) &addr, addrlen);
+        err = errno;
+        if (rc == 0) {
+            /* may be connected immediately, e.g. to localhost */
+            if (done != NULL)
+                *done = 0;
+        } else if (done != NULL && err == EINPROGRESS) {
+            rc = 0;
+        } else {
+            error(err, "%sconnect to <%s> failed",
+                  done != NULL ? "nonblocking " : "", octstr_get_cstr(ip2));
         }
         octstr_destroy(ip2);
-    } while (rc == -1 && hostinfo.h_addr_list[++i] != NULL);
+    }
+    gwlist_destroy(addrs, octstr_destroy_item);
 
     if (rc == -1)
         goto error;
 
-    gw_free(buff);
-    gw_free(buff1);
     return s;
 
 error:
     error(0, "error connecting to server `%s' at port `%d'", hostname, port);
     if (s >= 0)
         close(s);
-    gw_free(buff);
-    gw_free(buff1);
     return -1;
 }
 
+
+int tcpip_connect_to_server_with_port(char *hostname, int port, int our_port, const char *source_addr)
+{
+    return connect_to_server(hostname, port, our_port, source_addr, NULL);
+}
+
 int tcpip_connect_nb_to_server(char *hostname, int port, const char *source_addr, int *done)
 {
     return tcpip_connect_nb_to_server_with_port(hostname, port, 0, source_addr, done);
@@ -245,100 +304,7 @@ int tcpip_connect_nb_to_server(char *hostname, int port, const char *source_addr
 
 int tcpip_connect_nb_to_server_with_port(char *hostname, int port, int our_port, const char *source_addr, int *done)
 {
-    struct sockaddr_in addr;
-    struct sockaddr_in o_addr;
-    struct hostent hostinfo;
-    struct hostent o_hostinfo;
-    int s, flags, rc = -1, i;
-    char *buff, *buff1;
-
-    *done = 1;
-    buff = buff1 = NULL;
-
-    s = socket(PF_INET, SOCK_STREAM, 0);
-    if (s == -1) {
-        error(errno, "Couldn't create new socket.");
-        goto error;
-    }
-
-    if (gw_gethostbyname(&hostinfo, hostname, &buff) == -1) {
-        error(errno, "gethostbyname failed");
-        goto error;
-    }
-
-    if (our_port > 0 || (source_addr != NULL && strcmp(source_addr, "*") != 0)) {
-        int reuse;
-
-        o_addr = empty_sockaddr_in;
-        o_addr.sin_family = AF_INET;
-        o_addr.sin_port = htons(our_port);
-        if (source_addr == NULL || strcmp(source_addr, "*") == 0)
-            o_addr.sin_addr.s_addr = htonl(INADDR_ANY);
-        else {
-            if (gw_gethostbyname(&o_hostinfo, source_addr, &buff1) == -1) {
-                error(errno, "gethostbyname failed");
-                goto error;
-            }
-            o_addr.sin_addr = *(struct in_addr *) o_hostinfo.h_addr;
-        }
-
-        reuse = 1;
-        if (setsockopt(s, SOL_SOCKET, SO_REUSEADDR, (char *) &reuse, sizeof(reuse)) == -1) {
-            error(errno, "setsockopt failed before bind");
-            goto error;
-        }
-        if (bind(s, (struct sockaddr *) &o_addr, sizeof(o_addr)) == -1) {
-            error(errno, "bind to local port %d failed", our_port);
-            goto error;
-        }
-    }
-
-    flags = fcntl(s, F_GETFL, 0);
-    fcntl(s, F_SETFL, flags | O_NONBLOCK);
-
-    i = 0;
-    do {
-        Octstr *ip2;
-
-        addr = empty_sockaddr_in;
-        addr.sin_family = AF_INET;
-        addr.sin_port = htons(port);
-        addr.sin_addr = *(struct in_addr *) hostinfo.h_addr_list[i];
-
-        ip2 = gw_netaddr_to_octstr(AF_INET, &addr.sin_addr);
-
-        debug("gwlib.socket", 0, "Connecting nonblocking to <%s>", octstr_get_cstr(ip2));
-
-        if ((rc = connect(s, (struct sockaddr *) &addr, sizeof(addr))) < 0) {
-            if (errno != EINPROGRESS) {
-                error(errno, "nonblocking connect to <%s> failed", octstr_get_cstr(ip2));
-            }
-        }
-        octstr_destroy(ip2);
-    } while (rc == -1 && errno != EINPROGRESS && hostinfo.h_addr_list[++i] != NULL);
-
-    if (rc == -1 && errno != EINPROGRESS)
-        goto error;
-
-    /* May be connected immediatly
-     * (if we connecting to localhost for example)
-     */
-    if (rc == 0) {
-        *done = 0;
-    }
-
-    gw_free(buff);
-    gw_free(buff1);
-
-    return s;
-
-error:
-    error(0, "error connecting to server `%s' at port `%d'", hostname, port);
-    if (s >= 0)
-        close(s);
-    gw_free(buff);
-    gw_free(buff1);
-    return -1;
+    return connect_to_server(hostname, port, our_port, source_addr, done);
 }
 
 
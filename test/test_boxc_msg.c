@@ -0,0 +1,228 @@
+/* ==================================================================== 
+ * The Kannel Software License, Version 1.0 
+ * 
+ * Copyright (c) 2001-2016 Kannel Group  
+ * Copyright (c) 1998-2001 WapIT Ltd.   
+ * All rights reserved. 
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions 
+ * are met: 
+ * 
+ * 1. Redistributions of source code must retain the above copyright 
+ *    notice, this list of conditions and the following disclaimer. 
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright 
+ *    notice, this list of conditions and the following disclaimer in 
+ *    the documentation and/or other materials provided with the 
+ *    distribution. 
+ * 
+ * 3. The end-user documentation included with the redistribution, 
+ *    if any, must include the following acknowledgment: 
+ *       "This product includes software developed by the 
+ *        Kannel Group (http://www.kannel.org/)." 
+ *    Alternately, this acknowledgment may appear in the software itself, 
+ *    if and wherever such third-party acknowledgments normally appear. 
+ * 
+ * 4. The names "Kannel" and "Kannel Group" must not be used to 
+ *    endorse or promote products derived from this software without 
+ *    prior written permission. For written permission, please  
+ *    contact org@kannel.org. 
+ * 
+ * 5. Products derived from this software may not be called "Kannel", 
+ *    nor may "Kannel" appear in their name, without prior written 
+ *    permission of the Kannel Group. 
+ * 
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESSED OR IMPLIED 
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES 
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+ * DISCLAIMED.  IN NO EVENT SHALL THE KANNEL GROUP OR ITS CONTRIBUTORS 
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,  
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT  
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR  
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,  
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE  
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,  
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. 
+ * ==================================================================== 
+ * 
+ * This software consists of voluntary contributions made by many 
+ * individuals on behalf of the Kannel Group.  For more information on  
+ * the Kannel Group, please see <http://www.kannel.org/>. 
+ * 
+ * Portions of this software are based upon software originally written at  
+ * WapIT Ltd., Helsinki, Finland for the Kannel project.  
+ */ 
+
+/*
+ * test_boxc_msg.c - measure Msg throughput over a box connection
+ *
+ * A writer thread sends a stream of sms messages over a socket pair and
+ * the main thread reads them back, once with the classic msg_pack() /
+ * conn_read_withlen() framing and once with the packed format, with and
+ * without batching the writes.
+ */
+
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "gwlib/gwlib.h"
+#include "gw/msg.h"
+#include "gw/shared.h"
+#include "gw/sms.h"
+
+enum { MODE_LEGACY, MODE_PACKED, MODE_PACKED_BATCH };
+
+static long messages = 200000;
+static long batch = 64;
+static int mode;
+static Connection *writer_conn;
+
+
+static Msg *make_msg(long i)
+{
+    Msg *msg;
+
+    msg = msg_create(sms);
+    msg->sms.sender = octstr_create("+358401234567");
+    msg->sms.receiver = octstr_create("12345");
+    msg->sms.msgdata = octstr_format("test message number %ld", i);
+    msg->sms.smsc_id = octstr_create("fake");
+    msg->sms.service = octstr_create("default");
+    msg->sms.boxc_id = octstr_create("smsbox");
+    msg->sms.time = time(NULL);
+    msg->sms.sms_type = mt_push;
+    msg->sms.coding = DC_7BIT;
+    uuid_generate(msg->sms.id);
+    return msg;
+}
+
+
+static void write_msg(Msg *msg)
+{
+    Octstr *os;
+
+    if (mode == MODE_LEGACY) {
+        os = msg_pack(msg);
+        conn_write_withlen(writer_conn, os);
+        octstr_destroy(os);
+    } else
+        box_write_msg(writer_conn, msg, 1);
+}
+
+
+static void writer(void *arg)
+{
+    Msg *msg;
+    long i;
+
+    for (i = 0; i < messages; ++i) {
+        if (mode == MODE_PACKED_BATCH && i % batch == 0)
+            conn_set_output_buffering(writer_conn, 65536);
+        msg = make_msg(i);
+        write_msg(msg);
+        msg_destroy(msg);
+        if (mode == MODE_PACKED_BATCH && (i + 1) % batch == 0)
+            conn_set_output_buffering(writer_conn, 0);
+    }
+    conn_set_output_buffering(writer_conn, 0);
+    conn_flush(writer_conn);
+}
+
+
+static int read_msg(Connection *conn, Msg **msg)
+{
+    Octstr *os;
+
+    if (mode != MODE_LEGACY)
+        return box_read_msg(conn, msg);
+
+    if ((os = conn_read_withlen(conn)) == NULL)
+        return 0;
+    *msg = msg_unpack(os);
+    octstr_destroy(os);
+    return *msg == NULL ? -1 : 1;
+}
+
+
+static double run(int m)
+{
+    Connection *reader_conn;
+    double start, secs;
+    Msg *msg;
+    long got, tid;
+    int fds[2], ret;
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == -1)
+        panic(errno, "socketpair failed");
+    writer_conn = conn_wrap_fd(fds[0], 0);
+    reader_conn = conn_wrap_fd(fds[1], 0);
+    mode = m;
+
+    start = date_precise_now();
+    tid = gwthread_create(writer, NULL);
+    for (got = 0; got < messages; ) {
+        ret = read_msg(reader_conn, &msg);
+        if (ret == 1) {
+            gw_assert(msg_type(msg) == sms);
+            msg_destroy(msg);
+            ++got;
+        } else if (ret == -1)
+            panic(0, "Invalid message received");
+        else if (conn_eof(reader_conn) || conn_error(reader_conn))
+            panic(0, "Connection closed after %ld messages", got);
+        else
+            conn_wait(reader_conn, -1);
+    }
+    secs = date_precise_now() - start;
+    gwthread_join(tid);
+
+    conn_destroy(writer_conn);
+    conn_destroy(reader_conn);
+
+    return messages / secs;
+}
+
+
+static void help(void)
+{
+    info(0, "Usage: test_boxc_msg [-n messages] [-b batch]");
+}
+
+
+int main(int argc, char **argv)
+{
+    int opt;
+
+    gwlib_init();
+
+    while ((opt = getopt(argc, argv, "hn:b:")) != EOF) {
+        switch (opt) {
+        case 'n':
+            messages = atol(optarg);
+            break;
+        case 'b':
+            batch = atol(optarg);
+            break;
+        case 'h':
+            help();
+            exit(0);
+        default:
+            error(0, "Invalid option %c", opt);
+            help();
+            panic(0, "Stopping.");
+        }
+    }
+    if (messages <= 0 || batch <= 0)
+        panic(0, "Message count and batch size must be positive.");
+
+    log_set_output_level(GW_INFO);
+
+    info(0, "legacy:         %.0f msg/s", run(MODE_LEGACY));
+    info(0, "packed:         %.0f msg/s", run(MODE_PACKED));
+    info(0, "packed batched: %.0f msg/s", run(MODE_PACKED_BATCH));
+
+    gwlib_shutdown();
+    return 0;
+}
@@ -69,6 +69,8 @@
 int main(int argc, char **argv)
 {
     Octstr *os1, *os2;
+    CharsetGsmCount count;
+    int i;
 
     gwlib_init();
     
@@ -91,6 +93,35 @@ int main(int argc, char **argv)
 
     octstr_destroy(os1);
     octstr_destroy(os2);
+
+    /* "[" and the euro sign take two septets and must not be cut */
+    os1 = octstr_create("ab[cd\xe2\x82\xac");
+    if (charset_utf8_to_gsm_count(os1, 0, -1, 3, NULL, &count) != 8 ||
+        count.octets != octstr_len(os1) || count.parts != 3 || count.lossy != 0)
+        panic(0, "Wrong GSM count: %ld septets, %ld octets, %ld parts.",
+              count.septets, count.octets, count.parts);
+    charset_utf8_to_gsm_count(os1, 0, 3, 0, NULL, &count);
+    if (count.septets != 2 || count.octets != 2)
+        panic(0, "Escape sequence was cut.");
+    os2 = octstr_create("");
+    charset_utf8_to_gsm_count(os1, 0, -1, 0, os2, NULL);
+    charset_utf8_to_gsm(os1);
+    if (octstr_compare(os1, os2) != 0)
+        panic(0, "GSM count and conversion differ!");
+    debug("", 0, "GSM counting ok.");
+    octstr_destroy(os1);
+    octstr_destroy(os2);
+
+    /* second conversion of the same pair uses the cached descriptor */
+    for (i = 0; i < 2; i++) {
+        os1 = octstr_create("\xe4\xf6\xfc");
+        if (charset_convert(os1, "ISO-8859-1", "UTF-8") != 0 ||
+            octstr_str_compare(os1, "\xc3\xa4\xc3\xb6\xc3\xbc") != 0)
+            panic(0, "iconv conversion failed.");
+        octstr_destroy(os1);
+    }
+    debug("", 0, "iconv conversion ok.");
+
     gwlib_shutdown();
     return 0;
 }
@@ -0,0 +1,217 @@
+/* ==================================================================== 
+ * The Kannel Software License, Version 1.0 
+ * 
+ * Copyright (c) 2001-2016 Kannel Group  
+ * Copyright (c) 1998-2001 WapIT Ltd.   
+ * All rights reserved. 
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions 
+ * are met: 
+ * 
+ * 1. Redistributions of source code must retain the above copyright 
+ *    notice, this list of conditions and the following disclaimer. 
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright 
+ *    notice, this list of conditions and the following disclaimer in 
+ *    the documentation and/or other materials provided with the 
+ *    distribution. 
+ * 
+ * 3. The end-user documentation included with the redistribution, 
+ *    if any, must include the following acknowledgment: 
+ *       "This product includes software developed by the 
+ *        Kannel Group (http://www.kannel.org/)." 
+ *    Alternately, this acknowledgment may appear in the software itself, 
+ *    if and wherever such third-party acknowledgments normally appear. 
+ * 
+ * 4. The names "Kannel" and "Kannel Group" must not be used to 
+ *    endorse or promote products derived from this software without 
+ *    prior written permission. For written permission, please  
+ *    contact org@kannel.org. 
+ * 
+ * 5. Products derived from this software may not be called "Kannel", 
+ *    nor may "Kannel" appear in their name, without prior written 
+ *    permission of the Kannel Group. 
+ * 
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESSED OR IMPLIED 
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES 
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+ * DISCLAIMED.  IN NO EVENT SHALL THE KANNEL GROUP OR ITS CONTRIBUTORS 
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,  
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT  
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR  
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,  
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE  
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,  
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. 
+ * ==================================================================== 
+ * 
+ * This software consists of voluntary contributions made by many 
+ * individuals on behalf of the Kannel Group.  For more information on  
+ * the Kannel Group, please see <http://www.kannel.org/>. 
+ * 
+ * Portions of this software are based upon software originally written at  
+ * WapIT Ltd., Helsinki, Finland for the Kannel project.  
+ */ 
+
+/*
+ * test_counter.c - contention benchmark for Counter and Load
+ *
+ * A number of threads (16 by default) increase the same Counter, the
+ * same Load and, for comparison, an unsigned long guarded by a Mutex.
+ * Totals are checked and the throughput of each is reported, along
+ * with the time load_get() takes while the writers are running.
+ */
+
+#include <unistd.h>
+
+#include "gwlib/gwlib.h"
+#include "gw/load.h"
+
+static long threads = 16;
+static long loops = 1000000;
+
+static Counter *counter;
+static Load *load;
+static Mutex *mutex;
+static unsigned long mutex_value;
+static volatile int running;
+
+
+static void counter_thread(void *arg)
+{
+    long i;
+
+    for (i = 0; i < loops; i++)
+        counter_increase(counter);
+}
+
+
+static void load_thread(void *arg)
+{
+    long i;
+
+    for (i = 0; i < loops; i++)
+        load_increase(load);
+}
+
+
+static void mutex_thread(void *arg)
+{
+    long i;
+
+    for (i = 0; i < loops; i++) {
+        mutex_lock(mutex);
+        mutex_value++;
+        mutex_unlock(mutex);
+    }
+}
+
+
+static void reader_thread(void *arg)
+{
+    double start, secs;
+    long n = 0;
+
+    start = date_precise_now();
+    while (running) {
+        load_get(load, 0);
+        load_get(load, 1);
+        n++;
+    }
+    secs = date_precise_now() - start;
+    if (n > 0)
+        info(0, "load_get   %.2f us per call while writing", secs * 1e6 / n / 2);
+}
+
+
+static void run(const char *name, gwthread_func_t *func, int reader)
+{
+    long *ids, i, reader_id = -1;
+    double start, secs;
+
+    ids = gw_malloc(sizeof(*ids) * threads);
+    running = 1;
+    if (reader)
+        reader_id = gwthread_create(reader_thread, NULL);
+    start = date_precise_now();
+    for (i = 0; i < threads; i++)
+        ids[i] = gwthread_create(func, NULL);
+    for (i = 0; i < threads; i++)
+        gwthread_join(ids[i]);
+    secs = date_precise_now() - start;
+    running = 0;
+    if (reader_id != -1)
+        gwthread_join(reader_id);
+    gw_free(ids);
+
+    info(0, "%-10s %ld threads: %.0f ops/s, %.1f ns per op", name, threads,
+         threads * loops / secs, secs * 1e9 / (threads * loops));
+}
+
+
+static void help(void)
+{
+    info(0, "Usage: test_counter [-t threads] [-n loops]");
+    info(0, "  -n is the number of increases done by each thread.");
+}
+
+
+int main(int argc, char **argv)
+{
+    int opt;
+    double rate;
+
+    gwlib_init();
+
+    while ((opt = getopt(argc, argv, "ht:n:")) != EOF) {
+        switch (opt) {
+        case 't':
+            threads = atol(optarg);
+            break;
+        case 'n':
+            loops = atol(optarg);
+            break;
+        case 'h':
+            help();
+            exit(0);
+        case '?':
+        default:
+            error(0, "Invalid option %c", opt);
+            help();
+            panic(0, "Stopping.");
+        }
+    }
+
+    counter = counter_create();
+    load = load_create_real(0);
+    load_add_interval(load, 60);
+    load_add_interval(load, -1);
+    mutex = mutex_create();
+
+    run("Mutex", mutex_thread, 0);
+    run("Counter", counter_thread, 0);
+    run("Load", load_thread, 1);
+
+    if (mutex_value != (unsigned long) (threads * loops))
+        panic(0, "Mutex counted %lu, expected %ld", mutex_value, threads * loops);
+    if (counter_value(counter) != (unsigned long) (threads * loops))
+        panic(0, "Counter counted %lu, expected %ld", counter_value(counter),
+              threads * loops);
+    /* the test ran well within the first minute, so the rate is total/elapsed */
+    rate = load_get(load, 1);
+    if (rate <= 0)
+        panic(0, "Load reports no load");
+
+    counter_set(counter, 1);
+    if (counter_decrease(counter) != 1 || counter_decrease(counter) != 0 ||
+        counter_value(counter) != 0)
+        panic(0, "counter_decrease went below zero");
+
+    counter_destroy(counter);
+    load_destroy(load);
+    mutex_destroy(mutex);
+
+    gwlib_shutdown();
+    return 0;
+}
@@ -64,6 +64,7 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <stdio.h>
+#include <signal.h>
 
 #include "gwlib/gwlib.h"
 #include "gwlib/http.h"
@@ -309,6 +310,14 @@ static void help(void)
     info(0, "    use this file as the SSL certificate authority");
     info(0, "-f");
     info(0, "    don't follow redirects");
+    info(0, "-L number");
+    info(0, "    open at most `number' connections to one server");
+    info(0, "-Q number");
+    info(0, "    queue at most `number' requests waiting for a connection");
+    info(0, "-D number");
+    info(0, "    pipeline up to `number' GET requests on one connection");
+    info(0, "-2");
+    info(0, "    use HTTP/2, negotiated for https and h2c for http servers");
 }
 
 int main(int argc, char **argv) 
@@ -327,9 +336,15 @@ int main(int argc, char **argv)
     double run_time;
     FILE *fp;
     int ssl = 0;
+#ifdef HAVE_LIBSSL
     Octstr *ca_file;
+#endif
+    unsigned long hits, misses, pipelined, queued, rejected;
     
     gwlib_init();
+
+    /* the server may close a kept-alive connection while we write to it */
+    signal(SIGPIPE, SIG_IGN);
     
     proxy = NULL;
     proxy_port = -1;
@@ -341,7 +356,7 @@ int main(int argc, char **argv)
     file = 0;
     fp = NULL;
     
-    while ((opt = getopt(argc, argv, "hv:qr:p:P:Se:t:i:a:u:sc:H:B:m:fC:")) != EOF) {
+    while ((opt = getopt(argc, argv, "hv:qr:p:P:Se:t:i:a:u:sc:H:B:m:fC:L:Q:D:2")) != EOF) {
 	switch (opt) {
 	case 'v':
 	    log_set_output_level(atoi(optarg));
@@ -452,9 +467,27 @@ int main(int argc, char **argv)
         break;
 
     case 'C':
+#ifdef HAVE_LIBSSL
         ca_file = octstr_create(optarg);
         conn_use_global_trusted_ca_file(ca_file);
         octstr_destroy(ca_file);
+#endif
+        break;
+
+    case 'L':
+        http_set_client_host_limits(atol(optarg), -1);
+        break;
+
+    case 'Q':
+        http_set_client_host_limits(-1, atol(optarg));
+        break;
+
+    case 'D':
+        http_set_client_pipeline_depth(atol(optarg));
+        break;
+
+    case '2':
+        http_set_client_h2(1, 1);
         break;
 
     case '?':
@@ -515,6 +548,9 @@ int main(int argc, char **argv)
     run_time = difftime(end, start);
     info(0, "%ld requests in %f seconds, %f requests/s.",
          (max_requests * num_threads), run_time, (max_requests * num_threads) / run_time);
+    if (http_client_pool_stats(&hits, &misses, &pipelined, &queued, &rejected) == 0)
+        info(0, "Connections: %lu reused, %lu new, %lu requests pipelined, "
+             "%lu queued, %lu rejected.", hits, misses, pipelined, queued, rejected);
     
     octstr_destroy(ssl_client_certkey_file);
     octstr_destroy(auth_username);
@@ -0,0 +1,438 @@
+/* ==================================================================== 
+ * The Kannel Software License, Version 1.0 
+ * 
+ * Copyright (c) 2001-2016 Kannel Group  
+ * Copyright (c) 1998-2001 WapIT Ltd.   
+ * All rights reserved. 
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions 
+ * are met: 
+ * 
+ * 1. Redistributions of source code must retain the above copyright 
+ *    notice, this list of conditions and the following disclaimer. 
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright 
+ *    notice, this list of conditions and the following disclaimer in 
+ *    the documentation and/or other materials provided with the 
+ *    distribution. 
+ * 
+ * 3. The end-user documentation included with the redistribution, 
+ *    if any, must include the following acknowledgment: 
+ *       "This product includes software developed by the 
+ *        Kannel Group (http://www.kannel.org/)." 
+ *    Alternately, this acknowledgment may appear in the software itself, 
+ *    if and wherever such third-party acknowledgments normally appear. 
+ * 
+ * 4. The names "Kannel" and "Kannel Group" must not be used to 
+ *    endorse or promote products derived from this software without 
+ *    prior written permission. For written permission, please  
+ *    contact org@kannel.org. 
+ * 
+ * 5. Products derived from this software may not be called "Kannel", 
+ *    nor may "Kannel" appear in their name, without prior written 
+ *    permission of the Kannel Group. 
+ * 
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESSED OR IMPLIED 
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES 
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+ * DISCLAIMED.  IN NO EVENT SHALL THE KANNEL GROUP OR ITS CONTRIBUTORS 
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,  
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT  
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR  
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,  
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE  
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,  
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. 
+ * ==================================================================== 
+ * 
+ * This software consists of voluntary contributions made by many 
+ * individuals on behalf of the Kannel Group.  For more information on  
+ * the Kannel Group, please see <http://www.kannel.org/>. 
+ * 
+ * Portions of this software are based upon software originally written at  
+ * WapIT Ltd., Helsinki, Finland for the Kannel project.  
+ */ 
+
+/*
+ * test_http2_server.c - a simple HTTP/2 server to test the HTTP/2 client
+ *
+ * Speaks h2c with prior knowledge on a plain TCP port, one thread per
+ * connection. Every request is answered with the reply text, a POST
+ * request with its own body. The highest number of requests that were
+ * open on a connection at the same time is logged when it is closed,
+ * to show how well the client multiplexes.
+ *
+ * Special paths:
+ *   /redirect - respond with 302 and the location /
+ *   /quit - shut the server down
+ */
+
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/socket.h>
+
+#include "gwlib/gwlib.h"
+
+#ifdef HAVE_NGHTTP2
+
+#include <nghttp2/nghttp2.h>
+
+static volatile sig_atomic_t run = 1;
+static Octstr *reply_text = NULL;
+static long max_streams = 100;
+static long goaway_after = 0;
+static int verbose = 0;
+
+typedef struct {
+    Connection *conn;
+    nghttp2_session *session;
+    long requests;      /* answered on this connection */
+    long open;          /* streams open right now */
+    long max_open;      /* highest value of open */
+} Client;
+
+typedef struct {
+    Octstr *method;
+    Octstr *path;
+    Octstr *body;
+    Octstr *reply;
+    long pos;
+} Stream;
+
+
+static void stream_destroy(Stream *stream)
+{
+    octstr_destroy(stream->method);
+    octstr_destroy(stream->path);
+    octstr_destroy(stream->body);
+    octstr_destroy(stream->reply);
+    gw_free(stream);
+}
+
+
+static ssize_t read_reply(nghttp2_session *session, int32_t stream_id,
+                          uint8_t *buf, size_t length, uint32_t *data_flags,
+                          nghttp2_data_source *source, void *user_data)
+{
+    Stream *stream = source->ptr;
+    long len;
+
+    len = octstr_len(stream->reply) - stream->pos;
+    if (len > (long) length)
+        len = length;
+    octstr_get_many_chars((char *) buf, stream->reply, stream->pos, len);
+    stream->pos += len;
+    if (stream->pos >= octstr_len(stream->reply))
+        *data_flags |= NGHTTP2_DATA_FLAG_EOF;
+    return len;
+}
+
+
+#define NV(name, value) \
+    { (uint8_t *) (name), (uint8_t *) (value), sizeof(name) - 1, \
+      strlen(value), NGHTTP2_NV_FLAG_NONE }
+
+static void respond(Client *client, int32_t stream_id, Stream *stream)
+{
+    nghttp2_data_provider provider;
+    char length[32];
+    const char *status = "200";
+
+    if (verbose)
+        debug("test.http2", 0, "Request %s %s on stream %ld",
+              octstr_get_cstr(stream->method), octstr_get_cstr(stream->path),
+              (long) stream_id);
+
+    if (octstr_str_compare(stream->path, "/quit") == 0)
+        run = 0;
+    if (octstr_str_compare(stream->method, "POST") == 0)
+        stream->reply = octstr_duplicate(stream->body);
+    else if (octstr_str_compare(stream->path, "/redirect") == 0) {
+        stream->reply = octstr_create("");
+        status = "302";
+    } else
+        stream->reply = octstr_duplicate(reply_text);
+    snprintf(length, sizeof(length), "%ld", octstr_len(stream->reply));
+
+    {
+        nghttp2_nv nva[] = {
+            NV(":status", status),
+            NV("content-type", "text/plain"),
+            NV("content-length", length),
+            NV("location", "/")
+        };
+        provider.source.ptr = stream;
+        provider.read_callback = read_reply;
+        nghttp2_submit_response(client->session, stream_id, nva,
+                                strcmp(status, "302") == 0 ? 4 : 3,
+                                octstr_str_compare(stream->method, "HEAD") == 0 ?
+                                NULL : &provider);
+    }
+
+    client->requests++;
+    if (goaway_after > 0 && client->requests == goaway_after) {
+        debug("test.http2", 0, "Going away after %ld requests.", client->requests);
+        nghttp2_submit_goaway(client->session, NGHTTP2_FLAG_NONE,
+                              nghttp2_session_get_last_proc_stream_id(client->session),
+                              NGHTTP2_NO_ERROR, NULL, 0);
+    }
+}
+
+
+static int on_begin_headers(nghttp2_session *session,
+                            const nghttp2_frame *frame, void *user_data)
+{
+    Client *client = user_data;
+    Stream *stream;
+
+    if (frame->hd.type != NGHTTP2_HEADERS ||
+        frame->headers.cat != NGHTTP2_HCAT_REQUEST)
+        return 0;
+
+    stream = gw_malloc(sizeof(*stream));
+    stream->method = octstr_create("");
+    stream->path = octstr_create("");
+    stream->body = octstr_create("");
+    stream->reply = NULL;
+    stream->pos = 0;
+    nghttp2_session_set_stream_user_data(session, frame->hd.stream_id, stream);
+
+    if (++client->open > client->max_open)
+        client->max_open = client->open;
+    return 0;
+}
+
+
+static int on_header(nghttp2_session *session, const nghttp2_frame *frame,
+                     const uint8_t *name, size_t namelen,
+                     const uint8_t *value, size_t valuelen,
+                     uint8_t flags, void *user_data)
+{
+    Stream *stream;
+
+    stream = nghttp2_session_get_stream_user_data(session, frame->hd.stream_id);
+    if (stream == NULL)
+        return 0;
+
+    if (namelen == 7 && memcmp(name, ":method", 7) == 0)
+        octstr_append_data(stream->method, (char *) value, valuelen);
+    else if (namelen == 5 && memcmp(name, ":path", 5) == 0)
+        octstr_append_data(stream->path, (char *) value, valuelen);
+    return 0;
+}
+
+
+static int on_data_chunk_recv(nghttp2_session *session, uint8_t flags,
+                              int32_t stream_id, const uint8_t *data,
+                              size_t len, void *user_data)
+{
+    Stream *stream;
+
+    stream = nghttp2_session_get_stream_user_data(session, stream_id);
+    if (stream != NULL)
+        octstr_append_data(stream->body, (char *) data, len);
+    return 0;
+}
+
+
+static int on_frame_recv(nghttp2_session *session, const nghttp2_frame *frame,
+                         void *user_data)
+{
+    Stream *stream;
+
+    if ((frame->hd.type != NGHTTP2_HEADERS && frame->hd.type != NGHTTP2_DATA) ||
+        !(frame->hd.flags & NGHTTP2_FLAG_END_STREAM))
+        return 0;
+
+    stream = nghttp2_session_get_stream_user_data(session, frame->hd.stream_id);
+    if (stream != NULL)
+        respond(user_data, frame->hd.stream_id, stream);
+    return 0;
+}
+
+
+static int on_stream_close(nghttp2_session *session, int32_t stream_id,
+                           uint32_t error_code, void *user_data)
+{
+    Client *client = user_data;
+    Stream *stream;
+
+    stream = nghttp2_session_get_stream_user_data(session, stream_id);
+    if (stream != NULL) {
+        client->open--;
+        stream_destroy(stream);
+    }
+    return 0;
+}
+
+
+static void client_thread(void *arg)
+{
+    Client client;
+    nghttp2_session_callbacks *callbacks;
+    nghttp2_settings_entry settings[1];
+    const uint8_t *data;
+    Octstr *in, *out;
+    ssize_t len;
+
+    client.conn = arg;
+    client.requests = client.open = client.max_open = 0;
+
+    nghttp2_session_callbacks_new(&callbacks);
+    nghttp2_session_callbacks_set_on_begin_headers_callback(callbacks, on_begin_headers);
+    nghttp2_session_callbacks_set_on_header_callback(callbacks, on_header);
+    nghttp2_session_callbacks_set_on_data_chunk_recv_callback(callbacks, on_data_chunk_recv);
+    nghttp2_session_callbacks_set_on_frame_recv_callback(callbacks, on_frame_recv);
+    nghttp2_session_callbacks_set_on_stream_close_callback(callbacks, on_stream_close);
+    nghttp2_session_server_new(&client.session, callbacks, &client);
+    nghttp2_session_callbacks_del(callbacks);
+
+    settings[0].settings_id = NGHTTP2_SETTINGS_MAX_CONCURRENT_STREAMS;
+    settings[0].value = max_streams;
+    nghttp2_submit_settings(client.session, NGHTTP2_FLAG_NONE, settings, 1);
+
+    while (run && (nghttp2_session_want_read(client.session) ||
+                   nghttp2_session_want_write(client.session))) {
+        out = octstr_create("");
+        while ((len = nghttp2_session_mem_send(client.session, &data)) > 0)
+            octstr_append_data(out, (char *) data, len);
+        if (len >= 0 && octstr_len(out) > 0 &&
+            (conn_write(client.conn, out) == -1 || conn_flush(client.conn) == -1))
+            len = -1;
+        octstr_destroy(out);
+        if (len < 0)
+            break;
+        if (!nghttp2_session_want_read(client.session))
+            continue;
+        if (conn_wait(client.conn, 1.0) == -1)
+            break;
+        if ((in = conn_read_everything(client.conn)) != NULL) {
+            len = nghttp2_session_mem_recv(client.session,
+                                           (const uint8_t *) octstr_get_cstr(in),
+                                           octstr_len(in));
+            octstr_destroy(in);
+            if (len < 0) {
+                error(0, "Receiving failed: %s", nghttp2_strerror(len));
+                break;
+            }
+        }
+        if (conn_eof(client.conn) || conn_error(client.conn))
+            break;
+    }
+
+    info(0, "Connection closed after %ld requests, up to %ld at the same time.",
+         client.requests, client.max_open);
+    nghttp2_session_del(client.session);
+    conn_destroy(client.conn);
+}
+
+
+static void sigterm(int signo)
+{
+    run = 0;
+}
+
+
+static void help(void)
+{
+    info(0, "Usage: test_http2_server [options...]");
+    info(0, "where options are:");
+    info(0, "-v number");
+    info(0, "    set log level for stderr logging (default: 0 - debug)");
+    info(0, "-p port");
+    info(0, "    bind server to a specific port (default: 8080)");
+    info(0, "-r reply_text");
+    info(0, "    defines which static text to use for replies");
+    info(0, "-c number");
+    info(0, "    allow `number' concurrent requests per connection (default: 100)");
+    info(0, "-g number");
+    info(0, "    send GOAWAY after answering `number' requests on a connection");
+    info(0, "-V");
+    info(0, "    log every request");
+    info(0, "-h");
+    info(0, "    provides this usage help information");
+}
+
+
+int main(int argc, char **argv)
+{
+    int opt, fd, client;
+    int port = 8080;
+    struct sockaddr_storage sa;
+    socklen_t salen;
+
+    gwlib_init();
+
+    while ((opt = getopt(argc, argv, "hv:p:r:c:g:V")) != EOF) {
+        switch (opt) {
+        case 'v':
+            log_set_output_level(atoi(optarg));
+            break;
+        case 'p':
+            port = atoi(optarg);
+            break;
+        case 'r':
+            reply_text = octstr_create(optarg);
+            break;
+        case 'c':
+            max_streams = atol(optarg);
+            break;
+        case 'g':
+            goaway_after = atol(optarg);
+            break;
+        case 'V':
+            verbose = 1;
+            break;
+        case 'h':
+            help();
+            exit(0);
+        case '?':
+        default:
+            error(0, "Invalid option %c", opt);
+            help();
+            panic(0, "Stopping.");
+        }
+    }
+
+    if (reply_text == NULL)
+        reply_text = octstr_create("Sent.");
+
+    signal(SIGINT, sigterm);
+    signal(SIGTERM, sigterm);
+    signal(SIGPIPE, SIG_IGN);
+
+    if ((fd = make_server_socket(port, NULL)) == -1)
+        panic(0, "Could not open port %d.", port);
+    info(0, "HTTP/2 server listening on port %d.", port);
+
+    while (run) {
+        if (gwthread_pollfd(fd, POLLIN, 1.0) <= 0)
+            continue;
+        salen = sizeof(sa);
+        if ((client = accept(fd, (struct sockaddr *) &sa, &salen)) == -1)
+            continue;
+        socket_set_nodelay(client, 1);
+        if (gwthread_create(client_thread, conn_wrap_fd(client, 0)) == -1)
+            close(client);
+    }
+
+    close(fd);
+    gwthread_join_every(client_thread);
+    octstr_destroy(reply_text);
+    gwlib_shutdown();
+    return 0;
+}
+
+#else
+
+int main(int argc, char **argv)
+{
+    gwlib_init();
+    panic(0, "HTTP/2 support not compiled in, configure --with-nghttp2.");
+    gwlib_shutdown();
+    return 0;
+}
+
+#endif /* HAVE_NGHTTP2 */
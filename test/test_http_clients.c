@@ -0,0 +1,307 @@
+/* ==================================================================== 
+ * The Kannel Software License, Version 1.0 
+ * 
+ * Copyright (c) 2001-2016 Kannel Group  
+ * Copyright (c) 1998-2001 WapIT Ltd.   
+ * All rights reserved. 
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions 
+ * are met: 
+ * 
+ * 1. Redistributions of source code must retain the above copyright 
+ *    notice, this list of conditions and the following disclaimer. 
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright 
+ *    notice, this list of conditions and the following disclaimer in 
+ *    the documentation and/or other materials provided with the 
+ *    distribution. 
+ * 
+ * 3. The end-user documentation included with the redistribution, 
+ *    if any, must include the following acknowledgment: 
+ *       "This product includes software developed by the 
+ *        Kannel Group (http://www.kannel.org/)." 
+ *    Alternately, this acknowledgment may appear in the software itself, 
+ *    if and wherever such third-party acknowledgments normally appear. 
+ * 
+ * 4. The names "Kannel" and "Kannel Group" must not be used to 
+ *    endorse or promote products derived from this software without 
+ *    prior written permission. For written permission, please  
+ *    contact org@kannel.org. 
+ * 
+ * 5. Products derived from this software may not be called "Kannel", 
+ *    nor may "Kannel" appear in their name, without prior written 
+ *    permission of the Kannel Group. 
+ * 
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESSED OR IMPLIED 
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES 
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+ * DISCLAIMED.  IN NO EVENT SHALL THE KANNEL GROUP OR ITS CONTRIBUTORS 
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,  
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT  
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR  
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,  
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE  
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,  
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. 
+ * ==================================================================== 
+ * 
+ * This software consists of voluntary contributions made by many 
+ * individuals on behalf of the Kannel Group.  For more information on  
+ * the Kannel Group, please see <http://www.kannel.org/>. 
+ * 
+ * Portions of this software are based upon software originally written at  
+ * WapIT Ltd., Helsinki, Finland for the Kannel project.  
+ */ 
+
+/*
+ * test_http_clients.c - load a HTTP(S) server with many concurrent clients
+ *
+ * A number of client threads send GET requests over keep-alive
+ * connections, or over a new connection for each request, while
+ * another set of connections is opened and left idle. For an HTTPS
+ * server the idle connections never start their handshake, which must
+ * not keep the server from serving the busy clients. The request rate
+ * and the slowest response are printed at the end.
+ */
+
+#include <unistd.h>
+
+#include "gwlib/gwlib.h"
+
+#define MAX_THREADS 1024
+
+static Octstr *host;
+static Octstr *path;
+static int port;
+#ifdef HAVE_LIBSSL
+static int ssl = 0;
+#endif
+static int reconnect = 0;
+static long requests = 10;
+static double timeout = 30;
+
+static Counter *ok;
+static Counter *failed;
+static Mutex *slowest_lock;
+static double slowest = 0;
+
+
+static Connection *open_connection(void)
+{
+#ifdef HAVE_LIBSSL
+    if (ssl)
+        return conn_open_ssl(host, port, NULL, NULL);
+#endif
+    return conn_open_tcp(host, port, NULL);
+}
+
+
+/* Wait for a line, NULL if the connection broke or timed out. */
+static Octstr *read_line(Connection *conn)
+{
+    Octstr *line;
+
+    while ((line = conn_read_line(conn)) == NULL) {
+        if (conn_eof(conn) || conn_error(conn))
+            return NULL;
+        if (conn_wait(conn, timeout) != 0)
+            return NULL;
+    }
+    return line;
+}
+
+
+/* Read one response and return its status code, -1 on failure. */
+static int read_response(Connection *conn)
+{
+    Octstr *line, *body;
+    long len = 0, status = -1, pos;
+
+    if ((line = read_line(conn)) == NULL)
+        return -1;
+    if ((pos = octstr_search_char(line, ' ', 0)) > 0)
+        octstr_parse_long(&status, line, pos + 1, 10);
+    octstr_destroy(line);
+
+    while ((line = read_line(conn)) != NULL && octstr_len(line) > 0) {
+        if (octstr_case_nsearch(line, octstr_imm("Content-Length:"), 0, 15) == 0)
+            octstr_parse_long(&len, line, 15, 10);
+        octstr_destroy(line);
+    }
+    if (line == NULL)
+        return -1;
+    octstr_destroy(line);
+
+    while ((body = conn_read_fixed(conn, len)) == NULL) {
+        if (conn_eof(conn) || conn_error(conn) || conn_wait(conn, timeout) != 0)
+            return -1;
+    }
+    octstr_destroy(body);
+
+    return status;
+}
+
+
+static void client_thread(void *arg)
+{
+    Connection *conn = NULL;
+    Octstr *request;
+    double start, took;
+    long i;
+
+    request = octstr_format("GET %S HTTP/1.1\r\nHost: %S:%d\r\n"
+                            "Connection: %s\r\n\r\n", path, host, port,
+                            reconnect ? "close" : "keep-alive");
+
+    for (i = 0; i < requests; i++) {
+        start = date_precise_now();
+        if (conn == NULL && (conn = open_connection()) == NULL) {
+            counter_increase(failed);
+            continue;
+        }
+        if (conn_write(conn, request) == -1 || read_response(conn) != HTTP_OK) {
+            counter_increase(failed);
+            conn_destroy(conn);
+            conn = NULL;
+            continue;
+        }
+        took = date_precise_now() - start;
+        counter_increase(ok);
+        mutex_lock(slowest_lock);
+        if (took > slowest)
+            slowest = took;
+        mutex_unlock(slowest_lock);
+        if (reconnect) {
+            conn_destroy(conn);
+            conn = NULL;
+        }
+    }
+
+    if (conn != NULL)
+        conn_destroy(conn);
+    octstr_destroy(request);
+}
+
+
+static void help(void)
+{
+    info(0, "Usage: test_http_clients [options...] host port");
+    info(0, "where options are:");
+    info(0, "-c number");
+    info(0, "    number of concurrent clients (default: 10)");
+    info(0, "-n number");
+    info(0, "    number of requests per client (default: 10)");
+    info(0, "-i number");
+    info(0, "    number of idle connections to hold open (default: 0)");
+    info(0, "-r");
+    info(0, "    use a new connection for every request");
+    info(0, "-s");
+    info(0, "    connect with SSL");
+    info(0, "-u path");
+    info(0, "    path to request (default: /)");
+    info(0, "-t seconds");
+    info(0, "    give up on a response after this time (default: 30)");
+    info(0, "-v number");
+    info(0, "    set log level for stderr logging (default: 0 - debug)");
+}
+
+
+int main(int argc, char **argv)
+{
+    int opt;
+    long i, clients = 10, idle = 0, failures;
+    long threads[MAX_THREADS];
+    List *idle_conns;
+    Connection *conn;
+    double start, took;
+
+    gwlib_init();
+
+    path = octstr_create("/");
+
+    while ((opt = getopt(argc, argv, "hc:n:i:rsu:t:v:")) != EOF) {
+        switch (opt) {
+        case 'c':
+            clients = atol(optarg);
+            if (clients > MAX_THREADS)
+                clients = MAX_THREADS;
+            break;
+        case 'n':
+            requests = atol(optarg);
+            break;
+        case 'i':
+            idle = atol(optarg);
+            break;
+        case 'r':
+            reconnect = 1;
+            break;
+        case 's':
+#ifdef HAVE_LIBSSL
+            ssl = 1;
+#else
+            panic(0, "SSL support not compiled in.");
+#endif
+            break;
+        case 'u':
+            octstr_destroy(path);
+            path = octstr_create(optarg);
+            break;
+        case 't':
+            timeout = atof(optarg);
+            break;
+        case 'v':
+            log_set_output_level(atoi(optarg));
+            break;
+        case 'h':
+            help();
+            exit(0);
+        case '?':
+        default:
+            error(0, "Invalid option %c", opt);
+            help();
+            panic(0, "Stopping.");
+        }
+    }
+    if (optind + 2 != argc) {
+        help();
+        exit(0);
+    }
+    host = octstr_create(argv[optind]);
+    port = atoi(argv[optind + 1]);
+
+    ok = counter_create();
+    failed = counter_create();
+    slowest_lock = mutex_create();
+
+    /* plain TCP connections, so that an SSL server waits for the handshake */
+    idle_conns = gwlist_create();
+    for (i = 0; i < idle; i++) {
+        if ((conn = conn_open_tcp(host, port, NULL)) == NULL)
+            panic(0, "Could not open idle connection %ld.", i);
+        gwlist_append(idle_conns, conn);
+    }
+    info(0, "Holding %ld idle connections.", idle);
+
+    start = date_precise_now();
+    for (i = 0; i < clients; i++)
+        threads[i] = gwthread_create(client_thread, NULL);
+    for (i = 0; i < clients; i++)
+        gwthread_join(threads[i]);
+    took = date_precise_now() - start;
+
+    info(0, "%ld requests ok, %ld failed in %.3f s, %.1f requests/s, "
+         "slowest %.3f s", counter_value(ok), counter_value(failed),
+         took, counter_value(ok) / took, slowest);
+    failures = counter_value(failed);
+
+    gwlist_destroy(idle_conns, (void (*)(void *)) conn_destroy);
+    counter_destroy(ok);
+    counter_destroy(failed);
+    mutex_destroy(slowest_lock);
+    octstr_destroy(host);
+    octstr_destroy(path);
+    gwlib_shutdown();
+
+    return failures > 0;
+}
@@ -276,6 +276,8 @@ static void help(void) {
     info(0, "    bind server to a specific port");
     info(0, "-s");
     info(0, "    be an SSL-enabled server");
+    info(0, "-m number");
+    info(0, "    maximum number of open client connections (default: 500)");
     info(0, "-c ssl_cert");
     info(0, "    file of the SSL certificate to use");
     info(0, "-k ssl_key");
@@ -346,7 +348,7 @@ int main(int argc, char **argv) {
 
     reply_text = octstr_create("Sent.");
 
-    while ((opt = getopt(argc, argv, "hqv:p:t:f:l:sc:k:b:w:r:H:")) != EOF) {
+    while ((opt = getopt(argc, argv, "hqv:p:t:f:l:sc:k:b:w:r:H:m:")) != EOF) {
 	switch (opt) {
 	case 'v':
 	    log_set_output_level(atoi(optarg));
@@ -394,6 +396,10 @@ int main(int argc, char **argv) {
 	    filename = optarg;
 	    break;
 
+	case 'm':
+	    http_set_server_max_clients(atol(optarg));
+	    break;
+
 	case 'l':
 	    octstr_destroy(log_filename);
 	    log_filename = octstr_create(optarg);
@@ -0,0 +1,208 @@
+/* ==================================================================== 
+ * The Kannel Software License, Version 1.0 
+ * 
+ * Copyright (c) 2001-2016 Kannel Group  
+ * Copyright (c) 1998-2001 WapIT Ltd.   
+ * All rights reserved. 
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions 
+ * are met: 
+ * 
+ * 1. Redistributions of source code must retain the above copyright 
+ *    notice, this list of conditions and the following disclaimer. 
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright 
+ *    notice, this list of conditions and the following disclaimer in 
+ *    the documentation and/or other materials provided with the 
+ *    distribution. 
+ * 
+ * 3. The end-user documentation included with the redistribution, 
+ *    if any, must include the following acknowledgment: 
+ *       "This product includes software developed by the 
+ *        Kannel Group (http://www.kannel.org/)." 
+ *    Alternately, this acknowledgment may appear in the software itself, 
+ *    if and wherever such third-party acknowledgments normally appear. 
+ * 
+ * 4. The names "Kannel" and "Kannel Group" must not be used to 
+ *    endorse or promote products derived from this software without 
+ *    prior written permission. For written permission, please  
+ *    contact org@kannel.org. 
+ * 
+ * 5. Products derived from this software may not be called "Kannel", 
+ *    nor may "Kannel" appear in their name, without prior written 
+ *    permission of the Kannel Group. 
+ * 
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESSED OR IMPLIED 
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES 
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+ * DISCLAIMED.  IN NO EVENT SHALL THE KANNEL GROUP OR ITS CONTRIBUTORS 
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,  
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT  
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR  
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,  
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE  
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,  
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. 
+ * ==================================================================== 
+ * 
+ * This software consists of voluntary contributions made by many 
+ * individuals on behalf of the Kannel Group.  For more information on  
+ * the Kannel Group, please see <http://www.kannel.org/>. 
+ * 
+ * Portions of this software are based upon software originally written at  
+ * WapIT Ltd., Helsinki, Finland for the Kannel project.  
+ */ 
+
+/*
+ * test_msg_alloc.c - count the octet string allocations done per Msg
+ *
+ * Creates, packs, unpacks, duplicates and shares a number of sms messages
+ * and reports how many octet strings and separate data buffers each step
+ * allocated per message, and how many strings were shared by interning.
+ */
+
+#include <unistd.h>
+
+#include "gwlib/gwlib.h"
+#include "gw/msg.h"
+#include "gw/sms.h"
+
+static long messages = 10000;
+
+
+static Msg *make_msg(long i)
+{
+    Msg *msg;
+
+    msg = msg_create(sms);
+    msg->sms.sender = octstr_format("+35840%07ld", i);
+    msg->sms.receiver = octstr_create("12345");
+    msg->sms.msgdata = octstr_format("test message number %ld", i);
+    msg->sms.smsc_id = octstr_create("fake");
+    msg->sms.service = octstr_create("default");
+    msg->sms.account = octstr_create("customer");
+    msg->sms.boxc_id = octstr_create("smsbox");
+    msg->sms.time = time(NULL);
+    msg->sms.sms_type = mt_push;
+    msg->sms.coding = DC_7BIT;
+    return msg;
+}
+
+
+static void report(const char *what, unsigned long *last)
+{
+    unsigned long strings, buffers, interned;
+
+    octstr_alloc_stats(&strings, &buffers, &interned);
+    info(0, "%-10s %6.2f strings, %6.2f buffers, %6.2f interned per message",
+         what, (double) (strings - last[0]) / messages,
+         (double) (buffers - last[1]) / messages,
+         (double) (interned - last[2]) / messages);
+    last[0] = strings;
+    last[1] = buffers;
+    last[2] = interned;
+}
+
+
+static void help(void)
+{
+    info(0, "Usage: test_msg_alloc [-n messages]");
+}
+
+
+int main(int argc, char **argv)
+{
+    unsigned long last[3];
+    Msg **msgs, **copies;
+    Octstr **packed;
+    long i;
+    int opt;
+
+    gwlib_init();
+
+    while ((opt = getopt(argc, argv, "hn:")) != EOF) {
+        switch (opt) {
+        case 'n':
+            messages = atol(optarg);
+            break;
+        case 'h':
+            help();
+            exit(0);
+        default:
+            error(0, "Invalid option %c", opt);
+            help();
+            panic(0, "Stopping.");
+        }
+    }
+    if (messages <= 0)
+        panic(0, "Message count must be positive.");
+
+    log_set_output_level(GW_INFO);
+
+    msgs = gw_malloc(messages * sizeof(*msgs));
+    copies = gw_malloc(messages * sizeof(*copies));
+    packed = gw_malloc(messages * sizeof(*packed));
+
+    octstr_alloc_stats(&last[0], &last[1], &last[2]);
+    for (i = 0; i < messages; ++i)
+        msgs[i] = make_msg(i);
+    report("create", last);
+
+    for (i = 0; i < messages; ++i)
+        packed[i] = msg_pack(msgs[i]);
+    report("pack", last);
+
+    for (i = 0; i < messages; ++i) {
+        msg_destroy(msgs[i]);
+        msgs[i] = msg_unpack(packed[i]);
+        octstr_destroy(packed[i]);
+    }
+    report("unpack", last);
+
+    for (i = 0; i < messages; ++i) {
+        packed[i] = octstr_create("");
+        msg_pack_packed(msgs[i], packed[i]);
+    }
+    report("pack2", last);
+
+    for (i = 0; i < messages; ++i) {
+        msg_destroy(msgs[i]);
+        msgs[i] = msg_unpack_slice(packed[i], 0, octstr_len(packed[i]));
+        octstr_destroy(packed[i]);
+    }
+    report("unpack2", last);
+
+    for (i = 0; i < messages; ++i)
+        copies[i] = msg_duplicate(msgs[i]);
+    report("duplicate", last);
+
+    for (i = 0; i < messages; ++i) {
+        msg_destroy(copies[i]);
+        copies[i] = msg_share(msgs[i]);
+    }
+    report("share", last);
+
+    for (i = 0; i < messages; ++i) {
+        msg_destroy(copies[i]);
+        copies[i] = msg_ref(msgs[i]);
+    }
+    report("ref", last);
+
+    /* the bearerbox keeps the message after a reference was dropped */
+    for (i = 0; i < messages; ++i) {
+        msg_destroy(copies[i]);
+        copies[i] = msg_unshare(msgs[i]);
+        gw_assert(copies[i] == msgs[i]);
+    }
+    report("unshare", last);
+
+    for (i = 0; i < messages; ++i)
+        msg_destroy(copies[i]);
+    gw_free(msgs);
+    gw_free(copies);
+    gw_free(packed);
+
+    gwlib_shutdown();
+    return 0;
+}
@@ -0,0 +1,192 @@
+/* ==================================================================== 
+ * The Kannel Software License, Version 1.0 
+ * 
+ * Copyright (c) 2001-2016 Kannel Group  
+ * Copyright (c) 1998-2001 WapIT Ltd.   
+ * All rights reserved. 
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions 
+ * are met: 
+ * 
+ * 1. Redistributions of source code must retain the above copyright 
+ *    notice, this list of conditions and the following disclaimer. 
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright 
+ *    notice, this list of conditions and the following disclaimer in 
+ *    the documentation and/or other materials provided with the 
+ *    distribution. 
+ * 
+ * 3. The end-user documentation included with the redistribution, 
+ *    if any, must include the following acknowledgment: 
+ *       "This product includes software developed by the 
+ *        Kannel Group (http://www.kannel.org/)." 
+ *    Alternately, this acknowledgment may appear in the software itself, 
+ *    if and wherever such third-party acknowledgments normally appear. 
+ * 
+ * 4. The names "Kannel" and "Kannel Group" must not be used to 
+ *    endorse or promote products derived from this software without 
+ *    prior written permission. For written permission, please  
+ *    contact org@kannel.org. 
+ * 
+ * 5. Products derived from this software may not be called "Kannel", 
+ *    nor may "Kannel" appear in their name, without prior written 
+ *    permission of the Kannel Group. 
+ * 
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESSED OR IMPLIED 
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES 
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+ * DISCLAIMED.  IN NO EVENT SHALL THE KANNEL GROUP OR ITS CONTRIBUTORS 
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,  
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT  
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR  
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,  
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE  
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,  
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. 
+ * ==================================================================== 
+ * 
+ * This software consists of voluntary contributions made by many 
+ * individuals on behalf of the Kannel Group.  For more information on  
+ * the Kannel Group, please see <http://www.kannel.org/>. 
+ * 
+ * Portions of this software are based upon software originally written at  
+ * WapIT Ltd., Helsinki, Finland for the Kannel project.  
+ */ 
+
+/*
+ * test_numhash.c - build and lookup benchmark for numhash
+ *
+ * Generates a list of random 12 digit numbers and a few prefixes,
+ * builds a Numhash from it and checks that every listed number is
+ * found, that numbers under a prefix are found and that other numbers
+ * are not. Build time, memory used and lookup time are reported.
+ */
+
+#include <unistd.h>
+
+#include "gwlib/gwlib.h"
+#include "gw/numhash.h"
+
+#define BASE    100000000000LL
+#define RANGE   900000000000LL
+#define PREFIX  "35840"
+
+static long numbers = 1000000;
+static long lookups = 1000000;
+
+
+static long long random_number(void)
+{
+    long long n;
+
+    n = ((long long) gw_rand() << 31) ^ gw_rand();
+    return BASE + (n % RANGE);
+}
+
+
+/* numbers under PREFIX are left out of the list, they match the prefix */
+static int under_prefix(long long n)
+{
+    return n / 10000000 == atoll(PREFIX);
+}
+
+
+static void help(void)
+{
+    info(0, "Usage: test_numhash [-n numbers] [-l lookups]");
+}
+
+
+int main(int argc, char **argv)
+{
+    int opt;
+    long i, found, mem;
+    long long *keys, n;
+    Octstr *data, *nro;
+    Numhash *table;
+    double start, secs;
+
+    gwlib_init();
+
+    while ((opt = getopt(argc, argv, "hn:l:")) != EOF) {
+        switch (opt) {
+        case 'n':
+            numbers = atol(optarg);
+            break;
+        case 'l':
+            lookups = atol(optarg);
+            break;
+        case 'h':
+            help();
+            exit(0);
+        case '?':
+        default:
+            error(0, "Invalid option %c", opt);
+            help();
+            panic(0, "Stopping.");
+        }
+    }
+
+    keys = gw_malloc(sizeof(*keys) * numbers);
+    data = octstr_create("# test list\n");
+    for (i = 0; i < numbers; i++) {
+        do {
+            keys[i] = random_number();
+        } while (under_prefix(keys[i]));
+        octstr_format_append(data, "+%lld\n", keys[i]);
+    }
+    octstr_append_cstr(data, "+" PREFIX "* : prefix\n");
+
+    start = date_precise_now();
+    table = numhash_create_from_octstr(data);
+    secs = date_precise_now() - start;
+    if (table == NULL)
+        panic(0, "Could not create numhash.");
+    mem = numhash_memory(table);
+    info(0, "build    %ld numbers in %.2f s, %d entries, %ld bytes (%.2f per number)",
+         numbers, secs, numhash_size(table), mem, (double) mem / numbers);
+    info(0, "old      hash would need about %ld bytes",
+         (long) (numbers * (sizeof(long long) + sizeof(void *)) +
+                 2 * numbers * sizeof(void *)));
+
+    /* every listed number must be found */
+    start = date_precise_now();
+    for (i = 0; i < lookups; i++) {
+        n = keys[gw_rand() % numbers];
+        if (numhash_find_key(table, n) != 1)
+            panic(0, "Number %lld not found.", n);
+    }
+    secs = date_precise_now() - start;
+    info(0, "hits     %.1f ns per lookup", secs * 1e9 / lookups);
+
+    /* random numbers are almost never listed */
+    found = 0;
+    start = date_precise_now();
+    for (i = 0; i < lookups; i++)
+        found += numhash_find_key(table, random_number());
+    secs = date_precise_now() - start;
+    info(0, "random   %.1f ns per lookup, %ld found", secs * 1e9 / lookups, found);
+
+    /* prefix matches go through numhash_find_number */
+    nro = octstr_format("+%s1234567", PREFIX);
+    if (numhash_find_number(table, nro) != 1)
+        panic(0, "Prefix %s not matched by %s.", PREFIX, octstr_get_cstr(nro));
+    octstr_destroy(nro);
+    nro = octstr_format("+%s1234567", "35850");
+    found = numhash_find_number(table, nro);
+    octstr_destroy(nro);
+    nro = octstr_format("+%lld", keys[0]);
+    if (numhash_find_number(table, nro) != 1)
+        panic(0, "Number %s not found.", octstr_get_cstr(nro));
+    octstr_destroy(nro);
+    info(0, "prefix   ok (+358501234567 %s)", found ? "listed" : "not listed");
+
+    numhash_destroy(table);
+    octstr_destroy(data);
+    gw_free(keys);
+
+    gwlib_shutdown();
+
+    return 0;
+}
@@ -68,6 +68,11 @@ static int my_cmp(const void *a, const void *b)
     return octstr_compare((Octstr*) a, (Octstr*) b);
 } 
 
+static long my_bucket(const void *a)
+{
+    return octstr_get_char((Octstr*) a, 0) - '0';
+}
+
 static void my_dump(const void *a, long index)
 {    
     debug("", 0, "dump(%p, %ld) called", a, index);    
@@ -76,9 +81,9 @@ static void my_dump(const void *a, long index)
 
 int main()
 {    
-    Octstr *os;    
+    Octstr *os, *other, *name;
     long i;    
-    gw_prioqueue_t *queue;    
+    gw_prioqueue_t *queue, *sibling;
     
     gwlib_init();
     
@@ -101,6 +106,46 @@ int main()
     }   
     
     debug("", 0, "gw_prioqueue_len=%ld", gw_prioqueue_len(queue));    
+    gw_prioqueue_destroy(queue, octstr_destroy_item);
+
+    /* bucketed queue keeps insert order within one priority */
+    os = octstr_imm("3a1b3c2d1e");
+    queue = gw_prioqueue_create_buckets(4, my_bucket);
+    for (i = 0; i < octstr_len(os); i += 2)
+        gw_prioqueue_insert(queue, octstr_copy(os, i, 2));
+    gw_prioqueue_foreach(queue, my_dump);
+    os = octstr_create("");
+    while ((other = gw_prioqueue_remove(queue))) {
+        octstr_append(os, other);
+        octstr_destroy(other);
+    }
+    debug("", 0, "buckets: %s", octstr_get_cstr(os));
+    if (octstr_str_compare(os, "3a3c2d1b1e") != 0)
+        panic(0, "bucketed queue returned wrong order");
+    octstr_destroy(os);
+    gw_prioqueue_destroy(queue, octstr_destroy_item);
+
+    /* empty shards take over items of their siblings */
+    name = octstr_create("group");
+    queue = gw_prioqueue_create_buckets(4, my_bucket);
+    sibling = gw_prioqueue_create_buckets(4, my_bucket);
+    gw_prioqueue_join(queue, name);
+    gw_prioqueue_join(sibling, name);
+    gw_prioqueue_insert(sibling, octstr_create("1x"));
+    gw_prioqueue_insert(sibling, octstr_create("2y"));
+    if (gw_prioqueue_len(queue) != 0 || gw_prioqueue_group_len(queue) != 2)
+        panic(0, "wrong group length");
+    os = gw_prioqueue_steal(queue);
+    debug("", 0, "stolen: %s", octstr_get_cstr(os));
+    if (octstr_str_compare(os, "2y") != 0)
+        panic(0, "steal returned wrong item");
+    octstr_destroy(os);
+    gw_prioqueue_leave(sibling);
+    if (gw_prioqueue_steal(queue) != NULL)
+        panic(0, "steal from a queue that left the group");
+    gw_prioqueue_destroy(sibling, octstr_destroy_item);
+    gw_prioqueue_destroy(queue, octstr_destroy_item);
+    octstr_destroy(name);
     
     gwlib_shutdown();    
     return 0;
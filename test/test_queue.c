@@ -0,0 +1,271 @@
+/* ==================================================================== 
+ * The Kannel Software License, Version 1.0 
+ * 
+ * Copyright (c) 2001-2016 Kannel Group  
+ * Copyright (c) 1998-2001 WapIT Ltd.   
+ * All rights reserved. 
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions 
+ * are met: 
+ * 
+ * 1. Redistributions of source code must retain the above copyright 
+ *    notice, this list of conditions and the following disclaimer. 
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright 
+ *    notice, this list of conditions and the following disclaimer in 
+ *    the documentation and/or other materials provided with the 
+ *    distribution. 
+ * 
+ * 3. The end-user documentation included with the redistribution, 
+ *    if any, must include the following acknowledgment: 
+ *       "This product includes software developed by the 
+ *        Kannel Group (http://www.kannel.org/)." 
+ *    Alternately, this acknowledgment may appear in the software itself, 
+ *    if and wherever such third-party acknowledgments normally appear. 
+ * 
+ * 4. The names "Kannel" and "Kannel Group" must not be used to 
+ *    endorse or promote products derived from this software without 
+ *    prior written permission. For written permission, please  
+ *    contact org@kannel.org. 
+ * 
+ * 5. Products derived from this software may not be called "Kannel", 
+ *    nor may "Kannel" appear in their name, without prior written 
+ *    permission of the Kannel Group. 
+ * 
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESSED OR IMPLIED 
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES 
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+ * DISCLAIMED.  IN NO EVENT SHALL THE KANNEL GROUP OR ITS CONTRIBUTORS 
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,  
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT  
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR  
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,  
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE  
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,  
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. 
+ * ==================================================================== 
+ * 
+ * This software consists of voluntary contributions made by many 
+ * individuals on behalf of the Kannel Group.  For more information on  
+ * the Kannel Group, please see <http://www.kannel.org/>. 
+ * 
+ * Portions of this software are based upon software originally written at  
+ * WapIT Ltd., Helsinki, Finland for the Kannel project.  
+ */ 
+
+/*
+ * test_queue.c - compare gw_queue_t against List under N producers and
+ *                M consumers
+ *
+ * Every producer appends a sequence of tagged items; consumers check
+ * that items from the same producer arrive in order and that nothing is
+ * lost, and the throughput of both queue types is reported. Items put
+ * back with gw_queue_insert_head() must come out before all others.
+ */
+
+#include <unistd.h>
+
+#include "gwlib/gwlib.h"
+#include "gwlib/gw-queue.h"
+
+#define ITEM(producer, seq) ((void *) ((((unsigned long) (producer)) << 32 | (seq)) + 1))
+#define ITEM_PRODUCER(item) ((((unsigned long) (item)) - 1) >> 32)
+#define ITEM_SEQ(item) ((((unsigned long) (item)) - 1) & 0xffffffffUL)
+
+static long producers = 4;
+static long consumers = 4;
+static long items = 1000000;
+static long capacity = 0;
+static int use_list = 0;
+
+static void *queue;
+static Counter *next_producer;
+static Counter *received;
+static Counter *errors;
+
+
+static void produce(void *item)
+{
+    if (use_list)
+        gwlist_produce(queue, item);
+    else
+        gw_queue_produce(queue, item);
+}
+
+
+static void *consume(void)
+{
+    if (use_list)
+        return gwlist_consume(queue);
+    return gw_queue_consume(queue);
+}
+
+
+static void producer_thread(void *arg)
+{
+    unsigned long id, i;
+
+    id = counter_increase(next_producer);
+    for (i = 0; i < (unsigned long) items; i++)
+        produce(ITEM(id, i));
+
+    if (use_list)
+        gwlist_remove_producer(queue);
+    else
+        gw_queue_remove_producer(queue);
+}
+
+
+static void consumer_thread(void *arg)
+{
+    long *last;
+    void *item;
+    long i, n = 0;
+
+    last = gw_malloc(sizeof(*last) * producers);
+    for (i = 0; i < producers; i++)
+        last[i] = -1;
+
+    while ((item = consume()) != NULL) {
+        if ((long) ITEM_SEQ(item) <= last[ITEM_PRODUCER(item)])
+            counter_increase(errors);
+        last[ITEM_PRODUCER(item)] = ITEM_SEQ(item);
+        n++;
+    }
+    counter_increase_with(received, n);
+    gw_free(last);
+}
+
+
+static void run(const char *name)
+{
+    long *threads, i;
+    double start, secs;
+
+    counter_set(next_producer, 0);
+    counter_set(received, 0);
+    counter_set(errors, 0);
+
+    if (use_list) {
+        queue = gwlist_create();
+        for (i = 0; i < producers; i++)
+            gwlist_add_producer(queue);
+    } else {
+        queue = gw_queue_create(capacity);
+        for (i = 0; i < producers; i++)
+            gw_queue_add_producer(queue);
+    }
+
+    threads = gw_malloc(sizeof(*threads) * (producers + consumers));
+    start = date_precise_now();
+    for (i = 0; i < consumers; i++)
+        threads[i] = gwthread_create(consumer_thread, NULL);
+    for (i = 0; i < producers; i++)
+        threads[consumers + i] = gwthread_create(producer_thread, NULL);
+    for (i = 0; i < producers + consumers; i++)
+        gwthread_join(threads[i]);
+    secs = date_precise_now() - start;
+    gw_free(threads);
+
+    info(0, "%-8s %ld producers, %ld consumers: %ld items in %.3f s, %.0f items/s, %ld errors",
+         name, producers, consumers, counter_value(received), secs,
+         counter_value(received) / secs, counter_value(errors));
+    if (counter_value(received) != producers * items)
+        error(0, "%s: expected %ld items, got %ld", name, producers * items,
+              counter_value(received));
+
+    if (use_list)
+        gwlist_destroy(queue, NULL);
+    else
+        gw_queue_destroy(queue, NULL);
+}
+
+
+/*
+ * Fill a small ring so that items spill into the overflow, put two items
+ * back at the head and check the order everything comes out in.
+ */
+static void check_insert_head(void)
+{
+    gw_queue_t *q;
+    void *item;
+    unsigned long i;
+
+    q = gw_queue_create(4);
+    for (i = 0; i < 10; i++)
+        gw_queue_produce(q, ITEM(0, i));
+    gw_queue_insert_head(q, ITEM(1, 1));
+    gw_queue_insert_head(q, ITEM(1, 0));
+
+    for (i = 0; i < 12; i++) {
+        item = gw_queue_remove(q);
+        if (item != (i < 2 ? ITEM(1, i) : ITEM(0, i - 2))) {
+            error(0, "gw_queue_insert_head: item %ld out of order", i);
+            break;
+        }
+    }
+    if (gw_queue_len(q) != 0 || gw_queue_remove(q) != NULL)
+        error(0, "gw_queue_insert_head: queue not empty");
+    if (i == 12)
+        info(0, "gw_queue_insert_head: order ok");
+    gw_queue_destroy(q, NULL);
+}
+
+
+static void help(void)
+{
+    info(0, "Usage: test_queue [-p producers] [-c consumers] [-n items] [-s capacity]");
+    info(0, "  -n is the number of items produced by each producer,");
+    info(0, "  -s the gw_queue ring size (small values exercise the overflow).");
+}
+
+
+int main(int argc, char **argv)
+{
+    int opt;
+
+    gwlib_init();
+
+    while ((opt = getopt(argc, argv, "hp:c:n:s:")) != EOF) {
+        switch (opt) {
+        case 'p':
+            producers = atol(optarg);
+            break;
+        case 'c':
+            consumers = atol(optarg);
+            break;
+        case 'n':
+            items = atol(optarg);
+            break;
+        case 's':
+            capacity = atol(optarg);
+            break;
+        case 'h':
+            help();
+            exit(0);
+        case '?':
+        default:
+            error(0, "Invalid option %c", opt);
+            help();
+            panic(0, "Stopping.");
+        }
+    }
+
+    next_producer = counter_create();
+    received = counter_create();
+    errors = counter_create();
+
+    use_list = 1;
+    run("List");
+    use_list = 0;
+    run("gw_queue");
+    check_insert_head();
+
+    counter_destroy(next_producer);
+    counter_destroy(received);
+    counter_destroy(errors);
+
+    gwlib_shutdown();
+    return 0;
+}
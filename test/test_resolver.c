@@ -0,0 +1,169 @@
+/* ==================================================================== 
+ * The Kannel Software License, Version 1.0 
+ * 
+ * Copyright (c) 2001-2016 Kannel Group  
+ * Copyright (c) 1998-2001 WapIT Ltd.   
+ * All rights reserved. 
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions 
+ * are met: 
+ * 
+ * 1. Redistributions of source code must retain the above copyright 
+ *    notice, this list of conditions and the following disclaimer. 
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright 
+ *    notice, this list of conditions and the following disclaimer in 
+ *    the documentation and/or other materials provided with the 
+ *    distribution. 
+ * 
+ * 3. The end-user documentation included with the redistribution, 
+ *    if any, must include the following acknowledgment: 
+ *       "This product includes software developed by the 
+ *        Kannel Group (http://www.kannel.org/)." 
+ *    Alternately, this acknowledgment may appear in the software itself, 
+ *    if and wherever such third-party acknowledgments normally appear. 
+ * 
+ * 4. The names "Kannel" and "Kannel Group" must not be used to 
+ *    endorse or promote products derived from this software without 
+ *    prior written permission. For written permission, please  
+ *    contact org@kannel.org. 
+ * 
+ * 5. Products derived from this software may not be called "Kannel", 
+ *    nor may "Kannel" appear in their name, without prior written 
+ *    permission of the Kannel Group. 
+ * 
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESSED OR IMPLIED 
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES 
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+ * DISCLAIMED.  IN NO EVENT SHALL THE KANNEL GROUP OR ITS CONTRIBUTORS 
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,  
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT  
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR  
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,  
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE  
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,  
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. 
+ * ==================================================================== 
+ * 
+ * This software consists of voluntary contributions made by many 
+ * individuals on behalf of the Kannel Group.  For more information on  
+ * the Kannel Group, please see <http://www.kannel.org/>. 
+ * 
+ * Portions of this software are based upon software originally written at  
+ * WapIT Ltd., Helsinki, Finland for the Kannel project.  
+ */ 
+
+/*
+ * test_resolver.c - resolve host names with the caching resolver
+ *
+ * Every name given on the command line is first looked up in the
+ * background by a number of concurrent requests, which share one
+ * lookup, and then resolved again from the cache. The addresses and
+ * the time each step took are printed.
+ */
+
+#include <unistd.h>
+#include <netinet/in.h>
+
+#include "gwlib/gwlib.h"
+
+static long requests = 10;
+static Counter *done;
+
+
+static void resolved(void *data, int found)
+{
+    counter_increase(done);
+}
+
+
+static void print_addresses(Octstr *host, List *addrs)
+{
+    struct sockaddr_storage sa;
+    Octstr *ip;
+    long i;
+
+    if (addrs == NULL) {
+        info(0, "%s: not found", octstr_get_cstr(host));
+        return;
+    }
+    for (i = 0; i < gwlist_len(addrs); i++) {
+        gw_resolver_sockaddr(gwlist_get(addrs, i), &sa, 0);
+        if (sa.ss_family == AF_INET)
+            ip = gw_netaddr_to_octstr(AF_INET, &((struct sockaddr_in *) &sa)->sin_addr);
+        else
+            ip = gw_netaddr_to_octstr(AF_INET6, &((struct sockaddr_in6 *) &sa)->sin6_addr);
+        info(0, "%s: %s", octstr_get_cstr(host), octstr_get_cstr(ip));
+        octstr_destroy(ip);
+    }
+}
+
+
+static void help(void)
+{
+    info(0, "Usage: test_resolver [-n requests] host ...");
+}
+
+
+int main(int argc, char **argv)
+{
+    int opt;
+    long i, started;
+    double start;
+    Octstr *host;
+    List *addrs;
+
+    gwlib_init();
+
+    while ((opt = getopt(argc, argv, "hn:")) != EOF) {
+        switch (opt) {
+        case 'n':
+            requests = atol(optarg);
+            break;
+        case 'h':
+            help();
+            exit(0);
+        case '?':
+        default:
+            error(0, "Invalid option %c", opt);
+            help();
+            panic(0, "Stopping.");
+        }
+    }
+    if (optind == argc) {
+        help();
+        exit(0);
+    }
+
+    done = counter_create();
+
+    for (; optind < argc; optind++) {
+        host = octstr_create(argv[optind]);
+
+        counter_set(done, 0);
+        started = 0;
+        start = date_precise_now();
+        for (i = 0; i < requests; i++)
+            started += gw_resolve_async(host, resolved, NULL);
+        while (counter_value(done) < started)
+            gwthread_sleep(0.001);
+        info(0, "%s: %ld of %ld requests resolved in the background in %.3f ms",
+             octstr_get_cstr(host), started, requests,
+             (date_precise_now() - start) * 1000);
+
+        start = date_precise_now();
+        addrs = gw_resolve(host);
+        info(0, "%s: cached lookup took %.3f ms", octstr_get_cstr(host),
+             (date_precise_now() - start) * 1000);
+        print_addresses(host, addrs);
+
+        gwlist_destroy(addrs, octstr_destroy_item);
+        octstr_destroy(host);
+    }
+
+    counter_destroy(done);
+    gwlib_shutdown();
+
+    return 0;
+}
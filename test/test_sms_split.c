@@ -0,0 +1,169 @@
+/* ==================================================================== 
+ * The Kannel Software License, Version 1.0 
+ * 
+ * Copyright (c) 2001-2016 Kannel Group  
+ * Copyright (c) 1998-2001 WapIT Ltd.   
+ * All rights reserved. 
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions 
+ * are met: 
+ * 
+ * 1. Redistributions of source code must retain the above copyright 
+ *    notice, this list of conditions and the following disclaimer. 
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright 
+ *    notice, this list of conditions and the following disclaimer in 
+ *    the documentation and/or other materials provided with the 
+ *    distribution. 
+ * 
+ * 3. The end-user documentation included with the redistribution, 
+ *    if any, must include the following acknowledgment: 
+ *       "This product includes software developed by the 
+ *        Kannel Group (http://www.kannel.org/)." 
+ *    Alternately, this acknowledgment may appear in the software itself, 
+ *    if and wherever such third-party acknowledgments normally appear. 
+ * 
+ * 4. The names "Kannel" and "Kannel Group" must not be used to 
+ *    endorse or promote products derived from this software without 
+ *    prior written permission. For written permission, please  
+ *    contact org@kannel.org. 
+ * 
+ * 5. Products derived from this software may not be called "Kannel", 
+ *    nor may "Kannel" appear in their name, without prior written 
+ *    permission of the Kannel Group. 
+ * 
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESSED OR IMPLIED 
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES 
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+ * DISCLAIMED.  IN NO EVENT SHALL THE KANNEL GROUP OR ITS CONTRIBUTORS 
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,  
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT  
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR  
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,  
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE  
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,  
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. 
+ * ==================================================================== 
+ * 
+ * This software consists of voluntary contributions made by many 
+ * individuals on behalf of the Kannel Group.  For more information on  
+ * the Kannel Group, please see <http://www.kannel.org/>. 
+ * 
+ * Portions of this software are based upon software originally written at  
+ * WapIT Ltd., Helsinki, Finland for the Kannel project.  
+ */ 
+
+/*
+ * test_sms_split.c - benchmark sms_split() over long message bodies
+ *
+ * Splits a long GSM 7-bit and a long UCS-2 body into concatenated parts
+ * a number of times and reports the splits per second and the octet
+ * strings and data buffers allocated per part.
+ */
+
+#include <unistd.h>
+
+#include "gwlib/gwlib.h"
+#include "gw/msg.h"
+#include "gw/sms.h"
+#include "gw/dlr.h"
+
+static long rounds = 20000;
+static long length = 900;
+
+
+static Msg *make_msg(int coding)
+{
+    Msg *msg;
+    long i;
+
+    msg = msg_create(sms);
+    msg->sms.sender = octstr_create("+358401234567");
+    msg->sms.receiver = octstr_create("12345");
+    msg->sms.smsc_id = octstr_create("fake");
+    msg->sms.service = octstr_create("default");
+    msg->sms.account = octstr_create("customer");
+    msg->sms.dlr_url = octstr_create("http://localhost/dlr?id=1234567890&status=%d");
+    msg->sms.meta_data = octstr_create("?smpp?campaign=4711");
+    msg->sms.dlr_mask = DLR_SUCCESS | DLR_FAIL;
+    msg->sms.sms_type = mt_push;
+    msg->sms.coding = coding;
+    msg->sms.msgdata = octstr_create("");
+    for (i = 0; i < length; i++) {
+        if (coding == DC_UCS2) {
+            /* UTF-16BE cyrillic */
+            octstr_append_char(msg->sms.msgdata, 0x04);
+            octstr_append_char(msg->sms.msgdata, 0x10 + i % 32);
+        } else
+            octstr_append_char(msg->sms.msgdata, i % 10 == 9 ? ' ' : 'a' + i % 26);
+    }
+    return msg;
+}
+
+
+static void run(const char *name, int coding)
+{
+    unsigned long strings, buffers, interned, strings2, buffers2;
+    long i, parts = 0;
+    double start, secs;
+    Msg *msg;
+    List *list;
+
+    msg = make_msg(coding);
+    octstr_alloc_stats(&strings, &buffers, &interned);
+    start = date_precise_now();
+    for (i = 0; i < rounds; i++) {
+        list = sms_split(msg, NULL, NULL, NULL, octstr_imm(" "), 1, i & 0xFF, 10, 140);
+        parts += gwlist_len(list);
+        gwlist_destroy(list, msg_destroy_item);
+    }
+    secs = date_precise_now() - start;
+    octstr_alloc_stats(&strings2, &buffers2, &interned);
+    info(0, "%-5s %ld octets: %ld parts, %.0f splits/s, %.2f strings, %.2f buffers per part",
+         name, octstr_len(msg->sms.msgdata), parts / rounds, rounds / secs,
+         (double) (strings2 - strings) / parts, (double) (buffers2 - buffers) / parts);
+    msg_destroy(msg);
+}
+
+
+static void help(void)
+{
+    info(0, "Usage: test_sms_split [-n rounds] [-l characters]");
+}
+
+
+int main(int argc, char **argv)
+{
+    int opt;
+
+    gwlib_init();
+
+    while ((opt = getopt(argc, argv, "hn:l:")) != EOF) {
+        switch (opt) {
+        case 'n':
+            rounds = atol(optarg);
+            break;
+        case 'l':
+            length = atol(optarg);
+            break;
+        case 'h':
+            help();
+            exit(0);
+        default:
+            error(0, "Invalid option %c", opt);
+            help();
+            panic(0, "Stopping.");
+        }
+    }
+    if (rounds <= 0 || length <= 0)
+        panic(0, "Rounds and length must be positive.");
+
+    log_set_output_level(GW_INFO);
+
+    run("GSM", DC_7BIT);
+    run("UCS-2", DC_UCS2);
+
+    gwlib_shutdown();
+    return 0;
+}
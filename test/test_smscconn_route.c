@@ -0,0 +1,341 @@
+/* ==================================================================== 
+ * The Kannel Software License, Version 1.0 
+ * 
+ * Copyright (c) 2001-2016 Kannel Group  
+ * Copyright (c) 1998-2001 WapIT Ltd.   
+ * All rights reserved. 
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions 
+ * are met: 
+ * 
+ * 1. Redistributions of source code must retain the above copyright 
+ *    notice, this list of conditions and the following disclaimer. 
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright 
+ *    notice, this list of conditions and the following disclaimer in 
+ *    the documentation and/or other materials provided with the 
+ *    distribution. 
+ * 
+ * 3. The end-user documentation included with the redistribution, 
+ *    if any, must include the following acknowledgment: 
+ *       "This product includes software developed by the 
+ *        Kannel Group (http://www.kannel.org/)." 
+ *    Alternately, this acknowledgment may appear in the software itself, 
+ *    if and wherever such third-party acknowledgments normally appear. 
+ * 
+ * 4. The names "Kannel" and "Kannel Group" must not be used to 
+ *    endorse or promote products derived from this software without 
+ *    prior written permission. For written permission, please  
+ *    contact org@kannel.org. 
+ * 
+ * 5. Products derived from this software may not be called "Kannel", 
+ *    nor may "Kannel" appear in their name, without prior written 
+ *    permission of the Kannel Group. 
+ * 
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESSED OR IMPLIED 
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES 
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+ * DISCLAIMED.  IN NO EVENT SHALL THE KANNEL GROUP OR ITS CONTRIBUTORS 
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,  
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT  
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR  
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,  
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE  
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,  
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. 
+ * ==================================================================== 
+ * 
+ * This software consists of voluntary contributions made by many 
+ * individuals on behalf of the Kannel Group.  For more information on  
+ * the Kannel Group, please see <http://www.kannel.org/>. 
+ * 
+ * Portions of this software are based upon software originally written at  
+ * WapIT Ltd., Helsinki, Finland for the Kannel project.  
+ */ 
+
+
+/*
+ * test_smscconn_route.c - check the compiled SMSC routing table against
+ *                         smscconn_usable()
+ *
+ * Creates a number of loopback connections with random allowed, denied
+ * and preferred prefixes, smsc-ids and regexes, compiles them with
+ * smscconn_routes_create() and checks that smscconn_routes_lookup()
+ * gives the same decision as smscconn_usable() for every connection on
+ * random messages. The time spent by both is reported.
+ */
+
+#include <errno.h>
+#include <unistd.h>
+
+#include "gwlib/gwlib.h"
+#include "gw/msg.h"
+#include "gw/smscconn.h"
+#include "gw/smscconn_p.h"
+
+/* bearerbox globals referenced by the SMSC modules */
+gw_queue_t *incoming_sms, *outgoing_sms, *incoming_wdp, *outgoing_wdp;
+Counter *incoming_sms_counter, *outgoing_sms_counter;
+Counter *incoming_dlr_counter, *outgoing_dlr_counter;
+Load *incoming_sms_load, *outgoing_sms_load;
+Load *incoming_dlr_load, *outgoing_dlr_load;
+long max_incoming_sms_qlength, max_outgoing_sms_qlength;
+List *flow_threads, *suspended;
+Octstr *cfg_filename;
+volatile sig_atomic_t bb_status;
+volatile sig_atomic_t restart;
+
+char *bb_status_linebreak(int status_type)
+{
+    return "\n";
+}
+
+
+static long conns_count = 100;
+static long messages = 200000;
+
+static const char *smsc_ids[] = { "a", "b", "c", "d", "e", "zz" };
+static const char *regexes[] = { "^1", "^22", "^3[0-4]", "^\\+?7", "5$", "^[89]", "9" };
+static const char *id_regexes[] = { "^[ab]", "c", "^z+$", "^id1" };
+
+#define pick(table) (table[gw_rand() % (sizeof(table) / sizeof(table[0]))])
+
+
+/* random ';' separated list of 0-3 digit prefixes, sometimes with an
+ * empty entry in front, which matches every number */
+static Octstr *random_prefixes(void)
+{
+    Octstr *os = octstr_create("");
+    long i, j, n, len;
+
+    if (gw_rand() % 20 == 0)
+        octstr_append_char(os, ';');
+    n = 1 + gw_rand() % 4;
+    for (i = 0; i < n; i++) {
+        if (i > 0)
+            octstr_append_char(os, ';');
+        len = 1 + gw_rand() % 3;
+        if (gw_rand() % 10 == 0)
+            octstr_append_char(os, '+');
+        for (j = 0; j < len; j++)
+            octstr_append_char(os, '0' + gw_rand() % 10);
+    }
+    return os;
+}
+
+
+static Octstr *random_ids(void)
+{
+    Octstr *os = octstr_create("");
+    long i, n;
+
+    n = 1 + gw_rand() % 3;
+    for (i = 0; i < n; i++)
+        octstr_format_append(os, "%s%s", i ? ";" : "", pick(smsc_ids));
+    return os;
+}
+
+
+/* every rule is set on about a quarter of the connections */
+static Octstr *random_config(void)
+{
+    Octstr *cfg, *os;
+    long i;
+
+    cfg = octstr_create("");
+    for (i = 0; i < conns_count; i++) {
+        octstr_format_append(cfg, "group = smsc\nsmsc = loopback\nsmsc-id = c%ld\n", i);
+#define RULE(name, value) \
+        if (gw_rand() % 4 == 0) { \
+            os = value; \
+            octstr_format_append(cfg, "%s = \"%S\"\n", name, os); \
+            octstr_destroy(os); \
+        }
+        RULE("allowed-prefix", random_prefixes());
+        RULE("denied-prefix", random_prefixes());
+        RULE("preferred-prefix", random_prefixes());
+        RULE("allowed-smsc-id", random_ids());
+        RULE("denied-smsc-id", random_ids());
+        RULE("preferred-smsc-id", random_ids());
+        RULE("allowed-prefix-regex", octstr_create(pick(regexes)));
+        RULE("denied-prefix-regex", octstr_create(pick(regexes)));
+        RULE("preferred-prefix-regex", octstr_create(pick(regexes)));
+        RULE("allowed-smsc-id-regex", octstr_create(pick(id_regexes)));
+        RULE("denied-smsc-id-regex", octstr_create(pick(id_regexes)));
+#undef RULE
+        octstr_append_char(cfg, '\n');
+    }
+    return cfg;
+}
+
+
+static Msg *random_msg(void)
+{
+    Msg *msg;
+    long i, len;
+
+    msg = msg_create(sms);
+    msg->sms.receiver = octstr_create("");
+    if (gw_rand() % 10 == 0)
+        octstr_append_char(msg->sms.receiver, '+');
+    len = gw_rand() % 12;
+    for (i = 0; i < len; i++)
+        octstr_append_char(msg->sms.receiver, '0' + gw_rand() % 10);
+
+    /* unknown smsc-ids also overflow the smsc-id cache of the table */
+    switch (gw_rand() % 4) {
+    case 0:
+        break;
+    case 1:
+        msg->sms.smsc_id = octstr_format("id%ld", gw_rand() % 3000);
+        break;
+    default:
+        msg->sms.smsc_id = octstr_create(pick(smsc_ids));
+        break;
+    }
+    return msg;
+}
+
+
+static List *create_conns(void)
+{
+    Octstr *data, *filename;
+    List *groups, *conns;
+    SMSCConn *conn;
+    Cfg *cfg;
+    char name[] = "/tmp/test_smscconn_route.XXXXXX";
+    FILE *f;
+    int fd;
+    long i;
+
+    if ((fd = mkstemp(name)) == -1 || (f = fdopen(fd, "w")) == NULL)
+        panic(errno, "Could not create temporary file.");
+    data = random_config();
+    if (octstr_print(f, data) == -1 || fclose(f) != 0)
+        panic(errno, "Could not write `%s'.", name);
+    octstr_destroy(data);
+    filename = octstr_create(name);
+
+    cfg = cfg_create(filename);
+    if (cfg_read(cfg) == -1)
+        panic(0, "Could not read `%s'.", name);
+    unlink(name);
+    octstr_destroy(filename);
+
+    conns = gwlist_create();
+    groups = cfg_get_multi_group(cfg, octstr_imm("smsc"));
+    for (i = 0; i < gwlist_len(groups); i++) {
+        if ((conn = smscconn_create(gwlist_get(groups, i), 1)) == NULL)
+            panic(0, "Could not create connection %ld.", i);
+        gwlist_append(conns, conn);
+    }
+    gwlist_destroy(groups, NULL);
+    cfg_destroy(cfg);
+
+    return conns;
+}
+
+
+static void help(void)
+{
+    info(0, "Usage: test_smscconn_route [-c connections] [-n messages]");
+}
+
+
+int main(int argc, char **argv)
+{
+    int opt, expect, got;
+    long i, j, words, mismatches, usable_count, preferred_count;
+    unsigned long *usable, *preferred;
+    double start, table_secs, usable_secs;
+    SMSCConnRoutes *routes;
+    SMSCConn *conn;
+    List *conns;
+    Msg *msg;
+
+    gwlib_init();
+
+    while ((opt = getopt(argc, argv, "hc:n:")) != EOF) {
+        switch (opt) {
+        case 'c':
+            conns_count = atol(optarg);
+            break;
+        case 'n':
+            messages = atol(optarg);
+            break;
+        case 'h':
+            help();
+            exit(0);
+        case '?':
+        default:
+            error(0, "Invalid option %c", opt);
+            help();
+            panic(0, "Stopping.");
+        }
+    }
+
+    /* connections register as flow threads and incoming_sms producers,
+     * and complain loudly about conflicting random rules */
+    flow_threads = gwlist_create();
+    incoming_sms = gw_queue_create(0);
+    log_set_output_level(GW_ERROR);
+    conns = create_conns();
+    log_set_output_level(GW_DEBUG);
+    routes = smscconn_routes_create(conns);
+    words = smscconn_routes_words(routes);
+    usable = gw_malloc(sizeof(usable[0]) * words);
+    preferred = gw_malloc(sizeof(preferred[0]) * words);
+
+    mismatches = usable_count = preferred_count = 0;
+    table_secs = usable_secs = 0;
+    for (i = 0; i < messages; i++) {
+        msg = random_msg();
+
+        start = date_precise_now();
+        smscconn_routes_lookup(routes, msg, usable, preferred);
+        table_secs += date_precise_now() - start;
+
+        for (j = 0; j < gwlist_len(conns); j++) {
+            conn = gwlist_get(conns, j);
+            start = date_precise_now();
+            expect = smscconn_usable(conn, msg);
+            usable_secs += date_precise_now() - start;
+
+            got = !smscconn_route_isset(usable, j) ? -1 :
+                  smscconn_route_isset(preferred, j) ? 1 : 0;
+            if (got != expect && mismatches++ < 10)
+                error(0, "Connection %ld, receiver <%s>, smsc-id <%s>: "
+                      "smscconn_usable() %d, routing table %d.", j,
+                      octstr_get_cstr(msg->sms.receiver),
+                      msg->sms.smsc_id ? octstr_get_cstr(msg->sms.smsc_id) : "",
+                      expect, got);
+            usable_count += (got >= 0);
+            preferred_count += (got == 1);
+        }
+        msg_destroy(msg);
+    }
+
+    info(0, "%ld messages, %ld connections: %ld usable, %ld preferred, %ld mismatches",
+         messages, gwlist_len(conns), usable_count, preferred_count, mismatches);
+    info(0, "routing table %.1f us, smscconn_usable() %.1f us per message",
+         table_secs * 1e6 / messages, usable_secs * 1e6 / messages);
+
+    gw_free(usable);
+    gw_free(preferred);
+    smscconn_routes_destroy(routes);
+    while ((conn = gwlist_extract_first(conns)) != NULL) {
+        conn->status = SMSCCONN_DEAD;
+        smscconn_destroy(conn);
+    }
+    gwlist_destroy(conns, NULL);
+    gwlist_destroy(flow_threads, NULL);
+    gw_queue_destroy(incoming_sms, NULL);
+
+    if (mismatches > 0)
+        panic(0, "%ld mismatches between routing table and smscconn_usable().", mismatches);
+
+    gwlib_shutdown();
+
+    return 0;
+}